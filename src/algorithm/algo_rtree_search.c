@@ -0,0 +1,296 @@
+/*
+Copyright (C) 2026 Alexey Kozlov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+Heidelberg Institute for Theoretical Studies,
+Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+ /**
+  * @file algo_rtree_search.c
+  *
+  * @brief Topological search on rooted trees
+  *
+  * Rooted counterpart of the SPR round in algo_search.c. Candidate moves are
+  * evaluated with incremental likelihood computations on a
+  * pllmod_rtreeinfo_t and undone through the tree rollback information.
+  *
+  * @author Alexey Kozlov
+  */
+
+#include "pllmod_algorithm.h"
+#include "../pllmod_common.h"
+
+typedef struct rtree_spr_buffers
+{
+  pll_rnode_t ** nodes;
+  unsigned int * dist;
+  unsigned int * visit_mark;
+  unsigned int mark;
+} rtree_spr_buffers_t;
+
+/* parent of `node` in the tree resulting from removing `pruned` */
+static pll_rnode_t * rtree_pruned_parent(const pll_rnode_t * node,
+                                         const pll_rnode_t * pruned)
+{
+  return (node->parent == pruned) ? pruned->parent : node->parent;
+}
+
+/* child of an inner node in the tree resulting from removing `pruned` */
+static pll_rnode_t * rtree_pruned_child(pll_rnode_t * child,
+                                        const pll_rnode_t * pruned,
+                                        pll_rnode_t * sister)
+{
+  return (child == pruned) ? sister : child;
+}
+
+static void rtree_spr_visit(rtree_spr_buffers_t * buf,
+                            unsigned int * count,
+                            pll_rnode_t * node,
+                            unsigned int dist)
+{
+  if (buf->visit_mark[node->node_index] == buf->mark)
+    return;
+
+  buf->visit_mark[node->node_index] = buf->mark;
+  buf->nodes[*count] = node;
+  buf->dist[*count] = dist;
+  (*count)++;
+}
+
+/* collects the branches (identified by their lower node) within radius_max
+ * of the branch left after pruning `p`, in breadth-first order */
+static unsigned int rtree_spr_collect(rtree_spr_buffers_t * buf,
+                                      pll_rnode_t * p,
+                                      unsigned int radius_max)
+{
+  pll_rnode_t * pruned = p->parent;
+  pll_rnode_t * sister = (pruned->left == p) ? pruned->right : pruned->left;
+  unsigned int head = 0;
+  unsigned int count = 0;
+
+  buf->mark++;
+
+  /* the branch above `sister` is where `p` currently sits */
+  rtree_spr_visit(buf, &count, sister, 0);
+
+  while (head < count)
+  {
+    pll_rnode_t * node = buf->nodes[head];
+    unsigned int dist = buf->dist[head];
+    pll_rnode_t * parent;
+
+    head++;
+
+    if (dist == radius_max)
+      continue;
+
+    if (node->left)
+    {
+      rtree_spr_visit(buf, &count,
+                      rtree_pruned_child(node->left, pruned, sister), dist+1);
+      rtree_spr_visit(buf, &count,
+                      rtree_pruned_child(node->right, pruned, sister), dist+1);
+    }
+
+    parent = rtree_pruned_parent(node, pruned);
+    if (parent)
+    {
+      pll_rnode_t * left = rtree_pruned_child(parent->left, pruned, sister);
+      pll_rnode_t * right = rtree_pruned_child(parent->right, pruned, sister);
+
+      rtree_spr_visit(buf, &count, parent, dist+1);
+      rtree_spr_visit(buf, &count, (left == node) ? right : left, dist+1);
+    }
+  }
+
+  return count;
+}
+
+/* applies the SPR move and sets heuristic lengths for the affected branches:
+ * the merged branch keeps the sum and the splitted branch is halved */
+static int rtree_spr_apply(pllmod_rtreeinfo_t * rtreeinfo,
+                           pll_rnode_t * p,
+                           pll_rnode_t * r,
+                           double bl_min,
+                           pll_tree_rollback_t * rollback_info)
+{
+  pll_rnode_t * pruned = p->parent;
+  pll_rnode_t * sister = (pruned->left == p) ? pruned->right : pruned->left;
+  double pruned_bl = pruned->length;
+  double sister_bl = sister->length;
+  double regraft_bl = r->length;
+
+  if (!pllmod_rtree_spr(p, r, &rtreeinfo->root, rollback_info))
+    return PLL_FAILURE;
+
+  rtreeinfo->tree->root = rtreeinfo->root;
+
+  pllmod_rtreeinfo_set_branch_length(rtreeinfo, sister, sister_bl + pruned_bl);
+  if (pruned->parent)
+  {
+    double half_bl = PLL_MAX(regraft_bl / 2, bl_min);
+    pllmod_rtreeinfo_set_branch_length(rtreeinfo, pruned, half_bl);
+    pllmod_rtreeinfo_set_branch_length(rtreeinfo, r, half_bl);
+  }
+  else
+  {
+    /* regrafted above the old root */
+    pllmod_rtreeinfo_set_branch_length(rtreeinfo, r, pruned_bl);
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* undoes a move applied with rtree_spr_apply */
+static int rtree_spr_undo(pllmod_rtreeinfo_t * rtreeinfo,
+                          pll_tree_rollback_t * rollback_info)
+{
+  pll_rnode_t * p = (pll_rnode_t *) rollback_info->SPR.prune_edge;
+  pll_rnode_t * sister = (pll_rnode_t *) rollback_info->SPR.regraft_edge;
+  pll_rnode_t * r = (p->parent->left == p) ? p->parent->right :
+                                             p->parent->left;
+
+  if (!pllmod_tree_rollback(rollback_info))
+    return PLL_FAILURE;
+
+  while (rtreeinfo->root->parent)
+    rtreeinfo->root = rtreeinfo->root->parent;
+  rtreeinfo->tree->root = rtreeinfo->root;
+
+  /* rollback restores the lengths, but the dependent CLVs are stale */
+  pllmod_rtreeinfo_set_branch_length(rtreeinfo, p->parent, p->parent->length);
+  pllmod_rtreeinfo_set_branch_length(rtreeinfo, sister, sister->length);
+  pllmod_rtreeinfo_set_branch_length(rtreeinfo, r, r->length);
+
+  return PLL_SUCCESS;
+}
+
+/**
+ * Performs one round of SPR moves on a rooted tree.
+ *
+ * Every subtree is pruned in turn and evaluated at all the branches within
+ * the given radius. The best insertion is kept if it improves the
+ * log-likelihood by more than `lh_epsilon`.
+ *
+ * @return the log-likelihood of the resulting tree, 0 on error
+ */
+PLL_EXPORT double pllmod_algo_rtree_spr_round(pllmod_rtreeinfo_t * rtreeinfo,
+                                              unsigned int radius_min,
+                                              unsigned int radius_max,
+                                              double bl_min,
+                                              double lh_epsilon)
+{
+  unsigned int i, j;
+  unsigned int node_count = rtreeinfo->node_count;
+  double loglh;
+  pll_rnode_t ** prune_nodes = NULL;
+  rtree_spr_buffers_t buf;
+  pll_tree_rollback_t rollback_info;
+
+  if (radius_min < 1)
+    radius_min = 1;
+
+  if (radius_max < radius_min)
+  {
+    pllmod_set_error(PLLMOD_ERROR_INVALID_RANGE,
+                     "Invalid radius range: %u..%u\n", radius_min, radius_max);
+    return PLL_FAILURE;
+  }
+
+  memset(&buf, 0, sizeof(rtree_spr_buffers_t));
+  prune_nodes = (pll_rnode_t **) malloc(node_count * sizeof(pll_rnode_t *));
+  buf.nodes = (pll_rnode_t **) malloc(node_count * sizeof(pll_rnode_t *));
+  buf.dist = (unsigned int *) malloc(node_count * sizeof(unsigned int));
+  buf.visit_mark = (unsigned int *) calloc(node_count, sizeof(unsigned int));
+
+  if (!prune_nodes || !buf.nodes || !buf.dist || !buf.visit_mark)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for rooted SPR buffers\n");
+    loglh = PLL_FAILURE;
+    goto cleanup;
+  }
+
+  /* the node array is fixed, but node order within it is not relevant */
+  memcpy(prune_nodes, rtreeinfo->tree->nodes,
+         node_count * sizeof(pll_rnode_t *));
+
+  loglh = pllmod_rtreeinfo_compute_loglh(rtreeinfo, 0);
+
+  for (i = 0; i < node_count; ++i)
+  {
+    pll_rnode_t * p = prune_nodes[i];
+    pll_rnode_t * best_r = NULL;
+    double best_lh = loglh;
+    unsigned int count;
+
+    if (!p->parent)
+      continue;
+
+    count = rtree_spr_collect(&buf, p, radius_max);
+
+    for (j = 0; j < count; ++j)
+    {
+      pll_rnode_t * r = buf.nodes[j];
+      double lh;
+
+      if (buf.dist[j] < radius_min)
+        continue;
+
+      if (!rtree_spr_apply(rtreeinfo, p, r, bl_min, &rollback_info))
+      {
+        loglh = PLL_FAILURE;
+        goto cleanup;
+      }
+
+      lh = pllmod_rtreeinfo_compute_loglh(rtreeinfo, 1);
+
+      if (!rtree_spr_undo(rtreeinfo, &rollback_info))
+      {
+        loglh = PLL_FAILURE;
+        goto cleanup;
+      }
+
+      if (lh > best_lh)
+      {
+        best_lh = lh;
+        best_r = r;
+      }
+    }
+
+    if (best_r && best_lh - loglh > lh_epsilon)
+    {
+      if (!rtree_spr_apply(rtreeinfo, p, best_r, bl_min, NULL))
+      {
+        loglh = PLL_FAILURE;
+        goto cleanup;
+      }
+      loglh = pllmod_rtreeinfo_compute_loglh(rtreeinfo, 1);
+    }
+  }
+
+  /* recompute from scratch to avoid accumulating stale values */
+  loglh = pllmod_rtreeinfo_compute_loglh(rtreeinfo, 0);
+
+cleanup:
+  free(prune_nodes);
+  free(buf.nodes);
+  free(buf.dist);
+  free(buf.visit_mark);
+
+  return loglh;
+}
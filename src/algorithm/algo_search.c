@@ -41,6 +41,10 @@ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
 
 #define BRLEN_BUF_COUNT 12
 
+/* mixed into the tabu key of topologies scored with branch length
+   optimization */
+#define TABU_THOROUGH_SALT 0x5bd1e9955bd1e995ULL
+
 typedef struct spr_params
 {
   pll_bool_t thorough;
@@ -54,6 +58,10 @@ typedef struct spr_params
   int brlen_opt_radius;
   double spr_lheps;
   double * brlen_buf[BRLEN_BUF_COUNT];
+  pll_unode_t ** regraft_nodes;
+  unsigned int * regraft_dist;
+  pllmod_utree_fingerprint_t * fingerprint;
+  pllmod_topology_cache_t * tabu;
 } pllmod_search_params_t;
 
 typedef struct rollback_list
@@ -62,11 +70,13 @@ typedef struct rollback_list
   size_t current;
   unsigned int round;
   size_t size;
+  size_t capacity;
 } pllmod_rollback_list_t;
 
 typedef struct node_entry {
   pll_unode_t * p_node;
   pll_unode_t * r_node;
+  pll_unode_t * r2_node;    /* second reconnection edge (TBR only) */
   double bb1, bb2, bb3;
   double *b1, *b2, *b3;
   double lh;
@@ -78,10 +88,56 @@ typedef struct bestnode_list
   node_entry_t * list;
   size_t current;
   size_t size;
+  size_t capacity;
   unsigned int brlen_set_count;
   double ** brlen_buffers;
 } pllmod_bestnode_list_t;
 
+/* number of branches whose lengths are re-optimized after an NNI move */
+#define NNI_BRANCH_COUNT 5
+
+typedef struct nni_entry
+{
+  pll_unode_t * edge;
+  int type;
+  double lh_gain;
+  double * brlens;
+} nni_entry_t;
+
+/* buffers of the SPR, NNI and TBR rounds, kept across rounds on the same
+   tree */
+struct spr_workspace
+{
+  unsigned int tip_count;
+  unsigned int edge_count;
+  int brlen_unlinked;
+  unsigned int brlen_set_count;
+
+  pllmod_rollback_list_t * rollback_list;
+  pllmod_bestnode_list_t * bestnode_list;
+  pll_tree_rollback_t rollback2;
+
+  pll_unode_t ** allnodes;
+  pll_unode_t ** regraft_nodes;
+  unsigned int * regraft_dist;
+
+  /* second side of a TBR bisection */
+  pll_unode_t ** right_nodes;
+  unsigned int * right_dist;
+
+  /* NNI candidates, their branch lengths and the branches already moved */
+  nni_entry_t * nni_list;
+  double * nni_brlens;
+  unsigned char * branch_used;
+
+  /* optional tabu cache of recently scored topologies */
+  pllmod_utree_fingerprint_t * fingerprint;
+  pllmod_topology_cache_t * tabu;
+
+  double * brlen_buf[BRLEN_BUF_COUNT];
+  double static_brlen_buf[BRLEN_BUF_COUNT];
+};
+
 static void algo_query_allnodes_recursive(pll_unode_t * node,
                                           pll_unode_t ** buffer,
                                           unsigned int * index)
@@ -122,6 +178,7 @@ static pllmod_rollback_list_t * algo_rollback_list_create(size_t slots)
   rollback_list->current = 0;
   rollback_list->round = 0;
   rollback_list->size = slots;
+  rollback_list->capacity = slots;
   if (slots > 0)
   {
     rollback_list->list =
@@ -137,6 +194,19 @@ static pllmod_rollback_list_t * algo_rollback_list_create(size_t slots)
   return rollback_list;
 }
 
+/* empties the list and sets its size to `slots` (at most its capacity) */
+static void algo_rollback_list_reset(pllmod_rollback_list_t * rollback_list,
+                                     size_t slots)
+{
+  assert(slots <= rollback_list->capacity);
+
+  rollback_list->current = 0;
+  rollback_list->round = 0;
+  rollback_list->size = slots;
+  if (slots > 0)
+    memset(rollback_list->list, 0, slots * sizeof(pll_tree_rollback_t));
+}
+
 static void algo_rollback_list_destroy(pllmod_rollback_list_t * rollback_list)
 {
   if (rollback_list)
@@ -192,7 +262,7 @@ static void algo_bestnode_list_destroy(pllmod_bestnode_list_t * bestnode_list)
  {
    if (bestnode_list->brlen_buffers)
    {
-     for (size_t i = 0; i < bestnode_list->size; ++i)
+     for (size_t i = 0; i < bestnode_list->capacity; ++i)
        free(bestnode_list->brlen_buffers[i]);
      free(bestnode_list->brlen_buffers);
    }
@@ -215,6 +285,7 @@ static pllmod_bestnode_list_t * algo_bestnode_list_create(size_t slots,
   }
   bestnode_list->current = 0;
   bestnode_list->size = slots;
+  bestnode_list->capacity = slots;
   bestnode_list->brlen_set_count = brlen_set_count;
   if (slots > 0)
   {
@@ -270,6 +341,39 @@ static pllmod_bestnode_list_t * algo_bestnode_list_create(size_t slots,
   return bestnode_list;
 }
 
+/* empties the list and sets its size to `slots` (at most its capacity) */
+static void algo_bestnode_list_reset(pllmod_bestnode_list_t * bestnode_list,
+                                     size_t slots)
+{
+  assert(slots <= bestnode_list->capacity);
+
+  bestnode_list->current = 0;
+  bestnode_list->size = slots;
+  for (size_t i = 0; i < slots; ++i)
+  {
+    node_entry_t * entry = &bestnode_list->list[i];
+    double * b1 = entry->b1;
+    double * b2 = entry->b2;
+    double * b3 = entry->b3;
+
+    memset(entry, 0, sizeof(node_entry_t));
+    if (bestnode_list->brlen_buffers)
+    {
+      entry->b1 = b1;
+      entry->b2 = b2;
+      entry->b3 = b3;
+      memset(bestnode_list->brlen_buffers[i], 0,
+             3 * bestnode_list->brlen_set_count * sizeof(double));
+    }
+    else
+    {
+      entry->b1 = &entry->bb1;
+      entry->b2 = &entry->bb2;
+      entry->b3 = &entry->bb3;
+    }
+  }
+}
+
 static void algo_bestnode_list_copy_entry(pllmod_bestnode_list_t * best_node_list,
                                           size_t idx,
                                           const node_entry_t * src)
@@ -277,6 +381,7 @@ static void algo_bestnode_list_copy_entry(pllmod_bestnode_list_t * best_node_lis
   node_entry_t * dst = &best_node_list->list[idx];
   dst->p_node = src->p_node;
   dst->r_node = src->r_node;
+  dst->r2_node = src->r2_node;
   dst->lh = src->lh;
   dst->rollback_num = src->rollback_num;
 
@@ -598,6 +703,101 @@ PLL_EXPORT int algo_utree_spr(pllmod_treeinfo_t * treeinfo,
   return retval;
 }
 
+/* regrafts the pruned subtree `p_edge` into `r_edge`, scores the resulting
+ * tree and prunes it again. Returns the log-likelihood, or 0 on error */
+static double algo_spr_eval_regraft(pllmod_treeinfo_t * treeinfo,
+                                    node_entry_t * entry,
+                                    pll_unode_t * p_edge,
+                                    pll_unode_t * r_edge,
+                                    const pllmod_search_params_t * params)
+{
+  int retval;
+  double loglh;
+  double * b1 = params->brlen_buf[3];
+  double * b2 = params->brlen_buf[4];
+  double * b3 = params->brlen_buf[5];
+  double * regraft_length = params->brlen_buf[6];
+
+  /* regraft p_edge on r_edge*/
+  pllmod_treeinfo_get_branch_length_all(treeinfo, r_edge, regraft_length);
+
+  /* regraft into the candidate branch */
+  retval = algo_utree_regraft(treeinfo, params, p_edge, r_edge);
+  assert(retval == PLL_SUCCESS);
+  if (!retval)
+    return 0;
+
+  /* place root at the pruning branch and invalidate CLV at the new root */
+  pllmod_treeinfo_set_root(treeinfo, p_edge);
+  pllmod_treeinfo_invalidate_clv(treeinfo, p_edge);
+
+  /* save branch lengths */
+  pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge, b1);
+  pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next, b2);
+  pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next->next, b3);
+
+  /* make sure branches are within limits */
+  algo_unode_fix_length(treeinfo, p_edge->next, params->bl_min, params->bl_max);
+  algo_unode_fix_length(treeinfo, p_edge->next->next, params->bl_min, params->bl_max);
+
+  /* invalidate p-matrices */
+  pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next);
+  pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next->next);
+
+  /* recompute p-matrices for branches adjacent to regrafting point */
+  algo_update_pmatrix(treeinfo, p_edge->next);
+  algo_update_pmatrix(treeinfo, p_edge->next->next);
+
+  /* re-compute invalid CLVs, and get tree logLH */
+  loglh = pllmod_treeinfo_compute_loglh_flex(treeinfo, 1, 0);
+
+  if (params->thorough)
+  {
+    /* optimize 3 adjacent branches and get tree logLH */
+    loglh = algo_optimize_bl_triplet(p_edge,
+                                     treeinfo,
+                                     params,
+                                     1.0);
+
+    if (!loglh)
+      return 0;
+  }
+
+  if (loglh > entry->lh)
+  {
+//      double lh2 = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+//      printf("loglh part / full: %f / %f\n", loglh, lh2);
+
+    entry->lh = loglh;
+    entry->r_node = r_edge;
+    pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge, entry->b1);
+    pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next, entry->b2);
+    pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next->next, entry->b3);
+  }
+
+  // restore original branch lengths
+  pllmod_treeinfo_set_branch_length_all(treeinfo, p_edge, b1);
+  pllmod_treeinfo_set_branch_length_all(treeinfo, p_edge->next, b2);
+  pllmod_treeinfo_set_branch_length_all(treeinfo, p_edge->next->next, b3);
+
+  pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge);
+  pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next);
+  pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next->next);
+
+  /* rollback the REGRAFT */
+  pll_unode_t * pruned_tree = pllmod_utree_prune(p_edge);
+  pllmod_treeinfo_set_branch_length_all(treeinfo, pruned_tree, regraft_length);
+  pllmod_treeinfo_invalidate_pmatrix(treeinfo, pruned_tree);
+
+  /* recompute p-matrix for the pendant branch of the pruned subtree */
+  algo_update_pmatrix(treeinfo, p_edge);
+
+  /* recompute p-matrix for the "old" regraft branch */
+  algo_update_pmatrix(treeinfo, pruned_tree);
+
+  return loglh;
+}
+
 static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
                               node_entry_t * entry,
                               cutoff_info_t * cutoff_info,
@@ -612,14 +812,16 @@ static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
   int regraft_edges;
   unsigned int r_dist;
   double *z1, *z2, *z3;
-  double *b1, *b2, *b3;
-  double * regraft_length;
   unsigned int redge_count = 0;
   unsigned int ncount;
   int retval;
   unsigned int * regraft_dist;
   int descent;
+  int tabu_hit;
   double loglh;
+  double lh_diff;
+  double tree_lh;
+  pllmod_fingerprint_t r_fp = 0;
 
   pll_unode_t * p_edge = entry->p_node;
   const size_t total_edge_count = treeinfo->tree->edge_count;
@@ -632,11 +834,6 @@ static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
   z2 = params->brlen_buf[1];
   z3 = params->brlen_buf[2];
 
-  b1 = params->brlen_buf[3];
-  b2 = params->brlen_buf[4];
-  b3 = params->brlen_buf[5];
-  regraft_length = params->brlen_buf[6];
-
   /* save original branch lengths at the pruning point */
   pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge, z1);
   pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next, z2);
@@ -645,7 +842,14 @@ static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
   pllmod_treeinfo_set_root(treeinfo, p_edge);
 
   /* recompute all CLVs and p-matrices before pruning */
-  loglh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+  tree_lh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  /* fingerprints of the candidate topologies up to radius_min; the others
+     are derived on descent */
+  if (params->tabu && !pllmod_utree_fingerprint_spr(params->fingerprint,
+                                                    p_edge,
+                                                    params->radius_min))
+    return PLL_FAILURE;
 
   /* PRUNE */
   orig_prune_edge = algo_utree_prune(treeinfo, params, p_edge);
@@ -669,14 +873,8 @@ static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
   algo_update_pmatrix(treeinfo, orig_prune_edge);
 
   /* get list of candidate regrafting nodes in the given distance range */
-  regraft_nodes = (pll_unode_t **) calloc (total_edge_count,
-                                           sizeof(pll_unode_t *));
-  if (!regraft_nodes)
-  {
-    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                     "Cannot allocate memory for regraft nodes\n");
-    return PLL_FAILURE;
-  }
+  regraft_nodes = params->regraft_nodes;
+  regraft_dist = params->regraft_dist;
 
   retval = pllmod_utree_nodes_at_node_dist(treeinfo->root,
                                            &regraft_nodes[redge_count],
@@ -697,21 +895,15 @@ static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
   assert(retval == PLL_SUCCESS);
 
   /* initialize regraft distances */
-  regraft_dist = (unsigned int *) calloc(total_edge_count, sizeof(unsigned int));
-  if (!regraft_dist)
-  {
-    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                     "Cannot allocate memory for regraft distances\n");
-    return PLL_FAILURE;
-  }
-
   for (i = 0; i < redge_count; ++i)
     regraft_dist[i] = params->radius_min;
 
   regraft_edges = 0;
   j = 0;
-  while ((r_edge = regraft_nodes[j]) != NULL)
+  while (j < redge_count)
   {
+    r_edge = regraft_nodes[j];
+
     /* do not re-insert back into the pruning branch */
     if (r_edge == orig_prune_edge || r_edge == orig_prune_edge->back ||
         !pllmod_treeinfo_check_constraint(treeinfo, p_edge, r_edge))
@@ -722,89 +914,37 @@ static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
 
     regraft_edges++;
 
-    /* regraft p_edge on r_edge*/
-    pllmod_treeinfo_get_branch_length_all(treeinfo, r_edge, regraft_length);
-
     /* distance to the current regraft edge */
     r_dist = regraft_dist[j];
 
-    /* regraft into the candidate branch */
-    retval = algo_utree_regraft(treeinfo, params, p_edge, r_edge);
-    assert(retval == PLL_SUCCESS);
-
-    /* place root at the pruning branch and invalidate CLV at the new root */
-    pllmod_treeinfo_set_root(treeinfo, p_edge);
-    pllmod_treeinfo_invalidate_clv(treeinfo, p_edge);
-
-    /* save branch lengths */
-    pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge, b1);
-    pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next, b2);
-    pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next->next, b3);
-
-    /* make sure branches are within limits */
-    algo_unode_fix_length(treeinfo, p_edge->next, params->bl_min, params->bl_max);
-    algo_unode_fix_length(treeinfo, p_edge->next->next, params->bl_min, params->bl_max);
-
-    /* invalidate p-matrices */
-    pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next);
-    pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next->next);
-
-    /* recompute p-matrices for branches adjacent to regrafting point */
-    algo_update_pmatrix(treeinfo, p_edge->next);
-    algo_update_pmatrix(treeinfo, p_edge->next->next);
-
-    /* re-compute invalid CLVs, and get tree logLH */
-    loglh = pllmod_treeinfo_compute_loglh_flex(treeinfo, 1, 0);
-
-    if (params->thorough)
+    tabu_hit = 0;
+    if (params->tabu)
     {
-      /* optimize 3 adjacent branches and get tree logLH */
-      loglh = algo_optimize_bl_triplet(p_edge,
-                                       treeinfo,
-                                       params,
-                                       1.0);
-
-      if (!loglh)
-      {
-        free(regraft_nodes);
-        free(regraft_dist);
-
-        return PLL_FAILURE;
-      }
+      /* fast and thorough scores are not comparable, keep them apart */
+      r_fp = params->fingerprint->spr_fp[r_edge->node_index] ^
+             (params->thorough ? TABU_THOROUGH_SALT : 0);
+
+      /* the cache stores the score relative to the tree the topology was
+         scored against, which stays meaningful when other moves change the
+         branch lengths. Skip topologies that were worse than their tree in
+         a recent branch length epoch; their estimated score still decides
+         on the descent */
+      tabu_hit = pllmod_topology_cache_lookup(params->tabu, r_fp, &lh_diff) &&
+                 lh_diff < 0.;
+      if (tabu_hit)
+        loglh = tree_lh + lh_diff;
     }
 
-    if (loglh > entry->lh)
+    if (!tabu_hit)
     {
-//      double lh2 = pllmod_treeinfo_compute_loglh(treeinfo, 0);
-//      printf("loglh part / full: %f / %f\n", loglh, lh2);
+      loglh = algo_spr_eval_regraft(treeinfo, entry, p_edge, r_edge, params);
+      if (!loglh)
+        return PLL_FAILURE;
 
-      entry->lh = loglh;
-      entry->r_node = r_edge;
-      pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge, entry->b1);
-      pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next, entry->b2);
-      pllmod_treeinfo_get_branch_length_all(treeinfo, p_edge->next->next, entry->b3);
+      if (params->tabu)
+        pllmod_topology_cache_insert(params->tabu, r_fp, loglh - tree_lh);
     }
 
-    // restore original branch lengths
-    pllmod_treeinfo_set_branch_length_all(treeinfo, p_edge, b1);
-    pllmod_treeinfo_set_branch_length_all(treeinfo, p_edge->next, b2);
-    pllmod_treeinfo_set_branch_length_all(treeinfo, p_edge->next->next, b3);
-
-    pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge);
-    pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next);
-    pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next->next);
-
-    /* rollback the REGRAFT */
-    pll_unode_t * pruned_tree = pllmod_utree_prune(p_edge);
-    pllmod_treeinfo_set_branch_length_all(treeinfo, pruned_tree, regraft_length);
-    pllmod_treeinfo_invalidate_pmatrix(treeinfo, pruned_tree);
-
-    /* recompute p-matrix for the pendant branch of the pruned subtree */
-    algo_update_pmatrix(treeinfo, p_edge);
-
-    /* recompute p-matrix for the "old" regraft branch */
-    algo_update_pmatrix(treeinfo, pruned_tree);
-
     descent = r_dist < params->radius_max;
     if (cutoff_info && loglh < cutoff_info->lh_start)
     {
@@ -816,6 +956,10 @@ static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
 
     if (r_edge->next && descent)
     {
+      if (params->tabu &&
+          !pllmod_utree_fingerprint_spr_descend(params->fingerprint, r_edge))
+        return PLL_FAILURE;
+
       regraft_nodes[redge_count] = r_edge->next->back;
       regraft_nodes[redge_count+1] = r_edge->next->next->back;
       regraft_dist[redge_count] = regraft_dist[redge_count+1] = r_dist+1;
@@ -843,9 +987,6 @@ static int best_reinsert_edge(pllmod_treeinfo_t * treeinfo,
   pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next);
   pllmod_treeinfo_invalidate_pmatrix(treeinfo, p_edge->next->next);
 
-  free(regraft_nodes);
-  free(regraft_dist);
-
   return PLL_SUCCESS;
 }
 
@@ -908,6 +1049,11 @@ static double reinsert_nodes(pllmod_treeinfo_t * treeinfo, pll_unode_t ** nodes,
       DBG("SPR: %u -> (%u %u)\n", p_edge->clv_index,
           best_r_edge->clv_index, best_r_edge->back->clv_index);
 
+      /* keep the subtree hashes of the tabu fingerprints up to date */
+      if (params->tabu &&
+          !pllmod_utree_fingerprint_spr_apply(params->fingerprint, best_r_edge))
+        return 0;
+
       pll_unode_t * orig_prune_edge = p_edge->next->back;
       int retval = algo_utree_spr(treeinfo, params, p_edge, best_r_edge, rollback);
       assert(retval == PLL_SUCCESS);
@@ -967,6 +1113,236 @@ static double reinsert_nodes(pllmod_treeinfo_t * treeinfo, pll_unode_t ** nodes,
   return loglh;
 }
 
+/* makes the workspace lists big enough for `ntopol_keep` topologies */
+static int algo_spr_workspace_reserve(pllmod_spr_workspace_t * workspace,
+                                      unsigned int ntopol_keep)
+{
+  size_t rollback_slots = ntopol_keep;
+  size_t toplist_slots = 3 * (size_t) ntopol_keep;
+
+  if (!workspace->rollback_list ||
+      workspace->rollback_list->capacity < rollback_slots)
+  {
+    algo_rollback_list_destroy(workspace->rollback_list);
+    workspace->rollback_list = algo_rollback_list_create(rollback_slots);
+    if (!workspace->rollback_list)
+      return PLL_FAILURE;
+  }
+
+  if (!workspace->bestnode_list ||
+      workspace->bestnode_list->capacity < toplist_slots)
+  {
+    algo_bestnode_list_destroy(workspace->bestnode_list);
+    workspace->bestnode_list =
+        algo_bestnode_list_create(toplist_slots, workspace->brlen_set_count);
+    if (!workspace->bestnode_list)
+      return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* checks that the workspace was created for the tree of `treeinfo` */
+static int algo_spr_workspace_check(const pllmod_spr_workspace_t * workspace,
+                                    const pllmod_treeinfo_t * treeinfo)
+{
+  if (!workspace || workspace->tip_count != treeinfo->tip_count ||
+      workspace->edge_count != treeinfo->tree->edge_count ||
+      workspace->brlen_unlinked !=
+          (treeinfo->brlen_linkage == PLLMOD_COMMON_BRLEN_UNLINKED))
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Search workspace does not match the tree info\n");
+    return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
+
+/**
+ * Creates the buffers needed by pllmod_algo_spr_round_workspace(),
+ * pllmod_algo_nni_round_workspace() and pllmod_algo_tbr_round_workspace().
+ * A workspace is bound to the tree size and branch length linkage of
+ * `treeinfo`, and can be reused for any number of rounds on it.
+ *
+ * @param treeinfo the tree information structure
+ * @param ntopol_keep expected number of topologies kept per round. The lists
+ *                    grow if a round keeps more topologies.
+ *
+ * @return the new workspace, or NULL on error
+ */
+PLL_EXPORT pllmod_spr_workspace_t * pllmod_algo_spr_workspace_create(
+                                          const pllmod_treeinfo_t * treeinfo,
+                                          unsigned int ntopol_keep)
+{
+  unsigned int i;
+  pllmod_spr_workspace_t * workspace;
+
+  if (!treeinfo || treeinfo->tip_count < 3)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Invalid tree info\n");
+    return NULL;
+  }
+
+  workspace = (pllmod_spr_workspace_t *) calloc(1,
+                                              sizeof(pllmod_spr_workspace_t));
+  if (!workspace)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for SPR workspace\n");
+    return NULL;
+  }
+
+  workspace->tip_count = treeinfo->tip_count;
+  workspace->edge_count = treeinfo->tree->edge_count;
+  workspace->brlen_unlinked =
+      (treeinfo->brlen_linkage == PLLMOD_COMMON_BRLEN_UNLINKED) ? 1 : 0;
+  workspace->brlen_set_count = workspace->brlen_unlinked ?
+                                  treeinfo->init_partition_count : 1;
+
+  workspace->allnodes = (pll_unode_t **) calloc(
+                            (workspace->tip_count - 2) * 3,
+                            sizeof(pll_unode_t *));
+  workspace->regraft_nodes = (pll_unode_t **) calloc(workspace->edge_count,
+                                                     sizeof(pll_unode_t *));
+  workspace->regraft_dist = (unsigned int *) calloc(workspace->edge_count,
+                                                    sizeof(unsigned int));
+  workspace->right_nodes = (pll_unode_t **) calloc(workspace->edge_count,
+                                                   sizeof(pll_unode_t *));
+  workspace->right_dist = (unsigned int *) calloc(workspace->edge_count,
+                                                  sizeof(unsigned int));
+  workspace->nni_list = (nni_entry_t *) calloc(workspace->tip_count,
+                                               sizeof(nni_entry_t));
+  /* one extra slot for the original branch lengths */
+  workspace->nni_brlens = (double *) calloc((size_t) (workspace->tip_count - 2) *
+                                            NNI_BRANCH_COUNT *
+                                            workspace->brlen_set_count,
+                                            sizeof(double));
+  workspace->branch_used = (unsigned char *) calloc(workspace->edge_count,
+                                                    sizeof(unsigned char));
+  if (!workspace->allnodes || !workspace->regraft_nodes ||
+      !workspace->regraft_dist || !workspace->right_nodes ||
+      !workspace->right_dist || !workspace->nni_list ||
+      !workspace->nni_brlens || !workspace->branch_used)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for SPR workspace\n");
+    pllmod_algo_spr_workspace_destroy(workspace);
+    return NULL;
+  }
+
+  for (i = 0; i < BRLEN_BUF_COUNT; ++i)
+  {
+    if (workspace->brlen_unlinked)
+    {
+      workspace->brlen_buf[i] =
+          (double *) calloc(treeinfo->init_partition_count, sizeof(double));
+      if (!workspace->brlen_buf[i])
+      {
+        pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                         "Cannot allocate memory for SPR workspace\n");
+        pllmod_algo_spr_workspace_destroy(workspace);
+        return NULL;
+      }
+    }
+    else
+      workspace->brlen_buf[i] = &workspace->static_brlen_buf[i];
+  }
+
+  if (!algo_spr_workspace_reserve(workspace, ntopol_keep))
+  {
+    pllmod_algo_spr_workspace_destroy(workspace);
+    return NULL;
+  }
+
+  return workspace;
+}
+
+PLL_EXPORT void pllmod_algo_spr_workspace_destroy(
+                                          pllmod_spr_workspace_t * workspace)
+{
+  unsigned int i;
+
+  if (!workspace)
+    return;
+
+  if (workspace->brlen_unlinked)
+  {
+    for (i = 0; i < BRLEN_BUF_COUNT; ++i)
+      free(workspace->brlen_buf[i]);
+  }
+
+  algo_bestnode_list_destroy(workspace->bestnode_list);
+  algo_rollback_list_destroy(workspace->rollback_list);
+  pllmod_utree_fingerprint_destroy(workspace->fingerprint);
+  pllmod_topology_cache_destroy(workspace->tabu);
+  free(workspace->allnodes);
+  free(workspace->regraft_nodes);
+  free(workspace->regraft_dist);
+  free(workspace->right_nodes);
+  free(workspace->right_dist);
+  free(workspace->nni_list);
+  free(workspace->nni_brlens);
+  free(workspace->branch_used);
+  free(workspace);
+}
+
+/**
+ * Enables a tabu cache in the SPR workspace. Rounds run with this workspace
+ * remember the fingerprints of the topologies they evaluate, together with
+ * the score difference to the tree they were derived from, and skip
+ * candidate topologies that were scored worse than their tree.
+ *
+ * Entries are kept across rounds: a score difference to the tree is much
+ * less sensitive to re-optimized branch lengths or model parameters than the
+ * log-likelihood itself. Each round ends a branch length epoch when it
+ * re-optimizes all branch lengths, and entries expire after `max_age`
+ * epochs.
+ *
+ * @param workspace the SPR workspace
+ * @param cache_size maximum number of cached topologies. If 0, the tabu
+ *                   cache is disabled and released.
+ * @param max_age number of branch length epochs (rounds) after which cached
+ *                scores expire (0 = never)
+ *
+ * @return PLL_SUCCESS or PLL_FAILURE
+ */
+PLL_EXPORT int pllmod_algo_spr_workspace_set_tabu(
+                                        pllmod_spr_workspace_t * workspace,
+                                        unsigned int cache_size,
+                                        unsigned int max_age)
+{
+  if (!workspace)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "SPR workspace is NULL\n");
+    return PLL_FAILURE;
+  }
+
+  pllmod_topology_cache_destroy(workspace->tabu);
+  workspace->tabu = NULL;
+
+  if (!cache_size)
+  {
+    pllmod_utree_fingerprint_destroy(workspace->fingerprint);
+    workspace->fingerprint = NULL;
+    return PLL_SUCCESS;
+  }
+
+  if (!workspace->fingerprint)
+  {
+    workspace->fingerprint =
+        pllmod_utree_fingerprint_create(workspace->tip_count, 0);
+    if (!workspace->fingerprint)
+      return PLL_FAILURE;
+  }
+
+  workspace->tabu = pllmod_topology_cache_create(cache_size, max_age);
+  if (!workspace->tabu)
+    return PLL_FAILURE;
+
+  return PLL_SUCCESS;
+}
+
 PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
                                         unsigned int radius_min,
                                         unsigned int radius_max,
@@ -981,24 +1357,74 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
                                         double subtree_cutoff,
                                         int brlen_opt_radius,
                                         double spr_lheps)
+{
+  double loglh;
+  pllmod_spr_workspace_t * workspace;
+
+  /* reset error */
+  pll_errno = 0;
+
+  workspace = pllmod_algo_spr_workspace_create(treeinfo, ntopol_keep);
+  if (!workspace)
+    return 0;
+
+  loglh = pllmod_algo_spr_round_workspace(treeinfo,
+                                          workspace,
+                                          radius_min,
+                                          radius_max,
+                                          ntopol_keep,
+                                          thorough,
+                                          brlen_opt_method,
+                                          bl_min,
+                                          bl_max,
+                                          smoothings,
+                                          epsilon,
+                                          cutoff_info,
+                                          subtree_cutoff,
+                                          brlen_opt_radius,
+                                          spr_lheps);
+
+  pllmod_algo_spr_workspace_destroy(workspace);
+
+  return loglh;
+}
+
+/**
+ * Same as pllmod_algo_spr_round(), but all buffers are taken from
+ * `workspace`, so that repeated rounds do not allocate memory.
+ */
+PLL_EXPORT
+double pllmod_algo_spr_round_workspace(pllmod_treeinfo_t * treeinfo,
+                                       pllmod_spr_workspace_t * workspace,
+                                       unsigned int radius_min,
+                                       unsigned int radius_max,
+                                       unsigned int ntopol_keep,
+                                       pll_bool_t thorough,
+                                       int brlen_opt_method,
+                                       double bl_min,
+                                       double bl_max,
+                                       int smoothings,
+                                       double epsilon,
+                                       cutoff_info_t * cutoff_info,
+                                       double subtree_cutoff,
+                                       int brlen_opt_radius,
+                                       double spr_lheps)
 {
   unsigned int i;
   double loglh, best_lh;
   pllmod_search_params_t params;
   int retval;
-  int brlen_unlinked;
 
   unsigned int allnodes_count;
-  pll_unode_t ** allnodes = NULL;
+  pll_unode_t ** allnodes;
 
   size_t rollback_slots;
   size_t toplist_slots;
-  unsigned int brlen_set_count;
-  pllmod_rollback_list_t * rollback_list = NULL;
-  pllmod_bestnode_list_t * bestnode_list = NULL;
+  pllmod_rollback_list_t * rollback_list;
+  pllmod_bestnode_list_t * bestnode_list;
   pll_tree_rollback_t * rollback;
   size_t rollback_counter;
-  pll_tree_rollback_t * rollback2 = NULL;
+  pll_tree_rollback_t * rollback2;
   int toplist_index;
 
   node_entry_t * spr_entry;
@@ -1009,8 +1435,6 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
   pllmod_treeinfo_topology_t * tmp_topol = NULL;
 #endif
 
-  double static_brlen_buf[BRLEN_BUF_COUNT];
-
   /* process search params */
   params.thorough = thorough;
   params.ntopol_keep = ntopol_keep;
@@ -1023,37 +1447,37 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
   params.spr_lheps = spr_lheps;
   params.brlen_opt_radius = brlen_opt_radius;
 
-  brlen_unlinked = (treeinfo->brlen_linkage == PLLMOD_COMMON_BRLEN_UNLINKED) ? 1 : 0;
-
   /* reset error */
   pll_errno = 0;
 
-  /* allocate brlen buffers */
+  if (!algo_spr_workspace_check(workspace, treeinfo))
+    return 0;
+
+  /* grow the lists if this round keeps more topologies than expected */
+  if (!algo_spr_workspace_reserve(workspace, ntopol_keep))
+    return 0;
+
   for (i = 0; i < BRLEN_BUF_COUNT; ++i)
-  {
-    params.brlen_buf[i] = brlen_unlinked ?
-            (double *) calloc(treeinfo->init_partition_count, sizeof(double)) :
-            &static_brlen_buf[i];
-  }
+    params.brlen_buf[i] = workspace->brlen_buf[i];
+  params.regraft_nodes = workspace->regraft_nodes;
+  params.regraft_dist = workspace->regraft_dist;
+  params.fingerprint = workspace->fingerprint;
+  params.tabu = workspace->tabu;
+
+  /* fingerprints follow the applied SPRs incrementally from here on */
+  if (params.tabu &&
+      !pllmod_utree_fingerprint_compute(params.fingerprint, treeinfo->root))
+    return 0;
 
-  /* allocate rollback_info slots */
+  /* reset rollback_info slots */
   rollback_slots = params.ntopol_keep;
-  rollback_list = algo_rollback_list_create(rollback_slots);
-  if (!rollback_list)
-  {
-    /* return and spread error */
-    goto error_exit;
-  }
+  rollback_list = workspace->rollback_list;
+  algo_rollback_list_reset(rollback_list, rollback_slots);
 
-  /* allocate best node slots */
+  /* reset best node slots */
   toplist_slots = params.thorough ? params.ntopol_keep : params.ntopol_keep * 3;
-  brlen_set_count = brlen_unlinked ? treeinfo->init_partition_count : 1;
-  bestnode_list = algo_bestnode_list_create(toplist_slots, brlen_set_count);
-  if (!bestnode_list)
-  {
-    /* return and spread error */
-    goto error_exit;
-  }
+  bestnode_list = workspace->bestnode_list;
+  algo_bestnode_list_reset(bestnode_list, toplist_slots);
 
   if (cutoff_info)
   {
@@ -1066,13 +1490,7 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
 
   /* query all nodes */
   allnodes_count = (treeinfo->tip_count - 2) * 3;
-  allnodes = (pll_unode_t **) calloc (allnodes_count, sizeof(pll_unode_t *));
-  if (!allnodes)
-  {
-    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                     "Cannot allocate memory nodes list\n");
-    goto error_exit;
-  }
+  allnodes = workspace->allnodes;
 
   unsigned int node_count = algo_query_allnodes(treeinfo->root, allnodes);
   assert(node_count == allnodes_count);
@@ -1095,7 +1513,8 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
   if (!params.thorough && bestnode_list->current > 0)
   {
     params.thorough = PLL_TRUE;
-    for (i = 0; bestnode_list->list[i].p_node != NULL; i++)
+    for (i = 0; i < bestnode_list->size &&
+                bestnode_list->list[i].p_node != NULL; i++)
     {
       allnodes[i] = bestnode_list->list[i].p_node;
       bestnode_list->list[i].p_node = NULL;
@@ -1117,9 +1536,6 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
     }
   }
 
-  free(allnodes);
-  allnodes = NULL;
-
   best_lh = algo_optimize_bl_all(treeinfo,
                                  &params,
                                  epsilon,
@@ -1132,6 +1548,11 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
     goto error_exit;
   }
 
+  /* all branch lengths changed: start a new branch length epoch. The cached
+     entries are kept, and expire after max_age epochs */
+  if (params.tabu)
+    pllmod_topology_cache_next_generation(params.tabu);
+
   best_topol = pllmod_treeinfo_get_topology(treeinfo, NULL);
   if (!best_topol)
     goto error_exit;
@@ -1146,13 +1567,8 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
   */
   rollback_counter = 0;
   toplist_index = -1;
-  rollback2 = (pll_tree_rollback_t *) calloc(1, sizeof(pll_tree_rollback_t));
-  if (!rollback2)
-  {
-    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                     "Cannot allocate memory for additional rollback list\n");
-    goto error_exit;
-  }
+  rollback2 = &workspace->rollback2;
+  memset(rollback2, 0, sizeof(pll_tree_rollback_t));
   int undo_SPR = 0;
 
 #ifdef DEBUG
@@ -1296,19 +1712,8 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
     }
   }
 
-  free(rollback2);
-
-  algo_bestnode_list_destroy(bestnode_list);
-  algo_rollback_list_destroy(rollback_list);
-
-  if (brlen_unlinked)
-  {
-    for (i = 0; i < BRLEN_BUF_COUNT; ++i)
-      free(params.brlen_buf[i]);
-  }
-
-  /* update LH cutoff */
-  if (cutoff_info)
+  /* update LH cutoff */
+  if (cutoff_info)
   {
     cutoff_info->lh_cutoff =
         subtree_cutoff * (cutoff_info->lh_dec_sum / cutoff_info->lh_dec_count);
@@ -1338,13 +1743,1062 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
   return loglh;
 
 error_exit:
-  /* cleanup */
-  if (allnodes)
-    free(allnodes);
-  if (rollback2)
-    free(rollback2);
-  algo_bestnode_list_destroy(bestnode_list);
-  algo_rollback_list_destroy(rollback_list);
+  /* make sure libpll error code is set and exit */
+  assert(pll_errno);
+  return 0;
+}
+
+/* NNI search */
+
+/* branches around `edge` keyed by nodes that keep their identity when the
+ * NNI is applied: the central edge and the roots of the 4 adjacent subtrees */
+static void algo_nni_branches(pll_unode_t * edge, pll_unode_t ** branches)
+{
+  branches[0] = edge;
+  branches[1] = edge->next->back;
+  branches[2] = edge->next->next->back;
+  branches[3] = edge->back->next->back;
+  branches[4] = edge->back->next->next->back;
+}
+
+static void algo_nni_get_brlens(const pllmod_treeinfo_t * treeinfo,
+                                pll_unode_t ** branches,
+                                unsigned int brlen_set_count,
+                                double * brlens)
+{
+  for (unsigned int i = 0; i < NNI_BRANCH_COUNT; ++i)
+    pllmod_treeinfo_get_branch_length_all(treeinfo, branches[i],
+                                          brlens + i * brlen_set_count);
+}
+
+static void algo_nni_set_brlens(pllmod_treeinfo_t * treeinfo,
+                                pll_unode_t ** branches,
+                                unsigned int brlen_set_count,
+                                const double * brlens)
+{
+  for (unsigned int i = 0; i < NNI_BRANCH_COUNT; ++i)
+  {
+    pllmod_treeinfo_set_branch_length_all(treeinfo, branches[i],
+                                          brlens + i * brlen_set_count);
+    pllmod_treeinfo_invalidate_pmatrix(treeinfo, branches[i]);
+    algo_update_pmatrix(treeinfo, branches[i]);
+  }
+}
+
+/* applies the NNI stored in `entry` together with its optimized branches */
+static int algo_nni_apply(pllmod_treeinfo_t * treeinfo,
+                          const nni_entry_t * entry,
+                          unsigned int brlen_set_count)
+{
+  pll_unode_t * branches[NNI_BRANCH_COUNT];
+
+  algo_nni_branches(entry->edge, branches);
+
+  if (!pllmod_utree_nni(entry->edge, entry->type, NULL))
+    return PLL_FAILURE;
+
+  algo_nni_set_brlens(treeinfo, branches, brlen_set_count, entry->brlens);
+
+  pllmod_treeinfo_invalidate_clv(treeinfo, entry->edge);
+  pllmod_treeinfo_invalidate_clv(treeinfo, entry->edge->back);
+
+  return PLL_SUCCESS;
+}
+
+/*
+ * Evaluates both NNI alternatives around `edge` and stores the best one in
+ * `entry`. Only the CLVs at both ends of `edge` are recomputed, and the 5
+ * branches around it are optimized locally. The original topology and branch
+ * lengths are restored before returning.
+ */
+static int algo_nni_eval_edge(pllmod_treeinfo_t * treeinfo,
+                              const pllmod_search_params_t * params,
+                              pll_unode_t * edge,
+                              unsigned int brlen_set_count,
+                              double * orig_brlens,
+                              nni_entry_t * entry)
+{
+  const int types[2] = {PLL_UTREE_MOVE_NNI_LEFT, PLL_UTREE_MOVE_NNI_RIGHT};
+  pll_unode_t * branches[NNI_BRANCH_COUNT];
+  pll_tree_rollback_t rollback;
+  pll_unode_t * swap_node;
+  double start_lh, loglh;
+  unsigned int i;
+  int retval;
+
+  entry->edge = NULL;
+  entry->lh_gain = 0.;
+
+  /* place the root at the central edge, so that only the CLVs at its ends
+   * are affected by the move */
+  pllmod_treeinfo_set_root(treeinfo, edge);
+  start_lh = pllmod_treeinfo_compute_loglh_flex(treeinfo, 1, 0);
+
+  algo_nni_branches(edge, branches);
+  algo_nni_get_brlens(treeinfo, branches, brlen_set_count, orig_brlens);
+
+  for (i = 0; i < 2; ++i)
+  {
+    /* the subtree interchanged with edge->next->back */
+    swap_node = (types[i] == PLL_UTREE_MOVE_NNI_LEFT) ?
+                    edge->back->next->back : edge->back->next->next->back;
+    if (!pllmod_treeinfo_check_constraint(treeinfo, edge->next, swap_node))
+      continue;
+
+    if (!pllmod_utree_nni(edge, types[i], &rollback))
+      return PLL_FAILURE;
+
+    algo_nni_set_brlens(treeinfo, branches, brlen_set_count, orig_brlens);
+    pllmod_treeinfo_invalidate_clv(treeinfo, edge);
+    pllmod_treeinfo_invalidate_clv(treeinfo, edge->back);
+
+    pllmod_treeinfo_compute_loglh_flex(treeinfo, 1, 0);
+
+    /* optimize the central branch and the branches adjacent to both ends */
+    loglh = algo_optimize_bl_iterative(edge, treeinfo, params, 1,
+                                       params->spr_lheps, 1.0);
+    if (loglh)
+      loglh = algo_optimize_bl_iterative(edge->back, treeinfo, params, 1,
+                                         params->spr_lheps, 1.0);
+
+    if (loglh && loglh - start_lh > entry->lh_gain)
+    {
+      entry->edge = edge;
+      entry->type = types[i];
+      entry->lh_gain = loglh - start_lh;
+      algo_nni_get_brlens(treeinfo, branches, brlen_set_count, entry->brlens);
+    }
+
+    /* undo the move and restore the original branch lengths */
+    retval = pllmod_tree_rollback(&rollback);
+    assert(retval == PLL_SUCCESS);
+
+    algo_nni_set_brlens(treeinfo, branches, brlen_set_count, orig_brlens);
+    pllmod_treeinfo_invalidate_clv(treeinfo, edge);
+    pllmod_treeinfo_invalidate_clv(treeinfo, edge->back);
+
+    if (!loglh || !retval)
+      return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
+
+static int cmp_nni_entry(const void * a, const void * b)
+{
+  const nni_entry_t * e1 = (const nni_entry_t *) a;
+  const nni_entry_t * e2 = (const nni_entry_t *) b;
+
+  if (e1->lh_gain > e2->lh_gain)
+    return -1;
+  else if (e1->lh_gain < e2->lh_gain)
+    return 1;
+  else
+    return 0;
+}
+
+/**
+ * Performs one round of NNI search.
+ *
+ * Both NNI alternatives are evaluated on every inner branch, recomputing only
+ * the CLVs at the ends of the branch and optimizing the 5 branches around it.
+ * Improving moves are then applied from the best to the worst, skipping those
+ * that share a branch with an already applied move. If the combined moves
+ * score worse than the best single move, only the best move is kept.
+ *
+ * Branch lengths outside the 5 branches around each move are not optimized.
+ *
+ * @param treeinfo the tree information structure
+ * @param bl_min minimum branch length
+ * @param bl_max maximum branch length
+ * @param brlen_opt_method branch length optimization method
+ * @param smoothings number of local branch length optimization iterations
+ * @param lh_epsilon minimum log-likelihood improvement for a move
+ *
+ * @return the log-likelihood of the resulting tree, or 0 on error
+ */
+PLL_EXPORT double pllmod_algo_nni_round(pllmod_treeinfo_t * treeinfo,
+                                        double bl_min,
+                                        double bl_max,
+                                        int brlen_opt_method,
+                                        int smoothings,
+                                        double lh_epsilon)
+{
+  double loglh;
+  pllmod_spr_workspace_t * workspace;
+
+  /* reset error */
+  pll_errno = 0;
+
+  if (!treeinfo || treeinfo->tip_count < 4)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "NNI search requires at least 4 taxa\n");
+    return 0;
+  }
+
+  workspace = pllmod_algo_spr_workspace_create(treeinfo, 0);
+  if (!workspace)
+    return 0;
+
+  loglh = pllmod_algo_nni_round_workspace(treeinfo,
+                                          workspace,
+                                          bl_min,
+                                          bl_max,
+                                          brlen_opt_method,
+                                          smoothings,
+                                          lh_epsilon);
+
+  pllmod_algo_spr_workspace_destroy(workspace);
+
+  return loglh;
+}
+
+/**
+ * Same as pllmod_algo_nni_round(), but all buffers are taken from
+ * `workspace`, so that repeated rounds do not allocate memory.
+ */
+PLL_EXPORT
+double pllmod_algo_nni_round_workspace(pllmod_treeinfo_t * treeinfo,
+                                       pllmod_spr_workspace_t * workspace,
+                                       double bl_min,
+                                       double bl_max,
+                                       int brlen_opt_method,
+                                       int smoothings,
+                                       double lh_epsilon)
+{
+  unsigned int i;
+  unsigned int allnodes_count, node_count;
+  unsigned int nni_count, applied_count;
+  unsigned int brlen_set_count;
+  size_t entry_brlen_size;
+  double loglh, best_single_lh;
+  int retval;
+
+  pllmod_search_params_t params;
+  pll_unode_t ** allnodes;
+  nni_entry_t * nni_list;
+  double * brlen_pool;
+  unsigned char * branch_used;
+  pllmod_treeinfo_topology_t * orig_topol = NULL;
+
+  /* reset error */
+  pll_errno = 0;
+
+  if (!treeinfo || treeinfo->tip_count < 4)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "NNI search requires at least 4 taxa\n");
+    return 0;
+  }
+
+  if (!algo_spr_workspace_check(workspace, treeinfo))
+    return 0;
+
+  memset(&params, 0, sizeof(pllmod_search_params_t));
+  params.thorough = PLL_TRUE;
+  params.bl_min = bl_min;
+  params.bl_max = bl_max;
+  params.smoothings = smoothings;
+  params.brlen_opt_method = brlen_opt_method;
+  params.spr_lheps = lh_epsilon;
+  params.brlen_opt_radius = 1;
+
+  brlen_set_count = workspace->brlen_set_count;
+  entry_brlen_size = (size_t) NNI_BRANCH_COUNT * brlen_set_count;
+
+  allnodes_count = (treeinfo->tip_count - 2) * 3;
+  allnodes = workspace->allnodes;
+  nni_list = workspace->nni_list;
+  brlen_pool = workspace->nni_brlens;
+  branch_used = workspace->branch_used;
+
+  memset(nni_list, 0, (treeinfo->tip_count - 3) * sizeof(nni_entry_t));
+  memset(branch_used, 0, treeinfo->tree->edge_count * sizeof(unsigned char));
+
+  loglh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  node_count = algo_query_allnodes(treeinfo->root, allnodes);
+  assert(node_count == allnodes_count);
+
+  /* evaluate every inner branch once */
+  nni_count = 0;
+  for (i = 0; i < node_count; ++i)
+  {
+    pll_unode_t * edge = allnodes[i];
+    nni_entry_t * entry = &nni_list[nni_count];
+
+    if (pllmod_utree_is_tip(edge->back) ||
+        edge->node_index > edge->back->node_index)
+      continue;
+
+    entry->brlens = brlen_pool + (nni_count + 1) * entry_brlen_size;
+    if (!algo_nni_eval_edge(treeinfo, &params, edge, brlen_set_count,
+                            brlen_pool, entry))
+      goto error_exit;
+
+    if (entry->edge && entry->lh_gain > lh_epsilon)
+    {
+      DBG("NNI candidate: edge %u, type %d, gain %f\n",
+          edge->pmatrix_index, entry->type, entry->lh_gain);
+      nni_count++;
+    }
+  }
+
+  if (!nni_count)
+    return pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  qsort(nni_list, nni_count, sizeof(nni_entry_t), cmp_nni_entry);
+  best_single_lh = loglh + nni_list[0].lh_gain;
+
+  if (nni_count > 1)
+  {
+    orig_topol = pllmod_treeinfo_get_topology(treeinfo, NULL);
+    if (!orig_topol)
+      goto error_exit;
+  }
+
+  /* apply all moves that do not share a branch with a better one */
+  applied_count = 0;
+  for (i = 0; i < nni_count; ++i)
+  {
+    pll_unode_t * branches[NNI_BRANCH_COUNT];
+    unsigned int j;
+    int conflict = 0;
+
+    algo_nni_branches(nni_list[i].edge, branches);
+    for (j = 0; j < NNI_BRANCH_COUNT && !conflict; ++j)
+      conflict = branch_used[branches[j]->pmatrix_index];
+
+    if (conflict)
+      continue;
+
+    for (j = 0; j < NNI_BRANCH_COUNT; ++j)
+      branch_used[branches[j]->pmatrix_index] = 1;
+
+    if (!algo_nni_apply(treeinfo, &nni_list[i], brlen_set_count))
+      goto error_exit;
+
+    applied_count++;
+  }
+
+  loglh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  DBG("NNI: applied %u of %u moves, LH: %f, best single move LH: %f\n",
+      applied_count, nni_count, loglh, best_single_lh);
+
+  /* moves interfered with each other -> fall back to the best single move */
+  if (applied_count > 1 && loglh < best_single_lh)
+  {
+    retval = pllmod_treeinfo_set_topology(treeinfo, orig_topol);
+    if (!retval)
+      goto error_exit;
+
+    pllmod_treeinfo_invalidate_all(treeinfo);
+
+    if (!algo_nni_apply(treeinfo, &nni_list[0], brlen_set_count))
+      goto error_exit;
+
+    loglh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+  }
+
+  if (orig_topol)
+    pllmod_treeinfo_destroy_topology(orig_topol);
+
+  return loglh;
+
+error_exit:
+  if (orig_topol)
+    pllmod_treeinfo_destroy_topology(orig_topol);
+
+  /* make sure libpll error code is set and exit */
+  assert(pll_errno);
+  return 0;
+}
+
+/* TBR search */
+
+static void algo_brlen_sum(const pllmod_treeinfo_t * treeinfo,
+                           double * dst,
+                           const double * b1,
+                           const double * b2,
+                           double factor)
+{
+  unsigned int i;
+  unsigned int count =
+      (treeinfo->brlen_linkage == PLLMOD_COMMON_BRLEN_UNLINKED) ?
+          treeinfo->init_partition_count : 1;
+
+  for (i = 0; i < count; ++i)
+    dst[i] = (b1[i] + (b2 ? b2[i] : 0.)) * factor;
+}
+
+static void algo_tbr_update_branch(pllmod_treeinfo_t * treeinfo,
+                                   const pllmod_search_params_t * params,
+                                   pll_unode_t * edge,
+                                   const double * lengths)
+{
+  pllmod_treeinfo_set_branch_length_all(treeinfo, edge, lengths);
+  algo_unode_fix_length(treeinfo, edge, params->bl_min, params->bl_max);
+  pllmod_treeinfo_invalidate_pmatrix(treeinfo, edge);
+  algo_update_pmatrix(treeinfo, edge);
+}
+
+/* saves the lengths of the 5 branches around `b_edge` into brlen_buf[0..4] */
+static void algo_tbr_save_brlens(const pllmod_treeinfo_t * treeinfo,
+                                 const pllmod_search_params_t * params,
+                                 const pll_unode_t * b_edge)
+{
+  pllmod_treeinfo_get_branch_length_all(treeinfo, b_edge,
+                                        params->brlen_buf[0]);
+  pllmod_treeinfo_get_branch_length_all(treeinfo, b_edge->next,
+                                        params->brlen_buf[1]);
+  pllmod_treeinfo_get_branch_length_all(treeinfo, b_edge->next->next,
+                                        params->brlen_buf[2]);
+  pllmod_treeinfo_get_branch_length_all(treeinfo, b_edge->back->next,
+                                        params->brlen_buf[3]);
+  pllmod_treeinfo_get_branch_length_all(treeinfo, b_edge->back->next->next,
+                                        params->brlen_buf[4]);
+}
+
+/* sets the lengths of the branches joined by a bisection, from the lengths
+ * saved with algo_tbr_save_brlens() */
+static void algo_tbr_set_bisect_brlens(pllmod_treeinfo_t * treeinfo,
+                                       const pllmod_search_params_t * params,
+                                       pll_unode_t * left,
+                                       pll_unode_t * right)
+{
+  double * tmp = params->brlen_buf[10];
+
+  algo_brlen_sum(treeinfo, tmp, params->brlen_buf[1], params->brlen_buf[2], 1.);
+  algo_tbr_update_branch(treeinfo, params, left, tmp);
+
+  algo_brlen_sum(treeinfo, tmp, params->brlen_buf[3], params->brlen_buf[4], 1.);
+  algo_tbr_update_branch(treeinfo, params, right, tmp);
+}
+
+/* sets the lengths of the branches around `b_edge` after a reconnection:
+ * the reconnection branches are split in halves */
+static void algo_tbr_set_reconnect_brlens(pllmod_treeinfo_t * treeinfo,
+                                          const pllmod_search_params_t * params,
+                                          pll_unode_t * b_edge,
+                                          const double * central,
+                                          const double * r1_len,
+                                          const double * r2_len)
+{
+  double * tmp = params->brlen_buf[11];
+
+  algo_tbr_update_branch(treeinfo, params, b_edge, central);
+
+  algo_brlen_sum(treeinfo, tmp, r1_len, NULL, 0.5);
+  algo_tbr_update_branch(treeinfo, params, b_edge->next, tmp);
+  algo_tbr_update_branch(treeinfo, params, b_edge->next->next, tmp);
+
+  algo_brlen_sum(treeinfo, tmp, r2_len, NULL, 0.5);
+  algo_tbr_update_branch(treeinfo, params, b_edge->back->next, tmp);
+  algo_tbr_update_branch(treeinfo, params, b_edge->back->next->next, tmp);
+}
+
+/*
+ * Applies a TBR move scored by best_tbr_edge(). `r1` and `r2` are given as in
+ * the bisected tree, i.e., b_edge->next->back stands for the branch joined on
+ * the `b_edge` side. If `central` is NULL, the bisected branch keeps its
+ * length.
+ */
+static int algo_utree_tbr(pllmod_treeinfo_t * treeinfo,
+                          const pllmod_search_params_t * params,
+                          pll_unode_t * b_edge,
+                          pll_unode_t * r1,
+                          pll_unode_t * r2,
+                          const double * central,
+                          pll_tree_rollback_t * rollback_info)
+{
+  pll_tree_edge_t r_edge;
+  pll_unode_t * left = b_edge->next->back;
+  pll_unode_t * right = b_edge->back->next->back;
+  double * r1_len = params->brlen_buf[6];
+  double * r2_len = params->brlen_buf[5];
+
+  algo_tbr_save_brlens(treeinfo, params, b_edge);
+
+  if (r1 == left)
+    algo_brlen_sum(treeinfo, r1_len, params->brlen_buf[1],
+                   params->brlen_buf[2], 1.);
+  else
+    pllmod_treeinfo_get_branch_length_all(treeinfo, r1, r1_len);
+
+  if (r2 == right)
+    algo_brlen_sum(treeinfo, r2_len, params->brlen_buf[3],
+                   params->brlen_buf[4], 1.);
+  else
+    pllmod_treeinfo_get_branch_length_all(treeinfo, r2, r2_len);
+
+  r_edge.edge.utree.parent = r1;
+  r_edge.edge.utree.child  = r2;
+  r_edge.length = b_edge->length;
+
+  if (!pllmod_utree_tbr(b_edge, &r_edge, rollback_info))
+    return PLL_FAILURE;
+
+  algo_tbr_set_bisect_brlens(treeinfo, params, left, right);
+  algo_tbr_set_reconnect_brlens(treeinfo, params, b_edge,
+                                central ? central : params->brlen_buf[0],
+                                r1_len, r2_len);
+
+  pllmod_treeinfo_invalidate_clv(treeinfo, b_edge);
+  pllmod_treeinfo_invalidate_clv(treeinfo, b_edge->back);
+
+  return PLL_SUCCESS;
+}
+
+/* collects the branches at most `max_dist` branches away from `edge`, in
+ * breadth-first order */
+static unsigned int algo_tbr_collect_edges(pll_unode_t * edge,
+                                           unsigned int max_dist,
+                                           pll_unode_t ** nodes,
+                                           unsigned int * dist)
+{
+  unsigned int i;
+  unsigned int count = 0;
+
+  nodes[count] = edge;
+  dist[count++] = 0;
+
+  for (i = 0; i < count; ++i)
+  {
+    pll_unode_t * node = nodes[i];
+
+    if (dist[i] >= max_dist)
+      continue;
+
+    if (node->next)
+    {
+      nodes[count] = node->next->back;
+      nodes[count+1] = node->next->next->back;
+      dist[count] = dist[count+1] = dist[i] + 1;
+      count += 2;
+    }
+
+    /* the starting branch is expanded in both directions */
+    if (i == 0 && node->back->next)
+    {
+      nodes[count] = node->back->next->back;
+      nodes[count+1] = node->back->next->next->back;
+      dist[count] = dist[count+1] = 1;
+      count += 2;
+    }
+  }
+
+  return count;
+}
+
+/*
+ * Bisects the tree at entry->p_node and scores all reconnections of the two
+ * subtrees within params->radius_max branches from the bisection point. The
+ * subtree on the entry->p_node side is explored breadth-first, and the search
+ * does not descend below branches whose best score falls under the
+ * likelihood cutoff. The best reconnection is stored in `entry`, and the
+ * original tree is restored.
+ */
+static int best_tbr_edge(pllmod_treeinfo_t * treeinfo,
+                         node_entry_t * entry,
+                         cutoff_info_t * cutoff_info,
+                         const pllmod_search_params_t * params,
+                         pll_unode_t ** right_nodes,
+                         unsigned int * right_dist)
+{
+  assert(treeinfo && entry && params);
+
+  unsigned int j, k;
+  unsigned int left_count, right_count;
+  unsigned int min_dist;
+  pll_unode_t * left, * right;
+  pll_unode_t * r1, * r2;
+  pll_unode_t ** left_nodes = params->regraft_nodes;
+  unsigned int * left_dist = params->regraft_dist;
+  pll_tree_edge_t r_edge;
+  double * r1_len = params->brlen_buf[6];
+  double * r2_len = params->brlen_buf[5];
+  double loglh, r1_lh;
+  int retval;
+  int descent;
+
+  pll_unode_t * b_edge = entry->p_node;
+
+  entry->r_node = entry->r2_node = NULL;
+  entry->lh = PLLMOD_OPT_LNL_UNLIKELY;
+
+  min_dist = params->radius_min ? params->radius_min : 1;
+
+  pllmod_treeinfo_set_root(treeinfo, b_edge);
+
+  /* recompute all CLVs and p-matrices before bisecting */
+  loglh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  algo_tbr_save_brlens(treeinfo, params, b_edge);
+
+  /* BISECT */
+  retval = pllmod_utree_bisect(b_edge, &left, &right);
+  assert(retval == PLL_SUCCESS);
+
+  algo_tbr_set_bisect_brlens(treeinfo, params, left, right);
+
+  pllmod_treeinfo_invalidate_clv(treeinfo, left);
+  pllmod_treeinfo_invalidate_clv(treeinfo, left->back);
+  pllmod_treeinfo_invalidate_clv(treeinfo, right);
+  pllmod_treeinfo_invalidate_clv(treeinfo, right->back);
+
+  right_count = algo_tbr_collect_edges(right, params->radius_max,
+                                       right_nodes, right_dist);
+
+  left_nodes[0] = left;
+  left_dist[0] = 0;
+  left_count = 1;
+
+  j = 0;
+  while (j < left_count)
+  {
+    r1 = left_nodes[j];
+    r1_lh = PLLMOD_OPT_LNL_UNLIKELY;
+
+    pllmod_treeinfo_get_branch_length_all(treeinfo, r1, r1_len);
+
+    for (k = 0; k < right_count; ++k)
+    {
+      r2 = right_nodes[k];
+
+      /* the original tree, or closer than the minimum radius */
+      if (left_dist[j] + right_dist[k] < min_dist)
+        continue;
+
+      if (!pllmod_treeinfo_check_constraint(treeinfo, b_edge, r1) ||
+          !pllmod_treeinfo_check_constraint(treeinfo, b_edge->back, r2))
+        continue;
+
+      pllmod_treeinfo_get_branch_length_all(treeinfo, r2, r2_len);
+
+      /* RECONNECT */
+      r_edge.edge.utree.parent = r1;
+      r_edge.edge.utree.child  = r2;
+      r_edge.length = b_edge->length;
+      pllmod_utree_reconnect(&r_edge, b_edge);
+
+      algo_tbr_set_reconnect_brlens(treeinfo, params, b_edge,
+                                    params->brlen_buf[0], r1_len, r2_len);
+
+      /* only the CLVs on the paths to the reconnection points are updated */
+      pllmod_treeinfo_invalidate_clv(treeinfo, b_edge);
+      pllmod_treeinfo_invalidate_clv(treeinfo, b_edge->back);
+
+      loglh = pllmod_treeinfo_compute_loglh_flex(treeinfo, 1, 0);
+
+      if (params->thorough)
+      {
+        /* optimize the reconnecting branch */
+        loglh = algo_optimize_bl_iterative(b_edge, treeinfo, params, 0,
+                                           params->spr_lheps, 1.0);
+        if (!loglh)
+          return PLL_FAILURE;
+      }
+
+      if (loglh > entry->lh)
+      {
+        entry->lh = loglh;
+        entry->r_node = r1;
+        entry->r2_node = r2;
+        pllmod_treeinfo_get_branch_length_all(treeinfo, b_edge, entry->b1);
+      }
+
+      if (loglh > r1_lh)
+        r1_lh = loglh;
+
+      if (cutoff_info && loglh < cutoff_info->lh_start)
+      {
+        cutoff_info->lh_dec_count++;
+        cutoff_info->lh_dec_sum += cutoff_info->lh_start - loglh;
+      }
+
+      /* undo the reconnection */
+      retval = pllmod_utree_bisect(b_edge, &r1, &r2);
+      assert(retval == PLL_SUCCESS);
+      assert(r1 == left_nodes[j] && r2 == right_nodes[k]);
+
+      algo_tbr_update_branch(treeinfo, params, r1, r1_len);
+      algo_tbr_update_branch(treeinfo, params, r2, r2_len);
+    }
+
+    r1 = left_nodes[j];
+
+    descent = left_dist[j] < params->radius_max;
+    if (cutoff_info && r1_lh < cutoff_info->lh_start)
+    {
+      descent = descent &&
+                (cutoff_info->lh_start - r1_lh) < cutoff_info->lh_cutoff;
+    }
+
+    if (descent)
+    {
+      if (r1->next)
+      {
+        left_nodes[left_count] = r1->next->back;
+        left_nodes[left_count+1] = r1->next->next->back;
+        left_dist[left_count] = left_dist[left_count+1] = left_dist[j] + 1;
+        left_count += 2;
+      }
+      if (j == 0 && r1->back->next)
+      {
+        left_nodes[left_count] = r1->back->next->back;
+        left_nodes[left_count+1] = r1->back->next->next->back;
+        left_dist[left_count] = left_dist[left_count+1] = 1;
+        left_count += 2;
+      }
+    }
+
+    ++j;
+  }
+
+  /* restore the original tree */
+  r_edge.edge.utree.parent = left;
+  r_edge.edge.utree.child  = right;
+  r_edge.length = b_edge->length;
+  pllmod_utree_reconnect(&r_edge, b_edge);
+
+  algo_tbr_update_branch(treeinfo, params, b_edge, params->brlen_buf[0]);
+  algo_tbr_update_branch(treeinfo, params, b_edge->next, params->brlen_buf[1]);
+  algo_tbr_update_branch(treeinfo, params, b_edge->next->next,
+                         params->brlen_buf[2]);
+  algo_tbr_update_branch(treeinfo, params, b_edge->back->next,
+                         params->brlen_buf[3]);
+  algo_tbr_update_branch(treeinfo, params, b_edge->back->next->next,
+                         params->brlen_buf[4]);
+
+  pllmod_treeinfo_invalidate_clv(treeinfo, b_edge);
+  pllmod_treeinfo_invalidate_clv(treeinfo, b_edge->back);
+
+  return PLL_SUCCESS;
+}
+
+static double bisect_edges(pllmod_treeinfo_t * treeinfo,
+                           pll_unode_t ** edges,
+                           unsigned int edge_count,
+                           pllmod_rollback_list_t * rollback_list,
+                           pllmod_bestnode_list_t * best_node_list,
+                           cutoff_info_t * cutoff_info,
+                           const pllmod_search_params_t * params,
+                           pll_unode_t ** right_nodes,
+                           unsigned int * right_dist)
+{
+  unsigned int i;
+
+  double best_lh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  node_entry_t tbr_entry;
+
+  memset(&tbr_entry, 0, sizeof(node_entry_t));
+  tbr_entry.b1 = params->brlen_buf[7];
+  tbr_entry.b2 = params->brlen_buf[8];
+  tbr_entry.b3 = params->brlen_buf[9];
+
+  pll_tree_rollback_t * rollback = rollback_list->list + rollback_list->current;
+
+  for (i = 0; i < edge_count; ++i)
+  {
+    pll_unode_t * b_edge = edges[i];
+
+    /* earlier moves may have turned this into a leaf branch */
+    if (pllmod_utree_is_tip(b_edge) || pllmod_utree_is_tip(b_edge->back))
+      continue;
+
+    tbr_entry.p_node = b_edge;
+
+    if (cutoff_info)
+      cutoff_info->lh_start = best_lh;
+
+    if (!best_tbr_edge(treeinfo, &tbr_entry, cutoff_info, params,
+                       right_nodes, right_dist))
+    {
+      /* return and spread error */
+      return 0;
+    }
+
+    if (!tbr_entry.r_node)
+      continue;
+
+    if (tbr_entry.lh - best_lh > 1e-6)
+    {
+      DBG("TBR: %u -> (%u %u)\n", b_edge->clv_index,
+          tbr_entry.r_node->clv_index, tbr_entry.r2_node->clv_index);
+
+      if (!algo_utree_tbr(treeinfo, params, b_edge,
+                          tbr_entry.r_node, tbr_entry.r2_node,
+                          params->thorough ? tbr_entry.b1 : NULL,
+                          rollback))
+        return 0;
+
+      /* increment rollback slot counter to save TBR history */
+      rollback = algo_rollback_list_next(rollback_list);
+
+      best_lh = tbr_entry.lh;
+
+      DBG("New best: %f\n", best_lh);
+    }
+    else
+    {
+      /* LH didn't improve but could be still high enough to be in top-n */
+      tbr_entry.rollback_num = algo_rollback_list_abspos(rollback_list);
+      algo_bestnode_list_save(best_node_list, &tbr_entry);
+    }
+  }
+
+  return best_lh;
+}
+
+/**
+ * Performs one round of TBR search.
+ *
+ * The tree is bisected once at every inner branch, and the two subtrees are
+ * reconnected at all pairs of branches within `radius_max` branches from the
+ * bisection point. Only the CLVs on the paths to the reconnection points are
+ * recomputed for each pair. Improving moves are applied immediately. After
+ * optimizing all branch lengths, the best `ntopol_keep` moves scored on the
+ * final topology are re-evaluated, and the first one that improves the
+ * likelihood is kept.
+ *
+ * @param treeinfo the tree information structure
+ * @param radius_min minimum total distance of the two reconnection branches
+ *                   from the bisection point
+ * @param radius_max maximum distance of each reconnection branch from the
+ *                   bisection point
+ * @param ntopol_keep number of non-improving moves to re-evaluate
+ * @param thorough optimize the reconnecting branch for every candidate
+ * @param brlen_opt_method branch length optimization method
+ * @param bl_min minimum branch length
+ * @param bl_max maximum branch length
+ * @param smoothings number of branch length optimization iterations
+ * @param epsilon log-likelihood epsilon for branch length optimization
+ * @param cutoff_info likelihood cutoff information, or NULL to disable it
+ * @param subtree_cutoff factor for updating the likelihood cutoff
+ *
+ * @return the log-likelihood of the resulting tree, or 0 on error
+ */
+PLL_EXPORT double pllmod_algo_tbr_round(pllmod_treeinfo_t * treeinfo,
+                                        unsigned int radius_min,
+                                        unsigned int radius_max,
+                                        unsigned int ntopol_keep,
+                                        pll_bool_t thorough,
+                                        int brlen_opt_method,
+                                        double bl_min,
+                                        double bl_max,
+                                        int smoothings,
+                                        double epsilon,
+                                        cutoff_info_t * cutoff_info,
+                                        double subtree_cutoff)
+{
+  double loglh;
+  pllmod_spr_workspace_t * workspace;
+
+  /* reset error */
+  pll_errno = 0;
+
+  if (!treeinfo || treeinfo->tip_count < 4)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "TBR search requires at least 4 taxa\n");
+    return 0;
+  }
+
+  workspace = pllmod_algo_spr_workspace_create(treeinfo, ntopol_keep);
+  if (!workspace)
+    return 0;
+
+  loglh = pllmod_algo_tbr_round_workspace(treeinfo,
+                                          workspace,
+                                          radius_min,
+                                          radius_max,
+                                          ntopol_keep,
+                                          thorough,
+                                          brlen_opt_method,
+                                          bl_min,
+                                          bl_max,
+                                          smoothings,
+                                          epsilon,
+                                          cutoff_info,
+                                          subtree_cutoff);
+
+  pllmod_algo_spr_workspace_destroy(workspace);
+
+  return loglh;
+}
+
+/**
+ * Same as pllmod_algo_tbr_round(), but all buffers are taken from
+ * `workspace`, so that repeated rounds do not allocate memory.
+ */
+PLL_EXPORT
+double pllmod_algo_tbr_round_workspace(pllmod_treeinfo_t * treeinfo,
+                                       pllmod_spr_workspace_t * workspace,
+                                       unsigned int radius_min,
+                                       unsigned int radius_max,
+                                       unsigned int ntopol_keep,
+                                       pll_bool_t thorough,
+                                       int brlen_opt_method,
+                                       double bl_min,
+                                       double bl_max,
+                                       int smoothings,
+                                       double epsilon,
+                                       cutoff_info_t * cutoff_info,
+                                       double subtree_cutoff)
+{
+  unsigned int i;
+  unsigned int allnodes_count, node_count, edge_count;
+  int toplist_index;
+  double loglh, best_lh;
+
+  pllmod_search_params_t params;
+  pll_unode_t ** allnodes;
+  pllmod_rollback_list_t * rollback_list;
+  pllmod_bestnode_list_t * bestnode_list;
+  pllmod_treeinfo_topology_t * best_topol = NULL;
+
+  /* reset error */
+  pll_errno = 0;
+
+  if (!treeinfo || treeinfo->tip_count < 4)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "TBR search requires at least 4 taxa\n");
+    return 0;
+  }
+
+  if (!algo_spr_workspace_check(workspace, treeinfo))
+    return 0;
+
+  /* process search params */
+  memset(&params, 0, sizeof(pllmod_search_params_t));
+  params.thorough = thorough;
+  params.ntopol_keep = ntopol_keep;
+  params.radius_min = radius_min;
+  params.radius_max = radius_max;
+  params.bl_min = bl_min;
+  params.bl_max = bl_max;
+  params.smoothings = smoothings;
+  params.brlen_opt_method = brlen_opt_method;
+  params.spr_lheps = epsilon;
+
+  /* grow the lists if this round keeps more topologies than expected */
+  if (!algo_spr_workspace_reserve(workspace, ntopol_keep))
+    return 0;
+
+  for (i = 0; i < BRLEN_BUF_COUNT; ++i)
+    params.brlen_buf[i] = workspace->brlen_buf[i];
+  params.regraft_nodes = workspace->regraft_nodes;
+  params.regraft_dist = workspace->regraft_dist;
+
+  rollback_list = workspace->rollback_list;
+  algo_rollback_list_reset(rollback_list, ntopol_keep);
+
+  bestnode_list = workspace->bestnode_list;
+  algo_bestnode_list_reset(bestnode_list, ntopol_keep);
+
+  allnodes_count = (treeinfo->tip_count - 2) * 3;
+  allnodes = workspace->allnodes;
+
+  if (cutoff_info)
+  {
+    cutoff_info->lh_dec_count = 0;
+    cutoff_info->lh_dec_sum = 0.;
+  }
+
+  pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  /* collect every inner branch once */
+  node_count = algo_query_allnodes(treeinfo->root, allnodes);
+  assert(node_count == allnodes_count);
+
+  edge_count = 0;
+  for (i = 0; i < node_count; ++i)
+  {
+    pll_unode_t * node = allnodes[i];
+    if (!pllmod_utree_is_tip(node->back) &&
+        node->node_index < node->back->node_index)
+      allnodes[edge_count++] = node;
+  }
+
+  best_lh = bisect_edges(treeinfo, allnodes, edge_count, rollback_list,
+                         bestnode_list, cutoff_info, &params,
+                         workspace->right_nodes, workspace->right_dist);
+  if (!best_lh)
+  {
+    /* return and spread error */
+    goto error_exit;
+  }
+
+  best_lh = algo_optimize_bl_all(treeinfo, &params, epsilon, 0.25);
+  if (!best_lh)
+    goto error_exit;
+
+  DBG("Best tree LH after BLO: %f\n", best_lh);
+
+  /* re-evaluate the best moves that were scored on the current topology */
+  toplist_index = algo_bestnode_list_next_index(bestnode_list,
+                                  algo_rollback_list_abspos(rollback_list),
+                                  -1);
+  if (toplist_index != -1)
+  {
+    best_topol = pllmod_treeinfo_get_topology(treeinfo, NULL);
+    if (!best_topol)
+      goto error_exit;
+  }
+
+  while (toplist_index != -1)
+  {
+    node_entry_t * tbr_entry = &bestnode_list->list[toplist_index];
+
+    if (!algo_utree_tbr(treeinfo, &params, tbr_entry->p_node,
+                        tbr_entry->r_node, tbr_entry->r2_node,
+                        thorough ? tbr_entry->b1 : NULL, NULL))
+      goto error_exit;
+
+    loglh = algo_optimize_bl_all(treeinfo, &params, epsilon, 0.25);
+    if (!loglh)
+      goto error_exit;
+
+    DBG("  Topology %d: LH after BLO: %f\n", toplist_index, loglh);
+
+    /* keep the first improving move, the remaining ones refer to the old
+     * topology */
+    if (loglh - best_lh > 0.01)
+    {
+      best_lh = loglh;
+      break;
+    }
+
+    if (!pllmod_treeinfo_set_topology(treeinfo, best_topol))
+      goto error_exit;
+
+    toplist_index = algo_bestnode_list_next_index(bestnode_list,
+                                    algo_rollback_list_abspos(rollback_list),
+                                    toplist_index);
+  }
+
+  /* update LH cutoff */
+  if (cutoff_info && cutoff_info->lh_dec_count)
+  {
+    cutoff_info->lh_cutoff =
+        subtree_cutoff * (cutoff_info->lh_dec_sum / cutoff_info->lh_dec_count);
+  }
+
+  /* update partials and CLVs */
+  loglh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  if (best_topol)
+    pllmod_treeinfo_destroy_topology(best_topol);
+
+  return loglh;
+
+error_exit:
+  if (best_topol)
+    pllmod_treeinfo_destroy_topology(best_topol);
 
   /* make sure libpll error code is set and exit */
   assert(pll_errno);
@@ -0,0 +1,412 @@
+/*
+Copyright (C) 2026 Alexey Kozlov
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+Heidelberg Institute for Theoretical Studies,
+Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+*/
+
+ /**
+  * @file algo_search_driver.c
+  *
+  * @brief Complete tree searches built on top of the SPR rounds
+  *
+  * pllmod_algo_search() runs the usual outer loop of an ML tree search on a
+  * single tree: fast SPR rounds until convergence, followed by thorough
+  * rounds with an increasing radius, with branch length (and optionally
+  * model) optimization after every round.
+  *
+  * A multi-start search runs pllmod_algo_search() from several starting
+  * trees. Starts are claimed one at a time from a shared counter, so the
+  * caller can run pllmod_algo_multistart_run() from as many threads as it
+  * wants and the load is balanced dynamically.
+  *
+  * @author Alexey Kozlov
+  */
+
+#include "pllmod_algorithm.h"
+#include "../pllmod_common.h"
+
+#define SEARCH_SEED_GOLDEN 0x9e3779b97f4a7c15ULL
+
+/* splitmix64, used to derive independent per-start seeds */
+static unsigned long long search_seed_mix(unsigned long long z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* optimizes all branch lengths and, if requested, the model parameters */
+static double search_optimize_params(pllmod_treeinfo_t * treeinfo,
+                                     const pllmod_search_options_t * options)
+{
+  double loglh;
+
+  loglh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+  if (!loglh)
+    return 0;
+
+  /* the branch length optimization returns the negative log-likelihood */
+  loglh = -1 * pllmod_algo_opt_brlen_treeinfo(treeinfo,
+                                              options->bl_min,
+                                              options->bl_max,
+                                              options->lh_epsilon,
+                                              options->smoothings,
+                                              options->brlen_opt_method,
+                                              PLLMOD_OPT_BRLEN_OPTIMIZE_ALL);
+  if (!loglh)
+    return 0;
+
+  if (options->model_cb)
+    loglh = options->model_cb(treeinfo, options->model_data);
+
+  return loglh;
+}
+
+static double search_spr_round(pllmod_treeinfo_t * treeinfo,
+                               pllmod_spr_workspace_t * workspace,
+                               const pllmod_search_options_t * options,
+                               unsigned int radius_min,
+                               unsigned int radius_max,
+                               pll_bool_t thorough,
+                               cutoff_info_t * cutoff_info)
+{
+  double loglh = pllmod_algo_spr_round_workspace(treeinfo,
+                                                 workspace,
+                                                 radius_min,
+                                                 radius_max,
+                                                 options->ntopol_keep,
+                                                 thorough,
+                                                 options->brlen_opt_method,
+                                                 options->bl_min,
+                                                 options->bl_max,
+                                                 options->smoothings,
+                                                 options->lh_epsilon,
+                                                 cutoff_info,
+                                                 options->subtree_cutoff,
+                                                 options->brlen_opt_radius,
+                                                 options->spr_lheps);
+  if (!loglh)
+    return 0;
+
+  return search_optimize_params(treeinfo, options);
+}
+
+/**
+ * Sets the default search options.
+ */
+PLL_EXPORT void pllmod_algo_search_options_init(
+                                            pllmod_search_options_t * options)
+{
+  memset(options, 0, sizeof(pllmod_search_options_t));
+
+  options->radius_min = 5;
+  options->radius_max = 25;
+  options->ntopol_keep = 20;
+  options->brlen_opt_method = PLLMOD_OPT_BLO_NEWTON_FAST;
+  options->bl_min = PLLMOD_OPT_MIN_BRANCH_LEN;
+  options->bl_max = PLLMOD_OPT_MAX_BRANCH_LEN;
+  options->smoothings = 8;
+  options->brlen_opt_radius = 1;
+  options->lh_epsilon = 0.1;
+  options->spr_lheps = 0.1;
+  options->subtree_cutoff = 1.0;
+}
+
+/**
+ * Runs a complete ML tree search on the tree in `treeinfo`.
+ *
+ * Fast SPR rounds with radius `options->radius_min` are repeated until the
+ * log-likelihood improves by less than `options->lh_epsilon`. Then thorough
+ * rounds are run on a window of `options->radius_min` radii, which moves
+ * outwards after every round without improvement and goes back to the
+ * innermost window after every improvement. The search stops when the
+ * window goes beyond `options->radius_max`.
+ *
+ * @param treeinfo the tree information structure
+ * @param options search options, see pllmod_algo_search_options_init()
+ *
+ * @return the log-likelihood of the final tree, or 0 on error
+ */
+PLL_EXPORT double pllmod_algo_search(pllmod_treeinfo_t * treeinfo,
+                                     const pllmod_search_options_t * options)
+{
+  double loglh, old_loglh;
+  unsigned int radius_min, radius_max;
+  cutoff_info_t cutoff_info;
+  cutoff_info_t * cutoff = NULL;
+  pllmod_spr_workspace_t * workspace;
+
+  if (!treeinfo || !options)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Tree info or search options are NULL\n");
+    return 0;
+  }
+
+  if (!options->radius_min || options->radius_max < options->radius_min)
+  {
+    pllmod_set_error(PLLMOD_ERROR_INVALID_RANGE,
+                     "Invalid radius range: %u..%u\n",
+                     options->radius_min, options->radius_max);
+    return 0;
+  }
+
+  workspace = pllmod_algo_spr_workspace_create(treeinfo, options->ntopol_keep);
+  if (!workspace)
+    return 0;
+
+  if (options->tabu_size &&
+      !pllmod_algo_spr_workspace_set_tabu(workspace,
+                                          options->tabu_size,
+                                          options->tabu_max_age))
+  {
+    loglh = 0;
+    goto cleanup;
+  }
+
+  loglh = search_optimize_params(treeinfo, options);
+  if (!loglh)
+    goto cleanup;
+
+  if (options->subtree_cutoff > 0.)
+  {
+    cutoff_info.lh_dec_count = 0;
+    cutoff_info.lh_dec_sum = 0.;
+    cutoff_info.lh_start = loglh;
+    cutoff_info.lh_cutoff = loglh / -1000.0;
+    cutoff = &cutoff_info;
+  }
+
+  /* fast rounds */
+  do
+  {
+    old_loglh = loglh;
+    loglh = search_spr_round(treeinfo, workspace, options,
+                             1, options->radius_min, PLL_FALSE, cutoff);
+    if (!loglh)
+      goto cleanup;
+  }
+  while (loglh - old_loglh > options->lh_epsilon);
+
+  /* thorough rounds */
+  radius_min = 1;
+  radius_max = options->radius_min;
+  while (radius_min <= options->radius_max)
+  {
+    old_loglh = loglh;
+    loglh = search_spr_round(treeinfo, workspace, options,
+                             radius_min,
+                             PLL_MIN(radius_max, options->radius_max),
+                             PLL_TRUE, cutoff);
+    if (!loglh)
+      goto cleanup;
+
+    if (loglh - old_loglh > options->lh_epsilon)
+    {
+      radius_min = 1;
+      radius_max = options->radius_min;
+    }
+    else
+    {
+      radius_min += options->radius_min;
+      radius_max += options->radius_min;
+    }
+  }
+
+cleanup:
+  pllmod_algo_spr_workspace_destroy(workspace);
+
+  return loglh;
+}
+
+/**
+ * Creates a multi-start search.
+ *
+ * Every start gets a seed derived from `seed` and its index, so the result
+ * of each start does not depend on which thread runs it nor on the number
+ * of threads.
+ *
+ * @param start_count number of starting trees
+ * @param seed base random seed
+ * @param options search options, copied into the structure
+ * @param create_cb builds the tree information structure of a start from
+ *                  its index and seed (e.g., a random or parsimony tree over
+ *                  partitions owned by the callback)
+ * @param destroy_cb releases a structure returned by `create_cb`
+ * @param cb_data user data for the callbacks
+ *
+ * @return the new multi-start search, or NULL on error
+ */
+PLL_EXPORT pllmod_multistart_t * pllmod_algo_multistart_create(
+                                  unsigned int start_count,
+                                  unsigned int seed,
+                                  const pllmod_search_options_t * options,
+                                  pllmod_multistart_create_cb create_cb,
+                                  pllmod_multistart_destroy_cb destroy_cb,
+                                  void * cb_data)
+{
+  unsigned int i;
+  pllmod_multistart_t * multistart;
+
+  if (!start_count || !options || !create_cb || !destroy_cb)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid multi-start search parameters\n");
+    return NULL;
+  }
+
+  multistart = (pllmod_multistart_t *) calloc(1, sizeof(pllmod_multistart_t));
+  if (!multistart)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for multi-start search\n");
+    return NULL;
+  }
+
+  multistart->start_count = start_count;
+  multistart->options = *options;
+  multistart->create_cb = create_cb;
+  multistart->destroy_cb = destroy_cb;
+  multistart->cb_data = cb_data;
+  multistart->next_start = 0;
+
+  multistart->seeds = (unsigned int *) calloc(start_count,
+                                              sizeof(unsigned int));
+  multistart->loglh = (double *) calloc(start_count, sizeof(double));
+  multistart->trees = (pll_utree_t **) calloc(start_count,
+                                              sizeof(pll_utree_t *));
+  if (!multistart->seeds || !multistart->loglh || !multistart->trees)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for multi-start search\n");
+    pllmod_algo_multistart_destroy(multistart);
+    return NULL;
+  }
+
+  for (i = 0; i < start_count; ++i)
+    multistart->seeds[i] = (unsigned int) search_seed_mix(
+                  (unsigned long long) seed + (i + 1) * SEARCH_SEED_GOLDEN);
+
+  return multistart;
+}
+
+PLL_EXPORT void pllmod_algo_multistart_destroy(pllmod_multistart_t * multistart)
+{
+  unsigned int i;
+
+  if (!multistart)
+    return;
+
+  if (multistart->trees)
+  {
+    for (i = 0; i < multistart->start_count; ++i)
+      if (multistart->trees[i])
+        pll_utree_destroy(multistart->trees[i], NULL);
+  }
+
+  free(multistart->trees);
+  free(multistart->loglh);
+  free(multistart->seeds);
+  free(multistart);
+}
+
+/* returns the index of the next unprocessed start */
+static unsigned int multistart_claim(pllmod_multistart_t * multistart)
+{
+#if defined(__GNUC__)
+  return __sync_fetch_and_add(&multistart->next_start, 1);
+#else
+  /* without atomic operations, only one worker may run at a time */
+  return multistart->next_start++;
+#endif
+}
+
+/**
+ * Runs starts of a multi-start search until none is left.
+ *
+ * It can be called concurrently from any number of threads: each start is
+ * processed by exactly one of them. A start builds its tree information with
+ * the create callback, runs pllmod_algo_search() on it, keeps a copy of the
+ * resulting tree and releases it with the destroy callback, so at most one
+ * tree information structure per thread is alive at a time. The callbacks
+ * and the model callback of the options must be thread-safe.
+ *
+ * Note that the error state (pll_errno) is global; if several starts fail
+ * concurrently, only one of the errors is kept.
+ *
+ * @return PLL_SUCCESS if all starts run by this call succeeded,
+ *         PLL_FAILURE otherwise
+ */
+PLL_EXPORT int pllmod_algo_multistart_run(pllmod_multistart_t * multistart)
+{
+  unsigned int start;
+  int retval = PLL_SUCCESS;
+
+  while ((start = multistart_claim(multistart)) < multistart->start_count)
+  {
+    pllmod_treeinfo_t * treeinfo;
+    double loglh;
+
+    treeinfo = multistart->create_cb(start,
+                                     multistart->seeds[start],
+                                     multistart->cb_data);
+    if (!treeinfo)
+    {
+      retval = PLL_FAILURE;
+      continue;
+    }
+
+    loglh = pllmod_algo_search(treeinfo, &multistart->options);
+    if (loglh)
+    {
+      multistart->trees[start] = pll_utree_clone(treeinfo->tree);
+      if (multistart->trees[start])
+        multistart->loglh[start] = loglh;
+      else
+        retval = PLL_FAILURE;
+    }
+    else
+      retval = PLL_FAILURE;
+
+    multistart->destroy_cb(treeinfo, multistart->cb_data);
+  }
+
+  return retval;
+}
+
+/**
+ * Returns the index of the start with the highest log-likelihood, or -1 if
+ * no start has finished. Ties are resolved towards the lowest index.
+ */
+PLL_EXPORT int pllmod_algo_multistart_best(
+                                      const pllmod_multistart_t * multistart)
+{
+  unsigned int i;
+  int best = -1;
+
+  for (i = 0; i < multistart->start_count; ++i)
+  {
+    if (!multistart->trees[i])
+      continue;
+
+    if (best < 0 || multistart->loglh[i] > multistart->loglh[best])
+      best = (int) i;
+  }
+
+  return best;
+}
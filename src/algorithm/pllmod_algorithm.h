@@ -46,6 +46,58 @@ typedef struct cutoff_info
   int lh_dec_count;
 } cutoff_info_t;
 
+/* opaque buffers reused across SPR rounds, see algo_search.c */
+typedef struct spr_workspace pllmod_spr_workspace_t;
+
+/* optional model optimization run by the search driver after every round;
+   returns the new log-likelihood, or 0 on error */
+typedef double (*pllmod_search_model_cb)(pllmod_treeinfo_t * treeinfo,
+                                         void * data);
+
+typedef struct search_options
+{
+  unsigned int radius_min;      /* fast rounds radius, thorough radius step */
+  unsigned int radius_max;      /* maximum radius of the thorough rounds */
+  unsigned int ntopol_keep;
+  int brlen_opt_method;
+  double bl_min;
+  double bl_max;
+  int smoothings;
+  int brlen_opt_radius;
+  double lh_epsilon;            /* minimum improvement for another round */
+  double spr_lheps;
+  double subtree_cutoff;        /* 0 disables the likelihood cutoff */
+  unsigned int tabu_size;       /* 0 disables the tabu cache */
+  unsigned int tabu_max_age;
+  pllmod_search_model_cb model_cb;
+  void * model_data;
+} pllmod_search_options_t;
+
+/* builds / releases the tree information of one start of a multi-start
+   search */
+typedef pllmod_treeinfo_t * (*pllmod_multistart_create_cb)(unsigned int start,
+                                                           unsigned int seed,
+                                                           void * data);
+typedef void (*pllmod_multistart_destroy_cb)(pllmod_treeinfo_t * treeinfo,
+                                             void * data);
+
+typedef struct multistart
+{
+  unsigned int start_count;
+  pllmod_search_options_t options;
+  pllmod_multistart_create_cb create_cb;
+  pllmod_multistart_destroy_cb destroy_cb;
+  void * cb_data;
+
+  /* next start to be claimed by a worker */
+  volatile unsigned int next_start;
+
+  /* per-start seeds and results */
+  unsigned int * seeds;
+  double * loglh;
+  pll_utree_t ** trees;
+} pllmod_multistart_t;
+
 typedef int (*treeinfo_param_set_cb)(pllmod_treeinfo_t * treeinfo,
                                      unsigned int  part_num,
                                      const double * param_vals,
@@ -218,4 +270,108 @@ PLL_EXPORT double pllmod_algo_spr_round(pllmod_treeinfo_t * treeinfo,
                                         int brlen_opt_radius,
                                         double spr_lheps);
 
+PLL_EXPORT pllmod_spr_workspace_t * pllmod_algo_spr_workspace_create(
+                                          const pllmod_treeinfo_t * treeinfo,
+                                          unsigned int ntopol_keep);
+
+PLL_EXPORT void pllmod_algo_spr_workspace_destroy(
+                                          pllmod_spr_workspace_t * workspace);
+
+PLL_EXPORT int pllmod_algo_spr_workspace_set_tabu(
+                                          pllmod_spr_workspace_t * workspace,
+                                          unsigned int cache_size,
+                                          unsigned int max_age);
+
+PLL_EXPORT
+double pllmod_algo_spr_round_workspace(pllmod_treeinfo_t * treeinfo,
+                                       pllmod_spr_workspace_t * workspace,
+                                       unsigned int radius_min,
+                                       unsigned int radius_max,
+                                       unsigned int ntopol_keep,
+                                       pll_bool_t thorough,
+                                       int brlen_opt_method,
+                                       double bl_min,
+                                       double bl_max,
+                                       int smoothings,
+                                       double epsilon,
+                                       cutoff_info_t * cutoff_info,
+                                       double subtree_cutoff,
+                                       int brlen_opt_radius,
+                                       double spr_lheps);
+
+PLL_EXPORT double pllmod_algo_nni_round(pllmod_treeinfo_t * treeinfo,
+                                        double bl_min,
+                                        double bl_max,
+                                        int brlen_opt_method,
+                                        int smoothings,
+                                        double lh_epsilon);
+
+PLL_EXPORT
+double pllmod_algo_nni_round_workspace(pllmod_treeinfo_t * treeinfo,
+                                       pllmod_spr_workspace_t * workspace,
+                                       double bl_min,
+                                       double bl_max,
+                                       int brlen_opt_method,
+                                       int smoothings,
+                                       double lh_epsilon);
+
+PLL_EXPORT double pllmod_algo_tbr_round(pllmod_treeinfo_t * treeinfo,
+                                        unsigned int radius_min,
+                                        unsigned int radius_max,
+                                        unsigned int ntopol_keep,
+                                        pll_bool_t thorough,
+                                        int brlen_opt_method,
+                                        double bl_min,
+                                        double bl_max,
+                                        int smoothings,
+                                        double epsilon,
+                                        cutoff_info_t * cutoff_info,
+                                        double subtree_cutoff);
+
+PLL_EXPORT
+double pllmod_algo_tbr_round_workspace(pllmod_treeinfo_t * treeinfo,
+                                       pllmod_spr_workspace_t * workspace,
+                                       unsigned int radius_min,
+                                       unsigned int radius_max,
+                                       unsigned int ntopol_keep,
+                                       pll_bool_t thorough,
+                                       int brlen_opt_method,
+                                       double bl_min,
+                                       double bl_max,
+                                       int smoothings,
+                                       double epsilon,
+                                       cutoff_info_t * cutoff_info,
+                                       double subtree_cutoff);
+
+/* search driver */
+
+PLL_EXPORT void pllmod_algo_search_options_init(
+                                            pllmod_search_options_t * options);
+
+PLL_EXPORT double pllmod_algo_search(pllmod_treeinfo_t * treeinfo,
+                                     const pllmod_search_options_t * options);
+
+PLL_EXPORT pllmod_multistart_t * pllmod_algo_multistart_create(
+                                  unsigned int start_count,
+                                  unsigned int seed,
+                                  const pllmod_search_options_t * options,
+                                  pllmod_multistart_create_cb create_cb,
+                                  pllmod_multistart_destroy_cb destroy_cb,
+                                  void * cb_data);
+
+PLL_EXPORT void pllmod_algo_multistart_destroy(pllmod_multistart_t * multistart);
+
+PLL_EXPORT int pllmod_algo_multistart_run(pllmod_multistart_t * multistart);
+
+PLL_EXPORT int pllmod_algo_multistart_best(
+                                      const pllmod_multistart_t * multistart);
+
+/* rooted search */
+
+PLL_EXPORT double pllmod_algo_rtree_spr_round(pllmod_rtreeinfo_t * rtreeinfo,
+                                              unsigned int radius_min,
+                                              unsigned int radius_max,
+                                              double bl_min,
+                                              double lh_epsilon);
+
 #endif
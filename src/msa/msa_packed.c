@@ -0,0 +1,752 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Heidelberg Institute for Theoretical Studies,
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+ /**
+  * @file msa_packed.c
+  *
+  * @brief Bit-packed nucleotide alignments
+  *
+  * Every site is stored as a 2-bit state index (alignments without
+  * ambiguities) or as a 4-bit state set (ambiguity codes and gaps), packed
+  * into 64-bit words. Filtering and splitting copy runs of consecutive
+  * columns as bit strings, without unpacking the sequences.
+  *
+  * @author Alexey Kozlov
+  */
+
+#include "pll_msa.h"
+
+#include "../pllmod_common.h"
+
+/* number of columns unpacked at once for the statistics */
+#define MSA_PACKED_TILE_SIZE 2048
+
+#define MSA_PACKED_WORD_BITS 64
+
+/* definition missing in PLL master */
+#ifndef PLL_ERROR_MSA_MAP_INVALID
+#define PLL_ERROR_MSA_MAP_INVALID          132
+#endif
+
+/* number of words of a packed sequence. One more word is allocated, such
+   that 64 bits can be read at any position of the sequence */
+static unsigned long packed_words(unsigned long length, unsigned int bits)
+{
+  return (length * bits + MSA_PACKED_WORD_BITS - 1) / MSA_PACKED_WORD_BITS;
+}
+
+static inline unsigned int get_code(const unsigned long long * seq,
+                                    unsigned int bits,
+                                    unsigned long pos)
+{
+  const unsigned long bit_pos = pos * bits;
+  return (unsigned int) (seq[bit_pos / MSA_PACKED_WORD_BITS] >>
+                         (bit_pos % MSA_PACKED_WORD_BITS)) & ((1u << bits) - 1);
+}
+
+/* read 64 bits starting at bit position pos */
+static inline unsigned long long read_bits(const unsigned long long * src,
+                                           unsigned long pos)
+{
+  const unsigned long w = pos / MSA_PACKED_WORD_BITS;
+  const unsigned long off = pos % MSA_PACKED_WORD_BITS;
+
+  return off ? (src[w] >> off) | (src[w+1] << (MSA_PACKED_WORD_BITS - off))
+             : src[w];
+}
+
+/* copy bit_count bits from src (at src_pos) to dst (at dst_pos) */
+static void copy_bits(unsigned long long * dst,
+                      unsigned long dst_pos,
+                      const unsigned long long * src,
+                      unsigned long src_pos,
+                      unsigned long bit_count)
+{
+  while (bit_count)
+  {
+    const unsigned long off = dst_pos % MSA_PACKED_WORD_BITS;
+    const unsigned long n = PLL_MIN(MSA_PACKED_WORD_BITS - off, bit_count);
+    const unsigned long long mask = (n == MSA_PACKED_WORD_BITS) ?
+                                        ~0ull : ((1ull << n) - 1);
+    unsigned long long * w = dst + dst_pos / MSA_PACKED_WORD_BITS;
+
+    *w = (*w & ~(mask << off)) | ((read_bits(src, src_pos) & mask) << off);
+
+    dst_pos += n;
+    src_pos += n;
+    bit_count -= n;
+  }
+}
+
+/* copy the sites listed in cols (in order) to dst, merging runs of
+   consecutive columns into a single bit string copy */
+static void gather_sites(unsigned long long * dst,
+                         const unsigned long long * src,
+                         unsigned int bits,
+                         const unsigned long * cols,
+                         unsigned long col_count)
+{
+  unsigned long j = 0;
+
+  while (j < col_count)
+  {
+    unsigned long run = 1;
+    while (j + run < col_count && cols[j + run] == cols[j] + run)
+      ++run;
+
+    copy_bits(dst, j * bits, src, cols[j] * bits, run * bits);
+    j += run;
+  }
+}
+
+/* unpack the sites [first, first + len) of a sequence */
+static void unpack_sites(const pllmod_msa_packed_t * packed,
+                         const unsigned long long * seq,
+                         unsigned long first,
+                         unsigned long len,
+                         char * out)
+{
+  unsigned long j;
+
+  for (j = 0; j < len; ++j)
+    out[j] = packed->code_char[get_code(seq, packed->bits, first + j)];
+}
+
+static pllmod_msa_packed_t * packed_alloc(unsigned long count,
+                                          unsigned long length,
+                                          unsigned int bits)
+{
+  unsigned long i;
+  const unsigned long words = packed_words(length, bits);
+  pllmod_msa_packed_t * packed =
+      (pllmod_msa_packed_t *) calloc(1, sizeof(pllmod_msa_packed_t));
+
+  if (!packed)
+    goto alloc_error;
+
+  packed->count = (int) count;
+  packed->length = (int) length;
+  packed->bits = bits;
+  packed->words = words;
+  packed->sequence = (unsigned long long **) calloc(count + 1,
+                                                    sizeof(unsigned long long *));
+  packed->label = (char **) calloc(count + 1, sizeof(char *));
+  if (!packed->sequence || !packed->label)
+    goto alloc_error;
+
+  for (i = 0; i < count; ++i)
+  {
+    packed->sequence[i] = (unsigned long long *) calloc(words + 1,
+                                                  sizeof(unsigned long long));
+    if (!packed->sequence[i])
+      goto alloc_error;
+  }
+
+  return packed;
+
+alloc_error:
+  pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                   "Cannot allocate memory for packed MSA");
+  pllmod_msa_packed_destroy(packed);
+  return NULL;
+}
+
+/**
+ * Pack a nucleotide MSA into 2 or 4 bits per site
+ *
+ * Characters are mapped to 4-bit state sets with @p tipmap (e.g.
+ * pll_map_nt). With 2 bits per site, only unambiguous states can be stored.
+ * Characters are restored with the lowest character of the alignment (or of
+ * @p tipmap) that maps to the same state.
+ *
+ * @param msa the alignment
+ * @param tipmap character-to-state mapping with at most 4 states
+ * @param bits bits per site: 2, 4, or 0 to use 2 bits whenever possible
+ *
+ * @return the packed alignment, or NULL on error
+ */
+PLL_EXPORT pllmod_msa_packed_t * pllmod_msa_pack(const pll_msa_t * msa,
+                                                 const pll_state_t * tipmap,
+                                                 unsigned int bits)
+{
+  unsigned long i, j;
+  unsigned char char_seen[PLL_ASCII_SIZE] = {0};
+  unsigned char char_code[PLL_ASCII_SIZE];
+  int ambiguous = 0;
+  pllmod_msa_packed_t * packed;
+
+  if (!msa || !tipmap)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "MSA or tipmap is NULL");
+    return NULL;
+  }
+
+  if (bits != 0 && bits != 2 && bits != 4)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid number of bits per site: %u", bits);
+    return NULL;
+  }
+
+  const unsigned long msa_count = (unsigned long) msa->count;
+  const unsigned long msa_length = (unsigned long) msa->length;
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    const unsigned char * seqchars = (const unsigned char *) msa->sequence[i];
+    for (j = 0; j < msa_length; ++j)
+      char_seen[seqchars[j]] = 1;
+  }
+
+  for (i = 0; i < PLL_ASCII_SIZE; ++i)
+  {
+    if (!char_seen[i])
+      continue;
+
+    if (!tipmap[i])
+    {
+      pllmod_set_error(PLL_ERROR_MSA_MAP_INVALID,
+                       "Invalid character in MSA: %c", (char) i);
+      return NULL;
+    }
+
+    if (tipmap[i] > 0xF)
+    {
+      pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                       "Character %c maps to more than 4 states", (char) i);
+      return NULL;
+    }
+
+    if (PLL_STATE_POPCNT(tipmap[i]) != 1)
+      ambiguous = 1;
+  }
+
+  if (!bits)
+    bits = ambiguous ? 4 : 2;
+  else if (bits == 2 && ambiguous)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Ambiguous characters cannot be packed into 2 bits");
+    return NULL;
+  }
+
+  packed = packed_alloc(msa_count, msa_length, bits);
+  if (!packed)
+    return NULL;
+
+  /* code of every character, and the character restored for every code */
+  for (i = 0; i < PLL_ASCII_SIZE; ++i)
+  {
+    const pll_state_t state = (tipmap[i] <= 0xF) ? tipmap[i] : 0;
+    if (bits == 4)
+      char_code[i] = (unsigned char) state;
+    else
+      char_code[i] = (PLL_STATE_POPCNT(state) == 1) ?
+                         (unsigned char) PLL_STATE_CTZ(state) : 0;
+  }
+
+  /* prefer the characters used in the alignment */
+  for (j = 0; j < 2; ++j)
+  {
+    for (i = 0; i < PLL_ASCII_SIZE; ++i)
+    {
+      const pll_state_t state = tipmap[i];
+      if ((j == 0 && !char_seen[i]) || !state || state > 0xF ||
+          (bits == 2 && PLL_STATE_POPCNT(state) != 1))
+        continue;
+      if (!packed->code_char[char_code[i]])
+        packed->code_char[char_code[i]] = (char) i;
+    }
+  }
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    const unsigned char * seqchars = (const unsigned char *) msa->sequence[i];
+    unsigned long long * seq = packed->sequence[i];
+    const unsigned int sites_per_word = MSA_PACKED_WORD_BITS / bits;
+
+    for (j = 0; j < msa_length; j += sites_per_word)
+    {
+      const unsigned long n = PLL_MIN(sites_per_word, msa_length - j);
+      unsigned long long w = 0;
+      unsigned long k;
+
+      for (k = 0; k < n; ++k)
+        w |= ((unsigned long long) char_code[seqchars[j + k]]) << (k * bits);
+
+      seq[j / sites_per_word] = w;
+    }
+
+    if (msa->label && msa->label[i])
+    {
+      packed->label[i] = strdup(msa->label[i]);
+      if (!packed->label[i])
+      {
+        pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                         "Cannot allocate memory for packed MSA");
+        pllmod_msa_packed_destroy(packed);
+        return NULL;
+      }
+    }
+  }
+
+  return packed;
+}
+
+/**
+ * Convert a packed MSA back into a character MSA
+ *
+ * @return the unpacked alignment, or NULL on error
+ */
+PLL_EXPORT pll_msa_t * pllmod_msa_unpack(const pllmod_msa_packed_t * packed)
+{
+  unsigned long i;
+  pll_msa_t * msa;
+
+  if (!packed)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Packed MSA is NULL");
+    return NULL;
+  }
+
+  const unsigned long count = (unsigned long) packed->count;
+  const unsigned long length = (unsigned long) packed->length;
+
+  msa = (pll_msa_t *) calloc(1, sizeof(pll_msa_t));
+  if (!msa)
+    goto unpack_error;
+
+  msa->count = packed->count;
+  msa->length = packed->length;
+  msa->sequence = (char **) calloc(count + 1, sizeof(char *));
+  msa->label = (char **) calloc(count + 1, sizeof(char *));
+  if (!msa->sequence || !msa->label)
+    goto unpack_error;
+
+  for (i = 0; i < count; ++i)
+  {
+    msa->sequence[i] = (char *) malloc(length + 1);
+    if (!msa->sequence[i])
+      goto unpack_error;
+
+    unpack_sites(packed, packed->sequence[i], 0, length, msa->sequence[i]);
+    msa->sequence[i][length] = '\0';
+
+    if (packed->label[i])
+    {
+      msa->label[i] = strdup(packed->label[i]);
+      if (!msa->label[i])
+        goto unpack_error;
+    }
+  }
+
+  return msa;
+
+unpack_error:
+  pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                   "Cannot allocate memory for unpacked MSA");
+  if (msa)
+  {
+    for (i = 0; i < count; ++i)
+    {
+      if (msa->sequence)
+        free(msa->sequence[i]);
+      if (msa->label)
+        free(msa->label[i]);
+    }
+    free(msa->sequence);
+    free(msa->label);
+    free(msa);
+  }
+  return NULL;
+}
+
+PLL_EXPORT void pllmod_msa_packed_destroy(pllmod_msa_packed_t * packed)
+{
+  int i;
+
+  if (!packed)
+    return;
+
+  for (i = 0; i < packed->count; ++i)
+  {
+    if (packed->sequence)
+      free(packed->sequence[i]);
+    if (packed->label)
+      free(packed->label[i]);
+  }
+  free(packed->sequence);
+  free(packed->label);
+  free(packed);
+}
+
+/**
+ * Filter a packed MSA by removing the specified sequences and/or columns
+ *
+ * @param packed packed alignment
+ * @param remove_seqs 0-based indices of sequences to remove
+ * @param remove_seqs_count size of @param remove_seqs array
+ * @param remove_cols 0-based indices of columns to remove
+ * @param remove_cols_count size of @param remove_cols array
+ *
+ * @return the filtered alignment, or NULL on error
+ */
+PLL_EXPORT pllmod_msa_packed_t * pllmod_msa_packed_filter(
+                                        const pllmod_msa_packed_t * packed,
+                                        const unsigned long * remove_seqs,
+                                        unsigned long remove_seqs_count,
+                                        const unsigned long * remove_cols,
+                                        unsigned long remove_cols_count)
+{
+  unsigned long i, j;
+  unsigned long new_count, new_length;
+  unsigned char * seqflag = NULL;
+  unsigned char * colflag = NULL;
+  unsigned long * keep_cols = NULL;
+  pllmod_msa_packed_t * new_msa = NULL;
+
+  if (!packed)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Packed MSA is NULL");
+    return NULL;
+  }
+
+  if ((remove_seqs_count && !remove_seqs) ||
+      (remove_cols_count && !remove_cols))
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "List of sequences or columns to remove is NULL");
+    return NULL;
+  }
+
+  const unsigned long old_count = (unsigned long) packed->count;
+  const unsigned long old_length = (unsigned long) packed->length;
+
+  seqflag = (unsigned char *) calloc(old_count + 1, sizeof(unsigned char));
+  colflag = (unsigned char *) calloc(old_length + 1, sizeof(unsigned char));
+  keep_cols = (unsigned long *) malloc((old_length + 1) * sizeof(unsigned long));
+  if (!seqflag || !colflag || !keep_cols)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for filtered MSA");
+    goto filter_exit;
+  }
+
+  for (i = 0; i < remove_seqs_count; ++i)
+  {
+    if (remove_seqs[i] >= old_count)
+    {
+      pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                "Invalid sequence number in remove list: %lu", remove_seqs[i]);
+      goto filter_exit;
+    }
+    seqflag[remove_seqs[i]] = 1;
+  }
+
+  for (i = 0; i < remove_cols_count; ++i)
+  {
+    if (remove_cols[i] >= old_length)
+    {
+      pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                "Invalid column number in remove list: %lu", remove_cols[i]);
+      goto filter_exit;
+    }
+    colflag[remove_cols[i]] = 1;
+  }
+
+  new_count = 0;
+  for (i = 0; i < old_count; ++i)
+    new_count += seqflag[i] ? 0 : 1;
+
+  new_length = 0;
+  for (j = 0; j < old_length; ++j)
+    if (!colflag[j])
+      keep_cols[new_length++] = j;
+
+  new_msa = packed_alloc(new_count, new_length, packed->bits);
+  if (!new_msa)
+    goto filter_exit;
+
+  memcpy(new_msa->code_char, packed->code_char, sizeof(packed->code_char));
+
+  for (i = 0, j = 0; i < old_count; ++i)
+  {
+    if (seqflag[i])
+      continue;
+
+    gather_sites(new_msa->sequence[j], packed->sequence[i], packed->bits,
+                 keep_cols, new_length);
+
+    if (packed->label[i])
+    {
+      new_msa->label[j] = strdup(packed->label[i]);
+      if (!new_msa->label[j])
+      {
+        pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                         "Cannot allocate memory for filtered MSA");
+        pllmod_msa_packed_destroy(new_msa);
+        new_msa = NULL;
+        goto filter_exit;
+      }
+    }
+    ++j;
+  }
+
+filter_exit:
+  free(seqflag);
+  free(colflag);
+  free(keep_cols);
+  return new_msa;
+}
+
+/**
+ * Split a packed MSA into several partitions (see pllmod_msa_split)
+ *
+ * @param packed packed alignment
+ * @param site_part array with 1-based partition indices for each column
+ *                  (0 = skip the column)
+ * @param part_count number of partitions
+ *
+ * @return list of packed per-partition alignments, or NULL on error
+ */
+PLL_EXPORT pllmod_msa_packed_t ** pllmod_msa_packed_split(
+                                        const pllmod_msa_packed_t * packed,
+                                        const unsigned int * site_part,
+                                        unsigned int part_count)
+{
+  unsigned long i, j;
+  unsigned int p;
+  unsigned long * part_offset = NULL;
+  unsigned long * part_cols = NULL;
+  pllmod_msa_packed_t ** part_msa_list = NULL;
+
+  if (!packed || !site_part)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Packed MSA or site partitioning is NULL");
+    return NULL;
+  }
+
+  const unsigned long count = (unsigned long) packed->count;
+  const unsigned long length = (unsigned long) packed->length;
+
+  part_offset = (unsigned long *) calloc(part_count + 1, sizeof(unsigned long));
+  part_cols = (unsigned long *) malloc((length + 1) * sizeof(unsigned long));
+  part_msa_list = (pllmod_msa_packed_t **) calloc(part_count,
+                                           sizeof(pllmod_msa_packed_t *));
+  if (!part_offset || !part_cols || !part_msa_list)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for partitioned MSA");
+    goto split_error;
+  }
+
+  /* list the columns of every partition (counting sort by partition) */
+  for (j = 0; j < length; ++j)
+  {
+    if (site_part[j] > part_count)
+    {
+      pllmod_set_error(PLLMOD_ERROR_INVALID_INDEX,
+                       "Partition index out of bounds: %u", site_part[j]-1);
+      goto split_error;
+    }
+    if (site_part[j])
+      part_offset[site_part[j]]++;
+  }
+
+  for (p = 0; p < part_count; ++p)
+    part_offset[p+1] += part_offset[p];
+
+  for (j = 0; j < length; ++j)
+  {
+    if (site_part[j])
+      part_cols[part_offset[site_part[j]-1]++] = j;
+  }
+
+  /* restore offsets */
+  for (p = part_count; p > 0; --p)
+    part_offset[p] = part_offset[p-1];
+  part_offset[0] = 0;
+
+  for (p = 0; p < part_count; ++p)
+  {
+    part_msa_list[p] = packed_alloc(count, part_offset[p+1] - part_offset[p],
+                                    packed->bits);
+    if (!part_msa_list[p])
+      goto split_error;
+
+    memcpy(part_msa_list[p]->code_char, packed->code_char,
+           sizeof(packed->code_char));
+  }
+
+  /* copy every row in one pass */
+  for (i = 0; i < count; ++i)
+  {
+    for (p = 0; p < part_count; ++p)
+    {
+      const unsigned long part_start = part_offset[p];
+      gather_sites(part_msa_list[p]->sequence[i], packed->sequence[i],
+                   packed->bits, part_cols + part_start,
+                   part_offset[p+1] - part_start);
+    }
+  }
+
+  free(part_offset);
+  free(part_cols);
+
+  return part_msa_list;
+
+split_error:
+  if (part_msa_list)
+  {
+    for (p = 0; p < part_count; ++p)
+      pllmod_msa_packed_destroy(part_msa_list[p]);
+    free(part_msa_list);
+  }
+  free(part_offset);
+  free(part_cols);
+  return NULL;
+}
+
+/**
+ * Compute MSA statistics (see pllmod_msa_compute_stats) on a packed MSA.
+ * The sequences are unpacked in tiles of columns, such that the unpacked
+ * alignment is never stored.
+ *
+ * @return the statistics, or NULL on error
+ */
+PLL_EXPORT pllmod_msa_stats_t * pllmod_msa_packed_compute_stats(
+                                        const pllmod_msa_packed_t * packed,
+                                        unsigned int states,
+                                        const pll_state_t * tipmap,
+                                        const unsigned int * weights,
+                                        unsigned long stats_mask)
+{
+  unsigned long i, j;
+  pllmod_msa_stats_stream_t * stream = NULL;
+  pllmod_msa_stats_t * stats = NULL;
+  char * tile_buf = NULL;
+  char ** tile = NULL;
+
+  if (!packed)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Packed MSA is NULL");
+    return NULL;
+  }
+
+  const unsigned long count = (unsigned long) packed->count;
+  const unsigned long length = (unsigned long) packed->length;
+
+  stream = pllmod_msa_stats_stream_create((unsigned int) count, packed->label,
+                                          states, tipmap, stats_mask);
+  if (!stream)
+    return NULL;
+
+  tile_buf = (char *) malloc(count * MSA_PACKED_TILE_SIZE + 1);
+  tile = (char **) malloc((count + 1) * sizeof(char *));
+  if (!tile_buf || !tile)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for MSA statistics");
+    goto stats_exit;
+  }
+
+  for (j = 0; j < length; j += MSA_PACKED_TILE_SIZE)
+  {
+    const unsigned long tile_len = PLL_MIN(MSA_PACKED_TILE_SIZE, length - j);
+
+    for (i = 0; i < count; ++i)
+    {
+      tile[i] = tile_buf + i * tile_len;
+      unpack_sites(packed, packed->sequence[i], j, tile_len, tile[i]);
+    }
+
+    if (!pllmod_msa_stats_stream_update(stream, (const char * const *) tile,
+                                        tile_len, weights ? weights + j : NULL))
+      goto stats_exit;
+  }
+
+  stats = pllmod_msa_stats_stream_finalize(stream);
+
+stats_exit:
+  free(tile_buf);
+  free(tile);
+  pllmod_msa_stats_stream_destroy(stream);
+  return stats;
+}
+
+/**
+ * Save a packed MSA to a PHYLIP file, in the same format as
+ * pllmod_msa_save_phylip
+ *
+ * @return PLL_SUCCESS or PLL_FAILURE
+ */
+PLL_EXPORT int pllmod_msa_packed_save_phylip(const pllmod_msa_packed_t * packed,
+                                             const char * out_fname)
+{
+  unsigned long i;
+  char * line;
+
+  if (!packed)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Packed MSA is NULL");
+    return PLL_FAILURE;
+  }
+
+  if (!out_fname)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "File name (out_fname) is NULL");
+    return PLL_FAILURE;
+  }
+
+  const unsigned long length = (unsigned long) packed->length;
+
+  line = (char *) malloc(length + 1);
+  if (!line)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for output buffer");
+    return PLL_FAILURE;
+  }
+
+  FILE * f = fopen(out_fname, "w");
+
+  if (!f)
+  {
+    pllmod_set_error(PLL_ERROR_FILE_OPEN, "Cannot open file: %s", out_fname);
+    free(line);
+    return PLL_FAILURE;
+  }
+
+  fprintf(f, "%lu %lu\n", (unsigned long) packed->count, length);
+
+  for (i = 0; i < (unsigned long) packed->count; ++i)
+  {
+    unpack_sites(packed, packed->sequence[i], 0, length, line);
+    line[length] = '\0';
+    fprintf(f, "%s    %s\n", packed->label[i], line);
+  }
+
+  fclose(f);
+  free(line);
+
+  return PLL_SUCCESS;
+}
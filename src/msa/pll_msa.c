@@ -28,18 +28,141 @@
   * @author Alexey Kozlov
   */
 
-#include <search.h>
-
 #include "pll_msa.h"
 #include "../util/pllmod_util.h"
 
 #include "../pllmod_common.h"
 
+/* number of columns processed at once by pllmod_msa_compute_stats */
+#define MSA_STATS_TILE_SIZE 2048
+
+/* number of sites whose state histograms are kept at once when computing
+   the empirical substitution rates */
+#define MSA_RATES_BLOCK_SIZE 256
+
+/* statistics computed by the per-site loop, which also checks that every
+   character has a state. Duplicates and substitution rates skip it */
+#define MSA_STATS_SITE_MASK (PLLMOD_MSA_STATS_GAP_PROP | \
+                             PLLMOD_MSA_STATS_GAP_SEQS | \
+                             PLLMOD_MSA_STATS_GAP_COLS | \
+                             PLLMOD_MSA_STATS_INV_PROP | \
+                             PLLMOD_MSA_STATS_INV_COLS | \
+                             PLLMOD_MSA_STATS_FREQS)
+
+/* number of characters scanned between checks by pllmod_msa_check */
+#define MSA_CHECK_CHUNK_SIZE 4096
+
+/* size of the output buffer of the MSA writers */
+#define MSA_WRITE_BUFFER_SIZE (1 << 20)
+
+/* label width in strict PHYLIP files */
+#define MSA_PHYLIP_STRICT_LABEL 10
+
+/* seeds of the two independent sequence hashes */
+#define MSA_HASH_SEED  0x9747b28c1c2dull
+#define MSA_HASH_SEED2 0x2545f4914f6cdd1dull
+
 /* definition missing in PLL master */
 #ifndef PLL_ERROR_MSA_MAP_INVALID
 #define PLL_ERROR_MSA_MAP_INVALID          132
 #endif
 
+/* state of every character, or the raw character if tipmap is NULL */
+static void fill_state_table(const pll_state_t * tipmap,
+                             pll_state_t * state_table)
+{
+  unsigned int c;
+
+  for (c = 0; c < PLL_ASCII_SIZE; ++c)
+    state_table[c] = tipmap ? tipmap[c] : (pll_state_t) c;
+}
+
+/* state of a tip site, given by the non-zero entries of its CLV */
+static pll_state_t clv_site_state(const double * clv, unsigned int states)
+{
+  unsigned int k;
+  pll_state_t state = 0;
+
+  for (k = 0; k < states; ++k)
+    if (clv[k] > 0)
+      state |= ((pll_state_t) 1) << k;
+
+  return state;
+}
+
+/* fully undefined sites do not contribute to the substitution rates */
+static pll_state_t undefined_state(unsigned int states)
+{
+  return (states < sizeof(pll_state_t) * 8) ?
+             (((pll_state_t) 1) << states) - 1 : ~((pll_state_t) 0);
+}
+
+/* add the state histogram of one tip site */
+static inline void add_state_hist(size_t * hist, pll_state_t state)
+{
+  while (state)
+  {
+    hist[PLL_STATE_CTZ(state)]++;
+    state &= state - 1;
+  }
+}
+
+/* Accumulate the products of the state counts of every pair of states, for a
+ * block of sites. Only the observed states of every site are visited */
+static void accumulate_pair_rates(unsigned int states,
+                                  unsigned long block_sites,
+                                  const size_t * hist,
+                                  const unsigned int * w,
+                                  unsigned int * observed,
+                                  size_t * pair_rates)
+{
+  unsigned long n;
+  unsigned int i, j, k;
+
+  for (n = 0; n < block_sites; ++n)
+  {
+    const size_t * site_hist = hist + n * states;
+    const size_t site_weight = w ? w[n] : 1;
+    unsigned int observed_count = 0;
+
+    for (k = 0; k < states; ++k)
+      if (site_hist[k])
+        observed[observed_count++] = k;
+
+    for (i = 0; i < observed_count; ++i)
+    {
+      const size_t freq_i = site_hist[observed[i]] * site_weight;
+      size_t * pair_row = pair_rates + observed[i] * states;
+      for (j = i + 1; j < observed_count; ++j)
+        pair_row[observed[j]] += freq_i * site_hist[observed[j]];
+    }
+  }
+}
+
+/* scale the pair counts into relative rates, the last rate is 1 */
+static void pair_counts_to_rates(unsigned int states,
+                                 const size_t * pair_rates,
+                                 double * subst_rates)
+{
+  unsigned int i, j, k = 0;
+
+  double last_rate = pair_rates[(states - 2) * states + states - 1];
+  if (last_rate < 1e-7)
+    last_rate = 1;
+  for (i = 0; i < states - 1; i++)
+  {
+    for (j = i + 1; j < states; j++)
+    {
+      subst_rates[k++] = pair_rates[i * states + j] / last_rate;
+      if (subst_rates[k - 1] < 0.01)
+        subst_rates[k - 1] = 0.01;
+      if (subst_rates[k - 1] > 50.0)
+        subst_rates[k - 1] = 50.0;
+    }
+  }
+  subst_rates[k - 1] = 1.0;
+}
+
 PLL_EXPORT double * pllmod_msa_empirical_frequencies(pll_partition_t * partition)
 {
   unsigned int i, j, k, n;
@@ -62,40 +185,35 @@ PLL_EXPORT double * pllmod_msa_empirical_frequencies(pll_partition_t * partition
 
   if (partition->attributes & PLL_ATTRIB_PATTERN_TIP)
   {
-    if (states == 4)
+    /* sum up the weights of every character, and spread them over the
+       states of the characters in the end */
+    unsigned long long char_weight[PLL_ASCII_SIZE] = {0};
+    pll_state_t state_table[PLL_ASCII_SIZE];
+
+    /* 4-state tip characters hold the states themselves */
+    fill_state_table(states == 4 ? NULL : tipmap, state_table);
+
+    for (i = 0; i < tips; ++i)
     {
-      for (i = 0; i < tips; ++i)
-            {
-              const unsigned char *tipchars = partition->tipchars[i];
-              for (n = 0; n < sites; ++n)
-              {
-                unsigned int state = (unsigned int) tipchars[n];
-                double sum_site = 1.0 * PLL_POPCNT32(state);
-                for (k = 0; k < states; ++k)
-                {
-                  if (state & 1)
-                    frequencies[k] += w[n] / sum_site;
-                  state >>= 1;
-                }
-              }
-            }
+      const unsigned char *tipchars = partition->tipchars[i];
+      for (n = 0; n < sites; ++n)
+        char_weight[tipchars[n]] += w[n];
     }
-    else
+
+    for (i = 0; i < PLL_ASCII_SIZE; ++i)
     {
-      for (i = 0; i < tips; ++i)
+      pll_state_t state = state_table[i];
+      double sum_site;
+
+      if (!char_weight[i] || !state)
+        continue;
+
+      sum_site = 1.0 * PLL_STATE_POPCNT(state);
+      for (k = 0; k < states; ++k)
       {
-        const unsigned char *tipchars = partition->tipchars[i];
-        for (n = 0; n < sites; ++n)
-        {
-          pll_state_t state = tipmap[(int) tipchars[n]];
-          double sum_site = 1.0 * PLL_STATE_POPCNT(state);
-          for (k = 0; k < states; ++k)
-          {
-            if (state & 1)
-              frequencies[k] += w[n] / sum_site;
-            state >>= 1;
-          }
-        }
+        if (state & 1)
+          frequencies[k] += char_weight[i] / sum_site;
+        state >>= 1;
       }
     }
   }
@@ -144,52 +262,91 @@ PLL_EXPORT double * pllmod_msa_empirical_frequencies(pll_partition_t * partition
   return frequencies;
 }
 
-void compute_pair_rates(unsigned int states, unsigned int tips,
-                        unsigned long sites, unsigned char ** tipchars,
-                        const unsigned int * w, const pll_state_t * tipmap,
-                        size_t * state_freq, size_t * pair_rates)
+/* Accumulate the pair counts of the sites in tipchars, one block of
+ * MSA_RATES_BLOCK_SIZE sites at a time. state_freq must hold
+ * MSA_RATES_BLOCK_SIZE * states entries */
+static void compute_pair_rates(unsigned int states, unsigned int tips,
+                               unsigned long sites, unsigned char ** tipchars,
+                               const unsigned int * w,
+                               const pll_state_t * tipmap,
+                               size_t * state_freq, size_t * pair_rates)
 {
-  unsigned int i, j, k;
-  unsigned long n;
-  pll_state_t undef_state = (pll_state_t) (pow (2, states)) - 1;
+  unsigned int i;
+  unsigned long n, b;
+  const pll_state_t undef_state = undefined_state(states);
+  pll_state_t state_table[PLL_ASCII_SIZE];
+  unsigned int observed[sizeof(pll_state_t) * 8];
 
-  for (n = 0; n < sites; ++n)
+  fill_state_table(tipmap, state_table);
+
+  for (b = 0; b < sites; b += MSA_RATES_BLOCK_SIZE)
   {
-    memset (state_freq, 0, sizeof(unsigned) * (states));
+    const unsigned long block_sites = PLL_MIN(MSA_RATES_BLOCK_SIZE, sites - b);
+
+    memset(state_freq, 0, sizeof(size_t) * states * block_sites);
     for (i = 0; i < tips; ++i)
     {
-      const unsigned int c = (unsigned int) tipchars[i][n];
-      pll_state_t state =  tipmap ? tipmap[c] : c;
-      if (state == undef_state)
-        continue;
-      for (k = 0; k < states; ++k)
+      const unsigned char * block_chars = tipchars[i] + b;
+      for (n = 0; n < block_sites; ++n)
       {
-        if (state & 1)
-          state_freq[k]++;
-        state >>= 1;
+        const pll_state_t state = state_table[block_chars[n]];
+        if (state != undef_state)
+          add_state_hist(state_freq + n * states, state);
       }
     }
 
-    for (i = 0; i < states; i++)
+    accumulate_pair_rates(states, block_sites, state_freq, w ? w + b : NULL,
+                          observed, pair_rates);
+  }
+}
+
+/* same as compute_pair_rates, reading the tip states from the CLVs */
+static void compute_pair_rates_clv(const pll_partition_t * partition,
+                                   size_t * state_freq,
+                                   size_t * pair_rates)
+{
+  unsigned int i;
+  unsigned long n, b;
+  const unsigned int states = partition->states;
+  const unsigned int sites = partition->sites;
+  const unsigned int tips = partition->tips;
+  const unsigned int span = partition->states_padded * partition->rate_cats;
+  const pll_state_t undef_state = undefined_state(states);
+  unsigned int observed[sizeof(pll_state_t) * 8];
+
+  for (b = 0; b < sites; b += MSA_RATES_BLOCK_SIZE)
+  {
+    const unsigned long block_sites = PLL_MIN(MSA_RATES_BLOCK_SIZE, sites - b);
+
+    memset(state_freq, 0, sizeof(size_t) * states * block_sites);
+    for (i = 0; i < tips; ++i)
     {
-      if (state_freq[i] == 0)
-        continue;
-      for (j = i + 1; j < states; j++)
+      const unsigned int * site_to_id = NULL;
+      if ((partition->attributes & PLL_ATTRIB_SITE_REPEATS)
+        && partition->repeats->pernode_ids[i]) {
+        site_to_id = partition->repeats->pernode_site_id[i];
+      }
+
+      for (n = 0; n < block_sites; ++n)
       {
-        pair_rates[i * states + j] += state_freq[i] * state_freq[j] * w[n];
+        const unsigned long j = site_to_id ? site_to_id[b + n] : b + n;
+        const pll_state_t state = clv_site_state(partition->clv[i] + j * span,
+                                                 states);
+        if (state != undef_state)
+          add_state_hist(state_freq + n * states, state);
       }
     }
+
+    accumulate_pair_rates(states, block_sites, state_freq,
+                          partition->pattern_weights + b, observed, pair_rates);
   }
 }
 
 PLL_EXPORT double * pllmod_msa_empirical_subst_rates(pll_partition_t * partition)
 {
-  unsigned int i, j, k, n;
   unsigned int states              = partition->states;
-  unsigned int states_padded       = partition->states_padded;
   unsigned int sites               = partition->sites;
   unsigned int tips                = partition->tips;
-  unsigned int rate_cats           = partition->rate_cats;
   const pll_state_t * tipmap       = partition->tipmap;
   const unsigned int * w           = partition->pattern_weights;
   unsigned char ** tipchars        = partition->tipchars;
@@ -198,7 +355,8 @@ PLL_EXPORT double * pllmod_msa_empirical_subst_rates(pll_partition_t * partition
   double * subst_rates = (double *) calloc ((size_t) n_subst_rates, sizeof(double));
 
   size_t * pair_rates = (size_t *) calloc(states * states, sizeof(size_t));
-  size_t * state_freq = (size_t *) malloc(states * sizeof(size_t));
+  size_t * state_freq = (size_t *) malloc(MSA_RATES_BLOCK_SIZE * states *
+                                          sizeof(size_t));
 
   if (!(subst_rates && pair_rates && state_freq))
   {
@@ -220,61 +378,10 @@ PLL_EXPORT double * pllmod_msa_empirical_subst_rates(pll_partition_t * partition
   }
   else
   {
-    unsigned int cur_site = 0;
-    for (n = 0; n < sites * states_padded * rate_cats;
-                                              n += (states_padded * rate_cats))
-    {
-      memset (state_freq, 0, sizeof(unsigned) * (states));
-      for (i = 0; i < tips; ++i)
-      {
-        int unstate = 1;
-        for (k = 0; k < states; ++k)
-          if (partition->clv[i][n + k] < 1e-7)
-          {
-            unstate = 0;
-            break;
-          }
-        if (unstate)
-          continue;
-        for (k = 0; k < states; ++k)
-        {
-          if (partition->clv[i][n + k] > 0)
-          {
-            state_freq[k]++;
-          }
-        }
-      }
-
-      for (i = 0; i < states; i++)
-      {
-        if (state_freq[i] == 0)
-          continue;
-        for (j = i + 1; j < states; j++)
-        {
-          pair_rates[i * states + j] += state_freq[i] * state_freq[j]
-              * w[cur_site];
-        }
-      }
-      cur_site++;
-    }
+    compute_pair_rates_clv(partition, state_freq, pair_rates);
   }
 
-  k = 0;
-  double last_rate = pair_rates[(states - 2) * states + states - 1];
-  if (last_rate < 1e-7)
-    last_rate = 1;
-  for (i = 0; i < states - 1; i++)
-  {
-    for (j = i + 1; j < states; j++)
-    {
-      subst_rates[k++] = pair_rates[i * states + j] / last_rate;
-      if (subst_rates[k - 1] < 0.01)
-        subst_rates[k - 1] = 0.01;
-      if (subst_rates[k - 1] > 50.0)
-        subst_rates[k - 1] = 50.0;
-    }
-  }
-  subst_rates[k - 1] = 1.0;
+  pair_counts_to_rates(states, pair_rates, subst_rates);
 
   free (state_freq);
   free (pair_rates);
@@ -310,184 +417,760 @@ PLL_EXPORT double pllmod_msa_empirical_invariant_sites(pll_partition_t *partitio
   return empirical_pinv;
 }
 
-/* Find duplicates using hash table from search.h. This works best for short
- * strings, so we use this method for checking taxa names */
-static int find_duplicate_strings_htable(char ** const strings,
-                                         unsigned long string_count,
-                                         unsigned long ** duplicates,
-                                         unsigned long * duplicate_count)
+/* 64-bit hash of a string (MurmurHash64A), reading 8 characters at a time.
+ * Long strings can be hashed in chunks by passing the hash of the previous
+ * chunk as seed */
+static unsigned long long string_hash64(const char * s,
+                                        unsigned long len,
+                                        unsigned long long seed)
 {
-  if (!strings)
-    return PLL_FAILURE;
+  const unsigned long long m = 0xc6a4a7935bd1e995ull;
+  const int r = 47;
+  unsigned long long h = seed ^ (len * m);
+  unsigned long long k;
+  unsigned long i;
+
+  for (i = 0; i + 8 <= len; i += 8)
+  {
+    memcpy(&k, s + i, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  if (i < len)
+  {
+    k = 0;
+    memcpy(&k, s + i, len - i);
+    h ^= k;
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+
+  return h;
+}
+
+/* Group identical items using their 64-bit hashes and an open addressing hash
+ * table, such that items are only compared (is_equal) against items with the
+ * same hash. Duplicates are returned as pairs (first occurrence, duplicate)
+ * and as groups of identical items, both sorted by first occurrence */
+static int find_duplicate_hashes(const unsigned long long * hash,
+                                 unsigned long count,
+                                 int (*is_equal)(unsigned long,
+                                                 unsigned long,
+                                                 const void *),
+                                 const void * data,
+                                 unsigned long ** duplicates,
+                                 unsigned long * duplicate_count,
+                                 unsigned long ** groups,
+                                 unsigned long ** group_offset,
+                                 unsigned long * group_count)
+{
+  unsigned long i, j, g;
+  unsigned long table_size = 1;
+  unsigned long * table = NULL;    /* first occurrence of every item */
+  unsigned long * first = NULL;    /* first occurrence of every item */
+  unsigned long * next = NULL;     /* next occurrence of every item */
+  unsigned long * last = NULL;     /* last occurrence so far, by first one */
 
-  unsigned long * data = (unsigned long *)malloc(string_count *
-                                                sizeof(unsigned long));
+  *duplicate_count = 0;
+  *group_count = 0;
+  *duplicates = NULL;
+  *groups = NULL;
+  *group_offset = NULL;
+
+  /* keep the table load factor below 0.5 */
+  while (table_size < 2 * count)
+    table_size <<= 1;
 
-  unsigned long * tmpdup = (unsigned long *)malloc(string_count * 2 *
-                                                sizeof(unsigned long));
+  first = (unsigned long *) malloc((count + 1) * sizeof(unsigned long));
+  next  = (unsigned long *) malloc((count + 1) * sizeof(unsigned long));
+  last  = (unsigned long *) malloc((count + 1) * sizeof(unsigned long));
+  table = (unsigned long *) malloc(table_size * sizeof(unsigned long));
 
-  if (!data || !tmpdup)
+  if (!first || !next || !last || !table)
   {
-    if (data)
-      free(data);
-    if (tmpdup)
-      free(tmpdup);
     pllmod_set_error(PLL_ERROR_MEM_ALLOC,
                      "Cannot allocate memory for duplicates array");
-    return PLL_FAILURE;
+    goto dup_error;
   }
 
-  hcreate(string_count);
+  for (i = 0; i < table_size; ++i)
+    table[i] = count;
 
-  unsigned long i;
-  for (i = 0; i < string_count; ++i)
+  for (i = 0; i < count; ++i)
   {
-    data[i] = i;
-    ENTRY entry;
+    unsigned long slot = (unsigned long) hash[i] & (table_size - 1);
 
-#ifdef __APPLE__
-    entry.key = strdup(strings[i]);
-#else
-    entry.key = (char *) strings[i];
-#endif
+    first[i] = i;
+    next[i]  = count;
 
-    entry.data = (void *)(data+i);
-    ENTRY *found = hsearch(entry, ENTER);
-    if (found->data != entry.data)
+    /* linear probing */
+    while (table[slot] != count)
     {
-      const unsigned long idx1 = *((unsigned long *) found->data);
-      const unsigned long idx2 = *((unsigned long *) entry.data);
+      j = table[slot];
+      if (hash[j] == hash[i] && is_equal(j, i, data))
+      {
+        first[i] = j;
+        break;
+      }
+      slot = (slot + 1) & (table_size - 1);
+    }
 
-      /* duplicate found, save it */
-      tmpdup[(*duplicate_count)*2] = idx1;
-      tmpdup[(*duplicate_count)*2+1] = idx2;
+    if (first[i] == i)
+    {
+      table[slot] = i;
+      last[i] = i;
+    }
+    else
+    {
+      j = first[i];
+      if (last[j] == j)
+        (*group_count)++;
+      next[last[j]] = i;
+      last[j] = i;
       (*duplicate_count)++;
     }
   }
 
-  hdestroy();
-  free(data);
+  free(table);
+  free(last);
+  table = last = NULL;
 
   if (*duplicate_count > 0)
   {
-    *duplicates = (unsigned long *) realloc(tmpdup, (*duplicate_count) * 2 *
-                                                  sizeof(unsigned long));
-  }
-  else
-  {
-    free(tmpdup);
-    *duplicates = NULL;
+    unsigned long d = 0, k = 0;
+
+    *duplicates = (unsigned long *) malloc((*duplicate_count) * 2 *
+                                           sizeof(unsigned long));
+    *groups = (unsigned long *) malloc((*duplicate_count + *group_count) *
+                                       sizeof(unsigned long));
+    *group_offset = (unsigned long *) malloc((*group_count + 1) *
+                                             sizeof(unsigned long));
+
+    if (!(*duplicates) || !(*groups) || !(*group_offset))
+    {
+      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                       "Cannot allocate memory for duplicates array");
+      goto dup_error;
+    }
+
+    for (i = 0, g = 0; i < count; ++i)
+    {
+      if (first[i] != i || next[i] == count)
+        continue;
+
+      (*group_offset)[g++] = k;
+      (*groups)[k++] = i;
+      for (j = next[i]; j != count; j = next[j])
+      {
+        (*groups)[k++] = j;
+        (*duplicates)[d++] = i;
+        (*duplicates)[d++] = j;
+      }
+    }
+    (*group_offset)[g] = k;
+
+    assert(g == *group_count);
+    assert(d == 2 * (*duplicate_count));
   }
 
+  free(first);
+  free(next);
+
   return PLL_SUCCESS;
+
+dup_error:
+  free(table);
+  free(first);
+  free(next);
+  free(last);
+  free(*duplicates);
+  free(*groups);
+  free(*group_offset);
+  *duplicates = *groups = *group_offset = NULL;
+  *duplicate_count = *group_count = 0;
+  return PLL_FAILURE;
 }
 
-/* Find duplicates using custom hash function optimized for long low-variance
- * strings - this method is used for detecting identical sequences */
+struct string_set
+{
+  char ** strings;
+  unsigned long * len;
+};
+
+static int strings_equal(unsigned long i, unsigned long j, const void * data)
+{
+  const struct string_set * set = (const struct string_set *) data;
+
+  return set->len[i] == set->len[j] &&
+         !memcmp(set->strings[i], set->strings[j], set->len[i]);
+}
+
+/* Find duplicate strings. Every string is hashed once and only compared
+ * (memcmp) against strings with the same hash. This method is used for
+ * detecting identical sequences */
 static int find_duplicate_strings(char ** const strings,
                                   unsigned long string_count,
                                   unsigned long string_len,
                                   unsigned long ** duplicates,
-                                  unsigned long * duplicate_count)
+                                  unsigned long * duplicate_count,
+                                  unsigned long ** groups,
+                                  unsigned long ** group_offset,
+                                  unsigned long * group_count)
 {
+  unsigned long i;
+  unsigned long long * hash;
+  struct string_set set;
+  int retval;
+
   if (!strings)
     return PLL_FAILURE;
 
-  unsigned long * tmpdup = (unsigned long *)malloc(string_count * 2 *
-                                                sizeof(unsigned long));
+  hash    = (unsigned long long *) malloc((string_count + 1) *
+                                          sizeof(unsigned long long));
+  set.len = (unsigned long *) malloc((string_count + 1) *
+                                     sizeof(unsigned long));
+  set.strings = strings;
 
-  unsigned long * hash = (unsigned long *)calloc(string_count,
-                                                 sizeof(unsigned long));
-
-  unsigned char * dupflag = (unsigned char *)calloc(string_count,
-                                                 sizeof(unsigned char));
-
-  if (!hash || !tmpdup || !dupflag)
+  if (!hash || !set.len)
   {
-    if (hash)
-      free(hash);
-    if (tmpdup)
-      free(tmpdup);
-    if (dupflag)
-      free(dupflag);
+    free(hash);
+    free(set.len);
     pllmod_set_error(PLL_ERROR_MEM_ALLOC,
                      "Cannot allocate memory for duplicates array");
     return PLL_FAILURE;
   }
 
-  *duplicate_count = 0;
-
-  unsigned long i;
-  unsigned long j;
-
   for (i = 0; i < string_count; ++i)
   {
-    for (j = 0; j < (string_len ? string_len : strlen(strings[i])); ++j)
-      hash[i] = hash[i] + (j+1) * (unsigned long) strings[i][j];
+    set.len[i] = string_len ? string_len : strlen(strings[i]);
+    hash[i]    = string_hash64(strings[i], set.len[i], MSA_HASH_SEED);
   }
 
-  int coll = 0;
+  retval = find_duplicate_hashes(hash, string_count, strings_equal, &set,
+                                 duplicates, duplicate_count,
+                                 groups, group_offset, group_count);
 
-  for (i = 0; i < string_count; ++i)
+  free(hash);
+  free(set.len);
+
+  return retval;
+}
+
+static int cmp_duplicate_pair(const void * a, const void * b)
+{
+  const unsigned long * p1 = (const unsigned long *) a;
+  const unsigned long * p2 = (const unsigned long *) b;
+
+  return (p1[1] > p2[1]) - (p1[1] < p2[1]);
+}
+
+/* Find duplicate taxa names. Names are compared as whole strings with the
+ * same reentrant hash table as sequences (no global hsearch table), and
+ * pairs (first occurrence, duplicate) are sorted by duplicate */
+static int find_duplicate_labels(char ** const labels,
+                                 unsigned long label_count,
+                                 unsigned long ** duplicates,
+                                 unsigned long * duplicate_count)
+{
+  unsigned long * groups, * group_offset;
+  unsigned long group_count;
+
+  if (!find_duplicate_strings(labels, label_count, 0,
+                              duplicates, duplicate_count,
+                              &groups, &group_offset, &group_count))
+    return PLL_FAILURE;
+
+  free(groups);
+  free(group_offset);
+
+  if (*duplicate_count > 0)
+    qsort(*duplicates, *duplicate_count, 2 * sizeof(unsigned long),
+          cmp_duplicate_pair);
+
+  return PLL_SUCCESS;
+}
+
+/* Set the error for the first character without state in the alignment */
+static void report_invalid_state(const pll_msa_t * msa,
+                                 const pll_state_t * tipmap)
+{
+  int i, j;
+
+  for (i = 0; i < msa->count; ++i)
   {
-    if (dupflag[i])
-      continue;
-    for (j = i+1; j < string_count; ++j)
+    const char *seqchars = msa->sequence[i];
+    for (j = 0; j < msa->length; ++j)
     {
-      if (hash[i] == hash[j])
+      if (tipmap[(unsigned char) seqchars[j]])
+        continue;
+
+      if (seqchars[j] == -1)
       {
-        coll++;
-        if (strcmp(strings[i], strings[j]) == 0)
-        {
-          /* duplicate found, save it */
-          tmpdup[(*duplicate_count)*2] = i;
-          tmpdup[(*duplicate_count)*2+1] = j;
-          (*duplicate_count)++;
-          dupflag[j] = 1;
-        }
+        /* most likely sequence was already encoded and the original character
+           is unknown at this point */
+        pllmod_set_error(PLL_ERROR_MSA_MAP_INVALID,
+                         "Unknown state in sequence %d", i+1);
+      }
+      else
+      {
+        pllmod_set_error(PLL_ERROR_MSA_MAP_INVALID,
+                         "Unknown state %c at sequence %d position %d",
+                         seqchars[j],
+                         i+1,
+                         j+1);
       }
+      return;
     }
   }
+}
 
-//  printf("Collisions: %d, duplicates: %lu\n", coll, *duplicate_count);
-
-  free(hash);
-  free(dupflag);
+/* Set the error for the first character without state in a tile of a block */
+static void report_invalid_block_state(const pllmod_msa_stats_stream_t * stream,
+                                       const char * const * block,
+                                       unsigned long tile_start,
+                                       unsigned long tile_len)
+{
+  unsigned long i, j;
 
-  if (*duplicate_count > 0)
+  for (i = 0; i < stream->count; ++i)
   {
-    *duplicates = (unsigned long *) realloc(tmpdup, (*duplicate_count) * 2 *
-                                                  sizeof(unsigned long));
-
-    if (!(*duplicates))
+    const char *seqchars = block[i];
+    for (j = tile_start; j < tile_start + tile_len; ++j)
     {
-      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                       "Cannot allocate memory for duplicates array");
-      return PLL_FAILURE;
+      if (stream->tipmap[(unsigned char) seqchars[j]])
+        continue;
+
+      if (seqchars[j] == -1)
+      {
+        pllmod_set_error(PLL_ERROR_MSA_MAP_INVALID,
+                         "Unknown state in sequence %lu", i+1);
+      }
+      else
+      {
+        pllmod_set_error(PLL_ERROR_MSA_MAP_INVALID,
+                         "Unknown state %c at sequence %lu position %lu",
+                         seqchars[j],
+                         i+1,
+                         stream->length + j + 1);
+      }
+      return;
     }
   }
-  else
-  {
-    free(tmpdup);
-    *duplicates = NULL;
-  }
+}
 
-  return PLL_SUCCESS;
+static int hashes_equal(unsigned long i, unsigned long j, const void * data)
+{
+  const unsigned long long * hash = (const unsigned long long *) data;
+
+  return hash[i] == hash[j];
 }
 
-PLL_EXPORT pllmod_msa_errors_t * pllmod_msa_check(const pll_msa_t * msa,
-                                                  const pll_state_t * tipmap)
+/* make room for at least `size` elements in a list of indices */
+static int msa_grow_list(unsigned long ** list,
+                         unsigned long * capacity,
+                         unsigned long size)
 {
-  unsigned long i, j;
+  unsigned long new_capacity = *capacity ? *capacity : 1024;
+  unsigned long * new_list;
 
-  if (!msa)
+  if (size <= *capacity)
+    return PLL_SUCCESS;
+
+  while (new_capacity < size)
+    new_capacity *= 2;
+
+  new_list = (unsigned long *) realloc(*list,
+                                       new_capacity * sizeof(unsigned long));
+  if (!new_list)
   {
-    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
-              "MSA structure is NULL");
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for MSA statistics");
     return PLL_FAILURE;
   }
 
-  if (!tipmap)
+  *list = new_list;
+  *capacity = new_capacity;
+
+  return PLL_SUCCESS;
+}
+
+/* trim a list of indices to its size, or free it if empty */
+static void msa_trim_list(unsigned long ** list, unsigned long size)
+{
+  if (!size)
+  {
+    free(*list);
+    *list = NULL;
+  }
+  else
+  {
+    unsigned long * new_list = (unsigned long *) realloc(*list,
+                                            size * sizeof(unsigned long));
+    if (new_list)
+      *list = new_list;
+  }
+}
+
+static int columns_hash_equal(unsigned long i,
+                              unsigned long j,
+                              const void * data)
+{
+  (void) i;
+  (void) j;
+  (void) data;
+
+  /* equal hashes are confirmed afterwards in a single pass over the rows */
+  return 1;
+}
+
+struct column_set
+{
+  const pll_msa_t * msa;
+  const unsigned long * cols;
+  const unsigned int * site_part;
+};
+
+static int columns_equal(unsigned long i, unsigned long j, const void * data)
+{
+  const struct column_set * set = (const struct column_set *) data;
+  const unsigned long c1 = set->cols[i];
+  const unsigned long c2 = set->cols[j];
+  int k;
+
+  /* columns of different partitions never form a pattern */
+  if (set->site_part && set->site_part[c1] != set->site_part[c2])
+    return 0;
+
+  for (k = 0; k < set->msa->count; ++k)
+    if (set->msa->sequence[k][c1] != set->msa->sequence[k][c2])
+      return 0;
+
+  return 1;
+}
+
+/* free a MSA, even if it was only partially allocated */
+static void msa_destroy_partial(pll_msa_t * msa)
+{
+  int i;
+
+  if (!msa)
+    return;
+
+  for (i = 0; i < msa->count; ++i)
+  {
+    if (msa->sequence)
+      free(msa->sequence[i]);
+    if (msa->label)
+      free(msa->label[i]);
+  }
+  free(msa->sequence);
+  free(msa->label);
+  free(msa);
+}
+
+/* Find the distinct columns of every partition and build one MSA with the
+ * distinct columns of every partition. Columns are hashed in tiles, such that
+ * rows are read sequentially, and columns with the same hash are confirmed in
+ * a second pass over the rows. Returns the pattern weights of every
+ * partition */
+static unsigned int ** msa_compress_columns(const pll_msa_t * msa,
+                                            const unsigned int * site_part,
+                                            unsigned int part_count,
+                                            const unsigned int * weights,
+                                            unsigned int * site_pattern,
+                                            pll_msa_t *** part_msa_list)
+{
+  const unsigned long msa_count = (unsigned long) msa->count;
+  const unsigned long msa_length = (unsigned long) msa->length;
+  unsigned long i, j, k, g;
+  unsigned long col_count = 0;
+  unsigned long * cols = NULL;         /* included columns */
+  unsigned long * rep = NULL;          /* first identical column, by index */
+  unsigned long * pattern = NULL;      /* pattern of every included column */
+  unsigned long * part_patterns = NULL;
+  unsigned long * pattern_cols = NULL; /* original column of every pattern */
+  unsigned long long * hash = NULL;
+  unsigned long * duplicates = NULL, * groups = NULL, * group_offset = NULL;
+  unsigned long duplicate_count, group_count;
+  unsigned int ** pattern_weights = NULL;
+  pll_msa_t ** msa_list = NULL;
+  int exact = 0;
+
+  *part_msa_list = NULL;
+
+  cols = (unsigned long *) malloc((msa_length + 1) * sizeof(unsigned long));
+  rep = (unsigned long *) malloc((msa_length + 1) * sizeof(unsigned long));
+  pattern = (unsigned long *) malloc((msa_length + 1) * sizeof(unsigned long));
+  hash = (unsigned long long *) malloc((msa_length + 1) *
+                                       sizeof(unsigned long long));
+  part_patterns = (unsigned long *) calloc(part_count + 1,
+                                           sizeof(unsigned long));
+  pattern_weights = (unsigned int **) calloc(part_count,
+                                             sizeof(unsigned int *));
+  msa_list = (pll_msa_t **) calloc(part_count, sizeof(pll_msa_t *));
+  if (!cols || !rep || !pattern || !hash || !part_patterns ||
+      !pattern_weights || !msa_list)
+    goto malloc_error;
+
+  for (j = 0; j < msa_length; ++j)
+  {
+    if (site_part && site_part[j] > part_count)
+    {
+      pllmod_set_error(PLLMOD_ERROR_INVALID_INDEX,
+                       "Partition index out of bounds: %u", site_part[j]-1);
+      goto error_exit;
+    }
+    if (!site_part || site_part[j])
+      cols[col_count++] = j;
+  }
+
+  /* hash the columns, seeded with their partition index */
+  for (j = 0; j < col_count; ++j)
+    hash[j] = 0xcbf29ce484222325ull ^ (site_part ? site_part[cols[j]] : 1);
+
+  for (k = 0; k < col_count; k += MSA_STATS_TILE_SIZE)
+  {
+    const unsigned long tile_len = PLL_MIN(MSA_STATS_TILE_SIZE, col_count - k);
+    unsigned long long * tile_hash = hash + k;
+    const unsigned long * tile_cols = cols + k;
+
+    for (i = 0; i < msa_count; ++i)
+    {
+      const unsigned char * seqchars = (const unsigned char *) msa->sequence[i];
+      for (j = 0; j < tile_len; ++j)
+        tile_hash[j] = (tile_hash[j] ^ seqchars[tile_cols[j]]) *
+                       0x100000001b3ull;
+    }
+
+    for (j = 0; j < tile_len; ++j)
+    {
+      tile_hash[j] ^= tile_hash[j] >> 33;
+      tile_hash[j] *= 0xff51afd7ed558ccdull;
+      tile_hash[j] ^= tile_hash[j] >> 33;
+    }
+  }
+
+  while (1)
+  {
+    struct column_set set;
+    set.msa  = msa;
+    set.cols = cols;
+    set.site_part = site_part;
+
+    if (!find_duplicate_hashes(hash, col_count,
+                               exact ? columns_equal : columns_hash_equal,
+                               &set,
+                               &duplicates, &duplicate_count,
+                               &groups, &group_offset, &group_count))
+      goto error_exit;
+
+    for (j = 0; j < col_count; ++j)
+      rep[j] = j;
+    for (g = 0; g < group_count; ++g)
+      for (k = group_offset[g] + 1; k < group_offset[g+1]; ++k)
+        rep[groups[k]] = groups[group_offset[g]];
+
+    free(duplicates);
+    free(groups);
+    free(group_offset);
+
+    if (exact)
+      break;
+
+    /* confirm the hash matches. Partition indices were part of the hash, so
+       they must be checked as well */
+    int collision = 0;
+    for (j = 0; j < col_count; ++j)
+      if (site_part && site_part[cols[rep[j]]] != site_part[cols[j]])
+        collision = 1;
+
+    for (i = 0; i < msa_count && !collision; ++i)
+    {
+      const char * seqchars = msa->sequence[i];
+      for (j = 0; j < col_count; ++j)
+        collision |= (seqchars[cols[rep[j]]] != seqchars[cols[j]]);
+    }
+
+    if (!collision)
+      break;
+
+    /* very unlikely, compare the columns with equal hashes */
+    exact = 1;
+  }
+
+  /* number the patterns of every partition in order of first occurrence */
+  for (j = 0; j < col_count; ++j)
+  {
+    const unsigned int p = site_part ? site_part[cols[j]] - 1 : 0;
+    if (rep[j] == j)
+      pattern[j] = part_patterns[p]++;
+    else
+      pattern[j] = pattern[rep[j]];
+  }
+
+  if (site_pattern)
+  {
+    for (j = 0; j < col_count; ++j)
+      site_pattern[cols[j]] = (unsigned int) pattern[j];
+  }
+
+  /* original column of every pattern, grouped by partition */
+  pattern_cols = (unsigned long *) malloc((col_count + 1) *
+                                          sizeof(unsigned long));
+  if (!pattern_cols)
+    goto malloc_error;
+
+  for (k = 0, g = 0; g < part_count; ++g)
+  {
+    const unsigned long count = part_patterns[g];
+    part_patterns[g] = k;
+    k += count;
+  }
+  part_patterns[part_count] = k;
+
+  for (j = 0; j < col_count; ++j)
+  {
+    const unsigned int p = site_part ? site_part[cols[j]] - 1 : 0;
+    if (rep[j] == j)
+      pattern_cols[part_patterns[p] + pattern[j]] = cols[j];
+  }
+
+  for (g = 0; g < part_count; ++g)
+  {
+    const unsigned long len = part_patterns[g+1] - part_patterns[g];
+
+    pattern_weights[g] = (unsigned int *) calloc(len + 1, sizeof(unsigned int));
+    msa_list[g] = (pll_msa_t *) calloc(1, sizeof(pll_msa_t));
+    if (!pattern_weights[g] || !msa_list[g])
+      goto malloc_error;
+
+    msa_list[g]->count = (int) msa_count;
+    msa_list[g]->length = (int) len;
+    msa_list[g]->sequence = (char **) calloc(msa_count + 1, sizeof(char *));
+    if (!msa_list[g]->sequence)
+      goto malloc_error;
+
+    for (i = 0; i < msa_count; ++i)
+    {
+      msa_list[g]->sequence[i] = (char *) malloc(len + 1);
+      if (!msa_list[g]->sequence[i])
+        goto malloc_error;
+    }
+  }
+
+  for (j = 0; j < col_count; ++j)
+  {
+    const unsigned int p = site_part ? site_part[cols[j]] - 1 : 0;
+    pattern_weights[p][pattern[j]] += weights ? weights[cols[j]] : 1;
+  }
+
+  /* copy every row in one pass */
+  for (i = 0; i < msa_count; ++i)
+  {
+    const char * src_seq = msa->sequence[i];
+    for (g = 0; g < part_count; ++g)
+    {
+      char * dst_seq = msa_list[g]->sequence[i];
+      const unsigned long * src_cols = pattern_cols + part_patterns[g];
+      const unsigned long len = part_patterns[g+1] - part_patterns[g];
+      for (j = 0; j < len; ++j)
+        dst_seq[j] = src_seq[src_cols[j]];
+      dst_seq[len] = '\0';
+    }
+  }
+
+  free(cols);
+  free(rep);
+  free(pattern);
+  free(hash);
+  free(part_patterns);
+  free(pattern_cols);
+
+  *part_msa_list = msa_list;
+
+  return pattern_weights;
+
+malloc_error:
+  pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                   "Cannot allocate memory needed for pattern compression");
+error_exit:
+  free(cols);
+  free(rep);
+  free(pattern);
+  free(hash);
+  free(part_patterns);
+  free(pattern_cols);
+  if (msa_list)
+  {
+    for (g = 0; g < part_count; ++g)
+      msa_destroy_partial(msa_list[g]);
+    free(msa_list);
+  }
+  if (pattern_weights)
+  {
+    for (g = 0; g < part_count; ++g)
+      free(pattern_weights[g]);
+    free(pattern_weights);
+  }
+  return NULL;
+}
+
+/* Check whether a sequence contains an invalid character, without branching
+ * on every character. The sequence is scanned in chunks of
+ * MSA_CHECK_CHUNK_SIZE characters with independent accumulators */
+static int sequence_has_invalid(const unsigned char * seqchars,
+                                unsigned long length,
+                                const unsigned char * invalid)
+{
+  unsigned long j, k;
+
+  for (j = 0; j < length; j += MSA_CHECK_CHUNK_SIZE)
+  {
+    const unsigned long chunk_len = PLL_MIN(MSA_CHECK_CHUNK_SIZE, length - j);
+    const unsigned char * chunk = seqchars + j;
+    unsigned char acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+
+    /* read 8 characters at a time */
+    for (k = 0; k + 8 <= chunk_len; k += 8)
+    {
+      unsigned long long w;
+      memcpy(&w, chunk + k, sizeof(w));
+      acc0 |= invalid[w & 0xFF] | invalid[(w >> 32) & 0xFF];
+      acc1 |= invalid[(w >> 8) & 0xFF] | invalid[(w >> 40) & 0xFF];
+      acc2 |= invalid[(w >> 16) & 0xFF] | invalid[(w >> 48) & 0xFF];
+      acc3 |= invalid[(w >> 24) & 0xFF] | invalid[w >> 56];
+    }
+    for (; k < chunk_len; ++k)
+      acc0 |= invalid[chunk[k]];
+
+    if (acc0 | acc1 | acc2 | acc3)
+      return 1;
+  }
+
+  return 0;
+}
+
+PLL_EXPORT pllmod_msa_errors_t * pllmod_msa_check(const pll_msa_t * msa,
+                                                  const pll_state_t * tipmap)
+{
+  unsigned long i, j;
+  unsigned char invalid[PLL_ASCII_SIZE];
+
+  if (!msa)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+              "MSA structure is NULL");
+    return PLL_FAILURE;
+  }
+
+  if (!tipmap)
   {
     pllmod_set_error(PLL_ERROR_PARAM_INVALID,
               "Character-to-state mapping (charmap) is NULL");
@@ -506,17 +1189,24 @@ PLL_EXPORT pllmod_msa_errors_t * pllmod_msa_check(const pll_msa_t * msa,
 
   errs->status = PLL_SUCCESS;
 
+  for (i = 0; i < PLL_ASCII_SIZE; ++i)
+    invalid[i] = tipmap[i] ? 0 : 1;
+
   const unsigned long msa_count = (unsigned long) msa->count;
   const unsigned long msa_length = (unsigned long) msa->length;
   for (i = 0; i < msa_count; ++i)
   {
     const unsigned char *seqchars = (unsigned char *) msa->sequence[i];
+
+    /* only look for the positions in sequences with invalid characters */
+    if (!sequence_has_invalid(seqchars, msa_length, invalid))
+      continue;
+
     for (j = 0; j < msa_length; ++j)
     {
       const int c = (int) seqchars[j];
-      const pll_state_t state = tipmap[c];
 
-      if (!state)
+      if (invalid[c])
       {
         if (!errs->invalid_chars)
         {
@@ -527,6 +1217,15 @@ PLL_EXPORT pllmod_msa_errors_t * pllmod_msa_check(const pll_msa_t * msa,
               (unsigned long *) calloc(PLLMOD_MSA_MAX_ERRORS, sizeof(unsigned long));
           errs->invalid_char_pos =
               (unsigned long *) calloc(PLLMOD_MSA_MAX_ERRORS, sizeof(unsigned long));
+          if (!errs->invalid_chars || !errs->invalid_char_seq ||
+              !errs->invalid_char_pos)
+          {
+            pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                             "Cannot allocate memory for MSA errors");
+            pllmod_msa_destroy_errors(errs);
+            free(errs);
+            return NULL;
+          }
         }
         errs->invalid_chars[errs->invalid_char_count] = (char) c;
         errs->invalid_char_seq[errs->invalid_char_count] = i;
@@ -557,367 +1256,576 @@ PLL_EXPORT void pllmod_msa_destroy_errors(pllmod_msa_errors_t * errs)
 }
 
 /**
- *  Compute diverse alignment statistics (see @param stats_mask for details)
+ *  Create an accumulator for computing alignment statistics incrementally, from
+ *  blocks of columns (e.g., read from a memory-mapped file), such that the
+ *  whole alignment does not need to be in memory.
  *
- *  @param msa Multiple Sequence Alignment
+ *  Duplicate sequences are detected with two independent 64-bit hashes of
+ *  every sequence, since sequences cannot be compared once a block has been
+ *  processed.
+ *
+ *  @param count Number of sequences
+ *  @param labels Sequence labels, required only for PLLMOD_MSA_STATS_DUP_TAXA
  *  @param states Number of states (e.g., DNA=4, AA=20 etc.)
- *  @param charmap Mapping from chars to states (e.g., pll_map_nt for DNA)
- *  @param weights Alignment site weights, NULL=equal weights
- *  @param stats_mask Statistics to be computed, any combination of:
- *      PLLMOD_MSA_STATS_DUP_TAXA   duplicate taxon names
- *      PLLMOD_MSA_STATS_DUP_SEQS   duplicate/identical sequences
- *      PLLMOD_MSA_STATS_GAP_PROP   proportion of gaps
- *      PLLMOD_MSA_STATS_GAP_SEQS   fully undetermined sequences (=all-gap rows)
- *      PLLMOD_MSA_STATS_GAP_COLS   fully undetermined sites (=all-gap columns)
- *      PLLMOD_MSA_STATS_INV_PROP   proportion of invariant sites
- *      PLLMOD_MSA_STATS_INV_COLS   invariant columns
- *      PLLMOD_MSA_STATS_FREQS      state frequencies (NB: gaps are ignored!)
- *      PLLMOD_MSA_STATS_ALL        all of the above
- * */
-PLL_EXPORT pllmod_msa_stats_t * pllmod_msa_compute_stats(const pll_msa_t * msa,
-                                                         unsigned int states,
-                                                         const pll_state_t * tipmap,
-                                                         const unsigned int * weights,
-                                                         unsigned long stats_mask)
+ *  @param tipmap Mapping from chars to states (e.g., pll_map_nt for DNA)
+ *  @param stats_mask Statistics to be computed (see pllmod_msa_compute_stats)
+ *
+ *  @return the accumulator, or NULL on error
+ */
+PLL_EXPORT pllmod_msa_stats_stream_t * pllmod_msa_stats_stream_create(
+                                                unsigned int count,
+                                                char * const * labels,
+                                                unsigned int states,
+                                                const pll_state_t * tipmap,
+                                                unsigned long stats_mask)
 {
-  if (!msa)
-  {
-    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
-              "MSA structure is NULL");
-    return PLL_FAILURE;
-  }
+  unsigned int k;
+  pllmod_msa_stats_stream_t * stream;
 
   if (!tipmap)
   {
     pllmod_set_error(PLL_ERROR_PARAM_INVALID,
               "Character-to-state mapping (charmap) is NULL");
-    return PLL_FAILURE;
+    return NULL;
   }
 
-  pllmod_msa_stats_t * stats = (pllmod_msa_stats_t *) calloc(1, sizeof(pllmod_msa_stats_t));
+  if ((stats_mask & PLLMOD_MSA_STATS_DUP_TAXA) && !labels)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+              "Sequence labels are required for finding duplicate taxa");
+    return NULL;
+  }
 
-  if (!stats)
+  stream = (pllmod_msa_stats_stream_t *) calloc(1,
+                                          sizeof(pllmod_msa_stats_stream_t));
+  if (!stream)
   {
     pllmod_set_error(PLL_ERROR_MEM_ALLOC,
                      "Cannot allocate memory for MSA statistics");
     return NULL;
   }
 
-  const unsigned int msa_count = msa->count;
-  const unsigned long msa_length = (unsigned long) msa->length;
+  stream->count      = count;
+  stream->states     = states;
+  stream->stats_mask = stats_mask;
+  stream->labels     = labels;
 
-  unsigned long i, j, k;
-  unsigned long sum_weights = 0;
-  unsigned long total_gap_count = 0;
-  unsigned long * col_gap_weight = NULL;
-  unsigned long * seq_gap_weight = NULL;
-  size_t * pair_rates = NULL;
-  size_t * col_state_freq = NULL;
+  stream->stats = (pllmod_msa_stats_t *) calloc(1, sizeof(pllmod_msa_stats_t));
+  stream->tile_gap = (unsigned long *) malloc(MSA_STATS_TILE_SIZE *
+                                              sizeof(unsigned long));
+  stream->tile_inv = (pll_state_t *) malloc(MSA_STATS_TILE_SIZE *
+                                            sizeof(pll_state_t));
+  if (!stream->stats || !stream->tile_gap || !stream->tile_inv)
+    goto create_error;
 
-  pll_state_t * inv_state = NULL;
-  unsigned long inv_weight = 0;
+  stream->stats->states = states;
 
-  stats->states = states;
-  stats->gap_cols_count = 0;
-  stats->gap_seqs_count = 0;
-  stats->inv_cols_count = 0;
+  if (stats_mask & PLLMOD_MSA_STATS_FREQS)
+  {
+    stream->stats->freqs = (double *) calloc(states, sizeof(double));
+    if (!stream->stats->freqs)
+      goto create_error;
+  }
 
-  /* search for duplicate taxa names (=sequence labels) */
-  if (stats_mask & PLLMOD_MSA_STATS_DUP_TAXA)
+  if (stats_mask & PLLMOD_MSA_STATS_GAP_SEQS)
   {
-    int retval = find_duplicate_strings_htable(msa->label, msa_count,
-                                        &stats->dup_taxa_pairs,
-                                        &stats->dup_taxa_pairs_count);
-    if (!retval)
-    {
-      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                       "Error finding duplicated taxa");
-      goto error_exit;
-    }
+    stream->seq_gap_weight = (unsigned long *) calloc(count + 1,
+                                                      sizeof(unsigned long));
+    if (!stream->seq_gap_weight)
+      goto create_error;
   }
 
-  /* search for duplicate sequences */
   if (stats_mask & PLLMOD_MSA_STATS_DUP_SEQS)
   {
-    int retval = find_duplicate_strings(msa->sequence, msa_count, msa_length,
-                                        &stats->dup_seqs_pairs,
-                                        &stats->dup_seqs_pairs_count);
-    if (!retval)
+    stream->seq_hash = (unsigned long long *) malloc((count + 1) *
+                                                sizeof(unsigned long long));
+    stream->seq_hash_check = (unsigned long long *) malloc((count + 1) *
+                                                sizeof(unsigned long long));
+    if (!stream->seq_hash || !stream->seq_hash_check)
+      goto create_error;
+    for (k = 0; k < count; ++k)
     {
-      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                       "Error finding duplicated sequences");
-      goto error_exit;
+      stream->seq_hash[k]       = MSA_HASH_SEED;
+      stream->seq_hash_check[k] = MSA_HASH_SEED2;
     }
   }
 
-  /* compute empirical substitution rates */
   if (stats_mask & PLLMOD_MSA_STATS_SUBST_RATES)
   {
-    size_t n_subst_rates = pllmod_util_subst_rate_count(states);
-    stats->subst_rates = (double *) calloc(n_subst_rates, sizeof(double));
-    pair_rates = (size_t *) calloc(states * states, sizeof(size_t));
-    col_state_freq = (size_t *) calloc(states, sizeof(size_t));
+    stream->pair_rates = (size_t *) calloc(states * states, sizeof(size_t));
+    stream->col_state_freq = (size_t *) calloc(MSA_RATES_BLOCK_SIZE * states,
+                                               sizeof(size_t));
+    if (!stream->pair_rates || !stream->col_state_freq)
+      goto create_error;
+  }
 
-    if (!pair_rates || !stats->subst_rates ||  !col_state_freq)
+  /* per-character lookup tables */
+  for (k = 0; k < PLL_ASCII_SIZE; ++k)
+  {
+    stream->tipmap[k]      = tipmap[k];
+    stream->char_is_gap[k] = (PLL_STATE_POPCNT(tipmap[k]) == states) ? 1 : 0;
+    stream->char_inv[k]    = stream->char_is_gap[k] ? 0 : tipmap[k];
+  }
+
+  return stream;
+
+create_error:
+  pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                   "Cannot allocate memory for MSA statistics");
+  pllmod_msa_stats_stream_destroy(stream);
+  return NULL;
+}
+
+/**
+ *  Add a block of columns to the statistics. Blocks must be added in
+ *  alignment order, and every block must contain all the sequences.
+ *
+ *  @param stream Statistics accumulator
+ *  @param block Characters of every sequence in the block, i.e., block[i][j]
+ *               is the j-th column of the block at sequence i
+ *  @param block_length Number of columns in the block
+ *  @param weights Column weights of the block, NULL=equal weights
+ *
+ *  Characters without a state are reported only when gap, invariant or
+ *  frequency statistics are requested, as in pllmod_msa_compute_stats.
+ *
+ *  @return PLL_SUCCESS or PLL_FAILURE
+ */
+PLL_EXPORT int pllmod_msa_stats_stream_update(
+                                          pllmod_msa_stats_stream_t * stream,
+                                          const char * const * block,
+                                          unsigned long block_length,
+                                          const unsigned int * weights)
+{
+  unsigned long i, j, k;
+  unsigned long tile_start;
+  const unsigned long count = stream->count;
+  const unsigned long stats_mask = stream->stats_mask;
+  pllmod_msa_stats_t * stats = stream->stats;
+  unsigned long * tile_gap = stream->tile_gap;
+  pll_state_t * tile_inv = stream->tile_inv;
+  const unsigned int * char_is_gap = stream->char_is_gap;
+  const pll_state_t * char_inv = stream->char_inv;
+  unsigned long * char_weight = stream->char_weight;
+  unsigned char * char_seen = stream->char_seen;
+
+  if (!stats)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "MSA statistics were already finalized");
+    return PLL_FAILURE;
+  }
+
+  /* make room for the new gap and invariant columns */
+  if ((stats_mask & PLLMOD_MSA_STATS_GAP_COLS) &&
+      !msa_grow_list(&stats->gap_cols, &stream->gap_cols_capacity,
+                     stats->gap_cols_count + block_length))
+    return PLL_FAILURE;
+
+  if ((stats_mask & (PLLMOD_MSA_STATS_INV_COLS | PLLMOD_MSA_STATS_INV_PROP)) &&
+      !msa_grow_list(&stats->inv_cols, &stream->inv_cols_capacity,
+                     stats->inv_cols_count + block_length))
+    return PLL_FAILURE;
+
+  /* process the block in tiles of columns across all sequences, such that
+     the per-column accumulators stay in cache. Global counters are reduced
+     after every tile */
+  for (tile_start = 0;
+       (stats_mask & MSA_STATS_SITE_MASK) && tile_start < block_length;
+       tile_start += MSA_STATS_TILE_SIZE)
+  {
+    const unsigned long tile_len = PLL_MIN(MSA_STATS_TILE_SIZE,
+                                           block_length - tile_start);
+    const unsigned int * tile_weights = weights ? weights + tile_start : NULL;
+
+    memset(tile_gap, 0, tile_len * sizeof(unsigned long));
+    memset(tile_inv, 0, tile_len * sizeof(pll_state_t));
+
+    for (i = 0; i < count; ++i)
     {
-      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                       "Cannot allocate memory for MSA statistics");
-      goto error_exit;
-    }
+      const unsigned char * seqchars =
+                      (const unsigned char *) block[i] + tile_start;
+      unsigned long row_gap_weight = 0;
 
-    compute_pair_rates(states, msa_count, msa_length,
-                       (unsigned char **) msa->sequence, weights,
-                       tipmap, col_state_freq, pair_rates);
+      if (tile_weights)
+      {
+        for (j = 0; j < tile_len; ++j)
+        {
+          const unsigned char c = seqchars[j];
+          const unsigned int w = tile_weights[j];
+          char_seen[c] = 1;
+          char_weight[c] += w;
+          tile_gap[j] += char_is_gap[c];
+          tile_inv[j] |= char_inv[c];
+          row_gap_weight += char_is_gap[c] * w;
+        }
+      }
+      else
+      {
+        for (j = 0; j < tile_len; ++j)
+        {
+          const unsigned char c = seqchars[j];
+          char_seen[c] = 1;
+          char_weight[c] += 1;
+          tile_gap[j] += char_is_gap[c];
+          tile_inv[j] |= char_inv[c];
+          row_gap_weight += char_is_gap[c];
+        }
+      }
 
-    k = 0;
-    double last_rate = pair_rates[(states - 2) * states + states - 1];
-    if (last_rate < 1e-7)
-      last_rate = 1;
-    for (i = 0; i < states - 1; i++)
+      if (stream->seq_gap_weight)
+        stream->seq_gap_weight[i] += row_gap_weight;
+    }
+
+    /* check for characters without state */
+    for (k = 0; k < PLL_ASCII_SIZE; ++k)
     {
-      for (j = i + 1; j < states; j++)
+      if (char_seen[k] && !stream->tipmap[k])
       {
-        stats->subst_rates[k++] = pair_rates[i * states + j] / last_rate;
-        if (stats->subst_rates[k - 1] < 0.01)
-          stats->subst_rates[k - 1] = 0.01;
-        if (stats->subst_rates[k - 1] > 50.0)
-          stats->subst_rates[k - 1] = 50.0;
+        report_invalid_block_state(stream, block, tile_start, tile_len);
+        return PLL_FAILURE;
       }
     }
-    stats->subst_rates[k - 1] = 1.0;
 
-    assert(k == n_subst_rates);
+    /* reduce the tile */
+    for (j = 0; j < tile_len; ++j)
+    {
+      const unsigned long col = stream->length + tile_start + j;
+      const unsigned int w = tile_weights ? tile_weights[j] : 1;
+
+      stream->sum_weights += w;
+
+      if ((stats_mask & PLLMOD_MSA_STATS_GAP_COLS) && tile_gap[j] == count)
+        stats->gap_cols[stats->gap_cols_count++] = col;
 
-    free(col_state_freq);
-    free(pair_rates);
-    col_state_freq = pair_rates = NULL;
+      if ((stats_mask & (PLLMOD_MSA_STATS_INV_COLS |
+                         PLLMOD_MSA_STATS_INV_PROP)) &&
+          PLL_STATE_POPCNT(tile_inv[j]) == 1)
+      {
+        stream->inv_weight += w;
+        stats->inv_cols[stats->inv_cols_count++] = col;
+      }
+    }
   }
 
-  /* if we were asked to find duplicates only, no need to loop over sites */
-  if (!(stats_mask & ~(PLLMOD_MSA_STATS_DUP_SEQS | PLLMOD_MSA_STATS_DUP_TAXA |
-                       PLLMOD_MSA_STATS_SUBST_RATES)))
-    return stats;
+  if (stream->seq_hash)
+  {
+    for (i = 0; i < count; ++i)
+    {
+      stream->seq_hash[i] = string_hash64(block[i],
+                                          block_length,
+                                          stream->seq_hash[i]);
+      stream->seq_hash_check[i] = string_hash64(block[i],
+                                                block_length,
+                                                stream->seq_hash_check[i]);
+    }
+  }
 
-  if (stats_mask & PLLMOD_MSA_STATS_FREQS)
+  if (stream->pair_rates)
+    compute_pair_rates(stream->states, (unsigned int) count, block_length,
+                       (unsigned char **) block, weights, stream->tipmap,
+                       stream->col_state_freq, stream->pair_rates);
+
+  stream->length += block_length;
+
+  return PLL_SUCCESS;
+}
+
+/**
+ *  Compute the final statistics from the blocks added so far. The stream
+ *  cannot be updated afterwards, and must be still destroyed.
+ *
+ *  @return the statistics, or NULL on error
+ */
+PLL_EXPORT pllmod_msa_stats_t * pllmod_msa_stats_stream_finalize(
+                                          pllmod_msa_stats_stream_t * stream)
+{
+  unsigned long i, j, k;
+  const unsigned int states = stream->states;
+  const unsigned long stats_mask = stream->stats_mask;
+  pllmod_msa_stats_t * stats = stream->stats;
+  unsigned long total_gap_count = 0;
+
+  if (!stats)
   {
-    stats->freqs = (double *) calloc(states, sizeof(double));
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "MSA statistics were already finalized");
+    return NULL;
+  }
 
-    if (!stats->freqs)
+  /* search for duplicate taxa names (=sequence labels) */
+  if (stats_mask & PLLMOD_MSA_STATS_DUP_TAXA)
+  {
+    int retval = find_duplicate_labels((char **) stream->labels,
+                                       stream->count,
+                                       &stats->dup_taxa_pairs,
+                                       &stats->dup_taxa_pairs_count);
+    if (!retval)
     {
       pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                       "Cannot allocate memory for empirical frequencies");
-      goto error_exit;
+                       "Error finding duplicated taxa");
+      return NULL;
     }
   }
 
-  if (stats_mask & PLLMOD_MSA_STATS_GAP_COLS)
+  /* search for duplicate sequences */
+  if (stream->seq_hash)
   {
-    col_gap_weight = (unsigned long *) calloc(msa_length, sizeof(unsigned long));
-  }
+    /* use the first hash for grouping, and the second one for confirming */
+    int retval = find_duplicate_hashes(stream->seq_hash, stream->count,
+                                       hashes_equal, stream->seq_hash_check,
+                                       &stats->dup_seqs_pairs,
+                                       &stats->dup_seqs_pairs_count,
+                                       &stats->dup_seqs_groups,
+                                       &stats->dup_seqs_groups_offset,
+                                       &stats->dup_seqs_groups_count);
+
+    free(stream->seq_hash);
+    free(stream->seq_hash_check);
+    stream->seq_hash = stream->seq_hash_check = NULL;
 
-  if (stats_mask & PLLMOD_MSA_STATS_GAP_SEQS)
-  {
-    seq_gap_weight = (unsigned long *) calloc(msa_count, sizeof(unsigned long));
+    if (!retval)
+    {
+      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                       "Error finding duplicated sequences");
+      return NULL;
+    }
   }
 
-  if (stats_mask & (PLLMOD_MSA_STATS_INV_COLS | PLLMOD_MSA_STATS_INV_PROP))
+  /* compute empirical substitution rates */
+  if (stats_mask & PLLMOD_MSA_STATS_SUBST_RATES)
   {
-    inv_state = (pll_state_t *) calloc(msa_length, sizeof(pll_state_t));
-    stats->inv_cols = (unsigned long *) calloc(msa_length, sizeof(unsigned long));
-    if (!inv_state || !stats->inv_cols)
+    size_t n_subst_rates = pllmod_util_subst_rate_count(states);
+
+    stats->subst_rates = (double *) calloc(n_subst_rates, sizeof(double));
+    if (!stats->subst_rates)
     {
       pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                       "Cannot allocate memory for computing invariant sites");
-      goto error_exit;
+                       "Cannot allocate memory for MSA statistics");
+      return NULL;
     }
+
+    pair_counts_to_rates(states, stream->pair_rates, stats->subst_rates);
   }
 
-  /* check memory allocation */
-  if (((stats_mask & PLLMOD_MSA_STATS_FREQS) && !stats->freqs) ||
-      ((stats_mask & PLLMOD_MSA_STATS_GAP_COLS) && !col_gap_weight) ||
-      ((stats_mask & PLLMOD_MSA_STATS_GAP_SEQS) && !seq_gap_weight)
-      )
+  for (k = 0; k < PLL_ASCII_SIZE; ++k)
   {
-    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                     "Cannot allocate memory for MSA statistics");
-    goto error_exit;
+    if (stream->char_is_gap[k])
+      total_gap_count += stream->char_weight[k];
   }
 
-  for (i = 0; i < msa_count; ++i)
+  const size_t total_chars = stream->sum_weights * stream->count;
+
+  /* compute frequencies, ignoring gaps */
+  if (stats_mask & PLLMOD_MSA_STATS_FREQS)
   {
-    const char *seqchars = msa->sequence[i];
-    for (j = 0; j < msa_length; ++j)
+    for (k = 0; k < PLL_ASCII_SIZE; ++k)
     {
-      const pll_state_t state = tipmap[(int) seqchars[j]];
-      const unsigned int site_states = PLL_STATE_POPCNT(state);
-      const int is_gap = site_states == states ? 1 : 0;
-      const unsigned int w = weights ? weights[j] : 1;
-
-      if (!state)
+      if (stream->char_weight[k] && !stream->char_is_gap[k])
       {
-        if (seqchars[j] == -1)
-        {
-          /* most likely sequence was already encoded and the original character
-             is unknown at this point */
-          pllmod_set_error(PLL_ERROR_MSA_MAP_INVALID,
-                           "Unknown state in sequence %d", i+1);
-        }
-        else
+        const pll_state_t state = stream->tipmap[k];
+        const double state_prob = ((double) stream->char_weight[k]) /
+                                  PLL_STATE_POPCNT(state);
+        for (j = 0; j < states; ++j)
         {
-          pllmod_set_error(PLL_ERROR_MSA_MAP_INVALID,
-                           "Unknown state %c at sequence %d position %d",
-                           seqchars[j],
-                           i+1,
-                           j+1);
+          if (state & ((pll_state_t) 1 << j))
+            stats->freqs[j] += state_prob;
         }
-        goto error_exit;
       }
+    }
 
-      /* compute sum of weights (=alignment length before pattern compression)*/
-      if (i == 0)
-        sum_weights += w;
+    for (k = 0; k < states; ++k)
+      stats->freqs[k] /= total_chars - total_gap_count;
+  }
 
-      if (stats_mask & (PLLMOD_MSA_STATS_GAP_PROP | PLLMOD_MSA_STATS_FREQS))
-      {
-        if (is_gap)
-          total_gap_count += w;
-      }
+  /* compute proportion of gaps */
+  if (stats_mask & PLLMOD_MSA_STATS_GAP_PROP)
+    stats->gap_prop = ((double) total_gap_count) / total_chars;
 
-      if (stats_mask & PLLMOD_MSA_STATS_GAP_COLS)
-      {
-        if (is_gap)
-          col_gap_weight[j] += 1;
-        if (i == msa_count-1 && col_gap_weight[j] == msa_count)
-           stats->gap_cols_count++;
-      }
+  /* compute proportion of invariant sites */
+  if (stats_mask & (PLLMOD_MSA_STATS_INV_COLS | PLLMOD_MSA_STATS_INV_PROP))
+  {
+    stats->inv_prop = ((double) stream->inv_weight) / stream->sum_weights;
+    msa_trim_list(&stats->inv_cols, stats->inv_cols_count);
+  }
 
-      if (stats_mask & PLLMOD_MSA_STATS_GAP_SEQS)
-      {
-        if (is_gap)
-          seq_gap_weight[i] += w;
-        if (j == msa_length-1 && seq_gap_weight[i] == sum_weights)
-          stats->gap_seqs_count++;
-      }
+  /* detect gap-only columns */
+  if (stats_mask & PLLMOD_MSA_STATS_GAP_COLS)
+    msa_trim_list(&stats->gap_cols, stats->gap_cols_count);
+
+  /* detect gap-only sequences */
+  if (stats_mask & PLLMOD_MSA_STATS_GAP_SEQS)
+  {
+    for (i = 0; i < stream->count; ++i)
+    {
+      if (stream->seq_gap_weight[i] == stream->sum_weights)
+        stats->gap_seqs_count++;
+    }
+
+    if (stats->gap_seqs_count > 0)
+    {
+      stats->gap_seqs = (unsigned long *) calloc(stats->gap_seqs_count,
+                                                 sizeof(unsigned long));
 
-      if (stats_mask & (PLLMOD_MSA_STATS_INV_COLS | PLLMOD_MSA_STATS_INV_PROP))
+      if (!stats->gap_seqs)
       {
-        if (!is_gap)
-          inv_state[j] |= state;
-        if (i == msa_count-1 && PLL_STATE_POPCNT(inv_state[j]) == 1)
-        {
-          inv_weight += w;
-          stats->inv_cols[stats->inv_cols_count++] = j;
-        }
+        pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                         "Cannot allocate memory for gap sequences");
+        return NULL;
       }
 
-      if (stats_mask & PLLMOD_MSA_STATS_FREQS)
+      unsigned long c = 0;
+      for (i = 0; i < stream->count; ++i)
       {
-        /* ignore gap sites when computing the base freqs */
-        if (!is_gap)
-        {
-          double state_prob = ((double) w) / site_states;
-          for (k = 0; k < states; ++k)
-          {
-            if (state & (1ll << k))
-              stats->freqs[k] += state_prob;
-          }
-        }
+        if (stream->seq_gap_weight[i] == stream->sum_weights)
+          stats->gap_seqs[c++] = i;
       }
+      assert(c == stats->gap_seqs_count);
+    }
+  }
 
-    }  // site loop
-  } // sequence loop
+  /* the statistics belong now to the caller */
+  stream->stats = NULL;
+
+  return stats;
+}
+
+PLL_EXPORT void pllmod_msa_stats_stream_destroy(
+                                          pllmod_msa_stats_stream_t * stream)
+{
+  if (!stream)
+    return;
+
+  if (stream->stats)
+    pllmod_msa_destroy_stats(stream->stats);
+  free(stream->tile_gap);
+  free(stream->tile_inv);
+  free(stream->seq_gap_weight);
+  free(stream->seq_hash);
+  free(stream->seq_hash_check);
+  free(stream->pair_rates);
+  free(stream->col_state_freq);
+  free(stream);
+}
 
-  /* compute proportion of invariant sites */
-  if (stats_mask & (PLLMOD_MSA_STATS_INV_COLS | PLLMOD_MSA_STATS_INV_PROP))
+/**
+ *  Compute diverse alignment statistics (see @param stats_mask for details)
+ *
+ *  @param msa Multiple Sequence Alignment
+ *  @param states Number of states (e.g., DNA=4, AA=20 etc.)
+ *  @param charmap Mapping from chars to states (e.g., pll_map_nt for DNA)
+ *  @param weights Alignment site weights, NULL=equal weights
+ *  @param stats_mask Statistics to be computed, any combination of:
+ *      PLLMOD_MSA_STATS_DUP_TAXA   duplicate taxon names
+ *      PLLMOD_MSA_STATS_DUP_SEQS   duplicate/identical sequences, as pairs
+ *                                  and as groups of identical sequences
+ *      PLLMOD_MSA_STATS_GAP_PROP   proportion of gaps
+ *      PLLMOD_MSA_STATS_GAP_SEQS   fully undetermined sequences (=all-gap rows)
+ *      PLLMOD_MSA_STATS_GAP_COLS   fully undetermined sites (=all-gap columns)
+ *      PLLMOD_MSA_STATS_INV_PROP   proportion of invariant sites
+ *      PLLMOD_MSA_STATS_INV_COLS   invariant columns
+ *      PLLMOD_MSA_STATS_FREQS      state frequencies (NB: gaps are ignored!)
+ *      PLLMOD_MSA_STATS_ALL        all of the above
+ * */
+PLL_EXPORT pllmod_msa_stats_t * pllmod_msa_compute_stats(const pll_msa_t * msa,
+                                                         unsigned int states,
+                                                         const pll_state_t * tipmap,
+                                                         const unsigned int * weights,
+                                                         unsigned long stats_mask)
+{
+  if (!msa)
   {
-    stats->inv_prop = ((double) inv_weight) / sum_weights;
-    stats->inv_cols = realloc(stats->inv_cols,
-                              stats->inv_cols_count * sizeof(unsigned long));
-    free(inv_state);
-    inv_state = NULL;
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+              "MSA structure is NULL");
+    return PLL_FAILURE;
   }
 
-  const size_t total_chars = sum_weights * msa_count;
-
-  /* normalize frequencies */
-  if (stats_mask & PLLMOD_MSA_STATS_FREQS)
+  if (!tipmap)
   {
-    for (k = 0; k < states; ++k)
-      stats->freqs[k] /= total_chars - total_gap_count;
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+              "Character-to-state mapping (charmap) is NULL");
+    return PLL_FAILURE;
   }
 
-  /* compute proportion of gaps */
-  if (stats_mask & PLLMOD_MSA_STATS_GAP_PROP)
-    stats->gap_prop = ((double) total_gap_count) / total_chars;
+  const unsigned int msa_count = msa->count;
+  const unsigned long msa_length = (unsigned long) msa->length;
 
-  /* detect gap-only columns */
-  if ((stats_mask & PLLMOD_MSA_STATS_GAP_COLS))
+  unsigned long i, start;
+  const char ** block = NULL;
+  pllmod_msa_stats_t * stats = NULL;
+  pllmod_msa_stats_stream_t * stream;
+
+  /* duplicate sequences are compared exactly, the rest is computed by
+     streaming the alignment in blocks of columns */
+  stream = pllmod_msa_stats_stream_create(msa_count,
+                                          msa->label,
+                                          states,
+                                          tipmap,
+                                          stats_mask & ~PLLMOD_MSA_STATS_DUP_SEQS);
+  if (!stream)
+    return NULL;
+
+  /* if we were asked to find duplicates only, no need to loop over sites */
+  if (stats_mask & ~(PLLMOD_MSA_STATS_DUP_SEQS | PLLMOD_MSA_STATS_DUP_TAXA))
   {
-    if (stats->gap_cols_count > 0)
+    block = (const char **) malloc((msa_count + 1) * sizeof(char *));
+    if (!block)
     {
-      stats->gap_cols = (unsigned long *) calloc(stats->gap_cols_count,
-                                                 sizeof(unsigned long));
+      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                       "Cannot allocate memory for MSA statistics");
+      goto error_exit;
+    }
 
-      if (!stats->gap_cols)
-      {
-        pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                       "Cannot allocate memory for gap columns");
-        goto error_exit;
-      }
+    for (start = 0; start < msa_length; start += MSA_STATS_TILE_SIZE)
+    {
+      for (i = 0; i < msa_count; ++i)
+        block[i] = msa->sequence[i] + start;
 
-      unsigned long c = 0;
-      for (j = 0; j < msa_length; ++j)
+      if (!pllmod_msa_stats_stream_update(stream,
+                                          block,
+                                          PLL_MIN(MSA_STATS_TILE_SIZE,
+                                                  msa_length - start),
+                                          weights ? weights + start : NULL))
       {
-        if (col_gap_weight[j] == msa_count)
-          stats->gap_cols[c++] = j;
+        /* report the first invalid character in the whole alignment */
+        if (pll_errno == PLL_ERROR_MSA_MAP_INVALID)
+          report_invalid_state(msa, tipmap);
+        goto error_exit;
       }
-      assert(c == stats->gap_cols_count);
     }
-    free(col_gap_weight);
-    col_gap_weight = NULL;
   }
 
-  /* detect gap-only sequences */
-  if ((stats_mask & PLLMOD_MSA_STATS_GAP_SEQS))
+  stats = pllmod_msa_stats_stream_finalize(stream);
+  if (!stats)
+    goto error_exit;
+
+  /* search for duplicate sequences */
+  if (stats_mask & PLLMOD_MSA_STATS_DUP_SEQS)
   {
-    if (stats->gap_seqs_count > 0)
+    int retval = find_duplicate_strings(msa->sequence, msa_count, msa_length,
+                                        &stats->dup_seqs_pairs,
+                                        &stats->dup_seqs_pairs_count,
+                                        &stats->dup_seqs_groups,
+                                        &stats->dup_seqs_groups_offset,
+                                        &stats->dup_seqs_groups_count);
+    if (!retval)
     {
-      stats->gap_seqs = (unsigned long *) calloc(stats->gap_seqs_count,
-                                                 sizeof(unsigned long));
-
-      if (!stats->gap_seqs)
-      {
-        pllmod_set_error(PLL_ERROR_MEM_ALLOC,
-                         "Cannot allocate memory for gap sequences");
-        goto error_exit;
-      }
-
-      unsigned long c = 0;
-      for (i = 0; i < msa_count; ++i)
-      {
-        if (seq_gap_weight[i] == sum_weights)
-          stats->gap_seqs[c++] = i;
-      }
-      assert(c == stats->gap_seqs_count);
+      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                       "Error finding duplicated sequences");
+      goto error_exit;
     }
-    free(seq_gap_weight);
-    seq_gap_weight = NULL;
   }
 
+  free(block);
+  pllmod_msa_stats_stream_destroy(stream);
+
   return stats;
 
 error_exit:
-  if (inv_state)
-    free(inv_state);
-  if (col_gap_weight)
-    free(col_gap_weight);
-  if (seq_gap_weight)
-    free(seq_gap_weight);
-  if (col_state_freq)
-    free(col_state_freq);
-  if (pair_rates)
-    free(pair_rates);
-  pllmod_msa_destroy_stats(stats);
+  free(block);
+  if (stats)
+    pllmod_msa_destroy_stats(stats);
+  pllmod_msa_stats_stream_destroy(stream);
 
   return NULL;
 }
@@ -930,6 +1838,12 @@ PLL_EXPORT void pllmod_msa_destroy_stats(pllmod_msa_stats_t * stats)
   if (stats->dup_seqs_pairs)
     free(stats->dup_seqs_pairs);
 
+  if (stats->dup_seqs_groups)
+    free(stats->dup_seqs_groups);
+
+  if (stats->dup_seqs_groups_offset)
+    free(stats->dup_seqs_groups_offset);
+
   if (stats->gap_seqs)
     free(stats->gap_seqs);
 
@@ -993,6 +1907,7 @@ PLL_EXPORT pll_msa_t * pllmod_msa_filter(pll_msa_t * msa,
 
   unsigned char * seqflag = NULL;
   unsigned char * colflag = NULL;
+  unsigned long * keep_cols = NULL;
   pll_msa_t * new_msa = NULL;
 
   if (remove_seqs_count)
@@ -1030,6 +1945,23 @@ PLL_EXPORT pll_msa_t * pllmod_msa_filter(pll_msa_t * msa,
   const unsigned long new_count = old_count - remove_seqs_count;
   const unsigned long new_length = old_length - remove_cols_count;
 
+  /* list of columns to keep, such that every row is copied in one pass */
+  if (colflag)
+  {
+    unsigned long col_idx = 0;
+
+    keep_cols = (unsigned long *) malloc((old_length+1) * sizeof(unsigned long));
+    if (!keep_cols)
+      goto error_exit;
+
+    for (j = 0; j < old_length; ++j)
+    {
+      if (!colflag[j])
+        keep_cols[col_idx++] = j;
+    }
+    assert(col_idx == new_length);
+  }
+
   if (inplace)
     new_msa = msa;
   else
@@ -1039,7 +1971,7 @@ PLL_EXPORT pll_msa_t * pllmod_msa_filter(pll_msa_t * msa,
     new_msa->length = (int) new_length;
     new_msa->label = (char **) calloc(new_count, sizeof(char *));
     new_msa->sequence = (char **) calloc(new_count, sizeof(char *));
-    if (!msa->label || !new_msa->sequence)
+    if (!new_msa->label || !new_msa->sequence)
       goto error_exit;
   }
 
@@ -1070,16 +2002,12 @@ PLL_EXPORT pll_msa_t * pllmod_msa_filter(pll_msa_t * msa,
     }
     else
     {
-      unsigned long col_idx = 0;
-      for (j = 0; j < old_length; ++j)
-      {
-        if (colflag[j])
-          continue;
-
-        new_msa->sequence[seq_idx][col_idx++] = msa->sequence[i][j];
-      }
-      assert(col_idx == new_length);
-      new_msa->sequence[seq_idx][new_length] = '\0';
+      /* columns are kept in order, so in-place copy is safe */
+      char * dst_seq = new_msa->sequence[seq_idx];
+      const char * src_seq = msa->sequence[i];
+      for (j = 0; j < new_length; ++j)
+        dst_seq[j] = src_seq[keep_cols[j]];
+      dst_seq[new_length] = '\0';
 
       /* trim sequence to the new size */
       if (inplace)
@@ -1110,6 +2038,7 @@ PLL_EXPORT pll_msa_t * pllmod_msa_filter(pll_msa_t * msa,
     free(seqflag);
   if (colflag)
     free(colflag);
+  free(keep_cols);
 
   return new_msa;
 
@@ -1118,6 +2047,7 @@ error_exit:
     free(seqflag);
   if (colflag)
     free(colflag);
+  free(keep_cols);
   if (new_msa)
   {
     for (i = 0; i < (unsigned long) new_msa->count; ++i)
@@ -1166,6 +2096,8 @@ PLL_EXPORT pll_msa_t ** pllmod_msa_split(const pll_msa_t * msa,
 {
   unsigned int p;
   unsigned long i, j;
+  unsigned long * part_cols = NULL;
+  unsigned long * part_offset = NULL;
 
   pll_msa_t ** part_msa_list = (pll_msa_t **) calloc(part_count,
                                                      sizeof(pll_msa_t *));
@@ -1213,21 +2145,54 @@ PLL_EXPORT pll_msa_t ** pllmod_msa_split(const pll_msa_t * msa,
     }
   }
 
+  /* list the columns of every partition (counting sort by partition) */
+  part_offset = (unsigned long *) malloc((part_count + 1) *
+                                         sizeof(unsigned long));
+  part_cols = (unsigned long *) malloc(((unsigned long) msa->length + 1) *
+                                       sizeof(unsigned long));
+  if (!part_offset || !part_cols)
+    goto malloc_error;
+
+  part_offset[0] = 0;
+  for (p = 0; p < part_count; ++p)
+  {
+    part_offset[p+1] = part_offset[p] + part_len[p];
+    part_msa_list[p]->length = (int) part_len[p];
+  }
+
   for (j = 0; j < (unsigned long) msa->length; j++)
   {
     /* partition index of 0 means that site should be skipped */
     if (site_part[j])
     {
       p = site_part[j]-1;
-      assert(p >= 0 && p < part_count);
-      const unsigned int len = (unsigned int) part_msa_list[p]->length;
-      part_msa_list[p]->length++;
-      for (i = 0; i < (unsigned long) msa->count; i++)
-        part_msa_list[p]->sequence[i][len] = msa->sequence[i][j];
+      assert(p < part_count);
+      part_cols[part_offset[p]++] = j;
+    }
+  }
+
+  /* restore offsets */
+  for (p = part_count; p > 0; --p)
+    part_offset[p] = part_offset[p-1];
+  part_offset[0] = 0;
+
+  /* copy every row in one pass */
+  for (i = 0; i < (unsigned long) msa->count; i++)
+  {
+    const char * src_seq = msa->sequence[i];
+    for (p = 0; p < part_count; ++p)
+    {
+      char * dst_seq = part_msa_list[p]->sequence[i];
+      const unsigned long * cols = part_cols + part_offset[p];
+      const unsigned long len = part_offset[p+1] - part_offset[p];
+      for (j = 0; j < len; j++)
+        dst_seq[j] = src_seq[cols[j]];
     }
   }
 
   free(part_len);
+  free(part_offset);
+  free(part_cols);
 
   return part_msa_list;
 
@@ -1237,6 +2202,8 @@ malloc_error:
 error_exit:
   if (part_len)
     free(part_len);
+  free(part_offset);
+  free(part_cols);
   if (part_msa_list)
   {
     for (p = 0; p < part_count; ++p)
@@ -1261,42 +2228,328 @@ error_exit:
 }
 
 /**
- * Save MSA to a PHYLIP file
+ * Compress the alignment into unique site patterns
+ *
+ * @param msa original MSA
+ * @param weights column weights of the original MSA, NULL=equal weights
+ * @param[out] pattern_weights weight of every pattern, to be freed by the
+ *                             caller
+ * @param[out] site_pattern pattern index of every column of the original MSA,
+ *                          allocated by the caller (can be NULL)
+ *
+ * @return MSA with one column for every distinct pattern, in order of first
+ *         occurrence, or NULL on error
  */
-PLL_EXPORT int pllmod_msa_save_phylip(const pll_msa_t * msa,
-                                      const char * out_fname)
+PLL_EXPORT pll_msa_t * pllmod_msa_compress_patterns(const pll_msa_t * msa,
+                                                    const unsigned int * weights,
+                                                    unsigned int ** pattern_weights,
+                                                    unsigned int * site_pattern)
 {
-  if (!msa)
+  pll_msa_t ** pattern_msa;
+  pll_msa_t * compressed_msa;
+  unsigned int ** part_weights;
+  unsigned long i;
+
+  part_weights = msa_compress_columns(msa, NULL, 1, weights, site_pattern,
+                                      &pattern_msa);
+  if (!part_weights)
+    return NULL;
+
+  compressed_msa = pattern_msa[0];
+  *pattern_weights = part_weights[0];
+  free(pattern_msa);
+  free(part_weights);
+
+  /* copy the labels */
+  compressed_msa->label = (char **) calloc((size_t) msa->count, sizeof(char *));
+  if (!compressed_msa->label)
+    goto label_error;
+
+  for (i = 0; i < (unsigned long) msa->count; ++i)
   {
-    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "MSA structure is NULL");
-    return PLL_FAILURE;
+    if (msa->label && msa->label[i])
+    {
+      compressed_msa->label[i] = strdup(msa->label[i]);
+      if (!compressed_msa->label[i])
+        goto label_error;
+    }
   }
 
-  if (!out_fname)
+  return compressed_msa;
+
+label_error:
+  pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                   "Cannot allocate memory for MSA labels");
+  msa_destroy_partial(compressed_msa);
+  free(*pattern_weights);
+  *pattern_weights = NULL;
+  return NULL;
+}
+
+/**
+ * Split MSA into several partitions (see pllmod_msa_split) and compress every
+ * partition into unique site patterns, in one pass over the alignment
+ *
+ * @param msa original MSA
+ * @param site_part array with 1-based partition indices for each column in
+ * original MSA (0 = skip the column)
+ * @param part_count number of partitions
+ * @param weights column weights of the original MSA, NULL=equal weights
+ * @param[out] pattern_weights weights of the patterns of every partition,
+ *                             to be freed by the caller
+ *
+ * @return list of per-partition compressed MSA objects, or NULL on error
+ */
+PLL_EXPORT pll_msa_t ** pllmod_msa_split_patterns(const pll_msa_t * msa,
+                                                  const unsigned int * site_part,
+                                                  unsigned int part_count,
+                                                  const unsigned int * weights,
+                                                  unsigned int *** pattern_weights)
+{
+  pll_msa_t ** part_msa_list;
+
+  *pattern_weights = msa_compress_columns(msa, site_part, part_count, weights,
+                                          NULL, &part_msa_list);
+
+  return *pattern_weights ? part_msa_list : NULL;
+}
+
+/* output buffer, written to the file with few large writes */
+typedef struct msa_writer
+{
+  FILE * f;
+  char * buf;
+  size_t size;
+  size_t used;
+  int status;
+} msa_writer_t;
+
+static void writer_flush(msa_writer_t * w)
+{
+  if (w->used && fwrite(w->buf, 1, w->used, w->f) != w->used)
+    w->status = PLL_FAILURE;
+  w->used = 0;
+}
+
+static void writer_put(msa_writer_t * w, const char * data, size_t len)
+{
+  if (w->used + len > w->size)
   {
-    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "File name (out_fname) is NULL");
-    return PLL_FAILURE;
+    writer_flush(w);
+
+    /* write long sequences directly */
+    if (len > w->size)
+    {
+      if (fwrite(data, 1, len, w->f) != len)
+        w->status = PLL_FAILURE;
+      return;
+    }
   }
 
-  FILE * f = fopen(out_fname, "w");
+  memcpy(w->buf + w->used, data, len);
+  w->used += len;
+}
+
+static void writer_put_char(msa_writer_t * w, char c, size_t count)
+{
+  while (count--)
+  {
+    if (w->used == w->size)
+      writer_flush(w);
+    w->buf[w->used++] = c;
+  }
+}
+
+static int write_msa(const pll_msa_t * msa,
+                     char * const * labels,
+                     const char * out_fname,
+                     int format,
+                     char * buf,
+                     size_t buf_size)
+{
+  unsigned long i;
+  msa_writer_t w;
+  char header[64];
 
-  if (!f)
+  w.f = fopen(out_fname, "w");
+  if (!w.f)
   {
     pllmod_set_error(PLL_ERROR_FILE_OPEN, "Cannot open file: %s", out_fname);
     return PLL_FAILURE;
   }
 
-  // TODO: data type should be changed to unsigned long in pll_msa_t!
-  fprintf(f, "%lu %lu\n", (unsigned long) msa->count,
-                          (unsigned long) msa->length);
+  /* the writer buffer replaces the stdio one */
+  setvbuf(w.f, NULL, _IONBF, 0);
+  w.buf = buf;
+  w.size = buf_size;
+  w.used = 0;
+  w.status = PLL_SUCCESS;
 
-  unsigned long i;
-  for (i = 0; i < (unsigned long) msa->count; ++i)
+  const unsigned long msa_count = (unsigned long) msa->count;
+  const size_t msa_length = (size_t) msa->length;
+
+  if (format != PLLMOD_MSA_FORMAT_FASTA)
+  {
+    // TODO: data type should be changed to unsigned long in pll_msa_t!
+    int len = snprintf(header, sizeof(header), "%lu %lu\n", msa_count,
+                       (unsigned long) msa_length);
+    writer_put(&w, header, (size_t) len);
+  }
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    const char * label = labels[i] ? labels[i] : "";
+    const size_t label_len = strlen(label);
+
+    switch (format)
+    {
+      case PLLMOD_MSA_FORMAT_FASTA:
+        writer_put_char(&w, '>', 1);
+        writer_put(&w, label, label_len);
+        writer_put_char(&w, '\n', 1);
+        break;
+      case PLLMOD_MSA_FORMAT_PHYLIP_STRICT:
+        /* labels are truncated or padded to 10 characters */
+        writer_put(&w, label, PLL_MIN(label_len, MSA_PHYLIP_STRICT_LABEL));
+        if (label_len < MSA_PHYLIP_STRICT_LABEL)
+          writer_put_char(&w, ' ', MSA_PHYLIP_STRICT_LABEL - label_len);
+        break;
+      default:
+        writer_put(&w, label, label_len);
+        writer_put_char(&w, ' ', 4);
+    }
+
+    writer_put(&w, msa->sequence[i], msa_length);
+    writer_put_char(&w, '\n', 1);
+  }
+
+  writer_flush(&w);
+
+  if (fclose(w.f) || w.status != PLL_SUCCESS)
   {
-    fprintf(f, "%s    %s\n", msa->label[i], msa->sequence[i]);
+    pllmod_set_error(PLL_ERROR_FILE_OPEN, "Cannot write file: %s", out_fname);
+    return PLL_FAILURE;
   }
 
-  fclose(f);
+  return PLL_SUCCESS;
+}
 
+static int check_format(int format)
+{
+  if (format != PLLMOD_MSA_FORMAT_PHYLIP_RELAXED &&
+      format != PLLMOD_MSA_FORMAT_PHYLIP_STRICT &&
+      format != PLLMOD_MSA_FORMAT_FASTA)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid MSA output format: %d", format);
+    return PLL_FAILURE;
+  }
   return PLL_SUCCESS;
 }
+
+/**
+ * Save MSA to a file in PHYLIP (relaxed or strict) or FASTA format
+ *
+ * @param msa the alignment
+ * @param out_fname output file name
+ * @param format PLLMOD_MSA_FORMAT_PHYLIP_RELAXED,
+ *               PLLMOD_MSA_FORMAT_PHYLIP_STRICT or PLLMOD_MSA_FORMAT_FASTA
+ *
+ * @return PLL_SUCCESS or PLL_FAILURE
+ */
+PLL_EXPORT int pllmod_msa_save(const pll_msa_t * msa,
+                               const char * out_fname,
+                               int format)
+{
+  if (!msa || !msa->label)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "MSA structure or its labels are NULL");
+    return PLL_FAILURE;
+  }
+
+  return pllmod_msa_save_list(&msa, 1, msa->label, &out_fname, format);
+}
+
+/**
+ * Save a list of MSAs (e.g. the partitions from pllmod_msa_split), one file
+ * each, sharing a single output buffer
+ *
+ * @param msa_list the alignments
+ * @param msa_count number of alignments
+ * @param labels sequence labels used for every alignment, or NULL to use the
+ *               labels of each alignment
+ * @param out_fnames output file name of every alignment
+ * @param format output format (see pllmod_msa_save)
+ *
+ * @return PLL_SUCCESS or PLL_FAILURE (the remaining files are not written)
+ */
+PLL_EXPORT int pllmod_msa_save_list(const pll_msa_t * const * msa_list,
+                                    unsigned int msa_count,
+                                    char * const * labels,
+                                    const char * const * out_fnames,
+                                    int format)
+{
+  unsigned int i;
+  char * buf;
+  int retval = PLL_SUCCESS;
+
+  if (!msa_list || !out_fnames)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "MSA list or file names are NULL");
+    return PLL_FAILURE;
+  }
+
+  if (!check_format(format))
+    return PLL_FAILURE;
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    if (!msa_list[i] || !out_fnames[i] || (!labels && !msa_list[i]->label))
+    {
+      pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                       "MSA %u, its labels or its file name are NULL", i);
+      return PLL_FAILURE;
+    }
+  }
+
+  buf = (char *) malloc(MSA_WRITE_BUFFER_SIZE);
+  if (!buf)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for output buffer");
+    return PLL_FAILURE;
+  }
+
+  for (i = 0; i < msa_count && retval == PLL_SUCCESS; ++i)
+  {
+    retval = write_msa(msa_list[i], labels ? labels : msa_list[i]->label,
+                       out_fnames[i], format, buf, MSA_WRITE_BUFFER_SIZE);
+  }
+
+  free(buf);
+
+  return retval;
+}
+
+/**
+ * Save MSA to a PHYLIP file
+ */
+PLL_EXPORT int pllmod_msa_save_phylip(const pll_msa_t * msa,
+                                      const char * out_fname)
+{
+  if (!msa)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "MSA structure is NULL");
+    return PLL_FAILURE;
+  }
+
+  if (!out_fname)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "File name (out_fname) is NULL");
+    return PLL_FAILURE;
+  }
+
+  return pllmod_msa_save(msa, out_fname, PLLMOD_MSA_FORMAT_PHYLIP_RELAXED);
+}
@@ -40,6 +40,11 @@
 
 #define PLLMOD_MSA_MAX_ERRORS        100
 
+/* MSA output formats */
+#define PLLMOD_MSA_FORMAT_PHYLIP_RELAXED 0
+#define PLLMOD_MSA_FORMAT_PHYLIP_STRICT  1
+#define PLLMOD_MSA_FORMAT_FASTA          2
+
 
 typedef struct msa_stats
 {
@@ -63,8 +68,45 @@ typedef struct msa_stats
 
   double * freqs;
   double * subst_rates;
+
+  /* appended to keep the layout of the fields above.
+     group g: dup_seqs_groups[dup_seqs_groups_offset[g] .. offset[g+1]-1] */
+  unsigned long dup_seqs_groups_count;
+  unsigned long * dup_seqs_groups_offset;
+  unsigned long * dup_seqs_groups;
 } pllmod_msa_stats_t;
 
+/* accumulator for computing statistics from blocks of columns */
+typedef struct msa_stats_stream
+{
+  unsigned long count;            /* number of sequences */
+  unsigned long length;           /* number of columns added so far */
+  unsigned int states;
+  unsigned long stats_mask;
+  char * const * labels;
+
+  pll_state_t tipmap[PLL_ASCII_SIZE];
+  pll_state_t char_inv[PLL_ASCII_SIZE];     /* state, or 0 for gaps */
+  unsigned int char_is_gap[PLL_ASCII_SIZE];
+  unsigned long char_weight[PLL_ASCII_SIZE];
+  unsigned char char_seen[PLL_ASCII_SIZE];
+
+  unsigned long sum_weights;
+  unsigned long inv_weight;
+  unsigned long * seq_gap_weight;
+  unsigned long long * seq_hash;        /* hash of every sequence */
+  unsigned long long * seq_hash_check;  /* independent hash for collisions */
+  size_t * pair_rates;
+  size_t * col_state_freq;
+
+  unsigned long gap_cols_capacity;
+  unsigned long inv_cols_capacity;
+  unsigned long * tile_gap;
+  pll_state_t * tile_inv;
+
+  pllmod_msa_stats_t * stats;     /* partial statistics */
+} pllmod_msa_stats_stream_t;
+
 typedef struct msa_errors
 {
   unsigned long invalid_char_count;
@@ -74,6 +116,18 @@ typedef struct msa_errors
   int status;
 } pllmod_msa_errors_t;
 
+/* nucleotide alignment packed into 2 or 4 bits per site */
+typedef struct msa_packed
+{
+  int count;
+  int length;
+  unsigned int bits;              /* bits per site (2 or 4) */
+  unsigned long words;            /* 64-bit words per sequence */
+  unsigned long long ** sequence;
+  char ** label;
+  char code_char[16];             /* character of every code */
+} pllmod_msa_packed_t;
+
 PLL_EXPORT double * pllmod_msa_empirical_frequencies(pll_partition_t * partition);
 PLL_EXPORT double * pllmod_msa_empirical_subst_rates(pll_partition_t * partition);
 PLL_EXPORT double pllmod_msa_empirical_invariant_sites(pll_partition_t *partition);
@@ -91,6 +145,25 @@ PLL_EXPORT pllmod_msa_stats_t * pllmod_msa_compute_stats(const pll_msa_t * msa,
 
 PLL_EXPORT void pllmod_msa_destroy_stats(pllmod_msa_stats_t * stats);
 
+PLL_EXPORT pllmod_msa_stats_stream_t * pllmod_msa_stats_stream_create(
+                                                unsigned int count,
+                                                char * const * labels,
+                                                unsigned int states,
+                                                const pll_state_t * tipmap,
+                                                unsigned long stats_mask);
+
+PLL_EXPORT int pllmod_msa_stats_stream_update(
+                                          pllmod_msa_stats_stream_t * stream,
+                                          const char * const * block,
+                                          unsigned long block_length,
+                                          const unsigned int * weights);
+
+PLL_EXPORT pllmod_msa_stats_t * pllmod_msa_stats_stream_finalize(
+                                          pllmod_msa_stats_stream_t * stream);
+
+PLL_EXPORT void pllmod_msa_stats_stream_destroy(
+                                          pllmod_msa_stats_stream_t * stream);
+
 PLL_EXPORT pll_msa_t * pllmod_msa_filter(pll_msa_t * msa,
                                          unsigned long * remove_seqs,
                                          unsigned long remove_seqs_count,
@@ -102,8 +175,61 @@ PLL_EXPORT pll_msa_t ** pllmod_msa_split(const pll_msa_t * msa,
                                          const unsigned int * site_part,
                                          unsigned int part_count);
 
+PLL_EXPORT pll_msa_t * pllmod_msa_compress_patterns(const pll_msa_t * msa,
+                                                    const unsigned int * weights,
+                                                    unsigned int ** pattern_weights,
+                                                    unsigned int * site_pattern);
+
+PLL_EXPORT pll_msa_t ** pllmod_msa_split_patterns(const pll_msa_t * msa,
+                                                  const unsigned int * site_part,
+                                                  unsigned int part_count,
+                                                  const unsigned int * weights,
+                                                  unsigned int *** pattern_weights);
+
 // This could be moved to a general file I/O module if we decide to have one
 PLL_EXPORT int pllmod_msa_save_phylip(const pll_msa_t * msa,
                                       const char * out_fname);
 
+PLL_EXPORT int pllmod_msa_save(const pll_msa_t * msa,
+                               const char * out_fname,
+                               int format);
+
+PLL_EXPORT int pllmod_msa_save_list(const pll_msa_t * const * msa_list,
+                                    unsigned int msa_count,
+                                    char * const * labels,
+                                    const char * const * out_fnames,
+                                    int format);
+
+/* functions in msa_packed.c */
+
+PLL_EXPORT pllmod_msa_packed_t * pllmod_msa_pack(const pll_msa_t * msa,
+                                                 const pll_state_t * tipmap,
+                                                 unsigned int bits);
+
+PLL_EXPORT pll_msa_t * pllmod_msa_unpack(const pllmod_msa_packed_t * packed);
+
+PLL_EXPORT void pllmod_msa_packed_destroy(pllmod_msa_packed_t * packed);
+
+PLL_EXPORT pllmod_msa_packed_t * pllmod_msa_packed_filter(
+                                        const pllmod_msa_packed_t * packed,
+                                        const unsigned long * remove_seqs,
+                                        unsigned long remove_seqs_count,
+                                        const unsigned long * remove_cols,
+                                        unsigned long remove_cols_count);
+
+PLL_EXPORT pllmod_msa_packed_t ** pllmod_msa_packed_split(
+                                        const pllmod_msa_packed_t * packed,
+                                        const unsigned int * site_part,
+                                        unsigned int part_count);
+
+PLL_EXPORT pllmod_msa_stats_t * pllmod_msa_packed_compute_stats(
+                                        const pllmod_msa_packed_t * packed,
+                                        unsigned int states,
+                                        const pll_state_t * tipmap,
+                                        const unsigned int * weights,
+                                        unsigned long stats_mask);
+
+PLL_EXPORT int pllmod_msa_packed_save_phylip(const pllmod_msa_packed_t * packed,
+                                             const char * out_fname);
+
 #endif /* PLL_MSA_H_ */
@@ -375,10 +375,10 @@ PLL_EXPORT pll_consensus_utree_t * pllmod_utree_weight_consensus(
   pll_unode_t ** tipnodes;                 /* tips from reference tree */
   bitv_hashtable_t * splits_hash = NULL;
   string_hashtable_t * string_hashtable = NULL;
-  pll_split_t * tree_splits;
+  pll_compact_split_set_t * tree_splits;
+  pll_split_t split = NULL;
   unsigned int i, j,
-               tip_count = reference_tree->tip_count,
-               n_splits  = tip_count - 3;
+               tip_count = reference_tree->tip_count;
 
   /* validate threshold */
   if (threshold > 1 || threshold < 0)
@@ -424,6 +424,15 @@ PLL_EXPORT pll_consensus_utree_t * pllmod_utree_weight_consensus(
 
   /* create hashtable */
   splits_hash = hash_init(tip_count * 10, tip_count);
+  split = (pll_split_t) malloc(bitv_length(tip_count) *
+                               sizeof(pll_split_base_t));
+  if (!split)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC, "Cannot allocate memory for split");
+    string_hash_destroy(string_hashtable);
+    hash_destroy(splits_hash);
+    return NULL;
+  }
 
   pll_errno = 0;
 
@@ -433,30 +442,41 @@ PLL_EXPORT pll_consensus_utree_t * pllmod_utree_weight_consensus(
     if (current_tree->tip_count != tip_count)
     {
       /*TODO: error */
+      free(split);
       return NULL;
     }
 
-    tree_splits = pllmod_utree_split_create(current_tree->nodes[
+    /* no non-trivial splits */
+    if (tip_count < 4)
+      continue;
+
+    /* compact splits avoid a dense split array for every tree */
+    tree_splits = pllmod_utree_compact_split_create(current_tree->nodes[
                                                 current_tree->tip_count +
                                                 current_tree->inner_count - 1],
                                              tip_count,
+                                             NULL,
                                              NULL);
+    if (!tree_splits)
+      break;
 
-    /* insert normalized splits */
-    for (j=0; j<n_splits; ++j)
+    /* insert normalized splits, expanded one at a time */
+    for (j=0; j<tree_splits->split_count; ++j)
     {
-      bitv_normalize(tree_splits[j], tip_count);
+      pllmod_utree_compact_split_get(tree_splits, j, split);
 
-      hash_insert(tree_splits[j],
+      hash_insert(split,
                   splits_hash,
                   j,
                   HASH_KEY_UNDEF,
                   weights[i],
                   0);
     }
-    pllmod_utree_split_destroy(tree_splits);
+    pllmod_utree_compact_split_destroy(tree_splits);
   }
 
+  free(split);
+
   if (pll_errno)
   {
     /* cleanup and spread error */
@@ -980,6 +980,80 @@ PLL_EXPORT pll_utree_t * pllmod_utree_create_random(unsigned int taxa_count,
   return (wrapped_tree);
 }
 
+/**
+ * Creates a random topology with default branch lengths in a tree arena
+ *
+ * Same as pllmod_utree_create_random(), but all nodes, labels and the tree
+ * structure are allocated in `arena`. The tree is released together with the
+ * arena and must not be passed to pll_utree_destroy().
+ */
+PLL_EXPORT pll_utree_t * pllmod_utree_arena_create_random(
+                                                  pllmod_utree_arena_t * arena,
+                                                  unsigned int taxa_count,
+                                                  const char * const* names,
+                                                  unsigned int random_seed)
+{
+  unsigned int i;
+  unsigned int node_count = 2 * taxa_count - 2;
+  unsigned int node_id = 0;
+  pll_unode_t ** nodes;
+  pll_utree_t * wrapped_tree = NULL;
+
+  if (taxa_count < 3)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid taxa_count value (%u)\n", taxa_count);
+    return NULL;
+  }
+
+  nodes = (pll_unode_t **) calloc(node_count, sizeof(pll_unode_t *));
+  if (!nodes)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for nodes!");
+    return NULL;
+  }
+
+  /* allocate tips and inner nodes contiguously */
+  for (i=0; i<taxa_count; ++i)
+  {
+    nodes[i] = pllmod_utree_arena_create_tip(arena, i,
+                                             names ? names[i] : NULL, NULL);
+    if (!nodes[i])
+      goto random_exit;
+    nodes[i]->pmatrix_index = i;
+    nodes[i]->node_index = node_id++;
+  }
+
+  for (i=taxa_count; i<node_count; ++i)
+  {
+    nodes[i] = pllmod_utree_arena_create_node(arena, i, (int)(i - taxa_count),
+                                              NULL, NULL);
+    if (!nodes[i])
+      goto random_exit;
+    nodes[i]->node_index = node_id++;
+    nodes[i]->next->node_index = node_id++;
+    nodes[i]->next->next->node_index = node_id++;
+  }
+
+  /* build minimal tree with 3 tips and 1 inner node */
+  pllmod_utree_connect_nodes(nodes[0], nodes[taxa_count],
+                             PLLMOD_TREE_DEFAULT_BRANCH_LENGTH);
+  pllmod_utree_connect_nodes(nodes[1], nodes[taxa_count]->next,
+                             PLLMOD_TREE_DEFAULT_BRANCH_LENGTH);
+  pllmod_utree_connect_nodes(nodes[2], nodes[taxa_count]->next->next,
+                             PLLMOD_TREE_DEFAULT_BRANCH_LENGTH);
+
+  /* insert remaining taxa_count-3 tips into the tree */
+  if (utree_insert_tips_random(nodes, taxa_count, 3, random_seed))
+    wrapped_tree = pllmod_utree_arena_wraptree(arena, nodes[taxa_count],
+                                               taxa_count);
+
+random_exit:
+  free(nodes);
+  return wrapped_tree;
+}
+
 /**
  * Creates a maximum parsimony topology using randomized stepwise-addition
  * algorithm. All branch lengths will be set to default.
@@ -1050,33 +1124,113 @@ pll_utree_t * pllmod_utree_create_parsimony_multipart(unsigned int taxon_count,
                                                       unsigned int * score)
 {
   pll_utree_t * tree = NULL;
+  pllmod_parsimony_context_t * context;
+
+  context = pllmod_utree_parsimony_context_create(taxon_count,
+                                                  taxon_names,
+                                                  partition_count,
+                                                  partitions);
+  if (!context)
+    return NULL;
+
+  tree = pllmod_utree_parsimony_context_tree(context, random_seed, score);
+
+  pllmod_utree_parsimony_context_destroy(context);
+
+  return tree;
+}
+
+/**
+ * Creates the parsimony vectors of a partitioned alignment once, such that
+ * several parsimony trees can be built from them (see
+ * pllmod_utree_parsimony_context_trees).
+ *
+ * @param taxon_count number of taxa
+ * @param taxon_names names of the taxa, must be kept by the caller
+ * @param partition_count number of partitions
+ * @param partitions partitions with the tip states set, must be kept by the
+ *                   caller
+ *
+ * @return the parsimony context, or NULL on error
+ */
+PLL_EXPORT pllmod_parsimony_context_t * pllmod_utree_parsimony_context_create(
+                                      unsigned int taxon_count,
+                                      char * const * taxon_names,
+                                      unsigned int partition_count,
+                                      pll_partition_t * const * partitions)
+{
   unsigned int i;
+  pllmod_parsimony_context_t * context;
 
-  pll_parsimony_t ** parsimony =
-      (pll_parsimony_t **) calloc(partition_count, sizeof(pll_parsimony_t *));
+  context = (pllmod_parsimony_context_t *)
+                calloc(1, sizeof(pllmod_parsimony_context_t));
+  if (context)
+    context->parsimony = (pll_parsimony_t **) calloc(partition_count,
+                                                     sizeof(pll_parsimony_t *));
 
-  if (!parsimony)
+  if (!context || !context->parsimony)
   {
     pll_errno = PLL_ERROR_MEM_ALLOC;
     snprintf(pll_errmsg, 200, "Unable to allocate enough memory.");
+    free(context);
     return NULL;
   }
 
+  context->taxon_count = taxon_count;
+  context->taxon_names = taxon_names;
+  context->partition_count = partition_count;
+  context->partitions = partitions;
+
   for (i = 0; i < partition_count; ++i)
   {
     assert(taxon_count == partitions[i]->tips);
-    parsimony[i] = pll_fastparsimony_init(partitions[i]);
-    if (!parsimony[i])
+    context->parsimony[i] = pll_fastparsimony_init(partitions[i]);
+    if (!context->parsimony[i])
     {
       assert(pll_errno);
-      goto cleanup;
+      pllmod_utree_parsimony_context_destroy(context);
+      return NULL;
     }
   }
 
-  tree = pll_fastparsimony_stepwise(parsimony,
-                                    taxon_names,
+  return context;
+}
+
+PLL_EXPORT void pllmod_utree_parsimony_context_destroy(
+                                      pllmod_parsimony_context_t * context)
+{
+  unsigned int i;
+
+  if (!context)
+    return;
+
+  /* destroy parsimony */
+  for (i = 0; i < context->partition_count; ++i)
+  {
+    if (context->parsimony[i])
+      pll_parsimony_destroy(context->parsimony[i]);
+  }
+
+  free(context->parsimony);
+  free(context);
+}
+
+/**
+ * Creates a maximum parsimony topology using randomized stepwise-addition
+ * algorithm, reusing the parsimony vectors of the context. All branch lengths
+ * will be set to default.
+ */
+PLL_EXPORT pll_utree_t * pllmod_utree_parsimony_context_tree(
+                                      pllmod_parsimony_context_t * context,
+                                      unsigned int random_seed,
+                                      unsigned int * score)
+{
+  pll_utree_t * tree;
+
+  tree = pll_fastparsimony_stepwise(context->parsimony,
+                                    context->taxon_names,
                                     score,
-                                    partition_count,
+                                    context->partition_count,
                                     random_seed);
 
   if (tree)
@@ -1094,17 +1248,60 @@ pll_utree_t * pllmod_utree_create_parsimony_multipart(unsigned int taxon_count,
   else
     assert(pll_errno);
 
-cleanup:
-  /* destroy parsimony */
-  for (i = 0; i < partition_count; ++i)
+  return tree;
+}
+
+/**
+ * Creates one parsimony tree for every random seed. The inner parsimony
+ * vectors of the context are overwritten by every tree, so a context must not
+ * be used by several threads at once; create one context per thread instead.
+ *
+ * @param context parsimony context
+ * @param random_seeds seed of every tree
+ * @param tree_count number of trees
+ * @param[out] trees the trees
+ * @param[out] scores parsimony score of every tree (can be NULL)
+ *
+ * @return PLL_SUCCESS, or PLL_FAILURE if any tree could not be built (no
+ *         trees are returned then)
+ */
+PLL_EXPORT int pllmod_utree_parsimony_context_trees(
+                                      pllmod_parsimony_context_t * context,
+                                      const unsigned int * random_seeds,
+                                      unsigned int tree_count,
+                                      pll_utree_t ** trees,
+                                      unsigned int * scores)
+{
+  unsigned int i, j;
+  unsigned int score;
+
+  if (!context || !random_seeds || !trees)
   {
-    if (parsimony[i])
-      pll_parsimony_destroy(parsimony[i]);
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Parsimony context, seeds or output trees are NULL");
+    return PLL_FAILURE;
   }
 
-  free(parsimony);
+  for (i = 0; i < tree_count; ++i)
+  {
+    trees[i] = pllmod_utree_parsimony_context_tree(context,
+                                                   random_seeds[i],
+                                                   &score);
+    if (!trees[i])
+    {
+      for (j = 0; j < i; ++j)
+      {
+        pll_utree_destroy(trees[j], NULL);
+        trees[j] = NULL;
+      }
+      return PLL_FAILURE;
+    }
 
-  return tree;
+    if (scores)
+      scores[i] = score;
+  }
+
+  return PLL_SUCCESS;
 }
 
 /* static functions */
@@ -1136,45 +1333,138 @@ static int utree_find_node_in_subtree(pll_unode_t * root,
 /******************************************************************************/
 /* Additional utilities */
 
+/* growable stack of traversal frames */
+struct trav_frame_s
+{
+  void * node;
+  void * cursor;
+  int retval;
+  int visited;
+};
+
+struct trav_stack_s
+{
+  struct trav_frame_s * frames;
+  unsigned int top;
+  unsigned int size;
+};
+
+static struct trav_frame_s * trav_stack_push(struct trav_stack_s * stack,
+                                             void * node,
+                                             void * cursor)
+{
+  struct trav_frame_s * frame;
+
+  if (stack->top == stack->size)
+  {
+    unsigned int new_size = stack->size ? 2 * stack->size : 64;
+    struct trav_frame_s * new_frames = (struct trav_frame_s *)
+                    realloc(stack->frames, new_size * sizeof(struct trav_frame_s));
+    if (!new_frames)
+    {
+      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                       "Cannot allocate memory for traversal stack\n");
+      return NULL;
+    }
+    stack->frames = new_frames;
+    stack->size = new_size;
+  }
+
+  frame = stack->frames + stack->top++;
+  frame->node = node;
+  frame->cursor = cursor;
+  frame->retval = 1;
+  frame->visited = 0;
+
+  return frame;
+}
+
+/*
+ * Explicit-stack version of the recursive traversal: a failing pre-order
+ * callback skips the subtree, and a failing in-order callback skips the
+ * remaining children and the post-order callback of the node. Both make the
+ * node visit fail, while the siblings are still visited.
+ */
 static int utree_traverse_apply(pll_unode_t * node,
                                 int (*cb_pre_trav)(pll_unode_t *, void *),
                                 int (*cb_in_trav)(pll_unode_t *, void *),
                                 int (*cb_post_trav)(pll_unode_t *, void *),
-                                void *data)
+                                void *data,
+                                struct trav_stack_s * stack)
 {
-  int retval = 1;
-  pll_unode_t * child_tree = 0;
+  int child_retval;
+  pll_unode_t * child = node;
 
-  if (cb_pre_trav && !cb_pre_trav(node,  data))
-    return PLL_FAILURE;
+  stack->top = 0;
 
-  if (pllmod_utree_is_tip(node))
+  while (1)
   {
-    if (cb_in_trav)
-      retval &= cb_in_trav(node, data);
-    if (cb_post_trav)
-      retval &= cb_post_trav(node, data);
-    return retval;
-  }
+    /* visit `child`; inner nodes push a frame, the others end right away */
+    child_retval = 1;
+    if (cb_pre_trav && !cb_pre_trav(child, data))
+      child_retval = PLL_FAILURE;
+    else if (pllmod_utree_is_tip(child))
+    {
+      if (cb_in_trav)
+        child_retval &= cb_in_trav(child, data);
+      if (cb_post_trav)
+        child_retval &= cb_post_trav(child, data);
+    }
+    else if (!trav_stack_push(stack, child, child->next))
+      return PLL_FAILURE;
+    else
+      child_retval = -1;
 
-  child_tree = node->next;
-  while(child_tree != node)
-  {
-    retval &= utree_traverse_apply(child_tree->back,
-                                   cb_pre_trav, cb_in_trav, cb_post_trav, data);
+    /* unwind until the next child to visit */
+    child = NULL;
+    while (!child)
+    {
+      struct trav_frame_s * frame;
+      pll_unode_t * fnode;
+      pll_unode_t * cursor;
 
-    if (cb_in_trav &&
-        child_tree->next != node &&
-        !cb_in_trav(child_tree, data))
-      return PLL_FAILURE;
+      if (child_retval >= 0)
+      {
+        if (!stack->top)
+          return child_retval;
+        stack->frames[stack->top - 1].retval &= child_retval;
+      }
+      child_retval = -1;
 
-    child_tree = child_tree->next;
-  }
+      frame = stack->frames + stack->top - 1;
+      fnode = (pll_unode_t *) frame->node;
+      cursor = (pll_unode_t *) frame->cursor;
 
-  if (cb_post_trav)
-    retval &= cb_post_trav(node,  data);
+      if (frame->visited)
+      {
+        /* subtree below `cursor` is done */
+        frame->visited = 0;
+        if (cb_in_trav &&
+            cursor->next != fnode &&
+            !cb_in_trav(cursor, data))
+        {
+          --stack->top;
+          child_retval = PLL_FAILURE;
+          continue;
+        }
+        cursor = cursor->next;
+        frame->cursor = cursor;
+      }
 
-  return retval;
+      if (cursor == fnode)
+      {
+        if (cb_post_trav)
+          frame->retval &= cb_post_trav(fnode, data);
+        child_retval = frame->retval;
+        --stack->top;
+      }
+      else
+      {
+        frame->visited = 1;
+        child = cursor->back;
+      }
+    }
+  }
 }
 
 PLL_EXPORT int pllmod_utree_traverse_apply(pll_unode_t * root,
@@ -1187,6 +1477,7 @@ PLL_EXPORT int pllmod_utree_traverse_apply(pll_unode_t * root,
                                            void *data)
 {
   int retval = 1;
+  struct trav_stack_s stack = {NULL, 0, 0};
 
   assert(root);
 
@@ -1194,14 +1485,203 @@ PLL_EXPORT int pllmod_utree_traverse_apply(pll_unode_t * root,
 
   retval &= utree_traverse_apply(root->back,
                                  cb_pre_trav, cb_in_trav, cb_post_trav,
-                                 data);
+                                 data, &stack);
   retval &= utree_traverse_apply(root,
                                  cb_pre_trav, cb_in_trav, cb_post_trav,
-                                 data);
+                                 data, &stack);
+
+  free(stack.frames);
 
   return retval;
 }
 
+static int utree_traversal_grow(pllmod_utree_traversal_t * traversal,
+                                unsigned int max_nodes)
+{
+  pll_unode_t ** preorder = (pll_unode_t **) realloc(traversal->preorder,
+                                          max_nodes * sizeof(pll_unode_t *));
+  pll_unode_t ** postorder;
+  pll_unode_t ** stack;
+
+  if (preorder)
+    traversal->preorder = preorder;
+  postorder = (pll_unode_t **) realloc(traversal->postorder,
+                                       max_nodes * sizeof(pll_unode_t *));
+  if (postorder)
+    traversal->postorder = postorder;
+  stack = (pll_unode_t **) realloc(traversal->stack,
+                                   2 * max_nodes * sizeof(pll_unode_t *));
+  if (stack)
+    traversal->stack = stack;
+
+  if (!preorder || !postorder || !stack)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for traversal\n");
+    return PLL_FAILURE;
+  }
+
+  traversal->max_nodes = max_nodes;
+  return PLL_SUCCESS;
+}
+
+/* fills the node orders of the subtree rooted at `node` */
+static int utree_traversal_fill(pllmod_utree_traversal_t * traversal,
+                                pll_unode_t * node)
+{
+  unsigned int top = 0;
+  unsigned int post_count = traversal->node_count;
+  pll_unode_t ** stack;
+
+  if (traversal->node_count == traversal->max_nodes &&
+      !utree_traversal_grow(traversal, 2 * traversal->max_nodes))
+    return PLL_FAILURE;
+
+  traversal->preorder[traversal->node_count++] = node;
+  if (pllmod_utree_is_tip(node))
+  {
+    traversal->postorder[post_count] = node;
+    return PLL_SUCCESS;
+  }
+
+  /* the stack holds (node, next child) pairs */
+  stack = traversal->stack;
+  stack[0] = node;
+  stack[1] = node->next;
+  top = 1;
+
+  while (top)
+  {
+    pll_unode_t * snode = stack[2*top - 1];
+    pll_unode_t * child;
+
+    if (snode == stack[2*top - 2])
+    {
+      traversal->postorder[post_count++] = snode;
+      --top;
+      continue;
+    }
+
+    child = snode->back;
+    stack[2*top - 1] = snode->next;
+
+    if (traversal->node_count == traversal->max_nodes)
+    {
+      if (!utree_traversal_grow(traversal, 2 * traversal->max_nodes))
+        return PLL_FAILURE;
+      stack = traversal->stack;
+    }
+
+    traversal->preorder[traversal->node_count++] = child;
+    if (pllmod_utree_is_tip(child))
+      traversal->postorder[post_count++] = child;
+    else
+    {
+      stack[2*top] = child;
+      stack[2*top + 1] = child->next;
+      ++top;
+    }
+  }
+
+  assert(post_count == traversal->node_count);
+  return PLL_SUCCESS;
+}
+
+/**
+ * Creates a reusable traversal of an unrooted tree
+ *
+ * @param max_nodes expected number of nodes (tips and inner nodes) of the
+ *                  tree. The buffers grow if the tree is larger.
+ *
+ * @return the traversal, or NULL on error
+ */
+PLL_EXPORT pllmod_utree_traversal_t * pllmod_utree_traversal_create(
+                                                        unsigned int max_nodes)
+{
+  pllmod_utree_traversal_t * traversal = (pllmod_utree_traversal_t *)
+                                   calloc(1, sizeof(pllmod_utree_traversal_t));
+
+  if (!traversal)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for traversal\n");
+    return NULL;
+  }
+
+  if (!utree_traversal_grow(traversal, max_nodes ? max_nodes : 64))
+  {
+    pllmod_utree_traversal_destroy(traversal);
+    return NULL;
+  }
+
+  return traversal;
+}
+
+PLL_EXPORT void pllmod_utree_traversal_destroy(
+                                         pllmod_utree_traversal_t * traversal)
+{
+  if (!traversal)
+    return;
+
+  free(traversal->preorder);
+  free(traversal->postorder);
+  free(traversal->stack);
+  free(traversal);
+}
+
+/**
+ * Computes the pre-order and post-order node arrays of the tree rooted at
+ * the edge `root`-`root->back`, in the order in which
+ * pllmod_utree_traverse_apply() calls its pre-order and post-order callbacks.
+ *
+ * The arrays are kept until the traversal is invalidated or a different root
+ * is given, so the caller must call pllmod_utree_traversal_invalidate() after
+ * every topological change.
+ *
+ * @param traversal the traversal
+ * @param root an inner node
+ *
+ * @return PLL_SUCCESS or PLL_FAILURE
+ */
+PLL_EXPORT int pllmod_utree_traversal_update(
+                                         pllmod_utree_traversal_t * traversal,
+                                         pll_unode_t * root)
+{
+  if (!traversal || !root)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Traversal or root is NULL\n");
+    return PLL_FAILURE;
+  }
+
+  if (pllmod_utree_is_tip(root))
+  {
+    pllmod_set_error(PLLMOD_ERROR_INVALID_NODE_TYPE,
+                     "Internal node expected, but tip node was provided");
+    return PLL_FAILURE;
+  }
+
+  if (traversal->valid && traversal->root == root)
+    return PLL_SUCCESS;
+
+  traversal->valid = 0;
+  traversal->node_count = 0;
+  if (!utree_traversal_fill(traversal, root->back) ||
+      !utree_traversal_fill(traversal, root))
+    return PLL_FAILURE;
+
+  traversal->root = root;
+  traversal->valid = 1;
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT void pllmod_utree_traversal_invalidate(
+                                         pllmod_utree_traversal_t * traversal)
+{
+  if (traversal)
+    traversal->valid = 0;
+}
+
 PLL_EXPORT int pllmod_utree_is_tip(const pll_unode_t * node)
 {
   return (node->next == NULL);
@@ -1400,39 +1880,78 @@ PLL_EXPORT int pllmod_utree_set_clv_minimal(pll_unode_t * root,
   return PLL_SUCCESS;
 }
 
+/* explicit-stack version of the recursive traversal, see utree above */
 static int rtree_traverse_apply(pll_rnode_t * node,
                                 int (*cb_pre_trav)(pll_rnode_t *, void *),
                                 int (*cb_in_trav)(pll_rnode_t *, void *),
                                 int (*cb_post_trav)(pll_rnode_t *, void *),
-                                void *data)
+                                void *data,
+                                struct trav_stack_s * stack)
 {
-  int retval = 1;
+  int child_retval;
+  pll_rnode_t * child = node;
 
-  if (cb_pre_trav && !cb_pre_trav(node,  data))
-    return PLL_FAILURE;
+  stack->top = 0;
 
-  if (node->left)
+  while (1)
   {
-    retval &= rtree_traverse_apply(node->left,
-                                   cb_pre_trav,
-                                   cb_in_trav,
-                                   cb_post_trav,
-                                   data);
-
-    if (cb_in_trav && !cb_in_trav(node,  data))
+    child_retval = 1;
+    if (cb_pre_trav && !cb_pre_trav(child, data))
+      child_retval = PLL_FAILURE;
+    else if (!child->left)
+    {
+      if (cb_post_trav)
+        child_retval &= cb_post_trav(child, data);
+    }
+    else if (!trav_stack_push(stack, child, child->left))
       return PLL_FAILURE;
+    else
+      child_retval = -1;
 
-    retval &= rtree_traverse_apply(node->right,
-                                   cb_pre_trav,
-                                   cb_in_trav,
-                                   cb_post_trav,
-                                   data);
-  }
+    child = NULL;
+    while (!child)
+    {
+      struct trav_frame_s * frame;
+      pll_rnode_t * fnode;
 
-  if (cb_post_trav)
-    retval &= cb_post_trav(node,  data);
+      if (child_retval >= 0)
+      {
+        if (!stack->top)
+          return child_retval;
+        stack->frames[stack->top - 1].retval &= child_retval;
+      }
+      child_retval = -1;
 
-  return retval;
+      frame = stack->frames + stack->top - 1;
+      fnode = (pll_rnode_t *) frame->node;
+
+      if (!frame->visited)
+      {
+        /* descend to the left child */
+        frame->visited = 1;
+        child = fnode->left;
+      }
+      else if (frame->cursor == fnode->left)
+      {
+        /* left subtree is done */
+        if (cb_in_trav && !cb_in_trav(fnode, data))
+        {
+          --stack->top;
+          child_retval = PLL_FAILURE;
+          continue;
+        }
+        frame->cursor = fnode->right;
+        child = fnode->right;
+      }
+      else
+      {
+        if (cb_post_trav)
+          frame->retval &= cb_post_trav(fnode, data);
+        child_retval = frame->retval;
+        --stack->top;
+      }
+    }
+  }
 }
 
 PLL_EXPORT int pllmod_rtree_traverse_apply(pll_rnode_t * root,
@@ -1445,6 +1964,7 @@ PLL_EXPORT int pllmod_rtree_traverse_apply(pll_rnode_t * root,
                                            void *data)
 {
   int retval = 1;
+  struct trav_stack_s stack = {NULL, 0, 0};
 
   if (!root->left || !root->right) return PLL_FAILURE;
 
@@ -1452,7 +1972,10 @@ PLL_EXPORT int pllmod_rtree_traverse_apply(pll_rnode_t * root,
                                  cb_pre_trav,
                                  cb_in_trav,
                                  cb_post_trav,
-                                 data);
+                                 data,
+                                 &stack);
+
+  free(stack.frames);
 
   return retval;
 }
@@ -1673,13 +2196,24 @@ static int rtree_rollback_spr(pll_tree_rollback_t * rollback_info)
 
   pll_rnode_t * p = (pll_rnode_t *) rollback_info->SPR.prune_edge;
   pll_rnode_t * r = (pll_rnode_t *) rollback_info->SPR.regraft_edge;
+  pll_rnode_t ** sister_ptr;
+  pll_rnode_t * r_cur;
+
+  /* current sister of `p`, i.e., the branch that was splitted by the move */
+  if (!pllmod_rtree_get_sibling_pointers(p, NULL, &sister_ptr))
+    return PLL_FAILURE;
+  r_cur = *sister_ptr;
 
   /* undo move */
   if (!pllmod_rtree_spr(p, r, 0, 0))
     return PLL_FAILURE;
 
-  //TODO: set branch lengths
-  //
+  /* reset branch lengths */
+  p->length         = rollback_info->SPR.prune_right_bl;
+  p->parent->length = rollback_info->SPR.prune_bl;
+  r->length         = rollback_info->SPR.prune_left_bl;
+  r_cur->length     = rollback_info->SPR.regraft_bl;
+
   return PLL_SUCCESS;
 }
 
@@ -63,6 +63,12 @@
 #define PLLMOD_TREE_REARRANGE_NNI  1
 #define PLLMOD_TREE_REARRANGE_TBR  2
 
+/* tree distances */
+#define PLLMOD_TREE_DISTANCE_RF       0   /* Robinson-Foulds */
+#define PLLMOD_TREE_DISTANCE_WRF      1   /* weighted Robinson-Foulds */
+#define PLLMOD_TREE_DISTANCE_KF       2   /* Kuhner-Felsenstein branch score */
+#define PLLMOD_TREE_DISTANCE_INFO_RF  3   /* information-based RF (bits) */
+
 #define PLLMOD_TREEINFO_PARTITION_ALL -1
 
 #define HASH_KEY_UNDEF ((unsigned int) -1)
@@ -101,6 +107,42 @@ typedef struct
   unsigned int bitv_len;      /* bitv length */
 } bitv_hashtable_t;
 
+/* set of splits stored as sorted lists of tip rank intervals. Every split is
+   represented by the side that does not contain tip 0 */
+typedef struct compact_split_set_t
+{
+  unsigned int tip_count;
+  unsigned int split_count;
+  unsigned int * rank_to_tip;   /* tip node index at every rank */
+  unsigned int * offset;        /* split i: intervals offset[i]..offset[i+1]-1 */
+  unsigned int * interval;      /* first and last rank of every interval */
+  unsigned int * size;          /* number of tips in every split */
+  hash_key_t * key;
+} pll_compact_split_set_t;
+
+/* dictionary mapping distinct normalized splits to dense ids */
+typedef struct split_dict_t
+{
+  unsigned int tip_count;
+  unsigned int split_count;       /* number of distinct splits */
+  unsigned int tree_count;        /* number of trees added */
+  unsigned int capacity;
+  bitv_hashtable_t * hash;
+  bitv_hash_entry_t ** entries;   /* hashtable entry for every split id */
+  unsigned int * frequency;       /* number of trees containing every split */
+} pll_split_dict_t;
+
+/* tree given by the ids of its splits in a split dictionary, together with
+   the branch lengths */
+typedef struct split_dict_tree_t
+{
+  unsigned int tip_count;
+  unsigned int split_count;
+  unsigned int * split_ids;       /* sorted split ids */
+  double * length;                /* branch length of every split */
+  double * tip_length;            /* branch length of every tip */
+} pll_split_dict_tree_t;
+
 typedef struct consensus_data_t
 {
   pll_split_t split;
@@ -263,6 +305,36 @@ typedef struct treeinfo
   void (*parallel_reduce_cb)(void *, double *, size_t, int);
 } pllmod_treeinfo_t;
 
+/* rooted counterpart of treeinfo; branch lengths are linked among partitions */
+typedef struct rtreeinfo
+{
+  // dimensions
+  unsigned int tip_count;
+  unsigned int partition_count;
+  unsigned int node_count;
+
+  pll_rnode_t * root;
+  pll_rtree_t * tree;
+
+  // partitions & partition-specific stuff
+  pll_partition_t ** partitions;
+  unsigned int ** param_indices;
+  double * partition_loglh;
+
+  // invalidation flags
+  char ** clv_valid;
+  char ** pmatrix_valid;
+
+  // buffers
+  pll_rnode_t ** travbuffer;
+  unsigned int * matrix_indices;
+  double * branch_lengths;
+  pll_operation_t * operations;
+
+  // general-purpose counter
+  unsigned int counter;
+} pllmod_rtreeinfo_t;
+
 typedef struct
 {
   unsigned int node_count;
@@ -275,6 +347,90 @@ typedef struct
   double ** probs;
 } pllmod_ancestral_t;
 
+/* parsimony vectors of a partitioned alignment, kept for building several
+   parsimony starting trees */
+typedef struct parsimony_context
+{
+  unsigned int taxon_count;
+  char * const * taxon_names;
+
+  unsigned int partition_count;
+  pll_partition_t * const * partitions;
+  pll_parsimony_t ** parsimony;
+} pllmod_parsimony_context_t;
+
+/* memory blocks holding the nodes, labels and node arrays of unrooted trees,
+   released all at once */
+typedef struct utree_arena
+{
+  char * block;
+  size_t block_size;
+  size_t block_used;
+  size_t total_size;
+} pllmod_utree_arena_t;
+
+/* pre-order and post-order node arrays of an unrooted tree, kept until the
+   topology changes */
+typedef struct utree_traversal
+{
+  unsigned int node_count;
+  unsigned int max_nodes;
+  pll_unode_t ** preorder;
+  pll_unode_t ** postorder;
+  pll_unode_t ** stack;
+
+  pll_unode_t * root;
+  int valid;
+} pllmod_utree_traversal_t;
+
+/* topology fingerprint: XOR of the hashes of all splits */
+typedef unsigned long long pllmod_fingerprint_t;
+
+typedef struct utree_fingerprint
+{
+  unsigned int tip_count;
+  unsigned int node_count;
+  pllmod_fingerprint_t all_tips;
+  pllmod_fingerprint_t * tip_keys;
+
+  /* fingerprint of the tracked tree, see pllmod_utree_fingerprint_compute() */
+  pllmod_fingerprint_t fingerprint;
+
+  /* per node (node_index) of the tracked tree: XOR of the keys of the tips
+     on the side of the node, i.e., away from node->back */
+  pllmod_fingerprint_t * subtree_hash;
+
+  /* SPR neighborhood of `prune_edge`, see pllmod_utree_fingerprint_spr() */
+  pll_unode_t * prune_edge;
+  pllmod_fingerprint_t pruned_hash;     /* tips outside the pruned subtree */
+  unsigned int spr_stamp;
+  pllmod_fingerprint_t * spr_fp;        /* per node (node_index) */
+  pll_unode_t ** spr_parent;            /* next edge towards `prune_edge` */
+  unsigned int * spr_node_stamp;        /* == spr_stamp if in neighborhood */
+
+  pllmod_utree_traversal_t * traversal;
+} pllmod_utree_fingerprint_t;
+
+typedef struct topology_cache_entry
+{
+  pllmod_fingerprint_t fingerprint;
+  double score;
+  unsigned int generation;            /* 0 = empty slot */
+} pllmod_topology_cache_entry_t;
+
+/* bounded, direct-mapped cache of scored topologies */
+typedef struct topology_cache
+{
+  unsigned int capacity;
+  unsigned int max_age;
+  unsigned int generation;
+  pllmod_topology_cache_entry_t * entries;
+
+  /* statistics */
+  unsigned long lookups;
+  unsigned long hits;
+} pllmod_topology_cache_t;
+
 /* Topological rearrangements */
 /* functions at pll_tree.c */
 
@@ -380,6 +536,12 @@ PLL_EXPORT pll_utree_t * pllmod_utree_create_random(unsigned int taxa_count,
                                                     const char * const* names,
                                                     unsigned int random_seed);
 
+PLL_EXPORT pll_utree_t * pllmod_utree_arena_create_random(
+                                                  pllmod_utree_arena_t * arena,
+                                                  unsigned int taxa_count,
+                                                  const char * const* names,
+                                                  unsigned int random_seed);
+
 PLL_EXPORT int pllmod_utree_extend_random(pll_utree_t * tree,
                                           unsigned int ext_taxa_count,
                                           const char * const* ext_names,
@@ -404,6 +566,120 @@ pll_utree_t * pllmod_utree_create_parsimony_multipart(unsigned int taxon_count,
                                                       unsigned int random_seed,
                                                       unsigned int * score);
 
+PLL_EXPORT pllmod_parsimony_context_t * pllmod_utree_parsimony_context_create(
+                                      unsigned int taxon_count,
+                                      char * const * taxon_names,
+                                      unsigned int partition_count,
+                                      pll_partition_t * const * partitions);
+
+PLL_EXPORT void pllmod_utree_parsimony_context_destroy(
+                                      pllmod_parsimony_context_t * context);
+
+PLL_EXPORT pll_utree_t * pllmod_utree_parsimony_context_tree(
+                                      pllmod_parsimony_context_t * context,
+                                      unsigned int random_seed,
+                                      unsigned int * score);
+
+PLL_EXPORT int pllmod_utree_parsimony_context_trees(
+                                      pllmod_parsimony_context_t * context,
+                                      const unsigned int * random_seeds,
+                                      unsigned int tree_count,
+                                      pll_utree_t ** trees,
+                                      unsigned int * scores);
+
+/* functions at utree_parsimony.c */
+
+PLL_EXPORT int pllmod_utree_parsimony_score(pllmod_parsimony_context_t * context,
+                                            const pll_utree_t * tree,
+                                            unsigned int * score);
+
+PLL_EXPORT int pllmod_utree_parsimony_spr(pllmod_parsimony_context_t * context,
+                                          pll_utree_t * tree,
+                                          unsigned int radius,
+                                          unsigned int * score);
+
+PLL_EXPORT pll_utree_t * pllmod_utree_parsimony_ratchet(
+                                        pllmod_parsimony_context_t * context,
+                                        const pll_utree_t * tree,
+                                        unsigned int iterations,
+                                        unsigned int radius,
+                                        unsigned int random_seed,
+                                        unsigned int * score);
+
+
+/* functions at utree_arena.c */
+
+PLL_EXPORT pllmod_utree_arena_t * pllmod_utree_arena_create(
+                                                       unsigned int tip_count);
+
+PLL_EXPORT int pllmod_utree_arena_reset(pllmod_utree_arena_t * arena);
+
+PLL_EXPORT void pllmod_utree_arena_destroy(pllmod_utree_arena_t * arena);
+
+PLL_EXPORT pll_unode_t * pllmod_utree_arena_create_tip(
+                                                  pllmod_utree_arena_t * arena,
+                                                  unsigned int clv_index,
+                                                  const char * label,
+                                                  void * data);
+
+PLL_EXPORT pll_unode_t * pllmod_utree_arena_create_node(
+                                                  pllmod_utree_arena_t * arena,
+                                                  unsigned int clv_index,
+                                                  int scaler_index,
+                                                  const char * label,
+                                                  void * data);
+
+PLL_EXPORT pll_utree_t * pllmod_utree_arena_wraptree(
+                                                  pllmod_utree_arena_t * arena,
+                                                  pll_unode_t * root,
+                                                  unsigned int tip_count);
+
+PLL_EXPORT pll_utree_t * pllmod_utree_arena_clone(pllmod_utree_arena_t * arena,
+                                                  const pll_utree_t * tree);
+
+/* functions at utree_fingerprint.c */
+
+PLL_EXPORT pllmod_utree_fingerprint_t * pllmod_utree_fingerprint_create(
+                                                        unsigned int tip_count,
+                                                        unsigned int seed);
+
+PLL_EXPORT void pllmod_utree_fingerprint_destroy(pllmod_utree_fingerprint_t * fp);
+
+PLL_EXPORT pllmod_fingerprint_t pllmod_utree_fingerprint_compute(
+                                              pllmod_utree_fingerprint_t * fp,
+                                              pll_unode_t * root);
+
+PLL_EXPORT pllmod_fingerprint_t pllmod_utree_fingerprint_spr(
+                                              pllmod_utree_fingerprint_t * fp,
+                                              pll_unode_t * p_edge,
+                                              unsigned int radius);
+
+PLL_EXPORT int pllmod_utree_fingerprint_spr_descend(
+                                              pllmod_utree_fingerprint_t * fp,
+                                              pll_unode_t * r_edge);
+
+PLL_EXPORT pllmod_fingerprint_t pllmod_utree_fingerprint_spr_apply(
+                                              pllmod_utree_fingerprint_t * fp,
+                                              pll_unode_t * r_edge);
+
+PLL_EXPORT pllmod_topology_cache_t * pllmod_topology_cache_create(
+                                                        unsigned int capacity,
+                                                        unsigned int max_age);
+
+PLL_EXPORT void pllmod_topology_cache_destroy(pllmod_topology_cache_t * cache);
+
+PLL_EXPORT void pllmod_topology_cache_clear(pllmod_topology_cache_t * cache);
+
+PLL_EXPORT void pllmod_topology_cache_next_generation(
+                                              pllmod_topology_cache_t * cache);
+
+PLL_EXPORT void pllmod_topology_cache_insert(pllmod_topology_cache_t * cache,
+                                             pllmod_fingerprint_t fingerprint,
+                                             double score);
+
+PLL_EXPORT int pllmod_topology_cache_lookup(pllmod_topology_cache_t * cache,
+                                            pllmod_fingerprint_t fingerprint,
+                                            double * score);
 
 /* Discrete operations */
 /* functions at utree_distances.c */
@@ -412,6 +688,11 @@ PLL_EXPORT unsigned int pllmod_utree_rf_distance(pll_unode_t * t1,
                                                  pll_unode_t * t2,
                                                  unsigned int tip_count);
 
+/* linear-time RF distance without split bitvectors (Day, 1985) */
+PLL_EXPORT unsigned int pllmod_utree_rf_distance_day(pll_unode_t * t1,
+                                                     pll_unode_t * t2,
+                                                     unsigned int tip_count);
+
 /* check that node ids and tip labels agree in both trees */
 PLL_EXPORT int pllmod_utree_consistency_check(pll_utree_t * t1,
                                               pll_utree_t * t2);
@@ -480,6 +761,128 @@ pllmod_utree_split_hashtable_lookup(bitv_hashtable_t * splits_hash,
 PLL_EXPORT
 void pllmod_utree_split_hashtable_destroy(bitv_hashtable_t * hash);
 
+/* compact splits for large trees */
+
+PLL_EXPORT int pllmod_utree_split_tip_ranks(const pll_unode_t * tree,
+                                            unsigned int tip_count,
+                                            unsigned int * tip_rank);
+
+PLL_EXPORT
+pll_compact_split_set_t * pllmod_utree_compact_split_create(
+                                          const pll_unode_t * tree,
+                                          unsigned int tip_count,
+                                          const unsigned int * tip_rank,
+                                          pll_unode_t ** split_to_node_map);
+
+PLL_EXPORT int pllmod_utree_compact_split_equal(
+                                      const pll_compact_split_set_t * set1,
+                                      unsigned int split1,
+                                      const pll_compact_split_set_t * set2,
+                                      unsigned int split2);
+
+PLL_EXPORT unsigned int pllmod_utree_compact_split_lightside(
+                                        const pll_compact_split_set_t * set,
+                                        unsigned int split);
+
+PLL_EXPORT unsigned int pllmod_utree_compact_split_hamming_distance(
+                                      const pll_compact_split_set_t * set1,
+                                      unsigned int split1,
+                                      const pll_compact_split_set_t * set2,
+                                      unsigned int split2);
+
+PLL_EXPORT void pllmod_utree_compact_split_get(
+                                        const pll_compact_split_set_t * set,
+                                        unsigned int split,
+                                        pll_split_t bitv);
+
+PLL_EXPORT unsigned int pllmod_utree_compact_split_rf_distance(
+                                      const pll_compact_split_set_t * set1,
+                                      const pll_compact_split_set_t * set2);
+
+PLL_EXPORT bitv_hashtable_t *
+pllmod_utree_split_hashtable_insert_compact(bitv_hashtable_t * splits_hash,
+                                            const pll_compact_split_set_t * set,
+                                            const double * support,
+                                            int update_only);
+
+PLL_EXPORT void pllmod_utree_compact_split_destroy(pll_compact_split_set_t * set);
+
+
+/* functions at split_dictionary.c */
+
+PLL_EXPORT pll_split_dict_t * pllmod_utree_split_dict_create(
+                                                      unsigned int tip_count,
+                                                      unsigned int slot_count);
+
+PLL_EXPORT unsigned int pllmod_utree_split_dict_insert(pll_split_dict_t * dict,
+                                                       pll_split_t split);
+
+PLL_EXPORT unsigned int pllmod_utree_split_dict_lookup(
+                                                const pll_split_dict_t * dict,
+                                                pll_split_t split);
+
+PLL_EXPORT pll_split_t pllmod_utree_split_dict_get(const pll_split_dict_t * dict,
+                                                   unsigned int split_id);
+
+PLL_EXPORT unsigned int * pllmod_utree_split_dict_add_splits(
+                                                      pll_split_dict_t * dict,
+                                                      pll_split_t * splits,
+                                                      unsigned int split_count);
+
+PLL_EXPORT unsigned int * pllmod_utree_split_dict_add_tree(
+                                                    pll_split_dict_t * dict,
+                                                    const pll_unode_t * tree,
+                                                    unsigned int * split_count);
+
+PLL_EXPORT unsigned int * pllmod_utree_split_dict_add_compact(
+                                        pll_split_dict_t * dict,
+                                        const pll_compact_split_set_t * set);
+
+PLL_EXPORT unsigned int pllmod_utree_split_ids_intersect(
+                                                const unsigned int * ids1,
+                                                unsigned int count1,
+                                                const unsigned int * ids2,
+                                                unsigned int count2,
+                                                unsigned int * common);
+
+PLL_EXPORT unsigned int pllmod_utree_split_ids_rf_distance(
+                                                const unsigned int * ids1,
+                                                unsigned int count1,
+                                                const unsigned int * ids2,
+                                                unsigned int count2);
+
+PLL_EXPORT pll_split_system_t * pllmod_utree_split_dict_consensus(
+                                                const pll_split_dict_t * dict,
+                                                double threshold);
+
+PLL_EXPORT void * pllmod_utree_split_dict_serialize(const pll_split_dict_t * dict,
+                                                    size_t * size);
+
+PLL_EXPORT pll_split_dict_t * pllmod_utree_split_dict_deserialize(
+                                                            const void * data,
+                                                            size_t size);
+
+PLL_EXPORT void pllmod_utree_split_dict_destroy(pll_split_dict_t * dict);
+
+PLL_EXPORT pll_split_dict_tree_t * pllmod_utree_split_dict_tree_create(
+                                                    pll_split_dict_t * dict,
+                                                    const pll_unode_t * tree);
+
+PLL_EXPORT void pllmod_utree_split_dict_tree_destroy(
+                                                pll_split_dict_tree_t * tree);
+
+PLL_EXPORT double pllmod_utree_split_dict_distance(
+                                            const pll_split_dict_t * dict,
+                                            const pll_split_dict_tree_t * t1,
+                                            const pll_split_dict_tree_t * t2,
+                                            int distance_type);
+
+PLL_EXPORT int pllmod_utree_split_dict_distance_matrix(
+                                          const pll_split_dict_t * dict,
+                                          pll_split_dict_tree_t ** trees,
+                                          unsigned int tree_count,
+                                          int distance_type,
+                                          double * matrix);
 
 /* functions in consensus.c */
 
@@ -529,6 +932,19 @@ PLL_EXPORT int pllmod_utree_traverse_apply(pll_unode_t * root,
                                                             void *),
                                         void *data);
 
+PLL_EXPORT pllmod_utree_traversal_t * pllmod_utree_traversal_create(
+                                                       unsigned int max_nodes);
+
+PLL_EXPORT void pllmod_utree_traversal_destroy(
+                                        pllmod_utree_traversal_t * traversal);
+
+PLL_EXPORT int pllmod_utree_traversal_update(
+                                        pllmod_utree_traversal_t * traversal,
+                                        pll_unode_t * root);
+
+PLL_EXPORT void pllmod_utree_traversal_invalidate(
+                                        pllmod_utree_traversal_t * traversal);
+
 PLL_EXPORT int pllmod_utree_is_tip(const pll_unode_t * node);
 
 PLL_EXPORT void pllmod_utree_set_length(pll_unode_t * edge,
@@ -701,6 +1117,39 @@ PLL_EXPORT pllmod_ancestral_t * pllmod_treeinfo_compute_ancestral(pllmod_treeinf
 
 PLL_EXPORT void pllmod_treeinfo_destroy_ancestral(pllmod_ancestral_t * ancestral);
 
+/* rtreeinfo */
+
+PLL_EXPORT pllmod_rtreeinfo_t * pllmod_rtreeinfo_create(pll_rnode_t * root,
+                                                        unsigned int tips,
+                                                        unsigned int partitions);
+
+PLL_EXPORT int pllmod_rtreeinfo_init_partition(pllmod_rtreeinfo_t * rtreeinfo,
+                                               unsigned int partition_index,
+                                               pll_partition_t * partition,
+                                               const unsigned int * param_indices);
+
+PLL_EXPORT void pllmod_rtreeinfo_destroy(pllmod_rtreeinfo_t * rtreeinfo);
+
+PLL_EXPORT int pllmod_rtreeinfo_set_root(pllmod_rtreeinfo_t * rtreeinfo,
+                                         pll_rnode_t * root);
+
+PLL_EXPORT
+int pllmod_rtreeinfo_set_branch_length(pllmod_rtreeinfo_t * rtreeinfo,
+                                       pll_rnode_t * node,
+                                       double length);
+
+PLL_EXPORT void pllmod_rtreeinfo_invalidate_clv(pllmod_rtreeinfo_t * rtreeinfo,
+                                                const pll_rnode_t * node);
+
+PLL_EXPORT
+void pllmod_rtreeinfo_invalidate_pmatrix(pllmod_rtreeinfo_t * rtreeinfo,
+                                         const pll_rnode_t * node);
+
+PLL_EXPORT void pllmod_rtreeinfo_invalidate_all(pllmod_rtreeinfo_t * rtreeinfo);
+
+PLL_EXPORT double pllmod_rtreeinfo_compute_loglh(pllmod_rtreeinfo_t * rtreeinfo,
+                                                 int incremental);
+
 /* tbe_functions.c */
 
 typedef struct refsplit_info
@@ -732,4 +1181,28 @@ PLL_EXPORT int pllmod_utree_tbe_naive(pll_split_t * ref_splits,
                                       unsigned int tip_count,
                                       double * support);
 
+/* Cache-blocked version of the naive method for any number of splits (e.g.,
+ * multifurcating bootstrap trees). The context holds the bootstrap data
+ * shared by all callers; `thread_count` threads can then call
+ * pllmod_utree_tbe_naive_blocked concurrently, each of them computing a
+ * subset of `support` */
+typedef struct pllmod_tbe_naive_context pllmod_tbe_naive_context_t;
+
+PLL_EXPORT
+pllmod_tbe_naive_context_t * pllmod_utree_tbe_naive_context_create(
+                                                  pll_split_t * ref_splits,
+                                                  unsigned int ref_count,
+                                                  pll_split_t * bs_splits,
+                                                  unsigned int bs_count,
+                                                  unsigned int tip_count);
+
+PLL_EXPORT
+void pllmod_utree_tbe_naive_context_destroy(pllmod_tbe_naive_context_t * ctx);
+
+PLL_EXPORT int pllmod_utree_tbe_naive_blocked(
+                                      const pllmod_tbe_naive_context_t * ctx,
+                                      unsigned int thread_id,
+                                      unsigned int thread_count,
+                                      double * support);
+
 #endif /* PLL_TREE_H_ */
@@ -230,11 +230,10 @@ PLL_EXPORT int pllmod_rtree_spr(pll_rnode_t * p_node,
     rollback_info->rooted             = 1;
     rollback_info->SPR.prune_edge     = (void *) p_node;
     rollback_info->SPR.regraft_edge   = (void *) *sister_ptr;
-    //TODO: Set branch lengths
-    // rollback_info->SPR.prune_bl       = p_edge->parent->length;
-    // rollback_info->SPR.prune_left_bl  = (*sister)->length;
-    // rollback_info->SPR.prune_right_bl = p_edge->->length;
-    // rollback_info->SPR.regraft_bl     = r_tree->length;
+    rollback_info->SPR.prune_bl       = p_node->parent->length;
+    rollback_info->SPR.prune_left_bl  = (*sister_ptr)->length;
+    rollback_info->SPR.prune_right_bl = p_node->length;
+    rollback_info->SPR.regraft_bl     = r_tree->length;
   }
 
   if (pllmod_rtree_prune(p_node) == NULL)
@@ -0,0 +1,417 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Heidelberg Institute for Theoretical Studies,
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+ /**
+  * @file rtreeinfo.c
+  *
+  * @brief Global tree information for rooted trees
+  *
+  * Rooted counterpart of treeinfo.c. Each node has a single CLV, which
+  * depends on the subtree below it, so changing a node invalidates the CLVs
+  * of all its ancestors. The likelihood is evaluated at the root, which
+  * allows using non-reversible models. Branch lengths are shared among
+  * partitions.
+  *
+  * @author Alexey Kozlov
+  */
+
+#include "pll_tree.h"
+
+#include "../pllmod_common.h"
+
+static int cb_rtree_full_traversal(pll_rnode_t * node)
+{
+  PLLMOD_UNUSED(node);
+  return PLL_SUCCESS;
+}
+
+/* a callback function for performing a partial traversal on invalid CLVs */
+static int cb_rtree_partial_traversal(pll_rnode_t * node)
+{
+  unsigned int p;
+  pllmod_rtreeinfo_t * rtreeinfo = (pllmod_rtreeinfo_t *) node->data;
+
+  /* do not include tips */
+  if (!node->left) return PLL_FAILURE;
+
+  /* if at least one per-partition CLV is invalid, traverse the subtree */
+  for (p = 0; p < rtreeinfo->partition_count; ++p)
+  {
+    if (rtreeinfo->partitions[p] &&
+        !rtreeinfo->clv_valid[p][node->node_index])
+      return PLL_SUCCESS;
+  }
+
+  /* CLVs for all partitions are valid -> skip subtree */
+  return PLL_FAILURE;
+}
+
+PLL_EXPORT pllmod_rtreeinfo_t * pllmod_rtreeinfo_create(pll_rnode_t * root,
+                                                        unsigned int tips,
+                                                        unsigned int partitions)
+{
+  unsigned int i;
+  pllmod_rtreeinfo_t * rtreeinfo;
+
+  if (!root || root->parent || !root->left || tips < 2)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Root must be an inner node without parent\n");
+    return NULL;
+  }
+
+  if (!(rtreeinfo =
+          (pllmod_rtreeinfo_t *) calloc(1, sizeof(pllmod_rtreeinfo_t))))
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for rtreeinfo\n");
+    return NULL;
+  }
+
+  /* save dimensions */
+  rtreeinfo->tip_count = tips;
+  rtreeinfo->partition_count = partitions;
+  rtreeinfo->node_count = 2 * tips - 1;
+  rtreeinfo->root = root;
+
+  /* create pll_rtree structure and store it in rtreeinfo */
+  rtreeinfo->tree = pll_rtree_wraptree(root, tips);
+  if (!rtreeinfo->tree)
+  {
+    assert(pll_errno);
+    free(rtreeinfo);
+    return NULL;
+  }
+
+  rtreeinfo->travbuffer = (pll_rnode_t **) malloc(
+                            rtreeinfo->node_count * sizeof(pll_rnode_t *));
+  rtreeinfo->matrix_indices = (unsigned int *) malloc(
+                            rtreeinfo->node_count * sizeof(unsigned int));
+  rtreeinfo->branch_lengths = (double *) malloc(
+                            rtreeinfo->node_count * sizeof(double));
+  rtreeinfo->operations = (pll_operation_t *) malloc(
+                            (tips - 1) * sizeof(pll_operation_t));
+
+  rtreeinfo->partitions = (pll_partition_t **) calloc(partitions,
+                                                      sizeof(pll_partition_t *));
+  rtreeinfo->param_indices = (unsigned int **) calloc(partitions,
+                                                      sizeof(unsigned int *));
+  rtreeinfo->clv_valid = (char **) calloc(partitions, sizeof(char *));
+  rtreeinfo->pmatrix_valid = (char **) calloc(partitions, sizeof(char *));
+  rtreeinfo->partition_loglh = (double *) calloc(partitions, sizeof(double));
+
+  if (!rtreeinfo->travbuffer || !rtreeinfo->matrix_indices ||
+      !rtreeinfo->branch_lengths || !rtreeinfo->operations ||
+      !rtreeinfo->partitions || !rtreeinfo->param_indices ||
+      !rtreeinfo->clv_valid || !rtreeinfo->pmatrix_valid ||
+      !rtreeinfo->partition_loglh)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for rtreeinfo structures\n");
+    pllmod_rtreeinfo_destroy(rtreeinfo);
+    return NULL;
+  }
+
+  /* the partial traversal callback reaches rtreeinfo through the nodes */
+  for (i = 0; i < rtreeinfo->node_count; ++i)
+    rtreeinfo->tree->nodes[i]->data = rtreeinfo;
+
+  return rtreeinfo;
+}
+
+PLL_EXPORT int pllmod_rtreeinfo_init_partition(pllmod_rtreeinfo_t * rtreeinfo,
+                                               unsigned int partition_index,
+                                               pll_partition_t * partition,
+                                               const unsigned int * param_indices)
+{
+  if (!rtreeinfo || !partition)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+              "Rtreeinfo structure or partition is NULL\n");
+    return PLL_FAILURE;
+  }
+  else if (partition_index >= rtreeinfo->partition_count)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+              "Partition %d is out of bounds\n", partition_index);
+    return PLL_FAILURE;
+  }
+  else if (rtreeinfo->partitions[partition_index])
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+              "Partition %d is already initialized\n", partition_index);
+    return PLL_FAILURE;
+  }
+
+  /* allocate invalidation arrays, indexed by node and pmatrix index */
+  rtreeinfo->clv_valid[partition_index] =
+      (char *) calloc(rtreeinfo->node_count, sizeof(char));
+  rtreeinfo->pmatrix_valid[partition_index] =
+      (char *) calloc(rtreeinfo->node_count, sizeof(char));
+
+  /* per default, all rate categories use the same parameters */
+  rtreeinfo->param_indices[partition_index] =
+    (unsigned int *) calloc(partition->rate_cats, sizeof(unsigned int));
+
+  if (!rtreeinfo->clv_valid[partition_index] ||
+      !rtreeinfo->pmatrix_valid[partition_index] ||
+      !rtreeinfo->param_indices[partition_index])
+  {
+    free(rtreeinfo->clv_valid[partition_index]);
+    free(rtreeinfo->pmatrix_valid[partition_index]);
+    free(rtreeinfo->param_indices[partition_index]);
+    rtreeinfo->clv_valid[partition_index] = NULL;
+    rtreeinfo->pmatrix_valid[partition_index] = NULL;
+    rtreeinfo->param_indices[partition_index] = NULL;
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for partition %d\n",
+                     partition_index);
+    return PLL_FAILURE;
+  }
+
+  if (param_indices)
+    memcpy(rtreeinfo->param_indices[partition_index],
+           param_indices,
+           partition->rate_cats * sizeof(unsigned int));
+
+  rtreeinfo->partitions[partition_index] = partition;
+
+  return PLL_SUCCESS;
+}
+
+PLL_EXPORT void pllmod_rtreeinfo_destroy(pllmod_rtreeinfo_t * rtreeinfo)
+{
+  unsigned int p;
+
+  if (!rtreeinfo) return;
+
+  for (p = 0; p < rtreeinfo->partition_count; ++p)
+  {
+    if (rtreeinfo->clv_valid)
+      free(rtreeinfo->clv_valid[p]);
+    if (rtreeinfo->pmatrix_valid)
+      free(rtreeinfo->pmatrix_valid[p]);
+    if (rtreeinfo->param_indices)
+      free(rtreeinfo->param_indices[p]);
+  }
+
+  free(rtreeinfo->clv_valid);
+  free(rtreeinfo->pmatrix_valid);
+  free(rtreeinfo->param_indices);
+  free(rtreeinfo->partitions);
+  free(rtreeinfo->partition_loglh);
+
+  free(rtreeinfo->travbuffer);
+  free(rtreeinfo->matrix_indices);
+  free(rtreeinfo->branch_lengths);
+  free(rtreeinfo->operations);
+
+  if (rtreeinfo->tree)
+  {
+    free(rtreeinfo->tree->nodes);
+    free(rtreeinfo->tree);
+  }
+
+  free(rtreeinfo);
+}
+
+PLL_EXPORT int pllmod_rtreeinfo_set_root(pllmod_rtreeinfo_t * rtreeinfo,
+                                         pll_rnode_t * root)
+{
+  if (!rtreeinfo || !root || root->parent || !root->left)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Invalid root node!\n");
+    return PLL_FAILURE;
+  }
+
+  rtreeinfo->root = root;
+  rtreeinfo->tree->root = root;
+
+  return PLL_SUCCESS;
+}
+
+/* invalidates the CLVs of `node` and all its ancestors */
+PLL_EXPORT void pllmod_rtreeinfo_invalidate_clv(pllmod_rtreeinfo_t * rtreeinfo,
+                                                const pll_rnode_t * node)
+{
+  unsigned int p;
+
+  for (; node; node = node->parent)
+  {
+    for (p = 0; p < rtreeinfo->partition_count; ++p)
+    {
+      if (rtreeinfo->clv_valid[p])
+        rtreeinfo->clv_valid[p][node->node_index] = 0;
+    }
+  }
+}
+
+PLL_EXPORT
+void pllmod_rtreeinfo_invalidate_pmatrix(pllmod_rtreeinfo_t * rtreeinfo,
+                                         const pll_rnode_t * node)
+{
+  unsigned int p;
+
+  for (p = 0; p < rtreeinfo->partition_count; ++p)
+  {
+    if (rtreeinfo->pmatrix_valid[p])
+      rtreeinfo->pmatrix_valid[p][node->pmatrix_index] = 0;
+  }
+}
+
+PLL_EXPORT void pllmod_rtreeinfo_invalidate_all(pllmod_rtreeinfo_t * rtreeinfo)
+{
+  unsigned int p;
+
+  for (p = 0; p < rtreeinfo->partition_count; ++p)
+  {
+    if (rtreeinfo->clv_valid[p])
+      memset(rtreeinfo->clv_valid[p], 0, rtreeinfo->node_count * sizeof(char));
+    if (rtreeinfo->pmatrix_valid[p])
+      memset(rtreeinfo->pmatrix_valid[p], 0,
+             rtreeinfo->node_count * sizeof(char));
+  }
+}
+
+/* sets the length of the branch above `node`, and invalidates its p-matrix
+ * and the CLVs that depend on it */
+PLL_EXPORT
+int pllmod_rtreeinfo_set_branch_length(pllmod_rtreeinfo_t * rtreeinfo,
+                                       pll_rnode_t * node,
+                                       double length)
+{
+  node->length = length;
+
+  pllmod_rtreeinfo_invalidate_pmatrix(rtreeinfo, node);
+  if (node->parent)
+    pllmod_rtreeinfo_invalidate_clv(rtreeinfo, node->parent);
+
+  return PLL_SUCCESS;
+}
+
+/**
+ * Computes the log-likelihood of the rooted tree at its root.
+ *
+ * @param rtreeinfo the rooted tree information structure
+ * @param incremental if true, only invalid p-matrices and CLVs are
+ *                    recomputed
+ *
+ * @return the log-likelihood of the tree
+ */
+PLL_EXPORT double pllmod_rtreeinfo_compute_loglh(pllmod_rtreeinfo_t * rtreeinfo,
+                                                 int incremental)
+{
+  unsigned int i, p;
+  unsigned int traversal_size;
+  unsigned int ops_count;
+  double total_loglh = 0.0;
+  pll_rnode_t * root = rtreeinfo->root;
+
+  /* tree root must be an inner node! */
+  assert(root->left && !root->parent);
+
+  if (!pll_rtree_traverse(root,
+                          PLL_TREE_TRAVERSE_POSTORDER,
+                          incremental ? cb_rtree_partial_traversal :
+                                        cb_rtree_full_traversal,
+                          rtreeinfo->travbuffer,
+                          &traversal_size))
+    return (double) NAN;
+
+  pll_rtree_create_operations(rtreeinfo->travbuffer,
+                              traversal_size,
+                              NULL,
+                              NULL,
+                              rtreeinfo->operations,
+                              NULL,
+                              &ops_count);
+
+  rtreeinfo->counter += ops_count;
+
+  for (p = 0; p < rtreeinfo->partition_count; ++p)
+  {
+    pll_partition_t * partition = rtreeinfo->partitions[p];
+    char * pmatrix_valid = rtreeinfo->pmatrix_valid[p];
+    unsigned int matrix_count = 0;
+
+    if (!partition)
+    {
+      rtreeinfo->partition_loglh[p] = 0.0;
+      continue;
+    }
+
+    /* update the p-matrices of the children of the recomputed nodes */
+    for (i = 0; i < traversal_size; ++i)
+    {
+      const pll_rnode_t * node = rtreeinfo->travbuffer[i];
+      const pll_rnode_t * children[2];
+      unsigned int c;
+
+      if (!node->left)
+        continue;
+
+      children[0] = node->left;
+      children[1] = node->right;
+      for (c = 0; c < 2; ++c)
+      {
+        unsigned int pmatrix_index = children[c]->pmatrix_index;
+        if (!incremental || !pmatrix_valid[pmatrix_index])
+        {
+          rtreeinfo->matrix_indices[matrix_count] = pmatrix_index;
+          rtreeinfo->branch_lengths[matrix_count] = children[c]->length;
+          pmatrix_valid[pmatrix_index] = 1;
+          matrix_count++;
+        }
+      }
+    }
+
+    if (matrix_count)
+    {
+      if (!pll_update_prob_matrices(partition,
+                                    rtreeinfo->param_indices[p],
+                                    rtreeinfo->matrix_indices,
+                                    rtreeinfo->branch_lengths,
+                                    matrix_count))
+        return (double) NAN;
+    }
+
+    pll_update_partials(partition, rtreeinfo->operations, ops_count);
+
+    for (i = 0; i < traversal_size; ++i)
+    {
+      const pll_rnode_t * node = rtreeinfo->travbuffer[i];
+      if (node->left)
+        rtreeinfo->clv_valid[p][node->node_index] = 1;
+    }
+
+    rtreeinfo->partition_loglh[p] =
+        pll_compute_root_loglikelihood(partition,
+                                       root->clv_index,
+                                       root->scaler_index,
+                                       rtreeinfo->param_indices[p],
+                                       NULL);
+  }
+
+  for (p = 0; p < rtreeinfo->partition_count; ++p)
+    total_loglh += rtreeinfo->partition_loglh[p];
+
+  return total_loglh;
+}
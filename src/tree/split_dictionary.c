@@ -0,0 +1,1004 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Heidelberg Institute for Theoretical Studies,
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+ /**
+  * @file split_dictionary.c
+  *
+  * @brief Dictionary of splits shared among a set of trees
+  *
+  * Every distinct normalized split is hashed once and gets a dense integer
+  * id. Trees are then represented as sorted vectors of split ids, such that
+  * RF distances, intersections and split frequencies are integer set
+  * operations.
+  *
+  * @author Alexey Kozlov
+  */
+
+#include "pll_tree.h"
+#include "tree_hashtable.h"
+
+#include "../pllmod_common.h"
+
+#define SPLIT_DICT_MIN_CAPACITY 64
+
+static int dict_reserve(pll_split_dict_t * dict, unsigned int capacity);
+static int dict_insert(pll_split_dict_t * dict,
+                       pll_split_t split,
+                       unsigned int * split_id);
+static int _cmp_split_ids(const void * a, const void * b);
+static int _cmp_split_id_length(const void * a, const void * b);
+static double split_info_content(const pll_split_dict_t * dict,
+                                 unsigned int split_id);
+static int check_distance_params(const pll_split_dict_t * dict,
+                                 const pll_split_dict_tree_t * tree,
+                                 int distance_type);
+
+struct split_id_length
+{
+  unsigned int split_id;
+  double length;
+};
+
+/**
+ * Creates an empty split dictionary
+ *
+ * @param tip_count  number of tips
+ * @param slot_count number of hashtable slots, 0 for default
+ *
+ * @return the new dictionary, or NULL on error (check pll_errmsg)
+ */
+PLL_EXPORT pll_split_dict_t * pllmod_utree_split_dict_create(
+                                                      unsigned int tip_count,
+                                                      unsigned int slot_count)
+{
+  pll_split_dict_t * dict;
+
+  if (!slot_count)
+    slot_count = tip_count * 10;
+
+  dict = (pll_split_dict_t *) calloc(1, sizeof(pll_split_dict_t));
+  if (!dict)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for split dictionary\n");
+    return NULL;
+  }
+
+  dict->tip_count = tip_count;
+  dict->hash = hash_init(slot_count, tip_count);
+  if (!dict->hash || !dict_reserve(dict, SPLIT_DICT_MIN_CAPACITY))
+  {
+    pllmod_utree_split_dict_destroy(dict);
+    return NULL;
+  }
+
+  return dict;
+}
+
+/**
+ * Returns the id of a split, inserting it into the dictionary if needed
+ *
+ * @param dict  split dictionary
+ * @param split normalized split
+ *
+ * @return the split id, or HASH_KEY_UNDEF on error (check pll_errmsg)
+ */
+PLL_EXPORT unsigned int pllmod_utree_split_dict_insert(pll_split_dict_t * dict,
+                                                       pll_split_t split)
+{
+  unsigned int split_id;
+
+  if (!dict_insert(dict, split, &split_id))
+    return HASH_KEY_UNDEF;
+
+  return split_id;
+}
+
+/**
+ * Looks up a split in the dictionary
+ *
+ * @param dict  split dictionary
+ * @param split normalized split
+ *
+ * @return the split id, or HASH_KEY_UNDEF if the split is not in `dict`
+ */
+PLL_EXPORT unsigned int pllmod_utree_split_dict_lookup(
+                                                const pll_split_dict_t * dict,
+                                                pll_split_t split)
+{
+  bitv_hash_entry_t * e = pllmod_utree_split_hashtable_lookup(dict->hash,
+                                                              split,
+                                                              dict->tip_count);
+
+  return e ? e->bip_number : HASH_KEY_UNDEF;
+}
+
+/**
+ * Returns the split with a certain id. The split is owned by the dictionary.
+ */
+PLL_EXPORT pll_split_t pllmod_utree_split_dict_get(const pll_split_dict_t * dict,
+                                                   unsigned int split_id)
+{
+  if (split_id >= dict->split_count)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid split id: %u\n", split_id);
+    return NULL;
+  }
+
+  return dict->entries[split_id]->bit_vector;
+}
+
+/**
+ * Adds the splits of one tree to the dictionary and returns their ids.
+ * The frequency of every split is incremented, and the tree count too.
+ *
+ * @param dict        split dictionary
+ * @param splits      normalized splits of the tree
+ * @param split_count number of splits in `splits`
+ *
+ * @return sorted vector of `split_count` ids, or NULL on error
+ */
+PLL_EXPORT unsigned int * pllmod_utree_split_dict_add_splits(
+                                                      pll_split_dict_t * dict,
+                                                      pll_split_t * splits,
+                                                      unsigned int split_count)
+{
+  unsigned int i;
+  unsigned int * split_ids;
+
+  split_ids = (unsigned int *) malloc((split_count+1) * sizeof(unsigned int));
+  if (!split_ids)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for split ids\n");
+    return NULL;
+  }
+
+  for (i = 0; i < split_count; ++i)
+  {
+    if (!dict_insert(dict, splits[i], split_ids + i))
+    {
+      /* undo the frequencies of this tree */
+      while (i--)
+        dict->frequency[split_ids[i]]--;
+      free(split_ids);
+      return NULL;
+    }
+    dict->frequency[split_ids[i]]++;
+  }
+
+  qsort(split_ids, split_count, sizeof(unsigned int), _cmp_split_ids);
+  dict->tree_count++;
+
+  return split_ids;
+}
+
+/**
+ * Adds the splits of an unrooted binary tree to the dictionary
+ *
+ * @param dict             split dictionary
+ * @param tree             tree (any node)
+ * @param[out] split_count number of ids returned
+ *
+ * @return sorted vector of split ids, or NULL on error
+ */
+PLL_EXPORT unsigned int * pllmod_utree_split_dict_add_tree(
+                                                    pll_split_dict_t * dict,
+                                                    const pll_unode_t * tree,
+                                                    unsigned int * split_count)
+{
+  unsigned int * split_ids;
+  pll_split_t * splits = pllmod_utree_split_create(tree,
+                                                   dict->tip_count,
+                                                   NULL);
+  if (!splits)
+    return NULL;
+
+  split_ids = pllmod_utree_split_dict_add_splits(dict,
+                                                 splits,
+                                                 dict->tip_count - 3);
+  pllmod_utree_split_destroy(splits);
+
+  if (split_ids && split_count)
+    *split_count = dict->tip_count - 3;
+
+  return split_ids;
+}
+
+/**
+ * Adds a set of compact splits to the dictionary. Splits are expanded one at
+ * a time, so dense splits are never allocated for the whole tree.
+ *
+ * @return sorted vector of `set->split_count` ids, or NULL on error
+ */
+PLL_EXPORT unsigned int * pllmod_utree_split_dict_add_compact(
+                                        pll_split_dict_t * dict,
+                                        const pll_compact_split_set_t * set)
+{
+  unsigned int i;
+  unsigned int * split_ids;
+  pll_split_t split;
+
+  if (set->tip_count != dict->tip_count)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Split set and dictionary have different tip counts\n");
+    return NULL;
+  }
+
+  split_ids = (unsigned int *) malloc((set->split_count+1) *
+                                      sizeof(unsigned int));
+  split = (pll_split_t) malloc(dict->hash->bitv_len * sizeof(pll_split_base_t));
+  if (!split_ids || !split)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for split ids\n");
+    free(split_ids);
+    free(split);
+    return NULL;
+  }
+
+  for (i = 0; i < set->split_count; ++i)
+  {
+    pllmod_utree_compact_split_get(set, i, split);
+    if (!dict_insert(dict, split, split_ids + i))
+    {
+      while (i--)
+        dict->frequency[split_ids[i]]--;
+      free(split_ids);
+      free(split);
+      return NULL;
+    }
+    dict->frequency[split_ids[i]]++;
+  }
+
+  free(split);
+
+  qsort(split_ids, set->split_count, sizeof(unsigned int), _cmp_split_ids);
+  dict->tree_count++;
+
+  return split_ids;
+}
+
+/**
+ * Computes the intersection of two sorted vectors of split ids
+ *
+ * @param[out] common ids present in both vectors, can be NULL
+ *
+ * @return the number of common ids
+ */
+PLL_EXPORT unsigned int pllmod_utree_split_ids_intersect(
+                                                const unsigned int * ids1,
+                                                unsigned int count1,
+                                                const unsigned int * ids2,
+                                                unsigned int count2,
+                                                unsigned int * common)
+{
+  unsigned int i = 0, j = 0, k = 0;
+
+  while (i < count1 && j < count2)
+  {
+    if (ids1[i] < ids2[j])
+      ++i;
+    else if (ids1[i] > ids2[j])
+      ++j;
+    else
+    {
+      if (common)
+        common[k] = ids1[i];
+      ++k;
+      ++i;
+      ++j;
+    }
+  }
+
+  return k;
+}
+
+/**
+ * Computes the RF distance between two trees given as sorted vectors of
+ * split ids from the same dictionary
+ */
+PLL_EXPORT unsigned int pllmod_utree_split_ids_rf_distance(
+                                                const unsigned int * ids1,
+                                                unsigned int count1,
+                                                const unsigned int * ids2,
+                                                unsigned int count2)
+{
+  unsigned int equal = pllmod_utree_split_ids_intersect(ids1, count1,
+                                                        ids2, count2,
+                                                        NULL);
+
+  return count1 + count2 - 2*equal;
+}
+
+/**
+ * Builds the consensus split system from the split frequencies in the
+ * dictionary. Splits are not hashed again.
+ *
+ * @param dict      split dictionary
+ * @param threshold consensus threshold in [0,1] (see
+ *                  pllmod_utree_split_consensus)
+ *
+ * @return the consensus split system, or NULL on error
+ */
+PLL_EXPORT pll_split_system_t * pllmod_utree_split_dict_consensus(
+                                                const pll_split_dict_t * dict,
+                                                double threshold)
+{
+  unsigned int i;
+  bitv_hashtable_t * splits_hash;
+  pll_split_system_t * split_system;
+
+  if (!dict->tree_count)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Split dictionary does not contain any tree\n");
+    return NULL;
+  }
+
+  splits_hash = hash_init(dict->hash->table_size, dict->tip_count);
+  if (!splits_hash)
+    return NULL;
+
+  for (i = 0; i < dict->split_count; ++i)
+  {
+    const bitv_hash_entry_t * e = dict->entries[i];
+
+    if (!dict->frequency[i])
+      continue;
+
+    if (!hash_insert(e->bit_vector,
+                     splits_hash,
+                     i,
+                     e->key,
+                     (double) dict->frequency[i] / dict->tree_count,
+                     e->key % splits_hash->table_size))
+    {
+      hash_destroy(splits_hash);
+      return NULL;
+    }
+  }
+
+  split_system = pllmod_utree_split_consensus(splits_hash,
+                                              dict->tip_count,
+                                              threshold);
+
+  hash_destroy(splits_hash);
+
+  return split_system;
+}
+
+/**
+ * Serializes the dictionary into a contiguous buffer, which can be stored
+ * together with the trees (e.g., with pllmod_binary_custom_dump).
+ * Split ids are preserved by pllmod_utree_split_dict_deserialize.
+ *
+ * @param dict       split dictionary
+ * @param[out] size  size of the buffer in bytes
+ *
+ * @return the buffer, to be freed by the caller, or NULL on error
+ */
+PLL_EXPORT void * pllmod_utree_split_dict_serialize(const pll_split_dict_t * dict,
+                                                    size_t * size)
+{
+  unsigned int i;
+  unsigned int split_len = dict->hash->bitv_len;
+  unsigned int * buffer, * frequency;
+  pll_split_t splits;
+
+  *size = (3 + (size_t) dict->split_count) * sizeof(unsigned int) +
+          (size_t) dict->split_count * split_len * sizeof(pll_split_base_t);
+
+  buffer = (unsigned int *) malloc(*size);
+  if (!buffer)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for serialized dictionary\n");
+    return NULL;
+  }
+
+  buffer[0] = dict->tip_count;
+  buffer[1] = dict->split_count;
+  buffer[2] = dict->tree_count;
+
+  frequency = buffer + 3;
+  splits    = (pll_split_t) (frequency + dict->split_count);
+
+  memcpy(frequency, dict->frequency, dict->split_count * sizeof(unsigned int));
+  for (i = 0; i < dict->split_count; ++i)
+    memcpy(splits + (size_t) i * split_len,
+           dict->entries[i]->bit_vector,
+           split_len * sizeof(pll_split_base_t));
+
+  return buffer;
+}
+
+/**
+ * Creates a dictionary from a buffer created by
+ * pllmod_utree_split_dict_serialize
+ *
+ * @return the dictionary, or NULL on error (check pll_errmsg)
+ */
+PLL_EXPORT pll_split_dict_t * pllmod_utree_split_dict_deserialize(
+                                                            const void * data,
+                                                            size_t size)
+{
+  unsigned int i;
+  unsigned int tip_count, split_count, split_len, split_id;
+  const unsigned int * buffer = (const unsigned int *) data;
+  const pll_split_base_t * splits;
+  pll_split_dict_t * dict;
+
+  if (size < 3 * sizeof(unsigned int))
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid serialized dictionary size\n");
+    return NULL;
+  }
+
+  tip_count   = buffer[0];
+  split_count = buffer[1];
+  split_len   = bitv_length(tip_count);
+
+  if (size != (3 + (size_t) split_count) * sizeof(unsigned int) +
+              (size_t) split_count * split_len * sizeof(pll_split_base_t))
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid serialized dictionary size\n");
+    return NULL;
+  }
+
+  dict = pllmod_utree_split_dict_create(tip_count, split_count);
+  if (!dict || !dict_reserve(dict, split_count))
+  {
+    pllmod_utree_split_dict_destroy(dict);
+    return NULL;
+  }
+
+  splits = (const pll_split_base_t *) (buffer + 3 + split_count);
+  for (i = 0; i < split_count; ++i)
+  {
+    if (!dict_insert(dict,
+                     (pll_split_t) (splits + (size_t) i * split_len),
+                     &split_id))
+    {
+      pllmod_utree_split_dict_destroy(dict);
+      return NULL;
+    }
+    if (split_id != i)
+    {
+      pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                       "Duplicated split in serialized dictionary\n");
+      pllmod_utree_split_dict_destroy(dict);
+      return NULL;
+    }
+    dict->frequency[i] = buffer[3 + i];
+  }
+  dict->tree_count = buffer[2];
+
+  return dict;
+}
+
+PLL_EXPORT void pllmod_utree_split_dict_destroy(pll_split_dict_t * dict)
+{
+  if (!dict)
+    return;
+
+  if (dict->hash)
+    hash_destroy(dict->hash);
+  free(dict->entries);
+  free(dict->frequency);
+  free(dict);
+}
+
+/**
+ * Adds the splits of an unrooted binary tree to the dictionary and keeps the
+ * branch lengths, such that distances among many trees can be computed
+ * without extracting the splits again.
+ *
+ * @param dict  split dictionary
+ * @param tree  tree (any node)
+ *
+ * @return the tree splits and lengths, or NULL on error
+ */
+PLL_EXPORT pll_split_dict_tree_t * pllmod_utree_split_dict_tree_create(
+                                                    pll_split_dict_t * dict,
+                                                    const pll_unode_t * tree)
+{
+  unsigned int i, k;
+  unsigned int tip_count = dict->tip_count;
+  unsigned int split_count = tip_count - 3;
+  pll_split_t * splits = NULL;
+  pll_unode_t ** split_to_node_map = NULL;
+  struct split_id_length * pairs = NULL;
+  pll_split_dict_tree_t * dict_tree = NULL;
+
+  if (tip_count < 4)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE_SIZE,
+                     "Tree must have at least 4 tips\n");
+    return NULL;
+  }
+
+  split_to_node_map = (pll_unode_t **) malloc(split_count *
+                                              sizeof(pll_unode_t *));
+  pairs = (struct split_id_length *) malloc(split_count *
+                                            sizeof(struct split_id_length));
+  dict_tree = (pll_split_dict_tree_t *) calloc(1,
+                                               sizeof(pll_split_dict_tree_t));
+  if (!split_to_node_map || !pairs || !dict_tree)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for tree splits\n");
+    goto tree_error;
+  }
+
+  dict_tree->tip_count   = tip_count;
+  dict_tree->split_count = split_count;
+  dict_tree->split_ids   = (unsigned int *) malloc(split_count *
+                                                   sizeof(unsigned int));
+  dict_tree->length      = (double *) malloc(split_count * sizeof(double));
+  dict_tree->tip_length  = (double *) calloc(tip_count, sizeof(double));
+  if (!dict_tree->split_ids || !dict_tree->length || !dict_tree->tip_length)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for tree splits\n");
+    goto tree_error;
+  }
+
+  splits = pllmod_utree_split_create(tree, tip_count, split_to_node_map);
+  if (!splits)
+    goto tree_error;
+
+  /* every inner node is at the end of some inner branch, so all the tip
+     branches are found around them */
+  for (i = 0; i < split_count; ++i)
+  {
+    const pll_unode_t * inner[2];
+
+    inner[0] = split_to_node_map[i];
+    inner[1] = split_to_node_map[i]->back;
+    for (k = 0; k < 2; ++k)
+    {
+      const pll_unode_t * node = inner[k];
+      do
+      {
+        if (pllmod_utree_is_tip(node->back))
+        {
+          if (node->back->node_index >= tip_count)
+          {
+            pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE,
+                             "Tip node index out of range\n");
+            goto tree_error;
+          }
+          dict_tree->tip_length[node->back->node_index] = node->length;
+        }
+        node = node->next;
+      }
+      while (node != inner[k]);
+    }
+  }
+
+  for (i = 0; i < split_count; ++i)
+  {
+    if (!dict_insert(dict, splits[i], &pairs[i].split_id))
+    {
+      while (i--)
+        dict->frequency[pairs[i].split_id]--;
+      goto tree_error;
+    }
+    dict->frequency[pairs[i].split_id]++;
+    pairs[i].length = split_to_node_map[i]->length;
+  }
+  dict->tree_count++;
+
+  qsort(pairs, split_count, sizeof(struct split_id_length),
+        _cmp_split_id_length);
+  for (i = 0; i < split_count; ++i)
+  {
+    dict_tree->split_ids[i] = pairs[i].split_id;
+    dict_tree->length[i]    = pairs[i].length;
+  }
+
+  pllmod_utree_split_destroy(splits);
+  free(split_to_node_map);
+  free(pairs);
+
+  return dict_tree;
+
+tree_error:
+  if (splits)
+    pllmod_utree_split_destroy(splits);
+  free(split_to_node_map);
+  free(pairs);
+  pllmod_utree_split_dict_tree_destroy(dict_tree);
+  return NULL;
+}
+
+PLL_EXPORT void pllmod_utree_split_dict_tree_destroy(
+                                                pll_split_dict_tree_t * tree)
+{
+  if (!tree)
+    return;
+
+  free(tree->split_ids);
+  free(tree->length);
+  free(tree->tip_length);
+  free(tree);
+}
+
+/**
+ * Computes the distance between two trees of the same dictionary
+ *
+ * Available distances are:
+ *   PLLMOD_TREE_DISTANCE_RF:      number of splits present in only one tree
+ *   PLLMOD_TREE_DISTANCE_WRF:     sum of absolute branch length differences
+ *   PLLMOD_TREE_DISTANCE_KF:      square root of the sum of squared branch
+ *                                 length differences (branch score)
+ *   PLLMOD_TREE_DISTANCE_INFO_RF: sum of the phylogenetic information content
+ *                                 (in bits) of the splits present in only one
+ *                                 tree
+ *
+ * Missing splits have length 0. WRF and KF include the tip branches.
+ *
+ * @return the distance, or -1 on error
+ */
+PLL_EXPORT double pllmod_utree_split_dict_distance(
+                                            const pll_split_dict_t * dict,
+                                            const pll_split_dict_tree_t * t1,
+                                            const pll_split_dict_tree_t * t2,
+                                            int distance_type)
+{
+  unsigned int i = 0, j = 0;
+  double distance = 0;
+
+  if (!check_distance_params(dict, t1, distance_type) ||
+      !check_distance_params(dict, t2, distance_type))
+    return -1;
+
+  while (i < t1->split_count || j < t2->split_count)
+  {
+    unsigned int split_id;
+    double l1 = 0, l2 = 0;
+    int shared = 0;
+
+    if (j == t2->split_count ||
+        (i < t1->split_count && t1->split_ids[i] < t2->split_ids[j]))
+    {
+      split_id = t1->split_ids[i];
+      l1 = t1->length[i++];
+    }
+    else if (i == t1->split_count || t1->split_ids[i] > t2->split_ids[j])
+    {
+      split_id = t2->split_ids[j];
+      l2 = t2->length[j++];
+    }
+    else
+    {
+      split_id = t1->split_ids[i];
+      l1 = t1->length[i++];
+      l2 = t2->length[j++];
+      shared = 1;
+    }
+
+    switch (distance_type)
+    {
+      case PLLMOD_TREE_DISTANCE_RF:
+        distance += !shared;
+        break;
+      case PLLMOD_TREE_DISTANCE_WRF:
+        distance += fabs(l1 - l2);
+        break;
+      case PLLMOD_TREE_DISTANCE_KF:
+        distance += (l1 - l2) * (l1 - l2);
+        break;
+      case PLLMOD_TREE_DISTANCE_INFO_RF:
+        if (!shared)
+          distance += split_info_content(dict, split_id);
+        break;
+    }
+  }
+
+  if (distance_type == PLLMOD_TREE_DISTANCE_WRF)
+  {
+    for (i = 0; i < dict->tip_count; ++i)
+      distance += fabs(t1->tip_length[i] - t2->tip_length[i]);
+  }
+  else if (distance_type == PLLMOD_TREE_DISTANCE_KF)
+  {
+    for (i = 0; i < dict->tip_count; ++i)
+      distance += (t1->tip_length[i] - t2->tip_length[i]) *
+                  (t1->tip_length[i] - t2->tip_length[i]);
+    distance = sqrt(distance);
+  }
+
+  return distance;
+}
+
+/**
+ * Computes the all-pairs distance matrix among a set of trees of the same
+ * dictionary (see pllmod_utree_split_dict_distance)
+ *
+ * The splits of every tree are scattered once into a vector indexed by split
+ * id, and then every other tree is scored with a branch-free pass over its
+ * split ids.
+ *
+ * @param dict          split dictionary
+ * @param trees         trees created with pllmod_utree_split_dict_tree_create
+ * @param tree_count    number of trees
+ * @param distance_type distance (PLLMOD_TREE_DISTANCE_*)
+ * @param[out] matrix   tree_count x tree_count symmetric distance matrix
+ *
+ * @return PLL_SUCCESS or PLL_FAILURE
+ */
+PLL_EXPORT int pllmod_utree_split_dict_distance_matrix(
+                                          const pll_split_dict_t * dict,
+                                          pll_split_dict_tree_t ** trees,
+                                          unsigned int tree_count,
+                                          int distance_type,
+                                          double * matrix)
+{
+  unsigned int i, j, k;
+  unsigned int tip_count = dict->tip_count;
+  int weighted = (distance_type == PLLMOD_TREE_DISTANCE_WRF ||
+                  distance_type == PLLMOD_TREE_DISTANCE_KF);
+  double * split_value  = NULL;  /* value of the splits of tree i, by id */
+  double * split_weight = NULL;  /* RF weight of every split id */
+  double * tree_total   = NULL;  /* sum of split values of every tree */
+  int retval = PLL_FAILURE;
+
+  for (i = 0; i < tree_count; ++i)
+    if (!check_distance_params(dict, trees[i], distance_type))
+      return PLL_FAILURE;
+
+  split_value = (double *) calloc(dict->split_count + 1, sizeof(double));
+  tree_total  = (double *) calloc(tree_count + 1, sizeof(double));
+  if (!weighted)
+    split_weight = (double *) malloc((dict->split_count + 1) * sizeof(double));
+  if (!split_value || !tree_total || (!weighted && !split_weight))
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for distance computation\n");
+    goto matrix_exit;
+  }
+
+  if (!weighted)
+  {
+    for (k = 0; k < dict->split_count; ++k)
+      split_weight[k] = (distance_type == PLLMOD_TREE_DISTANCE_INFO_RF) ?
+                        split_info_content(dict, k) : 1.0;
+  }
+
+  for (i = 0; i < tree_count; ++i)
+  {
+    const pll_split_dict_tree_t * t = trees[i];
+    for (k = 0; k < t->split_count; ++k)
+    {
+      if (distance_type == PLLMOD_TREE_DISTANCE_WRF)
+        tree_total[i] += fabs(t->length[k]);
+      else if (distance_type == PLLMOD_TREE_DISTANCE_KF)
+        tree_total[i] += t->length[k] * t->length[k];
+      else
+        tree_total[i] += split_weight[t->split_ids[k]];
+    }
+  }
+
+  for (i = 0; i < tree_count; ++i)
+  {
+    const pll_split_dict_tree_t * ti = trees[i];
+
+    matrix[(size_t) i * tree_count + i] = 0;
+
+    for (k = 0; k < ti->split_count; ++k)
+      split_value[ti->split_ids[k]] = weighted ?
+                                      ti->length[k] :
+                                      split_weight[ti->split_ids[k]];
+
+    for (j = i + 1; j < tree_count; ++j)
+    {
+      const pll_split_dict_tree_t * tj = trees[j];
+      const unsigned int * split_ids = tj->split_ids;
+      const double * length = tj->length;
+      double acc = 0, distance = 0;
+
+      switch (distance_type)
+      {
+        case PLLMOD_TREE_DISTANCE_RF:
+        case PLLMOD_TREE_DISTANCE_INFO_RF:
+          /* acc is the weight of the shared splits */
+          for (k = 0; k < tj->split_count; ++k)
+            acc += split_value[split_ids[k]];
+          distance = tree_total[i] + tree_total[j] - 2 * acc;
+          break;
+        case PLLMOD_TREE_DISTANCE_WRF:
+          for (k = 0; k < tj->split_count; ++k)
+          {
+            double v = split_value[split_ids[k]];
+            acc += fabs(v - length[k]) - fabs(v);
+          }
+          for (k = 0; k < tip_count; ++k)
+            acc += fabs(ti->tip_length[k] - tj->tip_length[k]);
+          distance = tree_total[i] + acc;
+          break;
+        case PLLMOD_TREE_DISTANCE_KF:
+          for (k = 0; k < tj->split_count; ++k)
+          {
+            double v = split_value[split_ids[k]];
+            acc += (v - length[k]) * (v - length[k]) - v * v;
+          }
+          for (k = 0; k < tip_count; ++k)
+            acc += (ti->tip_length[k] - tj->tip_length[k]) *
+                   (ti->tip_length[k] - tj->tip_length[k]);
+          distance = sqrt(PLL_MAX(tree_total[i] + acc, 0));
+          break;
+      }
+
+      matrix[(size_t) i * tree_count + j] = distance;
+      matrix[(size_t) j * tree_count + i] = distance;
+    }
+
+    for (k = 0; k < ti->split_count; ++k)
+      split_value[ti->split_ids[k]] = 0;
+  }
+
+  retval = PLL_SUCCESS;
+
+matrix_exit:
+  free(split_value);
+  free(split_weight);
+  free(tree_total);
+  return retval;
+}
+
+/******************************************************************************/
+/* static functions */
+
+static int dict_reserve(pll_split_dict_t * dict, unsigned int capacity)
+{
+  bitv_hash_entry_t ** entries;
+  unsigned int * frequency;
+
+  if (capacity <= dict->capacity)
+    return PLL_SUCCESS;
+
+  entries = (bitv_hash_entry_t **) realloc(dict->entries,
+                                   capacity * sizeof(bitv_hash_entry_t *));
+  if (!entries)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for split dictionary\n");
+    return PLL_FAILURE;
+  }
+  dict->entries = entries;
+
+  frequency = (unsigned int *) realloc(dict->frequency,
+                                       capacity * sizeof(unsigned int));
+  if (!frequency)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for split dictionary\n");
+    return PLL_FAILURE;
+  }
+  dict->frequency = frequency;
+
+  dict->capacity = capacity;
+
+  return PLL_SUCCESS;
+}
+
+static int dict_insert(pll_split_dict_t * dict,
+                       pll_split_t split,
+                       unsigned int * split_id)
+{
+  bitv_hash_entry_t * e;
+
+  if (!bitv_is_normalized(split))
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_SPLIT,
+                     "Split is not normalized\n");
+    return PLL_FAILURE;
+  }
+
+  if (dict->split_count == dict->capacity &&
+      !dict_reserve(dict, 2 * dict->capacity))
+    return PLL_FAILURE;
+
+  e = hash_insert(split,
+                  dict->hash,
+                  dict->split_count,
+                  HASH_KEY_UNDEF,
+                  0.0,
+                  0);
+  if (!e)
+    return PLL_FAILURE;
+
+  if (e->bip_number == dict->split_count)
+  {
+    /* new split */
+    dict->entries[dict->split_count] = e;
+    dict->frequency[dict->split_count] = 0;
+    dict->split_count++;
+  }
+
+  *split_id = e->bip_number;
+
+  return PLL_SUCCESS;
+}
+
+static int _cmp_split_ids(const void * a, const void * b)
+{
+  unsigned int id1 = *((const unsigned int *) a);
+  unsigned int id2 = *((const unsigned int *) b);
+
+  return (id1 > id2) - (id1 < id2);
+}
+
+static int _cmp_split_id_length(const void * a, const void * b)
+{
+  const struct split_id_length * p1 = (const struct split_id_length *) a;
+  const struct split_id_length * p2 = (const struct split_id_length *) b;
+
+  return (p1->split_id > p2->split_id) - (p1->split_id < p2->split_id);
+}
+
+/* ln (2k-3)!!, i.e., the log number of rooted binary trees with k tips */
+static double log_tree_count(unsigned int k)
+{
+  return lgamma(2.0 * k - 1) - (k - 1) * M_LN2 - lgamma((double) k);
+}
+
+/* information content (bits) of a split: -log2 of the fraction of binary
+   trees containing it */
+static double split_info_content(const pll_split_dict_t * dict,
+                                 unsigned int split_id)
+{
+  unsigned int n = dict->tip_count;
+  unsigned int a = bitv_popcount(dict->entries[split_id]->bit_vector,
+                                 n,
+                                 dict->hash->bitv_len);
+
+  return (log_tree_count(n-1) - log_tree_count(a) - log_tree_count(n-a)) /
+         M_LN2;
+}
+
+static int check_distance_params(const pll_split_dict_t * dict,
+                                 const pll_split_dict_tree_t * tree,
+                                 int distance_type)
+{
+  if (distance_type < PLLMOD_TREE_DISTANCE_RF ||
+      distance_type > PLLMOD_TREE_DISTANCE_INFO_RF)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid distance type: %d\n", distance_type);
+    return PLL_FAILURE;
+  }
+
+  if (tree->tip_count != dict->tip_count)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE_SIZE,
+                     "Tree and dictionary have different tip counts\n");
+    return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
@@ -42,46 +42,88 @@ typedef struct tbe_data
   unsigned int tip_count_div_2;
 } tbe_data_t;
 
+/* splits are processed in blocks for the naive TBE computation */
+#define TBE_REF_BLOCK_SIZE 16
+#define TBE_BS_TILE_SIZE   64
+
+typedef struct tbe_light_split
+{
+  unsigned int light;
+  unsigned int index;
+} tbe_light_split_t;
+
+struct pllmod_tbe_naive_context
+{
+  pll_split_t * ref_splits;
+  unsigned int ref_count;
+  unsigned int bs_count;
+  unsigned int tip_count;
+  unsigned int split_len;
+  tbe_light_split_t * ref_order;  /* reference splits by lightside size */
+  unsigned int * bs_light;        /* lightside sizes of bs_block */
+  pll_split_base_t * bs_block;    /* bootstrap splits by lightside size */
+  bitv_hashtable_t * bs_splits_hash;
+};
+
 int cb_full_traversal(pll_unode_t * node)
 {
   (void) node;
   return 1;
 }
 
-void postorder_init_recursive(pll_unode_t * node, unsigned int * index,
-                              unsigned int * subtree_size, index_information_t* idx_infos)
+int postorder_init(pll_unode_t * root, unsigned int tip_count,
+                   unsigned int * trav_size, unsigned int * subtree_size,
+                   index_information_t* idx_infos)
 {
-  if (node->next == NULL)
+  unsigned int i;
+  pllmod_utree_traversal_t * traversal;
+
+  traversal = pllmod_utree_traversal_create(2 * tip_count - 2);
+  if (!traversal || !pllmod_utree_traversal_update(traversal, root))
   {
-    subtree_size[node->clv_index] = 1;
-    return;
+    pllmod_utree_traversal_destroy(traversal);
+    return PLL_FAILURE;
   }
-  pll_unode_t * snode = node->next;
-  do
+
+  *trav_size = 0;
+  for (i = 0; i < traversal->node_count; ++i)
   {
-    postorder_init_recursive(snode->back, index, subtree_size, idx_infos);
-    snode = snode->next;
-  } while (snode && snode != node);
-  index_information_t info;
-  info.idx = node->clv_index;
-  info.idx_left = node->next->back->clv_index;
-  info.idx_right = node->next->next->back->clv_index;
-  subtree_size[node->clv_index] = subtree_size[info.idx_left] + subtree_size[info.idx_right];
-  idx_infos[*index] = info;
-  *index = *index + 1;
+    pll_unode_t * node = traversal->postorder[i];
+    if (node->next == NULL)
+    {
+      subtree_size[node->clv_index] = 1;
+      continue;
+    }
+    index_information_t info;
+    info.idx = node->clv_index;
+    info.idx_left = node->next->back->clv_index;
+    info.idx_right = node->next->next->back->clv_index;
+    subtree_size[node->clv_index] = subtree_size[info.idx_left] + subtree_size[info.idx_right];
+    idx_infos[*trav_size] = info;
+    *trav_size = *trav_size + 1;
+  }
+
+  pllmod_utree_traversal_destroy(traversal);
+  return PLL_SUCCESS;
 }
 
-void postorder_init(pll_unode_t * root, unsigned int * trav_size,
-                    unsigned int * subtree_size, index_information_t* idx_infos)
+void free_tbe_data(tbe_data_t* data)
 {
-  *trav_size = 0;
-  postorder_init_recursive(root->back, trav_size, subtree_size, idx_infos);
-  postorder_init_recursive(root, trav_size, subtree_size, idx_infos);
+  free(data->subtree_size);
+  free(data->idx_infos);
+  free(data->count_ones);
+  free(data);
 }
 
 tbe_data_t* init_tbe_data(pll_unode_t * root, unsigned int tip_count)
 {
   tbe_data_t* data = (tbe_data_t*) malloc(sizeof(tbe_data_t));
+  if (!data)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for TBE data\n");
+    return NULL;
+  }
   data->tip_count = tip_count;
   data->tip_count_div_2 = tip_count / 2;
   data->trav_size = 0;
@@ -89,18 +131,22 @@ tbe_data_t* init_tbe_data(pll_unode_t * root, unsigned int tip_count)
   data->subtree_size = (unsigned int*) malloc(sizeof(unsigned int) * data->nodes_count);
   data->idx_infos = (index_information_t*) malloc(sizeof(index_information_t) * data->nodes_count);
   data->count_ones = (unsigned int*) malloc(sizeof(unsigned int) * data->nodes_count);
-  postorder_init(root, &data->trav_size, data->subtree_size, data->idx_infos);
+  if (!data->subtree_size || !data->idx_infos || !data->count_ones)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for TBE data\n");
+    free_tbe_data(data);
+    return NULL;
+  }
+  if (!postorder_init(root, tip_count, &data->trav_size, data->subtree_size,
+                      data->idx_infos))
+  {
+    free_tbe_data(data);
+    return NULL;
+  }
   return data;
 }
 
-void free_tbe_data(tbe_data_t* data)
-{
-  free(data->subtree_size);
-  free(data->idx_infos);
-  free(data->count_ones);
-  free(data);
-}
-
 unsigned int search_mindist(const pllmod_tbe_split_info_t* query,
                             tbe_data_t* data)
 {
@@ -146,29 +192,44 @@ unsigned int search_mindist(const pllmod_tbe_split_info_t* query,
   return min_dist;
 }
 
-/* This function computes a lower bound of Hamming distance between splits:
- * the computation terminates as soon as current distance values exceeds min_hdist.
- * This allows for substantial time savings if we are looking for the
- * minimum Hamming distance (as in TBE computation below).
- *
- * WARNING: This function does not check that hdist < N/2. Therefore,
- * it should be called twice, with original and inverted s1 (or s2),
- * to account for possible complementary split encoding.
- * */
-static unsigned int utree_split_hamming_distance_lbound(pll_split_t s1,
-                                                        pll_split_t s2,
-                                                        unsigned int split_len,
-                                                        unsigned int min_hdist)
+/* This function computes a lower bound of the transfer distance between
+ * splits, i.e. min(hdist, N-hdist), in a single pass. The computation
+ * terminates as soon as both the distance to s2 and to its complement
+ * exceed min_hdist, in which case the returned value is larger than
+ * min_hdist but not exact. */
+static unsigned int utree_split_transfer_distance_lbound(
+                                                const pll_split_base_t * s1,
+                                                const pll_split_base_t * s2,
+                                                unsigned int split_len,
+                                                unsigned int tip_count,
+                                                unsigned int min_hdist)
 {
+  unsigned int split_size = sizeof(pll_split_base_t) * 8;
   unsigned int hdist = 0;
+  unsigned int bits = 0;
   unsigned int i;
 
-  for (i = 0; (i < split_len) && (hdist <= min_hdist); ++i)
+  for (i = 0; i < split_len; ++i)
   {
     hdist += PLL_POPCNT32(s1[i] ^ s2[i]);
+    bits = PLL_MIN(bits + split_size, tip_count);
+
+    /* distance to the complement is at least bits - hdist */
+    if (hdist > min_hdist && bits - hdist > min_hdist)
+      return min_hdist + 1;
   }
 
-  return hdist;
+  return PLL_MIN(hdist, tip_count - hdist);
+}
+
+static int cmp_light_split(const void * a, const void * b)
+{
+  const tbe_light_split_t * s1 = (const tbe_light_split_t *) a;
+  const tbe_light_split_t * s2 = (const tbe_light_split_t *) b;
+
+  if (s1->light != s2->light)
+    return s1->light > s2->light ? 1 : -1;
+  return (s1->index > s2->index) - (s1->index < s2->index);
 }
 
 
@@ -295,8 +356,11 @@ PLL_EXPORT int pllmod_utree_tbe_nature(pll_split_t * ref_splits,
       continue;
     }
 
-    if (!tbe_data)
-      tbe_data = init_tbe_data(bs_root, tip_count);
+    if (!tbe_data && !(tbe_data = init_tbe_data(bs_root, tip_count)))
+    {
+      pllmod_utree_split_hashtable_destroy(bs_splits_hash);
+      return PLL_FAILURE;
+    }
 
     // else, we are in the search for minimum distance...
     unsigned int min_hdist = search_mindist(&split_info[i], tbe_data);
@@ -314,113 +378,354 @@ PLL_EXPORT int pllmod_utree_tbe_nature(pll_split_t * ref_splits,
 
 
 /* This is an old, naive and rather inefficient TBE computation method by Alexey,
- * keep it here just in case */
+ * keep it here just in case. It is now a single-threaded call to the
+ * cache-blocked version below. */
 PLL_EXPORT int pllmod_utree_tbe_naive(pll_split_t * ref_splits,
                                       pll_split_t * bs_splits,
                                       unsigned int tip_count,
                                       double * support)
 {
-  unsigned int i, j, k;
-  unsigned int split_count = tip_count - 3;
-  unsigned int split_len = bitv_length(tip_count);
-  unsigned int split_size  = sizeof(pll_split_base_t) * 8;
-  unsigned int split_offset = tip_count % split_size;
-  unsigned int split_mask = split_offset ? (1u<<split_offset) - 1 : ~0u;
-
-  pll_split_t inv_split = NULL;
-  unsigned int * bs_light = NULL;
+  pllmod_tbe_naive_context_t * ctx;
+  int retval;
 
-  if (!ref_splits || !bs_splits || !support)
+  if (!support)
   {
     pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Parameter is NULL!\n");
     return PLL_FAILURE;
   }
 
-  bitv_hashtable_t * bs_splits_hash =
-                          pllmod_utree_split_hashtable_insert(NULL,
-                                                              bs_splits,
-                                                              tip_count,
-                                                              split_count,
-                                                              NULL,
-                                                              0);
+  ctx = pllmod_utree_tbe_naive_context_create(ref_splits,
+                                              tip_count - 3,
+                                              bs_splits,
+                                              tip_count - 3,
+                                              tip_count);
+  if (!ctx)
+    return PLL_FAILURE;
 
-  if (!bs_splits_hash)
+  retval = pllmod_utree_tbe_naive_blocked(ctx, 0, 1, support);
+
+  pllmod_utree_tbe_naive_context_destroy(ctx);
+
+  return retval;
+}
+
+/**
+ * Creates the read-only data shared by all the callers of
+ * pllmod_utree_tbe_naive_blocked: a hashtable of the bootstrap splits, a
+ * contiguous copy of them sorted by lightside size, and the reference splits
+ * sorted by lightside size.
+ *
+ * The split arrays are not copied and must outlive the context.
+ *
+ * @param ref_splits     normalized reference splits
+ * @param ref_count      number of reference splits
+ * @param bs_splits      normalized bootstrap splits
+ * @param bs_count       number of bootstrap splits
+ * @param tip_count      number of tips
+ *
+ * @return the context, or NULL on error (check pll_errmsg)
+ */
+PLL_EXPORT
+pllmod_tbe_naive_context_t * pllmod_utree_tbe_naive_context_create(
+                                                  pll_split_t * ref_splits,
+                                                  unsigned int ref_count,
+                                                  pll_split_t * bs_splits,
+                                                  unsigned int bs_count,
+                                                  unsigned int tip_count)
+{
+  unsigned int i, j;
+  unsigned int split_len = bitv_length(tip_count);
+  tbe_light_split_t * bs_order = NULL;
+  pllmod_tbe_naive_context_t * ctx;
+
+  if (!ref_splits || !bs_splits)
   {
-    return PLL_FAILURE;
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Parameter is NULL!\n");
+    return NULL;
   }
 
-  inv_split = (pll_split_t) calloc(split_len, sizeof(pll_split_base_t));
-  bs_light = calloc(split_count, sizeof(unsigned int));
+  ctx = (pllmod_tbe_naive_context_t *) calloc(1,
+                                          sizeof(pllmod_tbe_naive_context_t));
+  if (!ctx)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC, "Cannot allocate memory\n");
+    return NULL;
+  }
 
-  if (!inv_split || !bs_light)
+  ctx->ref_splits = ref_splits;
+  ctx->ref_count  = ref_count;
+  ctx->bs_count   = bs_count;
+  ctx->tip_count  = tip_count;
+  ctx->split_len  = split_len;
+
+  ctx->ref_order = (tbe_light_split_t *) malloc((ref_count+1) *
+                                                sizeof(tbe_light_split_t));
+  bs_order       = (tbe_light_split_t *) malloc((bs_count+1) *
+                                                sizeof(tbe_light_split_t));
+  ctx->bs_light  = (unsigned int *) malloc((bs_count+1) * sizeof(unsigned int));
+  ctx->bs_block  = (pll_split_base_t *) malloc(((size_t) bs_count + 1) *
+                                               split_len *
+                                               sizeof(pll_split_base_t));
+
+  if (!ctx->ref_order || !bs_order || !ctx->bs_light || !ctx->bs_block)
   {
-    if (inv_split)
-      free(inv_split);
-    if (bs_light)
-      free(bs_light);
-    pllmod_utree_split_hashtable_destroy(bs_splits_hash);
     pllmod_set_error(PLL_ERROR_MEM_ALLOC, "Cannot allocate memory\n");
+    goto error_exit;
+  }
+
+  ctx->bs_splits_hash = pllmod_utree_split_hashtable_insert(NULL,
+                                                            bs_splits,
+                                                            tip_count,
+                                                            bs_count,
+                                                            NULL,
+                                                            0);
+  if (!ctx->bs_splits_hash)
+    goto error_exit;
+
+  for (i = 0; i < ref_count; ++i)
+  {
+    tbe_light_split_t * r = ctx->ref_order + i;
+    r->light = pllmod_utree_split_lightside(ref_splits[i], tip_count);
+    r->index = i;
+  }
+  for (j = 0; j < bs_count; ++j)
+  {
+    bs_order[j].light = pllmod_utree_split_lightside(bs_splits[j], tip_count);
+    bs_order[j].index = j;
+  }
+  qsort(ctx->ref_order, ref_count, sizeof(tbe_light_split_t), cmp_light_split);
+  qsort(bs_order, bs_count, sizeof(tbe_light_split_t), cmp_light_split);
+
+  /* contiguous copy of the bootstrap splits in lightside order */
+  for (j = 0; j < bs_count; ++j)
+  {
+    ctx->bs_light[j] = bs_order[j].light;
+    memcpy(ctx->bs_block + (size_t) j * split_len,
+           bs_splits[bs_order[j].index],
+           split_len * sizeof(pll_split_base_t));
+  }
+
+  free(bs_order);
+
+  return ctx;
+
+error_exit:
+  free(bs_order);
+  pllmod_utree_tbe_naive_context_destroy(ctx);
+  return NULL;
+}
+
+PLL_EXPORT
+void pllmod_utree_tbe_naive_context_destroy(pllmod_tbe_naive_context_t * ctx)
+{
+  if (!ctx)
+    return;
+
+  if (ctx->bs_splits_hash)
+    pllmod_utree_split_hashtable_destroy(ctx->bs_splits_hash);
+  free(ctx->ref_order);
+  free(ctx->bs_light);
+  free(ctx->bs_block);
+  free(ctx);
+}
+
+/**
+ * Computes the transfer support of the reference splits by exhaustive search
+ * of the closest bootstrap split, as pllmod_utree_tbe_naive does, but the
+ * number of splits in each tree is arbitrary (e.g., multifurcating bootstrap
+ * trees).
+ *
+ * Reference splits are processed in blocks of similar lightside size. Splits
+ * found in the bootstrap tree get full support, and splits with lightside 2
+ * get no support otherwise. For the rest, bootstrap splits are visited in
+ * tiles, starting from the ones with the closest lightside size. As the
+ * difference between lightside sizes is a lower bound of the transfer
+ * distance, the search stops as soon as no further tile can improve any
+ * split in the block.
+ *
+ * Reference blocks are distributed round-robin among `thread_count` callers.
+ * Each caller only reads `ctx` and writes the support of the splits in its
+ * own blocks, so the function can be called concurrently from `thread_count`
+ * threads with the same context and a different `thread_id`.
+ *
+ * @param ctx            context from pllmod_utree_tbe_naive_context_create
+ * @param thread_id      index of the calling thread
+ * @param thread_count   number of threads
+ * @param[out] support   transfer support for every reference split
+ *
+ * @return PLL_SUCCESS if OK, PLL_FAILURE otherwise (check pll_errmsg)
+ */
+PLL_EXPORT int pllmod_utree_tbe_naive_blocked(
+                                      const pllmod_tbe_naive_context_t * ctx,
+                                      unsigned int thread_id,
+                                      unsigned int thread_count,
+                                      double * support)
+{
+  unsigned int j, b;
+  unsigned int block_start, block_size;
+  unsigned int split_len, tip_count, bs_count;
+  const tbe_light_split_t * ref_order;
+  const unsigned int * bs_light;
+  const pll_split_base_t * bs_block;
+  pll_split_base_t * ref_block = NULL;
+  unsigned int ref_index[TBE_REF_BLOCK_SIZE];
+  unsigned int ref_min[TBE_REF_BLOCK_SIZE];
+  unsigned int ref_light[TBE_REF_BLOCK_SIZE];
+
+  if (!ctx || !support)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Parameter is NULL!\n");
     return PLL_FAILURE;
   }
 
-  /* precompute lightside size for all bootstrap splits */
-  for (j = 0; j < split_count; j++)
+  if (!thread_count || thread_id >= thread_count)
   {
-    bs_light[j] = pllmod_utree_split_lightside(bs_splits[j], tip_count);
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid thread id: %u (thread count: %u)\n",
+                     thread_id, thread_count);
+    return PLL_FAILURE;
   }
 
-  /* iterate over all splits of the reference tree */
-  for (i = 0; i < split_count; i++)
+  split_len = ctx->split_len;
+  tip_count = ctx->tip_count;
+  bs_count  = ctx->bs_count;
+  ref_order = ctx->ref_order;
+  bs_light  = ctx->bs_light;
+  bs_block  = ctx->bs_block;
+
+  ref_block = (pll_split_base_t *) malloc(TBE_REF_BLOCK_SIZE * split_len *
+                                          sizeof(pll_split_base_t));
+  if (!ref_block)
   {
-    pll_split_t ref_split = ref_splits[i];
-    unsigned int p =  pllmod_utree_split_lightside(ref_split, tip_count);
-    unsigned int min_hdist = p - 1;
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC, "Cannot allocate memory\n");
+    return PLL_FAILURE;
+  }
 
-    if (pllmod_utree_split_hashtable_lookup(bs_splits_hash, ref_split, tip_count))
+  for (block_start = thread_id * TBE_REF_BLOCK_SIZE;
+       block_start < ctx->ref_count;
+       block_start += thread_count * TBE_REF_BLOCK_SIZE)
+  {
+    unsigned int block_end = PLL_MIN(block_start + TBE_REF_BLOCK_SIZE,
+                                     ctx->ref_count);
+    unsigned int p_min, p_max, max_min;
+    unsigned int left, right;
+
+    /* exact matches and lightside 2 are settled here, the rest is searched */
+    block_size = 0;
+    max_min = 0;
+    for (j = block_start; j < block_end; ++j)
     {
-      /* found identical split in a bootstrap tree -> assign full support */
-      support[i] = 1.0;
-      continue;
+      const tbe_light_split_t * r = ref_order + j;
+      pll_split_t ref_split = ctx->ref_splits[r->index];
+
+      if (pllmod_utree_split_hashtable_lookup(ctx->bs_splits_hash,
+                                              ref_split,
+                                              tip_count))
+      {
+        support[r->index] = 1.0;
+        continue;
+      }
+
+      if (r->light <= 2)
+      {
+        support[r->index] = 0.0;
+        continue;
+      }
+
+      memcpy(ref_block + block_size * split_len, ref_split,
+             split_len * sizeof(pll_split_base_t));
+      ref_index[block_size] = r->index;
+      ref_light[block_size] = r->light;
+      ref_min[block_size]   = r->light - 1;
+      max_min = PLL_MAX(max_min, ref_min[block_size]);
+      ++block_size;
     }
 
-    /* inverse the reference split */
-    for (k = 0; k < split_len; ++k)
+    if (!block_size)
+      continue;
+
+    p_min = ref_light[0];
+    p_max = ref_light[block_size-1];
+
+    /* first bootstrap split with lightside >= p_min */
+    left = 0;
+    right = bs_count;
+    while (left < right)
     {
-      inv_split[k] = ~ref_split[k];
+      unsigned int mid = left + (right - left) / 2;
+      if (bs_light[mid] < p_min)
+        left = mid + 1;
+      else
+        right = mid;
     }
-    /* clear unused bits in the last array element */
-    inv_split[split_len-1] &= split_mask;
+    right = left;   /* next split on the right side */
 
-    /* iterate over all splits of the bootstrap tree */
-    for (j = 0; j < split_count; j++)
+    /* visit bootstrap tiles from the closest lightside outwards. Exact
+       matches were already found, so no split can go below distance 1 */
+    while (max_min > 1)
     {
-      unsigned int hdist, hdist_inv;
+      unsigned int dist_left, dist_right;
+      unsigned int tile_start, tile_end;
+      int left_ok, right_ok;
+
+      dist_left  = left ? p_min - bs_light[left-1] : 0;
+      dist_right = (right < bs_count && bs_light[right] > p_max) ?
+                      bs_light[right] - p_max : 0;
+      left_ok  = left > 0 && dist_left < max_min;
+      right_ok = right < bs_count && dist_right < max_min;
 
-      /* this split is too far away -> skip it */
-      if (abs(bs_light[j] - p) > min_hdist &&
-          abs(tip_count - bs_light[j] - p) > min_hdist)
+      if (!left_ok && !right_ok)
+        break;
+
+      if (right_ok && (!left_ok || dist_right <= dist_left))
       {
-        continue;
+        tile_start = right;
+        tile_end   = PLL_MIN(right + TBE_BS_TILE_SIZE, bs_count);
+        right = tile_end;
+      }
+      else
+      {
+        tile_end   = left;
+        tile_start = left > TBE_BS_TILE_SIZE ? left - TBE_BS_TILE_SIZE : 0;
+        left = tile_start;
       }
 
-      //      unsigned int hdist = pllmod_utree_split_hamming_distance(ref_split, bs_splits[j], tip_count);
-      hdist = utree_split_hamming_distance_lbound(ref_split, bs_splits[j],
-                                                  split_len, min_hdist);
-      hdist_inv = utree_split_hamming_distance_lbound(inv_split, bs_splits[j],
-                                                      split_len, min_hdist);
-      min_hdist = PLL_MIN(min_hdist, hdist);
-      min_hdist = PLL_MIN(min_hdist, hdist_inv);
-    }
+      for (j = tile_start; j < tile_end; ++j)
+      {
+        const pll_split_base_t * bs_split = bs_block + (size_t) j * split_len;
+        for (b = 0; b < block_size; ++b)
+        {
+          unsigned int lbound = bs_light[j] > ref_light[b] ?
+                                  bs_light[j] - ref_light[b] :
+                                  ref_light[b] - bs_light[j];
+          unsigned int hdist;
+
+          if (ref_min[b] <= 1 || lbound >= ref_min[b])
+            continue;
+
+          hdist = utree_split_transfer_distance_lbound(ref_block + b * split_len,
+                                                       bs_split,
+                                                       split_len,
+                                                       tip_count,
+                                                       ref_min[b]);
+          if (hdist < ref_min[b])
+            ref_min[b] = hdist;
+        }
+      }
 
-    assert(min_hdist > 0);
+      max_min = 0;
+      for (b = 0; b < block_size; ++b)
+        max_min = PLL_MAX(max_min, ref_min[b]);
+    }
 
-    support[i] = 1.0 - (((double) min_hdist) / (p - 1)) ;
+    for (b = 0; b < block_size; ++b)
+    {
+      unsigned int p = ref_light[b];
+      support[ref_index[b]] = 1.0 - (((double) ref_min[b]) / (p - 1));
+    }
   }
 
-  pllmod_utree_split_hashtable_destroy(bs_splits_hash);
-  free(inv_split);
-  free(bs_light);
+  free(ref_block);
 
   return PLL_SUCCESS;
 }
-
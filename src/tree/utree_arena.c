@@ -0,0 +1,648 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Heidelberg Institute for Theoretical Studies,
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+ /**
+  * @file utree_arena.c
+  *
+  * @brief Memory arena for unrooted trees
+  *
+  * Nodes, labels and node arrays of the trees built in an arena are carved
+  * out of a few large blocks. The 3 pll_unode_t of an inner node are
+  * adjacent, clones are laid out in preorder, and all trees in the arena are
+  * released at once with pllmod_utree_arena_reset() or
+  * pllmod_utree_arena_destroy(). Trees in an arena must never be passed to
+  * pll_utree_destroy().
+  *
+  * @author Alexey Kozlov
+  */
+
+#include "pll_tree.h"
+
+#include "../pllmod_common.h"
+
+/* alignment of the arena allocations, and size of the block header that
+   links every block to the previous one */
+#define UTREE_ARENA_ALIGNMENT 16
+
+/* label bytes reserved per tip when sizing the first block */
+#define UTREE_ARENA_LABEL_SIZE 16
+
+/* size of the first block if no tip count is given */
+#define UTREE_ARENA_MIN_BLOCK 4096
+
+typedef struct arena_pair
+{
+  const pll_unode_t * src;
+  pll_unode_t * dst;
+} arena_pair_t;
+
+typedef struct arena_frame
+{
+  pll_unode_t * entry;
+  pll_unode_t * cursor;
+} arena_frame_t;
+
+static size_t arena_tree_size(unsigned int tip_count)
+{
+  size_t inner_count = tip_count > 2 ? tip_count - 2 : 1;
+  size_t node_count = tip_count + inner_count;
+
+  return (tip_count + 3 * inner_count) * sizeof(pll_unode_t) +
+         node_count * sizeof(pll_unode_t *) + sizeof(pll_utree_t) +
+         tip_count * UTREE_ARENA_LABEL_SIZE + 4 * UTREE_ARENA_ALIGNMENT;
+}
+
+static int arena_add_block(pllmod_utree_arena_t * arena, size_t size)
+{
+  char * block = (char *) malloc(size);
+  if (!block)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for tree arena block\n");
+    return PLL_FAILURE;
+  }
+
+  *((char **) block) = arena->block;
+  arena->block = block;
+  arena->block_size = size;
+  arena->block_used = UTREE_ARENA_ALIGNMENT;
+  arena->total_size += size;
+
+  return PLL_SUCCESS;
+}
+
+static void arena_free_blocks(pllmod_utree_arena_t * arena)
+{
+  while (arena->block)
+  {
+    char * prev = *((char **) arena->block);
+    free(arena->block);
+    arena->block = prev;
+  }
+  arena->block_size = arena->block_used = arena->total_size = 0;
+}
+
+static void * arena_alloc(pllmod_utree_arena_t * arena,
+                          size_t size,
+                          size_t alignment)
+{
+  size_t offset = (arena->block_used + alignment - 1) & ~(alignment - 1);
+
+  if (!arena->block || offset + size > arena->block_size)
+  {
+    size_t block_size = 2 * arena->block_size;
+    if (block_size < size + UTREE_ARENA_ALIGNMENT)
+      block_size = size + UTREE_ARENA_ALIGNMENT;
+
+    if (!arena_add_block(arena, block_size))
+      return NULL;
+
+    offset = UTREE_ARENA_ALIGNMENT;
+  }
+
+  arena->block_used = offset + size;
+  return arena->block + offset;
+}
+
+static char * arena_strdup(pllmod_utree_arena_t * arena, const char * s)
+{
+  size_t len = strlen(s) + 1;
+  char * copy = (char *) arena_alloc(arena, len, 1);
+
+  if (copy)
+    memcpy(copy, s, len);
+
+  return copy;
+}
+
+/* copies the ring of `src` into the arena with `src` as first element */
+static pll_unode_t * arena_copy_ring(pllmod_utree_arena_t * arena,
+                                     const pll_unode_t * src,
+                                     arena_pair_t * pairs,
+                                     unsigned int * pair_count)
+{
+  const pll_unode_t * snode = src;
+  unsigned int ring_size = 0;
+  unsigned int i;
+  pll_unode_t * dst;
+  char * label = NULL;
+
+  do
+  {
+    ++ring_size;
+    snode = snode->next;
+  }
+  while (snode && snode != src);
+
+  dst = (pll_unode_t *) arena_alloc(arena,
+                                    ring_size * sizeof(pll_unode_t),
+                                    UTREE_ARENA_ALIGNMENT);
+  if (!dst)
+    return NULL;
+
+  if (src->label && !(label = arena_strdup(arena, src->label)))
+    return NULL;
+
+  snode = src;
+  for (i = 0; i < ring_size; ++i)
+  {
+    dst[i] = *snode;
+    dst[i].label = label;
+    dst[i].back = NULL;
+    dst[i].next = src->next ? dst + (i + 1) % ring_size : NULL;
+
+    pairs[*pair_count].src = snode;
+    pairs[*pair_count].dst = dst + i;
+    ++(*pair_count);
+
+    snode = snode->next;
+  }
+
+  return dst;
+}
+
+static int cmp_pair_src(const void * a, const void * b)
+{
+  const char * src_a = (const char *) ((const arena_pair_t *) a)->src;
+  const char * src_b = (const char *) ((const arena_pair_t *) b)->src;
+  return (src_a > src_b) - (src_a < src_b);
+}
+
+static pll_unode_t * arena_find_copy(const arena_pair_t * pairs,
+                                     unsigned int pair_count,
+                                     const pll_unode_t * src)
+{
+  arena_pair_t key;
+  const arena_pair_t * pair;
+
+  key.src = src;
+  key.dst = NULL;
+  pair = (const arena_pair_t *) bsearch(&key, pairs, pair_count,
+                                        sizeof(arena_pair_t), cmp_pair_src);
+
+  return pair ? pair->dst : NULL;
+}
+
+/*
+ * Postorder traversal of the subtree rooted at `node` with the same node
+ * order as pll_utree_wraptree(). If `nodes` is NULL the nodes are only counted.
+ */
+static int arena_fill_nodes(pll_unode_t * node,
+                            pll_unode_t ** nodes,
+                            arena_frame_t * stack,
+                            unsigned int stack_size,
+                            unsigned int * tip_index,
+                            unsigned int * inner_index)
+{
+  unsigned int top = 0;
+
+  if (!node->next)
+  {
+    if (nodes)
+      nodes[*tip_index] = node;
+    ++(*tip_index);
+    return PLL_SUCCESS;
+  }
+
+  stack[top].entry = node;
+  stack[top].cursor = node->next;
+  ++top;
+
+  while (top)
+  {
+    arena_frame_t * frame = stack + top - 1;
+    pll_unode_t * child;
+
+    if (frame->cursor == frame->entry)
+    {
+      if (nodes)
+        nodes[*inner_index] = frame->entry;
+      ++(*inner_index);
+      --top;
+      continue;
+    }
+
+    child = frame->cursor->back;
+    frame->cursor = frame->cursor->next;
+
+    if (!child->next)
+    {
+      if (nodes)
+        nodes[*tip_index] = child;
+      ++(*tip_index);
+    }
+    else
+    {
+      if (top == stack_size)
+      {
+        pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE,
+                         "Tree has more inner nodes than expected\n");
+        return PLL_FAILURE;
+      }
+      stack[top].entry = child;
+      stack[top].cursor = child->next;
+      ++top;
+    }
+  }
+
+  return PLL_SUCCESS;
+}
+
+static int arena_fill_tree(pll_unode_t * root,
+                           pll_unode_t ** nodes,
+                           arena_frame_t * stack,
+                           unsigned int stack_size,
+                           unsigned int * tip_index,
+                           unsigned int * inner_index)
+{
+  pll_unode_t * snode = root;
+
+  do
+  {
+    if (!arena_fill_nodes(snode->back, nodes, stack, stack_size,
+                          tip_index, inner_index))
+      return PLL_FAILURE;
+    snode = snode->next;
+  }
+  while (snode != root);
+
+  if (nodes)
+    nodes[*inner_index] = root;
+  ++(*inner_index);
+
+  return PLL_SUCCESS;
+}
+
+/**
+ * Creates an empty tree arena
+ *
+ * @param tip_count number of tips of the trees to be built, used for sizing
+ *                  the first block. The arena grows as needed.
+ *
+ * @return the new arena, or NULL on error
+ */
+PLL_EXPORT pllmod_utree_arena_t * pllmod_utree_arena_create(
+                                                        unsigned int tip_count)
+{
+  pllmod_utree_arena_t * arena;
+  size_t block_size = tip_count ? arena_tree_size(tip_count) :
+                                  UTREE_ARENA_MIN_BLOCK;
+
+  arena = (pllmod_utree_arena_t *) calloc(1, sizeof(pllmod_utree_arena_t));
+  if (!arena)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for tree arena\n");
+    return NULL;
+  }
+
+  if (!arena_add_block(arena, block_size))
+  {
+    free(arena);
+    return NULL;
+  }
+
+  return arena;
+}
+
+/**
+ * Releases all trees in the arena and keeps the memory for reuse
+ *
+ * If the arena had grown beyond its first block, its blocks are merged into a
+ * single one, such that the next trees of the same size fit in one block.
+ *
+ * @return PLL_SUCCESS, or PLL_FAILURE if the merged block cannot be allocated
+ */
+PLL_EXPORT int pllmod_utree_arena_reset(pllmod_utree_arena_t * arena)
+{
+  size_t total_size;
+
+  if (!arena)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Arena is NULL\n");
+    return PLL_FAILURE;
+  }
+
+  if (arena->block && !*((char **) arena->block))
+  {
+    arena->block_used = UTREE_ARENA_ALIGNMENT;
+    return PLL_SUCCESS;
+  }
+
+  total_size = arena->total_size;
+  arena_free_blocks(arena);
+
+  return arena_add_block(arena, total_size ? total_size :
+                                             UTREE_ARENA_MIN_BLOCK);
+}
+
+/**
+ * Destroys the arena together with all trees built in it
+ */
+PLL_EXPORT void pllmod_utree_arena_destroy(pllmod_utree_arena_t * arena)
+{
+  if (!arena)
+    return;
+
+  arena_free_blocks(arena);
+  free(arena);
+}
+
+/**
+ * Creates a tip node in the arena
+ *
+ * @param arena the tree arena
+ * @param clv_index the CLV index of the tip
+ * @param label the tip label, copied into the arena. Can be NULL.
+ * @param data the data pointer of the node
+ *
+ * @return the new node, or NULL on error
+ */
+PLL_EXPORT pll_unode_t * pllmod_utree_arena_create_tip(
+                                                  pllmod_utree_arena_t * arena,
+                                                  unsigned int clv_index,
+                                                  const char * label,
+                                                  void * data)
+{
+  pll_unode_t * node;
+
+  if (!arena)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Arena is NULL\n");
+    return NULL;
+  }
+
+  node = (pll_unode_t *) arena_alloc(arena, sizeof(pll_unode_t),
+                                     UTREE_ARENA_ALIGNMENT);
+  if (!node)
+    return NULL;
+
+  memset(node, 0, sizeof(pll_unode_t));
+  node->clv_index = clv_index;
+  node->scaler_index = PLL_SCALE_BUFFER_NONE;
+  node->data = data;
+
+  if (label && !(node->label = arena_strdup(arena, label)))
+    return NULL;
+
+  return node;
+}
+
+/**
+ * Creates an inner node in the arena
+ *
+ * Same as pllmod_utree_create_node(), but the 3 pll_unode_t are adjacent in
+ * memory and the label is copied into the arena.
+ *
+ * @return the new node, or NULL on error
+ */
+PLL_EXPORT pll_unode_t * pllmod_utree_arena_create_node(
+                                                  pllmod_utree_arena_t * arena,
+                                                  unsigned int clv_index,
+                                                  int scaler_index,
+                                                  const char * label,
+                                                  void * data)
+{
+  pll_unode_t * node;
+  char * label_copy = NULL;
+  unsigned int i;
+
+  if (!arena)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Arena is NULL\n");
+    return NULL;
+  }
+
+  node = (pll_unode_t *) arena_alloc(arena, 3 * sizeof(pll_unode_t),
+                                     UTREE_ARENA_ALIGNMENT);
+  if (!node)
+    return NULL;
+
+  if (label && !(label_copy = arena_strdup(arena, label)))
+    return NULL;
+
+  memset(node, 0, 3 * sizeof(pll_unode_t));
+  for (i = 0; i < 3; ++i)
+  {
+    node[i].next = node + (i + 1) % 3;
+    node[i].label = label_copy;
+    node[i].data = data;
+    node[i].clv_index = clv_index;
+    node[i].scaler_index = scaler_index;
+  }
+
+  return node;
+}
+
+/**
+ * Wraps a tree structure built in the arena
+ *
+ * Same as pll_utree_wraptree(), but the tree structure and its node array are
+ * allocated in the arena.
+ *
+ * @param arena the tree arena
+ * @param root an inner node of the tree, or a tip
+ * @param tip_count the number of tips
+ *
+ * @return the wrapped tree, or NULL on error
+ */
+PLL_EXPORT pll_utree_t * pllmod_utree_arena_wraptree(
+                                                  pllmod_utree_arena_t * arena,
+                                                  pll_unode_t * root,
+                                                  unsigned int tip_count)
+{
+  pll_utree_t * tree = NULL;
+  arena_frame_t * stack;
+  unsigned int tip_index = 0;
+  unsigned int inner_index = 0;
+
+  if (!arena || !root)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Arena or root is NULL\n");
+    return NULL;
+  }
+
+  if (tip_count < 3)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Invalid tip_count value (%u)\n", tip_count);
+    return NULL;
+  }
+
+  if (!root->next)
+    root = root->back;
+
+  stack = (arena_frame_t *) malloc(tip_count * sizeof(arena_frame_t));
+  if (!stack)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for traversal stack\n");
+    return NULL;
+  }
+
+  /* count nodes */
+  if (!arena_fill_tree(root, NULL, stack, tip_count, &tip_index, &inner_index))
+    goto wrap_exit;
+
+  if (tip_index != tip_count)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Tree has %u tips, expected %u\n", tip_index, tip_count);
+    goto wrap_exit;
+  }
+
+  tree = (pll_utree_t *) arena_alloc(arena, sizeof(pll_utree_t),
+                                     UTREE_ARENA_ALIGNMENT);
+  if (!tree)
+    goto wrap_exit;
+
+  tree->tip_count = tip_count;
+  tree->inner_count = inner_index;
+  tree->edge_count = tip_count + inner_index - 1;
+  tree->binary = (inner_index == tip_count - 2);
+  tree->vroot = root;
+  tree->nodes = (pll_unode_t **) arena_alloc(arena,
+                                  (tip_count + inner_index) *
+                                  sizeof(pll_unode_t *),
+                                  UTREE_ARENA_ALIGNMENT);
+  if (!tree->nodes)
+  {
+    tree = NULL;
+    goto wrap_exit;
+  }
+
+  tip_index = 0;
+  inner_index = tip_count;
+  arena_fill_tree(root, tree->nodes, stack, tip_count,
+                  &tip_index, &inner_index);
+
+wrap_exit:
+  free(stack);
+  return tree;
+}
+
+/**
+ * Clones a tree into the arena
+ *
+ * The nodes are laid out in preorder from the virtual root, with the
+ * pll_unode_t of every inner node adjacent to each other. The node array
+ * keeps the order of `tree`, and data pointers are copied as they are.
+ *
+ * @param arena the tree arena
+ * @param tree the tree to clone
+ *
+ * @return the cloned tree, or NULL on error
+ */
+PLL_EXPORT pll_utree_t * pllmod_utree_arena_clone(pllmod_utree_arena_t * arena,
+                                                  const pll_utree_t * tree)
+{
+  unsigned int i;
+  unsigned int node_count;
+  unsigned int unode_count;
+  unsigned int pair_count = 0;
+  unsigned int top = 0;
+  arena_pair_t * pairs;
+  unsigned int * stack;
+  pll_utree_t * clone = NULL;
+
+  if (!arena || !tree)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Arena or tree is NULL\n");
+    return NULL;
+  }
+
+  node_count = tree->tip_count + tree->inner_count;
+  unode_count = tree->tip_count;
+  for (i = tree->tip_count; i < node_count; ++i)
+  {
+    const pll_unode_t * snode = tree->nodes[i];
+    do
+    {
+      ++unode_count;
+      snode = snode->next;
+    }
+    while (snode != tree->nodes[i]);
+  }
+
+  pairs = (arena_pair_t *) malloc(unode_count * sizeof(arena_pair_t));
+  stack = (unsigned int *) malloc(unode_count * sizeof(unsigned int));
+  if (!pairs || !stack)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for tree clone\n");
+    goto clone_exit;
+  }
+
+  /* copy the nodes in preorder */
+  if (!arena_copy_ring(arena, tree->vroot, pairs, &pair_count))
+    goto clone_exit;
+  for (i = pair_count; i > 0; --i)
+    stack[top++] = i - 1;
+
+  while (top)
+  {
+    unsigned int first = pair_count;
+    const pll_unode_t * s = pairs[stack[--top]].src;
+    pll_unode_t * d = pairs[stack[top]].dst;
+    pll_unode_t * child;
+
+    if (d->back)
+      continue;
+
+    if (!(child = arena_copy_ring(arena, s->back, pairs, &pair_count)))
+      goto clone_exit;
+
+    d->back = child;
+    child->back = d;
+
+    for (i = pair_count; i > first + 1; --i)
+      stack[top++] = i - 1;
+  }
+
+  assert(pair_count == unode_count);
+
+  clone = (pll_utree_t *) arena_alloc(arena, sizeof(pll_utree_t),
+                                      UTREE_ARENA_ALIGNMENT);
+  if (!clone)
+    goto clone_exit;
+
+  *clone = *tree;
+  clone->nodes = (pll_unode_t **) arena_alloc(arena,
+                                              node_count *
+                                              sizeof(pll_unode_t *),
+                                              UTREE_ARENA_ALIGNMENT);
+  if (!clone->nodes)
+  {
+    clone = NULL;
+    goto clone_exit;
+  }
+
+  /* map the node array and the virtual root */
+  qsort(pairs, pair_count, sizeof(arena_pair_t), cmp_pair_src);
+  for (i = 0; i < node_count; ++i)
+    clone->nodes[i] = arena_find_copy(pairs, pair_count, tree->nodes[i]);
+  clone->vroot = arena_find_copy(pairs, pair_count, tree->vroot);
+
+clone_exit:
+  free(pairs);
+  free(stack);
+  return clone;
+}
@@ -45,6 +45,39 @@ static unsigned int get_utree_splitmap_id(pll_unode_t * node,
                                           unsigned int tip_count);
 static int split_is_valid_and_normalized(const pll_split_t bitv,
                                          unsigned int tip_count);
+static pll_unode_t * utree_find_tip(pll_unode_t * node,
+                                    unsigned int tip_index,
+                                    pll_unode_t ** stack,
+                                    unsigned int max_nodes);
+static unsigned int utree_rooted_preorder(pll_unode_t * root,
+                                          pll_unode_t ** order,
+                                          unsigned int * parent,
+                                          pll_unode_t ** stack,
+                                          unsigned int max_nodes);
+static int utree_rank_tips(pll_unode_t * const * order,
+                           unsigned int node_count,
+                           unsigned int tip_count,
+                           unsigned int * tip_rank);
+static void utree_cluster_intervals(pll_unode_t * const * order,
+                                    const unsigned int * parent,
+                                    unsigned int node_count,
+                                    const unsigned int * tip_rank,
+                                    unsigned int * lo,
+                                    unsigned int * hi,
+                                    unsigned int * size);
+
+static unsigned int merge_intervals(const unsigned int * a,
+                                    unsigned int a_count,
+                                    const unsigned int * b,
+                                    unsigned int b_count,
+                                    unsigned int * out);
+static hash_key_t compact_split_key(const unsigned int * interval,
+                                    unsigned int interval_count);
+static int compare_compact_splits(const pll_compact_split_set_t * set1,
+                                  unsigned int split1,
+                                  const pll_compact_split_set_t * set2,
+                                  unsigned int split2);
+static int _cmp_compact_split_entry(const void * a, const void * b);
 
 struct split_node_pair {
   pll_split_t split;
@@ -197,27 +230,17 @@ PLL_EXPORT int pllmod_utree_consistency_set(pll_utree_t * t1,
 /******************************************************************************/
 /* discrete operations */
 
+/* Uses Day's cluster table (see pllmod_utree_rf_distance_day), which needs
+ * linear time and memory also for very dissimilar trees */
 PLL_EXPORT unsigned int pllmod_utree_rf_distance(pll_unode_t * t1,
                                                  pll_unode_t * t2,
                                                  unsigned int tip_count)
 {
   unsigned int rf_distance;
 
-  /* reset pll_error */
-  pll_errno = 0;
-
-  /* split both trees */
-  pll_split_t * s1 = pllmod_utree_split_create(t1, tip_count, NULL);
-  pll_split_t * s2 = pllmod_utree_split_create(t2, tip_count, NULL);
-
-  /* compute distance */
-  rf_distance = pllmod_utree_split_rf_distance(s1, s2, tip_count);
+  rf_distance = pllmod_utree_rf_distance_day(t1, t2, tip_count);
 
-  /* clean up */
-  pllmod_utree_split_destroy(s1);
-  pllmod_utree_split_destroy(s2);
-
-  assert(rf_distance <= 2*(tip_count-3));
+  assert(rf_distance <= 2*(tip_count-3) || tip_count < 4);
   return rf_distance;
 }
 
@@ -262,6 +285,172 @@ PLL_EXPORT unsigned int pllmod_utree_split_rf_distance(pll_split_t * s1,
   return 2*(tip_count - 3 - equal);
 }
 
+/**
+ * Computes the Robinson-Foulds distance between two unrooted trees in linear
+ * time and space, without building split bitvectors (Day, 1985).
+ *
+ * Both trees are rooted at the tip with node index 0. Tips of `t1` are
+ * relabeled in preorder, such that every cluster in `t1` is an interval of
+ * tip ranks, and the clusters of `t1` are stored in a table indexed by
+ * either end of the interval. A cluster in `t2` is shared iff its ranks form
+ * an interval that is present in the table.
+ *
+ * Tip node indices must be consistent in both trees (see
+ * `pllmod_utree_consistency_set`). Multifurcating trees are supported.
+ *
+ * @param t1        first tree (any node)
+ * @param t2        second tree (any node)
+ * @param tip_count number of tips
+ *
+ * @return the RF distance, or 0 on error (check pll_errno for details)
+ */
+PLL_EXPORT unsigned int pllmod_utree_rf_distance_day(pll_unode_t * t1,
+                                                     pll_unode_t * t2,
+                                                     unsigned int tip_count)
+{
+  unsigned int i;
+  unsigned int node_count, max_nodes;
+  unsigned int cluster_count1 = 0,
+               cluster_count2 = 0,
+               equal = 0;
+  pll_unode_t ** order = NULL;
+  pll_unode_t ** stack = NULL;
+  pll_unode_t * r1, * r2;
+  unsigned int * parent = NULL;
+  unsigned int * lo = NULL, * hi = NULL, * size = NULL;
+  unsigned int * tip_rank = NULL;
+  unsigned int * table_lo = NULL, * table_hi = NULL;
+  unsigned int rf_distance = 0;
+
+  /* reset pll_error */
+  pll_errno = 0;
+
+  if (tip_count < 4)
+    return 0;
+
+  /* every tree with `tip_count` tips has at most `tip_count-2` inner nodes */
+  max_nodes = 2 * tip_count;
+
+  order    = (pll_unode_t **) malloc(2 * max_nodes * sizeof(pll_unode_t *));
+  parent   = (unsigned int *) malloc(4 * max_nodes * sizeof(unsigned int));
+  tip_rank = (unsigned int *) malloc(3 * tip_count * sizeof(unsigned int));
+  if (!(order && parent && tip_rank))
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for cluster table\n");
+    goto day_exit;
+  }
+
+  stack    = order + max_nodes;
+  lo       = parent + max_nodes;
+  hi       = lo + max_nodes;
+  size     = hi + max_nodes;
+  table_lo = tip_rank + tip_count;
+  table_hi = table_lo + tip_count;
+
+  for (i = 0; i < tip_count; ++i)
+    table_lo[i] = table_hi[i] = tip_count;
+
+  /* root both trees at tip 0 */
+  r1 = utree_find_tip(t1, 0, stack, max_nodes);
+  r2 = utree_find_tip(t2, 0, stack, max_nodes);
+  if (!r1 || !r2)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE,
+                     "Tip with node index 0 not found\n");
+    goto day_exit;
+  }
+
+  /* first tree: rank tips in preorder and fill cluster table */
+  node_count = utree_rooted_preorder(r1->back, order, parent,
+                                     stack, max_nodes);
+  if (!node_count)
+    goto day_exit;
+
+  if (!utree_rank_tips(order, node_count, tip_count, tip_rank))
+    goto day_exit;
+
+  utree_cluster_intervals(order, parent, node_count, tip_rank,
+                          lo, hi, size);
+
+  for (i = 1; i < node_count; ++i)
+  {
+    pll_unode_t * node = order[i];
+    if (!node->next || size[i] < 2 || size[i] > tip_count - 2)
+      continue;
+
+    ++cluster_count1;
+
+    /* the last child of a node shares its right end with the parent, so it
+       is stored at its left end (Day, 1985) */
+    if (node->back->next == order[parent[i]])
+    {
+      table_lo[lo[i]] = lo[i];
+      table_hi[lo[i]] = hi[i];
+    }
+    else
+    {
+      table_lo[hi[i]] = lo[i];
+      table_hi[hi[i]] = hi[i];
+    }
+  }
+
+  /* second tree: look up every cluster in the table */
+  node_count = utree_rooted_preorder(r2->back, order, parent,
+                                     stack, max_nodes);
+  if (!node_count)
+    goto day_exit;
+
+  for (i = 0; i < node_count; ++i)
+  {
+    pll_unode_t * node = order[i];
+    if (!node->next &&
+        (node->node_index >= tip_count || tip_rank[node->node_index] >= tip_count))
+    {
+      pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE,
+                       "Tip node index %u does not exist in the first tree\n",
+                       node->node_index);
+      goto day_exit;
+    }
+  }
+
+  utree_cluster_intervals(order, parent, node_count, tip_rank,
+                          lo, hi, size);
+
+  if (size[0] != tip_count - 1)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE_SIZE,
+                     "Trees do not have the same number of tips\n");
+    goto day_exit;
+  }
+
+  for (i = 1; i < node_count; ++i)
+  {
+    pll_unode_t * node = order[i];
+    unsigned int l = lo[i],
+                 h = hi[i];
+    if (!node->next || size[i] < 2 || size[i] > tip_count - 2)
+      continue;
+
+    ++cluster_count2;
+
+    if (h - l + 1 == size[i] &&
+        ((table_lo[l] == l && table_hi[l] == h) ||
+         (table_lo[h] == l && table_hi[h] == h)))
+      ++equal;
+  }
+
+  assert(equal <= cluster_count1 && equal <= cluster_count2);
+  rf_distance = cluster_count1 + cluster_count2 - 2 * equal;
+
+day_exit:
+  free(order);
+  free(parent);
+  free(tip_rank);
+
+  return rf_distance;
+}
+
 
 
 /******************************************************************************/
@@ -403,6 +592,7 @@ PLL_EXPORT pll_split_t * pllmod_utree_split_create(const pll_unode_t * tree,
   pll_split_t splits;         /* contiguous array of splits, as size is known */
   struct split_node_pair * split_nodes;
   pll_split_t first_split;
+  pllmod_utree_traversal_t * traversal;
 
   /* as many non-trivial splits as inner branches */
   split_count   = tip_count - 3;
@@ -468,11 +658,22 @@ PLL_EXPORT pll_split_t * pllmod_utree_split_create(const pll_unode_t * tree,
     tree = tree->back;
 
   /* traverse for computing the scripts */
-  pllmod_utree_traverse_apply((pll_unode_t *) tree,
-                              NULL,
-                              NULL,
-                              &cb_get_splits,
-                              &split_data);
+  traversal = pllmod_utree_traversal_create(2 * tip_count - 2);
+  if (!traversal ||
+      !pllmod_utree_traversal_update(traversal, (pll_unode_t *) tree))
+  {
+    pllmod_utree_traversal_destroy(traversal);
+    free(split_data.id_to_split);
+    free(splits);
+    free(split_list);
+    free(split_nodes);
+    return NULL;
+  }
+
+  for (i=0; i<traversal->node_count; ++i)
+    cb_get_splits(traversal->postorder[i], &split_data);
+
+  pllmod_utree_traversal_destroy(traversal);
 
   // TODO better handling for multifurcating trees
   assert(split_data.split_count <= split_count);
@@ -661,6 +862,547 @@ PLL_EXPORT void pllmod_utree_split_destroy(pll_split_t * split_list)
   free(split_list);
 }
 
+/******************************************************************************/
+/* compact splits */
+
+/*
+ * Splits of very large trees do not fit in memory as dense bitvectors, as they
+ * require O(n^2) bits. Instead, tips are ranked according to a preorder
+ * traversal of a reference tree rooted at tip 0, and each split is stored as
+ * the sorted list of rank intervals of the side that does not contain tip 0.
+ * Splits of the reference tree are single intervals, and splits of similar
+ * trees (e.g., bootstrap replicates) require only a few intervals each.
+ */
+
+struct compact_split_entry
+{
+  const unsigned int * interval;
+  unsigned int interval_count;
+  unsigned int size;
+  hash_key_t key;
+  pll_unode_t * node;
+};
+
+/**
+ * Computes the rank of every tip in a preorder traversal of `tree` rooted at
+ * tip 0. Tip 0 gets the last rank.
+ *
+ * @param tree      tree (any node)
+ * @param tip_count number of tips
+ * @param[out] tip_rank rank of every tip, indexed by node index
+ *
+ * @return PLL_SUCCESS if OK, PLL_FAILURE otherwise (check pll_errmsg)
+ */
+PLL_EXPORT int pllmod_utree_split_tip_ranks(const pll_unode_t * tree,
+                                            unsigned int tip_count,
+                                            unsigned int * tip_rank)
+{
+  unsigned int max_nodes = 2 * tip_count;
+  unsigned int node_count;
+  int retval = PLL_FAILURE;
+  pll_unode_t ** order;
+  unsigned int * parent;
+  pll_unode_t * root;
+
+  order  = (pll_unode_t **) malloc(2 * max_nodes * sizeof(pll_unode_t *));
+  parent = (unsigned int *) malloc(2 * max_nodes * sizeof(unsigned int));
+  if (!order || !parent)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for tree traversal\n");
+    goto ranks_exit;
+  }
+
+  root = utree_find_tip((pll_unode_t *) tree, 0, order + max_nodes, max_nodes);
+  if (!root || !root->back)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE,
+                     "Tip with node index 0 not found\n");
+    goto ranks_exit;
+  }
+
+  node_count = utree_rooted_preorder(root->back, order, parent,
+                                     order + max_nodes, max_nodes);
+  if (node_count)
+    retval = utree_rank_tips(order, node_count, tip_count, tip_rank);
+
+ranks_exit:
+  free(order);
+  free(parent);
+  return retval;
+}
+
+/**
+ * Creates the set of non-trivial splits of a tree in compact form.
+ *
+ * Splits are sorted such that two sets created with the same `tip_rank` can
+ * be compared by merging. Memory is linear in the total number of intervals
+ * and never requires dense bitvectors.
+ *
+ * @param tree              tree (any node)
+ * @param tip_count         number of tips
+ * @param tip_rank          tip ranks shared by all the sets that are going to
+ *                          be compared (see pllmod_utree_split_tip_ranks),
+ *                          or NULL for ranking the tips of `tree`
+ * @param split_to_node_map if not NULL, it is filled with the node defining
+ *                          every split
+ *
+ * @return the set of splits, or NULL on error (check pll_errmsg)
+ */
+PLL_EXPORT
+pll_compact_split_set_t * pllmod_utree_compact_split_create(
+                                          const pll_unode_t * tree,
+                                          unsigned int tip_count,
+                                          const unsigned int * tip_rank,
+                                          pll_unode_t ** split_to_node_map)
+{
+  unsigned int i, j;
+  unsigned int max_nodes = 2 * tip_count;
+  unsigned int node_count;
+  unsigned int split_count = 0;
+  unsigned int total_intervals = 0;
+  size_t iv_used = 0,
+         iv_capacity = 4 * (size_t) tip_count;
+  pll_unode_t ** order = NULL;
+  pll_unode_t * root;
+  unsigned int * parent = NULL;
+  unsigned int * node_offset, * node_count_iv, * node_size;
+  unsigned int * own_rank = NULL;
+  unsigned int * iv = NULL;
+  struct compact_split_entry * entries = NULL;
+  pll_compact_split_set_t * set = NULL;
+
+  if (tip_count < 4)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE_SIZE,
+                     "Tree must have at least 4 tips\n");
+    return NULL;
+  }
+
+  order  = (pll_unode_t **) malloc(2 * max_nodes * sizeof(pll_unode_t *));
+  parent = (unsigned int *) malloc(5 * max_nodes * sizeof(unsigned int));
+  iv     = (unsigned int *) malloc(2 * iv_capacity * sizeof(unsigned int));
+  set    = (pll_compact_split_set_t *) calloc(1, sizeof(pll_compact_split_set_t));
+  if (!(order && parent && iv && set))
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for compact splits\n");
+    goto compact_error;
+  }
+
+  node_offset   = parent + 2 * max_nodes;
+  node_count_iv = node_offset + max_nodes;
+  node_size     = node_count_iv + max_nodes;
+
+  set->tip_count = tip_count;
+  set->rank_to_tip = (unsigned int *) malloc(tip_count * sizeof(unsigned int));
+  if (!set->rank_to_tip)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for compact splits\n");
+    goto compact_error;
+  }
+
+  root = utree_find_tip((pll_unode_t *) tree, 0, order + max_nodes, max_nodes);
+  if (!root || !root->back)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE,
+                     "Tip with node index 0 not found\n");
+    goto compact_error;
+  }
+
+  node_count = utree_rooted_preorder(root->back, order, parent,
+                                     order + max_nodes, max_nodes);
+  if (!node_count)
+    goto compact_error;
+
+  if (!tip_rank)
+  {
+    own_rank = (unsigned int *) malloc(tip_count * sizeof(unsigned int));
+    if (!own_rank)
+    {
+      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                       "Cannot allocate memory for tip ranks\n");
+      goto compact_error;
+    }
+    if (!utree_rank_tips(order, node_count, tip_count, own_rank))
+      goto compact_error;
+    tip_rank = own_rank;
+  }
+
+  /* tip ranks must be a permutation */
+  for (i = 0; i < tip_count; ++i)
+    set->rank_to_tip[i] = tip_count;
+  for (i = 0; i < tip_count; ++i)
+  {
+    if (tip_rank[i] >= tip_count || set->rank_to_tip[tip_rank[i]] != tip_count)
+    {
+      pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                       "Tip ranks are not a permutation\n");
+      goto compact_error;
+    }
+    set->rank_to_tip[tip_rank[i]] = i;
+  }
+
+  for (i = 0; i < node_count; ++i)
+  {
+    node_count_iv[i] = 0;
+    node_size[i] = 0;
+  }
+
+  /* build interval lists bottom-up. The first child list is shared with the
+     parent, and further children are merged at the end of the buffer */
+  for (i = node_count - 1; i > 0; --i)
+  {
+    pll_unode_t * node = order[i];
+    unsigned int p = parent[i];
+
+    if (!node->next)
+    {
+      if (!node->node_index || node->node_index >= tip_count)
+      {
+        pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE,
+                         "Invalid tip node index %u\n", node->node_index);
+        goto compact_error;
+      }
+      if (iv_used == iv_capacity)
+      {
+        unsigned int * new_iv;
+        iv_capacity *= 2;
+        new_iv = (unsigned int *) realloc(iv, 2 * iv_capacity * sizeof(unsigned int));
+        if (!new_iv)
+        {
+          pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                           "Cannot allocate memory for compact splits\n");
+          goto compact_error;
+        }
+        iv = new_iv;
+      }
+      iv[2*iv_used] = iv[2*iv_used + 1] = tip_rank[node->node_index];
+      node_offset[i] = (unsigned int) iv_used++;
+      node_count_iv[i] = 1;
+      node_size[i] = 1;
+    }
+    else if (node_size[i] >= 2 && node_size[i] <= tip_count - 2)
+    {
+      ++split_count;
+      total_intervals += node_count_iv[i];
+    }
+
+    /* the list of the root is never needed */
+    if (!p)
+      continue;
+
+    node_size[p] += node_size[i];
+    if (!node_count_iv[p])
+    {
+      node_offset[p] = node_offset[i];
+      node_count_iv[p] = node_count_iv[i];
+    }
+    else
+    {
+      size_t needed = iv_used + node_count_iv[p] + node_count_iv[i];
+      if (needed > iv_capacity)
+      {
+        unsigned int * new_iv;
+        while (iv_capacity < needed)
+          iv_capacity *= 2;
+        new_iv = (unsigned int *) realloc(iv, 2 * iv_capacity * sizeof(unsigned int));
+        if (!new_iv)
+        {
+          pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                           "Cannot allocate memory for compact splits\n");
+          goto compact_error;
+        }
+        iv = new_iv;
+      }
+      j = merge_intervals(iv + 2*node_offset[p], node_count_iv[p],
+                          iv + 2*node_offset[i], node_count_iv[i],
+                          iv + 2*iv_used);
+      node_offset[p] = (unsigned int) iv_used;
+      node_count_iv[p] = j;
+      iv_used += j;
+    }
+  }
+
+  entries = (struct compact_split_entry *)
+                          malloc((split_count+1) * sizeof(struct compact_split_entry));
+  set->offset   = (unsigned int *) malloc((split_count+1) * sizeof(unsigned int));
+  set->interval = (unsigned int *) malloc(2 * (total_intervals+1) * sizeof(unsigned int));
+  set->size     = (unsigned int *) malloc((split_count+1) * sizeof(unsigned int));
+  set->key      = (hash_key_t *) malloc((split_count+1) * sizeof(hash_key_t));
+  if (!(entries && set->offset && set->interval && set->size && set->key))
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for compact splits\n");
+    goto compact_error;
+  }
+
+  for (i = 1, j = 0; i < node_count; ++i)
+  {
+    if (order[i]->next &&
+        node_size[i] >= 2 && node_size[i] <= tip_count - 2)
+    {
+      entries[j].interval       = iv + 2*node_offset[i];
+      entries[j].interval_count = node_count_iv[i];
+      entries[j].size           = node_size[i];
+      entries[j].key            = compact_split_key(entries[j].interval,
+                                                    node_count_iv[i]);
+      entries[j].node           = order[i];
+      ++j;
+    }
+  }
+  assert(j == split_count);
+
+  qsort(entries, split_count, sizeof(struct compact_split_entry),
+        _cmp_compact_split_entry);
+
+  set->split_count = split_count;
+  set->offset[0] = 0;
+  for (i = 0; i < split_count; ++i)
+  {
+    memcpy(set->interval + 2*set->offset[i], entries[i].interval,
+           2 * entries[i].interval_count * sizeof(unsigned int));
+    set->offset[i+1] = set->offset[i] + entries[i].interval_count;
+    set->size[i] = entries[i].size;
+    set->key[i]  = entries[i].key;
+    if (split_to_node_map)
+      split_to_node_map[i] = entries[i].node;
+  }
+
+  free(entries);
+  free(own_rank);
+  free(iv);
+  free(parent);
+  free(order);
+
+  return set;
+
+compact_error:
+  free(entries);
+  free(own_rank);
+  free(iv);
+  free(parent);
+  free(order);
+  pllmod_utree_compact_split_destroy(set);
+  return NULL;
+}
+
+/**
+ * Checks whether two compact splits are equal. Both sets must have been
+ * created with the same tip ranks.
+ */
+PLL_EXPORT int pllmod_utree_compact_split_equal(
+                                      const pll_compact_split_set_t * set1,
+                                      unsigned int split1,
+                                      const pll_compact_split_set_t * set2,
+                                      unsigned int split2)
+{
+  unsigned int n1 = set1->offset[split1+1] - set1->offset[split1];
+  unsigned int n2 = set2->offset[split2+1] - set2->offset[split2];
+
+  if (set1->key[split1] != set2->key[split2] || n1 != n2 ||
+      set1->size[split1] != set2->size[split2])
+    return 0;
+
+  return !memcmp(set1->interval + 2*set1->offset[split1],
+                 set2->interval + 2*set2->offset[split2],
+                 2 * n1 * sizeof(unsigned int));
+}
+
+PLL_EXPORT unsigned int pllmod_utree_compact_split_lightside(
+                                        const pll_compact_split_set_t * set,
+                                        unsigned int split)
+{
+  unsigned int size = set->size[split];
+  return PLL_MIN(size, set->tip_count - size);
+}
+
+/**
+ * Computes the Hamming distance between two compact splits, as
+ * pllmod_utree_split_hamming_distance does for dense splits.
+ */
+PLL_EXPORT unsigned int pllmod_utree_compact_split_hamming_distance(
+                                      const pll_compact_split_set_t * set1,
+                                      unsigned int split1,
+                                      const pll_compact_split_set_t * set2,
+                                      unsigned int split2)
+{
+  const unsigned int * a = set1->interval + 2*set1->offset[split1];
+  const unsigned int * b = set2->interval + 2*set2->offset[split2];
+  const unsigned int * a_end = set1->interval + 2*set1->offset[split1+1];
+  const unsigned int * b_end = set2->interval + 2*set2->offset[split2+1];
+  unsigned int tip_count = set1->tip_count;
+  unsigned int common = 0;
+  unsigned int hdist;
+
+  /* size of the intersection of both interval lists */
+  while (a < a_end && b < b_end)
+  {
+    unsigned int first = PLL_MAX(a[0], b[0]);
+    unsigned int last  = PLL_MIN(a[1], b[1]);
+    if (first <= last)
+      common += last - first + 1;
+    if (a[1] < b[1])
+      a += 2;
+    else
+      b += 2;
+  }
+
+  hdist = set1->size[split1] + set2->size[split2] - 2*common;
+
+  return PLL_MIN(hdist, tip_count - hdist);
+}
+
+/**
+ * Expands a compact split into a normalized dense split, such as the ones
+ * returned by pllmod_utree_split_create.
+ *
+ * @param set   set of splits
+ * @param split split index
+ * @param[out] bitv dense split, with room for bitv_length(tip_count) elements
+ */
+PLL_EXPORT void pllmod_utree_compact_split_get(
+                                        const pll_compact_split_set_t * set,
+                                        unsigned int split,
+                                        pll_split_t bitv)
+{
+  unsigned int split_size = sizeof(pll_split_base_t) * 8;
+  unsigned int split_len  = bitv_length(set->tip_count);
+  unsigned int i, r;
+
+  memset(bitv, 0, split_len * sizeof(pll_split_base_t));
+
+  for (i = set->offset[split]; i < set->offset[split+1]; ++i)
+  {
+    for (r = set->interval[2*i]; r <= set->interval[2*i+1]; ++r)
+    {
+      unsigned int tip_id = set->rank_to_tip[r];
+      bitv[tip_id / split_size] |= (1u << (tip_id % split_size));
+    }
+  }
+
+  /* stored side never contains tip 0, so this takes the complement */
+  bitv_normalize(bitv, set->tip_count);
+}
+
+/**
+ * Computes the RF distance between two sets of compact splits. Both sets
+ * must have been created with the same tip ranks.
+ *
+ * @return the RF distance, or 0 on error (check pll_errno for details)
+ */
+PLL_EXPORT unsigned int pllmod_utree_compact_split_rf_distance(
+                                      const pll_compact_split_set_t * set1,
+                                      const pll_compact_split_set_t * set2)
+{
+  unsigned int i = 0, j = 0;
+  unsigned int equal = 0;
+
+  pll_errno = 0;
+
+  if (set1->tip_count != set2->tip_count ||
+      memcmp(set1->rank_to_tip, set2->rank_to_tip,
+             set1->tip_count * sizeof(unsigned int)))
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Split sets were created with different tip ranks\n");
+    return 0;
+  }
+
+  while (i < set1->split_count && j < set2->split_count)
+  {
+    int cmp = compare_compact_splits(set1, i, set2, j);
+    if (!cmp)
+    {
+      ++equal;
+      ++i;
+      ++j;
+    }
+    else if (cmp < 0)
+      ++i;
+    else
+      ++j;
+  }
+
+  return set1->split_count + set2->split_count - 2*equal;
+}
+
+/**
+ * Creates or updates hashtable with compact splits (and their support), as
+ * pllmod_utree_split_hashtable_insert does for dense splits. Splits are
+ * expanded one at a time, so the hashtable can be used for consensus trees.
+ */
+PLL_EXPORT bitv_hashtable_t *
+pllmod_utree_split_hashtable_insert_compact(bitv_hashtable_t * splits_hash,
+                                            const pll_compact_split_set_t * set,
+                                            const double * support,
+                                            int update_only)
+{
+  unsigned int i;
+  pll_split_t split;
+  int own_hash = 0;
+
+  if (!splits_hash)
+  {
+    splits_hash = hash_init(set->tip_count * 10, set->tip_count);
+    update_only = 0;
+    own_hash = 1;
+  }
+
+  if (!splits_hash)
+    return NULL;
+
+  split = (pll_split_t) malloc(splits_hash->bitv_len * sizeof(pll_split_base_t));
+  if (!split)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for split\n");
+    if (own_hash)
+      hash_destroy(splits_hash);
+    return NULL;
+  }
+
+  for (i = 0; i < set->split_count; ++i)
+  {
+    pllmod_utree_compact_split_get(set, i, split);
+    if (update_only)
+    {
+      hash_update(split,
+                  splits_hash,
+                  HASH_KEY_UNDEF,
+                  support ? support[i] : 1.0,
+                  0);
+    }
+    else
+    {
+      hash_insert(split,
+                  splits_hash,
+                  splits_hash->entry_count,
+                  HASH_KEY_UNDEF,
+                  support ? support[i] : 1.0,
+                  0);
+    }
+  }
+
+  free(split);
+
+  return splits_hash;
+}
+
+PLL_EXPORT void pllmod_utree_compact_split_destroy(pll_compact_split_set_t * set)
+{
+  if (!set)
+    return;
+
+  free(set->rank_to_tip);
+  free(set->offset);
+  free(set->interval);
+  free(set->size);
+  free(set->key);
+  free(set);
+}
+
 /******************************************************************************/
 /* static functions */
 
@@ -840,3 +1582,276 @@ static int split_is_valid_and_normalized(const pll_split_t bitv,
 
   return (mask == all1) ? 0 : 1;
 }
+
+/*
+ * Finds the tip with node index `tip_index` in the tree containing `node`.
+ * `stack` must have room for `max_nodes` pointers.
+ */
+static pll_unode_t * utree_find_tip(pll_unode_t * node,
+                                    unsigned int tip_index,
+                                    pll_unode_t ** stack,
+                                    unsigned int max_nodes)
+{
+  unsigned int top = 0;
+
+  if (!node->back)
+    return (!node->next && node->node_index == tip_index) ? node : NULL;
+
+  stack[top++] = node;
+  stack[top++] = node->back;
+
+  while (top)
+  {
+    pll_unode_t * cur = stack[--top];
+    pll_unode_t * snode;
+
+    if (!cur->next)
+    {
+      if (cur->node_index == tip_index)
+        return cur;
+      continue;
+    }
+
+    for (snode = cur->next; snode != cur; snode = snode->next)
+    {
+      if (top == max_nodes)
+        return NULL;
+      stack[top++] = snode->back;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Fills `order` with the nodes of the subtree rooted at `root` in preorder,
+ * visiting the children of every node in the order of its `next` ring, and
+ * `parent` with the position in `order` of the parent of each node.
+ * Returns the number of nodes, or 0 if the tree has more than `max_nodes`.
+ */
+static unsigned int utree_rooted_preorder(pll_unode_t * root,
+                                          pll_unode_t ** order,
+                                          unsigned int * parent,
+                                          pll_unode_t ** stack,
+                                          unsigned int max_nodes)
+{
+  unsigned int top = 0;
+  unsigned int count = 0;
+  unsigned int * stack_parent = parent + max_nodes;
+
+  /* `stack_parent` reuses the `lo` buffer, which is not needed yet */
+  stack[top] = root;
+  stack_parent[top++] = 0;
+
+  while (top)
+  {
+    pll_unode_t * cur;
+    pll_unode_t * snode;
+    unsigned int first = top - 1;
+
+    --top;
+    cur = stack[top];
+
+    if (count == max_nodes)
+    {
+      pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE_SIZE,
+                       "Tree has more than %u nodes\n", max_nodes);
+      return 0;
+    }
+
+    order[count] = cur;
+    parent[count] = stack_parent[top];
+
+    if (cur->next)
+    {
+      /* push children such that the first child is visited first */
+      for (snode = cur->next; snode != cur; snode = snode->next)
+      {
+        if (top == max_nodes)
+        {
+          pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE_SIZE,
+                           "Tree has more than %u nodes\n", max_nodes);
+          return 0;
+        }
+        stack[top] = snode->back;
+        stack_parent[top++] = count;
+      }
+
+      /* reverse the pushed children */
+      for (unsigned int a = first, b = top - 1; a < b; ++a, --b)
+      {
+        pll_unode_t * aux_node = stack[a];
+        stack[a] = stack[b];
+        stack[b] = aux_node;
+      }
+    }
+
+    ++count;
+  }
+
+  return count;
+}
+
+/*
+ * Ranks the tips in `order` (a preorder of the tree rooted at tip 0, as
+ * returned by utree_rooted_preorder) from 0 to `tip_count-2`. Tip 0 gets the
+ * last rank.
+ */
+static int utree_rank_tips(pll_unode_t * const * order,
+                           unsigned int node_count,
+                           unsigned int tip_count,
+                           unsigned int * tip_rank)
+{
+  unsigned int i;
+  unsigned int rank = 0;
+
+  for (i = 0; i < tip_count; ++i)
+    tip_rank[i] = tip_count;
+
+  for (i = 0; i < node_count; ++i)
+  {
+    const pll_unode_t * node = order[i];
+    if (!node->next)
+    {
+      if (!node->node_index || node->node_index >= tip_count ||
+          tip_rank[node->node_index] < tip_count)
+      {
+        pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE,
+                         "Invalid or duplicated tip node index %u\n",
+                         node->node_index);
+        return PLL_FAILURE;
+      }
+      tip_rank[node->node_index] = rank++;
+    }
+  }
+
+  if (rank != tip_count - 1)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE_SIZE,
+                     "Tree has %u tips, but %u were expected\n",
+                     rank + 1, tip_count);
+    return PLL_FAILURE;
+  }
+
+  tip_rank[0] = tip_count - 1;
+
+  return PLL_SUCCESS;
+}
+
+/*
+ * Computes the lowest and highest tip rank and the number of tips below every
+ * node in `order`, which must be in preorder.
+ */
+static void utree_cluster_intervals(pll_unode_t * const * order,
+                                    const unsigned int * parent,
+                                    unsigned int node_count,
+                                    const unsigned int * tip_rank,
+                                    unsigned int * lo,
+                                    unsigned int * hi,
+                                    unsigned int * size)
+{
+  unsigned int i;
+
+  for (i = 0; i < node_count; ++i)
+  {
+    if (order[i]->next)
+    {
+      lo[i] = node_count;
+      hi[i] = 0;
+      size[i] = 0;
+    }
+    else
+    {
+      lo[i] = hi[i] = tip_rank[order[i]->node_index];
+      size[i] = 1;
+    }
+  }
+
+  /* children are always placed after their parents */
+  for (i = node_count - 1; i > 0; --i)
+  {
+    unsigned int p = parent[i];
+    if (lo[i] < lo[p]) lo[p] = lo[i];
+    if (hi[i] > hi[p]) hi[p] = hi[i];
+    size[p] += size[i];
+  }
+}
+
+/*
+ * Merges two sorted lists of disjoint rank intervals into `out`, joining
+ * adjacent intervals. Returns the number of intervals in `out`.
+ */
+static unsigned int merge_intervals(const unsigned int * a,
+                                    unsigned int a_count,
+                                    const unsigned int * b,
+                                    unsigned int b_count,
+                                    unsigned int * out)
+{
+  unsigned int i = 0, j = 0, k = 0;
+
+  while (i < a_count || j < b_count)
+  {
+    const unsigned int * next;
+    if (j == b_count || (i < a_count && a[2*i] < b[2*j]))
+      next = a + 2*(i++);
+    else
+      next = b + 2*(j++);
+
+    if (k && out[2*k-1] + 1 == next[0])
+      out[2*k-1] = next[1];
+    else
+    {
+      out[2*k]   = next[0];
+      out[2*k+1] = next[1];
+      ++k;
+    }
+  }
+
+  return k;
+}
+
+static hash_key_t compact_split_key(const unsigned int * interval,
+                                    unsigned int interval_count)
+{
+  return hash_get_key((pll_split_t) interval, (int) (2*interval_count));
+}
+
+/* order used for sorting compact splits: hash key, length and intervals */
+static int compare_compact_splits(const pll_compact_split_set_t * set1,
+                                  unsigned int split1,
+                                  const pll_compact_split_set_t * set2,
+                                  unsigned int split2)
+{
+  unsigned int n1 = set1->offset[split1+1] - set1->offset[split1];
+  unsigned int n2 = set2->offset[split2+1] - set2->offset[split2];
+  const unsigned int * a = set1->interval + 2*set1->offset[split1];
+  const unsigned int * b = set2->interval + 2*set2->offset[split2];
+  unsigned int i;
+
+  if (set1->key[split1] != set2->key[split2])
+    return set1->key[split1] > set2->key[split2] ? 1 : -1;
+  if (n1 != n2)
+    return n1 > n2 ? 1 : -1;
+  for (i = 0; i < 2*n1; ++i)
+    if (a[i] != b[i])
+      return a[i] > b[i] ? 1 : -1;
+
+  return 0;
+}
+
+static int _cmp_compact_split_entry(const void * a, const void * b)
+{
+  const struct compact_split_entry * e1 = (const struct compact_split_entry *) a;
+  const struct compact_split_entry * e2 = (const struct compact_split_entry *) b;
+  unsigned int i;
+
+  if (e1->key != e2->key)
+    return e1->key > e2->key ? 1 : -1;
+  if (e1->interval_count != e2->interval_count)
+    return e1->interval_count > e2->interval_count ? 1 : -1;
+  for (i = 0; i < 2*e1->interval_count; ++i)
+    if (e1->interval[i] != e2->interval[i])
+      return e1->interval[i] > e2->interval[i] ? 1 : -1;
+
+  return 0;
+}
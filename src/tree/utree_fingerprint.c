@@ -0,0 +1,561 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Heidelberg Institute for Theoretical Studies,
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+ /**
+  * @file utree_fingerprint.c
+  *
+  * @brief Topology fingerprints and a bounded cache of scored topologies
+  *
+  * Every tip gets a random 64-bit key. A split is hashed as the XOR of the
+  * keys on one of its sides, normalized to the smaller of the two side
+  * hashes and scrambled. The fingerprint of a topology is the XOR of the
+  * hashes of all its splits, so it does not depend on the node layout.
+  * The context keeps the subtree hashes of one tree, and updates them along
+  * the path of every applied SPR move.
+  *
+  * @author Alexey Kozlov
+  */
+
+#include "pll_tree.h"
+
+#include "../pllmod_common.h"
+
+#define FINGERPRINT_GOLDEN 0x9e3779b97f4a7c15ULL
+
+/* splitmix64 finalizer */
+static pllmod_fingerprint_t fingerprint_mix(pllmod_fingerprint_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* hash of the split with side hash `h`, independent of the side */
+static pllmod_fingerprint_t split_hash(const pllmod_utree_fingerprint_t * fp,
+                                       pllmod_fingerprint_t h)
+{
+  pllmod_fingerprint_t h_comp = fp->all_tips ^ h;
+  return fingerprint_mix(h < h_comp ? h : h_comp);
+}
+
+/* computes the subtree hashes of both directions of all edges, and returns
+ * the fingerprint of the tree */
+static int fingerprint_subtrees(pllmod_utree_fingerprint_t * fp,
+                                pll_unode_t * root,
+                                pllmod_fingerprint_t * fingerprint)
+{
+  unsigned int i;
+  pllmod_fingerprint_t * hash = fp->subtree_hash;
+  pllmod_utree_traversal_t * traversal = fp->traversal;
+
+  pllmod_utree_traversal_invalidate(traversal);
+  if (!pllmod_utree_traversal_update(traversal, root))
+    return PLL_FAILURE;
+
+  *fingerprint = 0;
+  for (i = 0; i < traversal->node_count; ++i)
+  {
+    const pll_unode_t * node = traversal->postorder[i];
+
+    assert(node->node_index < fp->node_count);
+    if (pllmod_utree_is_tip(node))
+    {
+      assert(node->node_index < fp->tip_count);
+      hash[node->node_index] = fp->tip_keys[node->node_index];
+    }
+    else
+      hash[node->node_index] = hash[node->next->back->node_index] ^
+                               hash[node->next->next->back->node_index];
+
+    hash[node->back->node_index] = fp->all_tips ^ hash[node->node_index];
+
+    /* `root` and `root->back` describe the same split */
+    if (node != root)
+      *fingerprint ^= split_hash(fp, hash[node->node_index]);
+  }
+
+  return PLL_SUCCESS;
+}
+
+/* drops the current SPR neighborhood */
+static void spr_invalidate(pllmod_utree_fingerprint_t * fp)
+{
+  fp->prune_edge = NULL;
+  if (!++fp->spr_stamp)
+  {
+    memset(fp->spr_node_stamp, 0, fp->node_count * sizeof(unsigned int));
+    fp->spr_stamp = 1;
+  }
+}
+
+/* adds the edge `node`-`node->back` to the SPR neighborhood; `node` points
+ * away from the pruning node */
+static void spr_set(pllmod_utree_fingerprint_t * fp,
+                    pll_unode_t * node,
+                    pll_unode_t * parent,
+                    pllmod_fingerprint_t fingerprint)
+{
+  fp->spr_fp[node->node_index] = fingerprint;
+  fp->spr_fp[node->back->node_index] = fingerprint;
+  fp->spr_parent[node->node_index] = parent;
+  fp->spr_node_stamp[node->node_index] = fp->spr_stamp;
+}
+
+/* derives the SPR fingerprints of the two edges below `node` */
+static void spr_children(pllmod_utree_fingerprint_t * fp, pll_unode_t * node)
+{
+  const pllmod_fingerprint_t * hash = fp->subtree_hash;
+  pll_unode_t * child;
+  pllmod_fingerprint_t node_fp;
+
+  /* moving the insertion point from `node` to one of its children only
+     changes the splits of these two edges */
+  node_fp = fp->spr_fp[node->node_index] ^
+            split_hash(fp, hash[node->node_index]);
+
+  child = node->next->back;
+  spr_set(fp, child, node,
+          node_fp ^ split_hash(fp, fp->pruned_hash ^ hash[child->node_index]));
+
+  child = node->next->next->back;
+  spr_set(fp, child, node,
+          node_fp ^ split_hash(fp, fp->pruned_hash ^ hash[child->node_index]));
+}
+
+static void spr_neighborhood(pllmod_utree_fingerprint_t * fp,
+                             pll_unode_t * node,
+                             unsigned int radius)
+{
+  if (!radius || pllmod_utree_is_tip(node))
+    return;
+
+  spr_children(fp, node);
+  spr_neighborhood(fp, node->next->back, radius - 1);
+  spr_neighborhood(fp, node->next->next->back, radius - 1);
+}
+
+/* returns the end of the edge `r_edge` that points away from the pruning
+ * node, or NULL if the edge is not in the SPR neighborhood */
+static pll_unode_t * spr_lower_end(const pllmod_utree_fingerprint_t * fp,
+                                   pll_unode_t * r_edge)
+{
+  if (!fp->prune_edge)
+    return NULL;
+  if (fp->spr_node_stamp[r_edge->node_index] == fp->spr_stamp)
+    return r_edge;
+  if (fp->spr_node_stamp[r_edge->back->node_index] == fp->spr_stamp)
+    return r_edge->back;
+  return NULL;
+}
+
+/**
+ * Creates the context for computing topology fingerprints.
+ *
+ * @param tip_count number of tips of the trees
+ * @param seed seed for the random tip keys. Fingerprints are only comparable
+ *             among contexts created with the same seed.
+ *
+ * @return the new context, or NULL on error
+ */
+PLL_EXPORT pllmod_utree_fingerprint_t * pllmod_utree_fingerprint_create(
+                                                        unsigned int tip_count,
+                                                        unsigned int seed)
+{
+  unsigned int i;
+  pllmod_fingerprint_t state = (pllmod_fingerprint_t) seed;
+  pllmod_utree_fingerprint_t * fp;
+
+  if (tip_count < 3)
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_INVALID_TREE_SIZE,
+                     "Fingerprints require at least 3 tips\n");
+    return NULL;
+  }
+
+  fp = (pllmod_utree_fingerprint_t *) calloc(1,
+                                          sizeof(pllmod_utree_fingerprint_t));
+  if (!fp)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for fingerprint\n");
+    return NULL;
+  }
+
+  fp->tip_count = tip_count;
+  fp->node_count = tip_count + 3 * (tip_count - 2);
+
+  fp->tip_keys = (pllmod_fingerprint_t *) malloc(tip_count *
+                                              sizeof(pllmod_fingerprint_t));
+  fp->subtree_hash = (pllmod_fingerprint_t *) calloc(fp->node_count,
+                                              sizeof(pllmod_fingerprint_t));
+  fp->spr_fp = (pllmod_fingerprint_t *) calloc(fp->node_count,
+                                              sizeof(pllmod_fingerprint_t));
+  fp->spr_parent = (pll_unode_t **) calloc(fp->node_count,
+                                           sizeof(pll_unode_t *));
+  fp->spr_node_stamp = (unsigned int *) calloc(fp->node_count,
+                                               sizeof(unsigned int));
+  fp->traversal = pllmod_utree_traversal_create(2 * tip_count - 2);
+
+  if (!fp->tip_keys || !fp->subtree_hash || !fp->spr_fp || !fp->spr_parent ||
+      !fp->spr_node_stamp || !fp->traversal)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for fingerprint\n");
+    pllmod_utree_fingerprint_destroy(fp);
+    return NULL;
+  }
+
+  fp->all_tips = 0;
+  for (i = 0; i < tip_count; ++i)
+  {
+    state += FINGERPRINT_GOLDEN;
+    fp->tip_keys[i] = fingerprint_mix(state);
+    fp->all_tips ^= fp->tip_keys[i];
+  }
+
+  fp->spr_stamp = 1;
+
+  return fp;
+}
+
+PLL_EXPORT void pllmod_utree_fingerprint_destroy(pllmod_utree_fingerprint_t * fp)
+{
+  if (!fp)
+    return;
+
+  pllmod_utree_traversal_destroy(fp->traversal);
+  free(fp->tip_keys);
+  free(fp->subtree_hash);
+  free(fp->spr_fp);
+  free(fp->spr_parent);
+  free(fp->spr_node_stamp);
+  free(fp);
+}
+
+/**
+ * Computes the fingerprint of an unrooted tree. Trees with the same topology
+ * get the same fingerprint regardless of the node layout and root.
+ *
+ * The context then tracks this tree: its subtree hashes are kept for
+ * pllmod_utree_fingerprint_spr(), and updated by
+ * pllmod_utree_fingerprint_spr_apply() as long as the tree is only changed
+ * through SPR moves announced to that function.
+ *
+ * @param fp fingerprint context
+ * @param root any inner node of the tree
+ *
+ * @return the fingerprint, or 0 on error
+ */
+PLL_EXPORT pllmod_fingerprint_t pllmod_utree_fingerprint_compute(
+                                              pllmod_utree_fingerprint_t * fp,
+                                              pll_unode_t * root)
+{
+  pllmod_fingerprint_t fingerprint;
+
+  spr_invalidate(fp);
+
+  if (!fingerprint_subtrees(fp, root, &fingerprint))
+    return 0;
+
+  fp->fingerprint = fingerprint;
+
+  return fingerprint;
+}
+
+/**
+ * Computes the fingerprints of the topologies in the SPR neighborhood of the
+ * subtree `p_edge->back` in the tracked tree (see
+ * pllmod_utree_fingerprint_compute()), without modifying the tree.
+ *
+ * After the call, `fp->spr_fp[r->node_index]` holds the fingerprint of the
+ * tree resulting from pllmod_utree_spr(p_edge, r), for every edge `r` at
+ * most `radius` edges away from the branch that remains after pruning. Both
+ * directions of an edge get the same value. The neighborhood can be extended
+ * one edge at a time with pllmod_utree_fingerprint_spr_descend().
+ *
+ * Only the stored subtree hashes are used, so the cost is proportional to
+ * the number of edges in the neighborhood, not to the size of the tree.
+ *
+ * @param fp fingerprint context
+ * @param p_edge the pruning node, as in pllmod_utree_spr()
+ * @param radius radius of the neighborhood
+ *
+ * @return the fingerprint of the current tree, or 0 on error
+ */
+PLL_EXPORT pllmod_fingerprint_t pllmod_utree_fingerprint_spr(
+                                              pllmod_utree_fingerprint_t * fp,
+                                              pll_unode_t * p_edge,
+                                              unsigned int radius)
+{
+  const pllmod_fingerprint_t * hash = fp->subtree_hash;
+  pll_unode_t * a;
+  pll_unode_t * b;
+
+  if (pllmod_utree_is_tip(p_edge))
+  {
+    pllmod_set_error(PLLMOD_TREE_ERROR_SPR_INVALID_NODE,
+                     "Pruning node must be an inner node\n");
+    return 0;
+  }
+
+  spr_invalidate(fp);
+
+  a = p_edge->next->back;
+  b = p_edge->next->next->back;
+
+  /* hash of all tips except those of the pruned subtree */
+  fp->prune_edge = p_edge;
+  fp->pruned_hash = hash[a->node_index] ^ hash[b->node_index];
+
+  /* re-inserting into the merged branch gives back the current tree */
+  spr_set(fp, a, NULL, fp->fingerprint);
+  spr_set(fp, b, NULL, fp->fingerprint);
+
+  spr_neighborhood(fp, a, radius);
+  spr_neighborhood(fp, b, radius);
+
+  return fp->fingerprint;
+}
+
+/**
+ * Extends the SPR neighborhood computed by pllmod_utree_fingerprint_spr() by
+ * the two edges below `r_edge`, i.e., `r_edge->next->back` and
+ * `r_edge->next->next->back`. The subtree may be pruned meanwhile.
+ *
+ * @param fp fingerprint context
+ * @param r_edge an inner node of the neighborhood that points away from the
+ *               pruning node
+ *
+ * @return PLL_SUCCESS, or PLL_FAILURE if `r_edge` is not in the neighborhood
+ */
+PLL_EXPORT int pllmod_utree_fingerprint_spr_descend(
+                                              pllmod_utree_fingerprint_t * fp,
+                                              pll_unode_t * r_edge)
+{
+  if (pllmod_utree_is_tip(r_edge) || !fp->prune_edge ||
+      fp->spr_node_stamp[r_edge->node_index] != fp->spr_stamp)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Node is not an inner node of the SPR neighborhood\n");
+    return PLL_FAILURE;
+  }
+
+  spr_children(fp, r_edge);
+
+  return PLL_SUCCESS;
+}
+
+/**
+ * Updates the tracked tree for the move pllmod_utree_spr(p_edge, r_edge),
+ * where `p_edge` is the pruning node of the current SPR neighborhood. Must be
+ * called before the move is applied to the tree.
+ *
+ * Only the subtree hashes of the edges on the path between the pruning and
+ * the regrafting point change. The SPR neighborhood is dropped.
+ *
+ * @param fp fingerprint context
+ * @param r_edge the regrafting edge; it must be in the SPR neighborhood
+ *
+ * @return the fingerprint of the resulting tree, or 0 on error
+ */
+PLL_EXPORT pllmod_fingerprint_t pllmod_utree_fingerprint_spr_apply(
+                                              pllmod_utree_fingerprint_t * fp,
+                                              pll_unode_t * r_edge)
+{
+  pllmod_fingerprint_t * hash = fp->subtree_hash;
+  pllmod_fingerprint_t pruned_subtree;
+  pllmod_fingerprint_t lower_hash;
+  pll_unode_t * p_edge = fp->prune_edge;
+  pll_unode_t * lower = spr_lower_end(fp, r_edge);
+  pll_unode_t * upper;
+  pll_unode_t * node;
+
+  if (!lower)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Regraft edge is not in the SPR neighborhood\n");
+    return 0;
+  }
+
+  pruned_subtree = fp->all_tips ^ fp->pruned_hash;
+  lower_hash = hash[lower->node_index];
+
+  /* the pruned subtree moves below all the edges on the path */
+  for (node = fp->spr_parent[lower->node_index]; node;
+       node = fp->spr_parent[node->node_index])
+  {
+    hash[node->node_index] ^= pruned_subtree;
+    if (fp->spr_parent[node->node_index])
+      hash[node->back->node_index] = fp->all_tips ^ hash[node->node_index];
+  }
+
+  /* the upper end of the regrafting edge, once the subtree is pruned */
+  if (fp->spr_parent[lower->node_index])
+    upper = lower->back;
+  else
+    upper = (lower == p_edge->next->back) ? p_edge->next->next->back :
+                                             p_edge->next->back;
+
+  hash[upper->node_index] = fp->all_tips ^ lower_hash ^ pruned_subtree;
+
+  /* pllmod_utree_regraft() connects `r_edge` to `p_edge->next` */
+  if (r_edge == lower)
+  {
+    hash[p_edge->next->node_index] = fp->all_tips ^ lower_hash;
+    hash[p_edge->next->next->node_index] = lower_hash ^ pruned_subtree;
+  }
+  else
+  {
+    hash[p_edge->next->node_index] = lower_hash ^ pruned_subtree;
+    hash[p_edge->next->next->node_index] = fp->all_tips ^ lower_hash;
+  }
+
+  fp->fingerprint = fp->spr_fp[lower->node_index];
+
+  spr_invalidate(fp);
+
+  return fp->fingerprint;
+}
+
+/**
+ * Creates a bounded cache of topologies and their scores.
+ *
+ * The cache is direct-mapped: a new topology replaces any older entry in its
+ * slot, so it keeps the most recently scored topologies. The meaning of the
+ * score is up to the caller: the SPR search stores the log-likelihood
+ * difference to the tree the topology was derived from.
+ *
+ * @param capacity number of slots, rounded up to a power of two
+ * @param max_age entries are ignored after `max_age` generations
+ *                (see pllmod_topology_cache_next_generation()). If 0, entries
+ *                never expire.
+ *
+ * @return the new cache, or NULL on error
+ */
+PLL_EXPORT pllmod_topology_cache_t * pllmod_topology_cache_create(
+                                                        unsigned int capacity,
+                                                        unsigned int max_age)
+{
+  unsigned int slots = 1;
+  pllmod_topology_cache_t * cache;
+
+  if (!capacity)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID, "Cache capacity must be > 0\n");
+    return NULL;
+  }
+
+  while (slots < capacity)
+    slots <<= 1;
+
+  cache = (pllmod_topology_cache_t *) calloc(1,
+                                            sizeof(pllmod_topology_cache_t));
+  if (!cache)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for topology cache\n");
+    return NULL;
+  }
+
+  cache->entries = (pllmod_topology_cache_entry_t *) calloc(slots,
+                                       sizeof(pllmod_topology_cache_entry_t));
+  if (!cache->entries)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for topology cache\n");
+    free(cache);
+    return NULL;
+  }
+
+  cache->capacity = slots;
+  cache->max_age = max_age;
+  cache->generation = 1;
+
+  return cache;
+}
+
+PLL_EXPORT void pllmod_topology_cache_destroy(pllmod_topology_cache_t * cache)
+{
+  if (!cache)
+    return;
+
+  free(cache->entries);
+  free(cache);
+}
+
+PLL_EXPORT void pllmod_topology_cache_clear(pllmod_topology_cache_t * cache)
+{
+  memset(cache->entries, 0,
+         cache->capacity * sizeof(pllmod_topology_cache_entry_t));
+  cache->generation = 1;
+  cache->lookups = cache->hits = 0;
+}
+
+/* starts a new generation; entries age by one */
+PLL_EXPORT void pllmod_topology_cache_next_generation(
+                                              pllmod_topology_cache_t * cache)
+{
+  cache->generation++;
+}
+
+PLL_EXPORT void pllmod_topology_cache_insert(pllmod_topology_cache_t * cache,
+                                             pllmod_fingerprint_t fingerprint,
+                                             double score)
+{
+  pllmod_topology_cache_entry_t * entry =
+      &cache->entries[fingerprint & (cache->capacity - 1)];
+
+  entry->fingerprint = fingerprint;
+  entry->score = score;
+  entry->generation = cache->generation;
+}
+
+/**
+ * Looks up a topology in the cache.
+ *
+ * @param cache the cache
+ * @param fingerprint fingerprint of the topology
+ * @param[out] score stored score, if found
+ *
+ * @return PLL_SUCCESS if the topology was found and has not expired,
+ *         PLL_FAILURE otherwise
+ */
+PLL_EXPORT int pllmod_topology_cache_lookup(pllmod_topology_cache_t * cache,
+                                            pllmod_fingerprint_t fingerprint,
+                                            double * score)
+{
+  const pllmod_topology_cache_entry_t * entry =
+      &cache->entries[fingerprint & (cache->capacity - 1)];
+
+  cache->lookups++;
+
+  if (!entry->generation || entry->fingerprint != fingerprint)
+    return PLL_FAILURE;
+
+  if (cache->max_age && cache->generation - entry->generation >= cache->max_age)
+    return PLL_FAILURE;
+
+  cache->hits++;
+  if (score)
+    *score = entry->score;
+
+  return PLL_SUCCESS;
+}
@@ -31,7 +31,10 @@
 
 #include "../pllmod_common.h"
 
-static void utree_nodes_at_dist(pll_unode_t * node,
+/* initial stack size of the distance traversal, enough for most radii */
+#define UTREE_DIST_STACK_SIZE 64
+
+static int utree_nodes_at_dist(pll_unode_t * node,
                                 pll_unode_t ** outbuffer,
                                 unsigned int * index,
                                 unsigned int min_distance,
@@ -419,9 +422,8 @@ PLL_EXPORT int pllmod_utree_nodes_at_node_dist(pll_unode_t * node,
     */
 
 
-  utree_nodes_at_dist(node, outbuffer, node_count, min_distance, max_distance, 0);
-
-  return PLL_SUCCESS;
+  return utree_nodes_at_dist(node, outbuffer, node_count,
+                             min_distance, max_distance, 0);
 }
 
 /**
@@ -469,35 +471,93 @@ PLL_EXPORT int pllmod_utree_nodes_at_edge_dist(pll_unode_t * edge,
        4          2
    */
 
-  utree_nodes_at_dist(edge->back, outbuffer, node_count,
-                      min_distance, max_distance, depth+1);
-  utree_nodes_at_dist(edge, outbuffer, node_count,
-                      min_distance, max_distance, depth);
+  if (!utree_nodes_at_dist(edge->back, outbuffer, node_count,
+                           min_distance, max_distance, depth+1))
+    return PLL_FAILURE;
 
-  return PLL_SUCCESS;
+  return utree_nodes_at_dist(edge, outbuffer, node_count,
+                             min_distance, max_distance, depth);
 }
 
 
 /******************************************************************************/
 /* static functions */
 
-static void utree_nodes_at_dist(pll_unode_t * node,
-                                pll_unode_t ** outbuffer,
-                                unsigned int * index,
-                                unsigned int min_distance,
-                                unsigned int max_distance,
-                                unsigned int depth)
+static int utree_nodes_at_dist(pll_unode_t * node,
+                               pll_unode_t ** outbuffer,
+                               unsigned int * index,
+                               unsigned int min_distance,
+                               unsigned int max_distance,
+                               unsigned int depth)
 {
-  if (depth >= min_distance && depth <= max_distance)
+  /* explicit preorder stack; it holds at most one pending sibling per level */
+  pll_unode_t * local_nodes[UTREE_DIST_STACK_SIZE];
+  unsigned int local_depths[UTREE_DIST_STACK_SIZE];
+  pll_unode_t ** stack_nodes = local_nodes;
+  unsigned int * stack_depths = local_depths;
+  unsigned int stack_size = UTREE_DIST_STACK_SIZE;
+  unsigned int top = 0;
+
+  stack_nodes[top] = node;
+  stack_depths[top++] = depth;
+
+  while (top)
   {
-    outbuffer[*index] = node;
-    *index = *index + 1;
+    --top;
+    node = stack_nodes[top];
+    depth = stack_depths[top];
+
+    if (depth >= min_distance && depth <= max_distance)
+    {
+      outbuffer[*index] = node;
+      *index = *index + 1;
+    }
+
+    if (depth >= max_distance || !(node->next)) continue;
+
+    if (top + 2 > stack_size)
+    {
+      pll_unode_t ** new_nodes = (pll_unode_t **) malloc(2 * stack_size *
+                                                     sizeof(pll_unode_t *));
+      unsigned int * new_depths = (unsigned int *) malloc(2 * stack_size *
+                                                     sizeof(unsigned int));
+      if (!new_nodes || !new_depths)
+      {
+        free(new_nodes);
+        free(new_depths);
+        if (stack_nodes != local_nodes)
+        {
+          free(stack_nodes);
+          free(stack_depths);
+        }
+        pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                         "Cannot allocate memory for traversal stack\n");
+        return PLL_FAILURE;
+      }
+
+      memcpy(new_nodes, stack_nodes, top * sizeof(pll_unode_t *));
+      memcpy(new_depths, stack_depths, top * sizeof(unsigned int));
+      if (stack_nodes != local_nodes)
+      {
+        free(stack_nodes);
+        free(stack_depths);
+      }
+      stack_nodes = new_nodes;
+      stack_depths = new_depths;
+      stack_size *= 2;
+    }
+
+    stack_nodes[top] = node->next->next->back;
+    stack_depths[top++] = depth + 1;
+    stack_nodes[top] = node->next->back;
+    stack_depths[top++] = depth + 1;
   }
 
-  if (depth >= max_distance || !(node->next)) return;
+  if (stack_nodes != local_nodes)
+  {
+    free(stack_nodes);
+    free(stack_depths);
+  }
 
-  utree_nodes_at_dist(node->next->back, outbuffer, index,
-                      min_distance, max_distance, depth+1);
-  utree_nodes_at_dist(node->next->next->back, outbuffer, index,
-                      min_distance, max_distance, depth+1);
+  return PLL_SUCCESS;
 }
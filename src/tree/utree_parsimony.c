@@ -0,0 +1,603 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Heidelberg Institute for Theoretical Studies,
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+ /**
+  * @file utree_parsimony.c
+  *
+  * @brief Parsimony SPR search and parsimony ratchet on unrooted trees
+  *
+  * The parsimony vectors of a parsimony context are indexed by the CLV
+  * indices of the tree nodes. Every inner vector remembers the direction it
+  * was computed for, so that orienting the tree towards a new pruning point
+  * only updates the vectors on the path from the previous one. The regraft
+  * edges are then visited in depth-first order. Every step re-orients a
+  * single inner vector, such that scoring a regraft edge costs two vector
+  * updates.
+  *
+  * @author Alexey Kozlov
+  */
+
+#include "pll_tree.h"
+
+#include "../pllmod_common.h"
+
+/* percentage of sites whose weight is doubled in every ratchet iteration */
+#define PARSIMONY_RATCHET_PERCENT 25
+
+typedef struct pars_search
+{
+  pllmod_parsimony_context_t * context;
+  unsigned int radius;
+
+  pll_operation_t * ops;
+  pll_unode_t ** stack;
+
+  /* direction of every inner vector: the node whose subtree (away from
+     node->back) the vector holds, or NULL if it is not valid */
+  pll_unode_t ** orient;
+
+  pll_unode_t ** path;           /* inner nodes from the pruning point */
+  pll_unode_t ** best_path;
+  unsigned int best_depth;
+
+  unsigned int prune_index;      /* vector of the pruned node */
+  unsigned int subtree_index;    /* vector of the pruned subtree */
+  unsigned int best_score;
+  pll_unode_t * best_edge;
+} pars_search_t;
+
+static void pars_update(pars_search_t * search,
+                        const pll_operation_t * ops,
+                        unsigned int count)
+{
+  unsigned int i;
+  pllmod_parsimony_context_t * context = search->context;
+
+  for (i = 0; i < context->partition_count; ++i)
+    pll_fastparsimony_update_vectors(context->parsimony[i], ops, count);
+}
+
+static void pars_combine(pars_search_t * search,
+                         unsigned int parent,
+                         unsigned int child1,
+                         unsigned int child2)
+{
+  pll_operation_t op;
+
+  op.parent_clv_index = parent;
+  op.child1_clv_index = child1;
+  op.child2_clv_index = child2;
+  op.parent_scaler_index = PLL_SCALE_BUFFER_NONE;
+  op.child1_scaler_index = PLL_SCALE_BUFFER_NONE;
+  op.child2_scaler_index = PLL_SCALE_BUFFER_NONE;
+  op.child1_matrix_index = op.child2_matrix_index = 0;
+
+  pars_update(search, &op, 1);
+}
+
+static unsigned int pars_edge_score(pars_search_t * search,
+                                    unsigned int index1,
+                                    unsigned int index2)
+{
+  return pll_fastparsimony_edge_score(search->context->parsimony,
+                                      search->context->partition_count,
+                                      index1,
+                                      index2);
+}
+
+static int pars_valid(const pars_search_t * search, const pll_unode_t * node)
+{
+  return !node->next || search->orient[node->clv_index] == node;
+}
+
+/* append the operations for the vector of the subtree rooted at root (away
+   from root->back), children before parents. Vectors that already hold the
+   right direction are kept, as are the vectors below them */
+static unsigned int subtree_ops(pars_search_t * search,
+                                pll_unode_t * root,
+                                pll_operation_t * ops)
+{
+  unsigned int count = 0, top = 0, i;
+  pll_unode_t ** stack = search->stack;
+
+  if (pars_valid(search, root))
+    return 0;
+
+  /* preorder, reversed afterwards */
+  stack[top++] = root;
+  while (top)
+  {
+    pll_unode_t * node = stack[--top];
+    pll_unode_t * child1 = node->next->back;
+    pll_unode_t * child2 = node->next->next->back;
+
+    ops[count].parent_clv_index = node->clv_index;
+    ops[count].child1_clv_index = child1->clv_index;
+    ops[count].child2_clv_index = child2->clv_index;
+    ops[count].parent_scaler_index = PLL_SCALE_BUFFER_NONE;
+    ops[count].child1_scaler_index = PLL_SCALE_BUFFER_NONE;
+    ops[count].child2_scaler_index = PLL_SCALE_BUFFER_NONE;
+    ops[count].child1_matrix_index = ops[count].child2_matrix_index = 0;
+    ++count;
+
+    search->orient[node->clv_index] = node;
+
+    if (!pars_valid(search, child1))
+      stack[top++] = child1;
+    if (!pars_valid(search, child2))
+      stack[top++] = child2;
+  }
+
+  for (i = 0; i < count / 2; ++i)
+  {
+    pll_operation_t tmp = ops[i];
+    ops[i] = ops[count - i - 1];
+    ops[count - i - 1] = tmp;
+  }
+
+  return count;
+}
+
+/* score of the tree, computing all vectors towards edge */
+static unsigned int pars_tree_score(pars_search_t * search,
+                                    pll_unode_t * edge)
+{
+  unsigned int count;
+
+  count = subtree_ops(search, edge, search->ops);
+  count += subtree_ops(search, edge->back, search->ops + count);
+  pars_update(search, search->ops, count);
+
+  return pars_edge_score(search, edge->clv_index, edge->back->clv_index);
+}
+
+/* Score the regraft edges in the subtree of node (away from node->back),
+ * where behind is the vector of the tree behind node. The vector of node is
+ * re-oriented towards the visited child, and restored afterwards */
+static void pars_visit(pars_search_t * search,
+                       pll_unode_t * node,
+                       unsigned int behind,
+                       unsigned int depth)
+{
+  unsigned int i;
+  pll_unode_t * children[2];
+
+  if (!node->next || depth > search->radius)
+    return;
+
+  search->path[depth-1] = node;
+
+  children[0] = node->next->back;
+  children[1] = node->next->next->back;
+
+  for (i = 0; i < 2; ++i)
+  {
+    pll_unode_t * child = children[i];
+    unsigned int score;
+
+    /* vector of everything but the child's subtree */
+    pars_combine(search, node->clv_index, behind, children[1-i]->clv_index);
+
+    /* regraft into the edge node - child */
+    pars_combine(search, search->prune_index, node->clv_index,
+                 child->clv_index);
+    score = pars_edge_score(search, search->prune_index,
+                            search->subtree_index);
+    if (score < search->best_score)
+    {
+      search->best_score = score;
+      search->best_edge = child;
+      search->best_depth = depth;
+      memcpy(search->best_path, search->path, depth * sizeof(pll_unode_t *));
+    }
+
+    pars_visit(search, child, node->clv_index, depth + 1);
+  }
+
+  pars_combine(search, node->clv_index, children[0]->clv_index,
+               children[1]->clv_index);
+}
+
+/* find the best regraft edge for the subtree at p_edge->back, and apply the
+   move if it improves the score */
+static int pars_spr_node(pars_search_t * search,
+                         pll_unode_t * p_edge,
+                         unsigned int * score,
+                         int * improved)
+{
+  unsigned int i, count;
+  pll_unode_t * edge1 = p_edge->next->back;
+  pll_unode_t * edge2 = p_edge->next->next->back;
+  const double length1 = p_edge->next->length;
+  const double length2 = p_edge->next->next->length;
+
+  *improved = 0;
+
+  /* orient the pruned subtree and the remaining tree towards p_edge. Only
+     the vectors between the previous pruning point and p_edge change */
+  count = subtree_ops(search, p_edge->back, search->ops);
+  count += subtree_ops(search, edge1, search->ops + count);
+  count += subtree_ops(search, edge2, search->ops + count);
+  pars_update(search, search->ops, count);
+
+  pllmod_utree_prune(p_edge);
+
+  search->prune_index = p_edge->clv_index;
+  search->subtree_index = p_edge->back->clv_index;
+  search->best_score = *score;
+  search->best_edge = NULL;
+  search->best_depth = 0;
+
+  pars_visit(search, edge1, edge2->clv_index, 1);
+  pars_visit(search, edge2, edge1->clv_index, 1);
+
+  /* restore the original topology */
+  pllmod_utree_connect_nodes(p_edge->next, edge1, length1);
+  pllmod_utree_connect_nodes(p_edge->next->next, edge2, length2);
+
+  /* the vector of the pruned node was used for scoring */
+  search->orient[p_edge->clv_index] = NULL;
+
+  if (!search->best_edge)
+    return PLL_SUCCESS;
+
+  if (!pllmod_utree_spr(p_edge, search->best_edge, NULL))
+    return PLL_FAILURE;
+
+  /* the subtrees of the nodes between the pruning and the regraft points
+     have changed */
+  for (i = 0; i < search->best_depth; ++i)
+    search->orient[search->best_path[i]->clv_index] = NULL;
+
+  *score = search->best_score;
+  *improved = 1;
+
+  return PLL_SUCCESS;
+}
+
+static void pars_search_destroy(pars_search_t * search)
+{
+  free(search->ops);
+  free(search->stack);
+  free(search->orient);
+  free(search->path);
+  free(search->best_path);
+}
+
+static int pars_search_init(pars_search_t * search,
+                            pllmod_parsimony_context_t * context,
+                            const pll_utree_t * tree,
+                            unsigned int radius)
+{
+  unsigned int i;
+  const unsigned int node_count = tree->tip_count + tree->inner_count;
+
+  if (!radius)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "SPR radius must be at least 1");
+    return PLL_FAILURE;
+  }
+
+  if (tree->tip_count != context->taxon_count)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Tree and parsimony context have different taxa");
+    return PLL_FAILURE;
+  }
+
+  /* parsimony vectors are indexed by the CLV indices */
+  for (i = 0; i < node_count; ++i)
+  {
+    if (tree->nodes[i]->clv_index >= node_count)
+    {
+      pllmod_set_error(PLLMOD_ERROR_INVALID_INDEX,
+                       "Invalid CLV index: %u", tree->nodes[i]->clv_index);
+      return PLL_FAILURE;
+    }
+  }
+
+  memset(search, 0, sizeof(pars_search_t));
+  search->context = context;
+  search->radius = radius;
+  search->ops = (pll_operation_t *) calloc(node_count,
+                                           sizeof(pll_operation_t));
+  search->stack = (pll_unode_t **) calloc(node_count, sizeof(pll_unode_t *));
+  search->orient = (pll_unode_t **) calloc(node_count, sizeof(pll_unode_t *));
+  search->path = (pll_unode_t **) calloc(node_count, sizeof(pll_unode_t *));
+  search->best_path = (pll_unode_t **) calloc(node_count,
+                                              sizeof(pll_unode_t *));
+
+  if (!search->ops || !search->stack || !search->orient || !search->path ||
+      !search->best_path)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for parsimony search");
+    pars_search_destroy(search);
+    return PLL_FAILURE;
+  }
+
+  return PLL_SUCCESS;
+}
+
+
+/**
+ * Computes the parsimony score of a tree
+ *
+ * @param context parsimony context of the tree taxa
+ * @param tree the tree, with the CLV indices of a tree created by
+ *             pllmod_utree_parsimony_context_tree
+ * @param[out] score parsimony score
+ *
+ * @return PLL_SUCCESS or PLL_FAILURE
+ */
+PLL_EXPORT int pllmod_utree_parsimony_score(pllmod_parsimony_context_t * context,
+                                            const pll_utree_t * tree,
+                                            unsigned int * score)
+{
+  pars_search_t search;
+
+  if (!context || !tree || !score)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Parsimony context, tree or score is NULL");
+    return PLL_FAILURE;
+  }
+
+  if (!pars_search_init(&search, context, tree, 1))
+    return PLL_FAILURE;
+
+  *score = pars_tree_score(&search, tree->nodes[tree->tip_count]);
+
+  pars_search_destroy(&search);
+
+  return PLL_SUCCESS;
+}
+
+/**
+ * Improves a tree with parsimony SPR moves, until no move within the radius
+ * improves the parsimony score
+ *
+ * @param context parsimony context of the tree taxa
+ * @param tree the tree to improve, modified in place
+ * @param radius maximum distance (in edges) between the pruning and the
+ *               regraft points
+ * @param[out] score parsimony score of the final tree (can be NULL)
+ *
+ * @return PLL_SUCCESS or PLL_FAILURE
+ */
+PLL_EXPORT int pllmod_utree_parsimony_spr(pllmod_parsimony_context_t * context,
+                                          pll_utree_t * tree,
+                                          unsigned int radius,
+                                          unsigned int * score)
+{
+  unsigned int i;
+  unsigned int cur_score;
+  int improved, moved;
+  pars_search_t search;
+
+  if (!context || !tree)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Parsimony context or tree is NULL");
+    return PLL_FAILURE;
+  }
+
+  if (!pars_search_init(&search, context, tree, radius))
+    return PLL_FAILURE;
+
+  cur_score = pars_tree_score(&search, tree->nodes[tree->tip_count]);
+
+  /* no SPR moves in trees with less than 4 taxa */
+  do
+  {
+    improved = 0;
+    for (i = tree->tip_count; i < tree->tip_count + tree->inner_count &&
+                              tree->tip_count > 3; ++i)
+    {
+      pll_unode_t * p_edge = tree->nodes[i];
+      do
+      {
+        if (!pars_spr_node(&search, p_edge, &cur_score, &moved))
+        {
+          pars_search_destroy(&search);
+          return PLL_FAILURE;
+        }
+        improved |= moved;
+        p_edge = p_edge->next;
+      }
+      while (p_edge != tree->nodes[i]);
+    }
+  }
+  while (improved);
+
+  assert(cur_score == pars_tree_score(&search, tree->nodes[tree->tip_count]));
+
+  pars_search_destroy(&search);
+
+  if (score)
+    *score = cur_score;
+
+  return PLL_SUCCESS;
+}
+
+/**
+ * Parsimony ratchet: alternates parsimony SPR searches on randomly reweighted
+ * sites and on the original sites, keeping the best tree found
+ *
+ * The partitions of the context are not modified: the reweighted sites are
+ * scored on private copies of the partition descriptors, which share the tip
+ * data of the context partitions.
+ *
+ * @param context parsimony context of the tree taxa
+ * @param tree the starting tree (not modified)
+ * @param iterations number of reweighting iterations
+ * @param radius SPR radius (see pllmod_utree_parsimony_spr)
+ * @param random_seed seed for the site reweighting
+ * @param[out] score parsimony score of the returned tree (can be NULL)
+ *
+ * @return the most parsimonious tree found, or NULL on error
+ */
+PLL_EXPORT pll_utree_t * pllmod_utree_parsimony_ratchet(
+                                        pllmod_parsimony_context_t * context,
+                                        const pll_utree_t * tree,
+                                        unsigned int iterations,
+                                        unsigned int radius,
+                                        unsigned int random_seed,
+                                        unsigned int * score)
+{
+  unsigned int i, j, k;
+  unsigned int best_score, cur_score;
+  pll_partition_t * weighted = NULL;
+  pll_partition_t ** weighted_list = NULL;
+  pll_parsimony_t ** weighted_pars = NULL;
+  pllmod_parsimony_context_t perturbed;
+  pll_utree_t * best_tree = NULL;
+  pll_utree_t * cur_tree = NULL;
+  pll_random_state * rstate = NULL;
+
+  if (!context || !tree)
+  {
+    pllmod_set_error(PLL_ERROR_PARAM_INVALID,
+                     "Parsimony context or tree is NULL");
+    return NULL;
+  }
+
+  pll_partition_t * const * partitions = context->partitions;
+
+  best_tree = pll_utree_clone(tree);
+  if (!best_tree ||
+      !pllmod_utree_parsimony_spr(context, best_tree, radius, &best_score))
+    goto ratchet_error;
+
+  weighted = (pll_partition_t *) calloc(context->partition_count,
+                                        sizeof(pll_partition_t));
+  weighted_list = (pll_partition_t **) calloc(context->partition_count,
+                                              sizeof(pll_partition_t *));
+  weighted_pars = (pll_parsimony_t **) calloc(context->partition_count,
+                                              sizeof(pll_parsimony_t *));
+  rstate = pll_random_create(random_seed);
+  if (!weighted || !weighted_list || !weighted_pars || !rstate)
+  {
+    pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                     "Cannot allocate memory for parsimony ratchet");
+    goto ratchet_error;
+  }
+
+  /* shallow copies of the partitions, owning only their pattern weights */
+  for (k = 0; k < context->partition_count; ++k)
+  {
+    const unsigned int sites = partitions[k]->sites;
+
+    weighted[k] = *partitions[k];
+    weighted[k].pattern_weights = (unsigned int *) malloc((sites + 1) *
+                                                          sizeof(unsigned int));
+    if (!weighted[k].pattern_weights)
+    {
+      pllmod_set_error(PLL_ERROR_MEM_ALLOC,
+                       "Cannot allocate memory for parsimony ratchet");
+      goto ratchet_error;
+    }
+    weighted_list[k] = weighted + k;
+  }
+
+  perturbed = *context;
+  perturbed.partitions = weighted_list;
+  perturbed.parsimony = weighted_pars;
+
+  for (i = 0; i < iterations; ++i)
+  {
+    cur_tree = pll_utree_clone(best_tree);
+    if (!cur_tree)
+      goto ratchet_error;
+
+    /* search on reweighted sites. Fast parsimony vectors hold the weights,
+       so they are rebuilt from the reweighted copies */
+    for (k = 0; k < context->partition_count; ++k)
+    {
+      const unsigned int * orig_weights = partitions[k]->pattern_weights;
+
+      weighted[k].pattern_weight_sum = 0;
+      for (j = 0; j < weighted[k].sites; ++j)
+      {
+        const unsigned int w = orig_weights[j];
+        weighted[k].pattern_weights[j] =
+            (pll_random_getint(rstate, 100) < PARSIMONY_RATCHET_PERCENT) ?
+                2 * w : w;
+        weighted[k].pattern_weight_sum += weighted[k].pattern_weights[j];
+      }
+
+      if (weighted_pars[k])
+        pll_parsimony_destroy(weighted_pars[k]);
+      weighted_pars[k] = pll_fastparsimony_init(weighted + k);
+      if (!weighted_pars[k])
+      {
+        assert(pll_errno);
+        goto ratchet_error;
+      }
+    }
+
+    if (!pllmod_utree_parsimony_spr(&perturbed, cur_tree, radius, NULL))
+      goto ratchet_error;
+
+    /* search on the original sites */
+    if (!pllmod_utree_parsimony_spr(context, cur_tree, radius, &cur_score))
+      goto ratchet_error;
+
+    if (cur_score < best_score)
+    {
+      pll_utree_destroy(best_tree, NULL);
+      best_tree = cur_tree;
+      best_score = cur_score;
+    }
+    else
+      pll_utree_destroy(cur_tree, NULL);
+    cur_tree = NULL;
+  }
+
+  if (score)
+    *score = best_score;
+
+  goto ratchet_exit;
+
+ratchet_error:
+  if (best_tree)
+    pll_utree_destroy(best_tree, NULL);
+  if (cur_tree)
+    pll_utree_destroy(cur_tree, NULL);
+  best_tree = NULL;
+
+ratchet_exit:
+  for (k = 0; k < context->partition_count; ++k)
+  {
+    if (weighted)
+      free(weighted[k].pattern_weights);
+    if (weighted_pars && weighted_pars[k])
+      pll_parsimony_destroy(weighted_pars[k]);
+  }
+  free(weighted);
+  free(weighted_list);
+  free(weighted_pars);
+  if (rstate)
+    pll_random_destroy(rstate);
+
+  return best_tree;
+}
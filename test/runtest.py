@@ -63,7 +63,8 @@ colors={"default":"",
   "mod_bin": "\033[1;45m",
   "mod_tre": "\033[1;46m",
   "mod_opt": "\033[1;42m",
-  "mod_msa": "\033[1;44m"}
+  "mod_msa": "\033[1;44m",
+  "mod_alg": "\033[1;43m"}
 
 which_test={"default": 0,
   "validation": 1,
@@ -71,8 +72,9 @@ which_test={"default": 0,
 
 modules={"optimize" : "mod_opt",
   "binary"   : "mod_bin",
-  "tree"     : "mod_tre"}
-  #"msa"      : 3}
+  "tree"     : "mod_tre",
+  "msa"      : "mod_msa",
+  "algorithm": "mod_alg"}
 
 #following from Python cookbook, #475186
 def has_colors(stream):
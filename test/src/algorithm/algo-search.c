@@ -0,0 +1,546 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pllmod_common.h"
+#include "pllmod_algorithm.h"
+#include "../common.h"
+
+#define N_TAXA 6
+#define N_SITES 40
+#define N_STATES 4
+#define RATE_CATS 4
+#define ALPHA 1.0
+
+#define RADIUS_MIN 1
+#define RADIUS_MAX 5
+#define NTOPOL_KEEP 10
+#define SMOOTHINGS 8
+#define LH_EPSILON 0.1
+#define SUBTREE_CUTOFF 1.0
+
+#define TABU_SIZE 16
+#define TABU_MAX_AGE 2
+
+#define N_STARTS 3
+#define RAND_SEED 42
+
+/* log-likelihoods returned by a round and recomputed from scratch */
+#define LH_TOLERANCE 1e-6
+
+/* the pairs A/B, C/D and E/F differ in one site, the groups in ~14 sites:
+   the maximum likelihood tree is OPT_TREE */
+#define OPT_TREE   "((A,B),(C,D),(E,F));"
+#define START_TREE "((A:0.1,C:0.1):0.1,(B:0.1,E:0.1):0.1,(D:0.1,F:0.1):0.1);"
+#define START_RTREE "(((A:0.1,C:0.1):0.1,(B:0.1,E:0.1):0.1):0.1,(D:0.1,F:0.1):0.1);"
+
+static const char * names[N_TAXA] = { "A", "B", "C", "D", "E", "F" };
+
+static const char * seqs[N_TAXA] = {
+  "GCTACAGATAATTAGATGACATACACGTCATGACGAAGCA",
+  "GCTACAGATATTTACATGACATACACGTCATGACGAAGCA",
+  "TGTAATTACAATGACATAACAAACACGTAAGCGCGAAACT",
+  "TGTAATTACAATGACAAAACAAACACGTAAGCACGAAACT",
+  "GCTTAAGACGATTTCATAACATACATCTCAGCAGGTAAGT",
+  "GCTTAAGACAATTTCATAGCATACATCTCAGCAGGTAAGT"
+};
+
+static unsigned int params_indices[RATE_CATS] = { 0, 0, 0, 0 };
+
+static const char * seq_by_label(const char * label)
+{
+  unsigned int i;
+
+  for (i = 0; i < N_TAXA && strcmp(label, names[i]); ++i);
+  if (i == N_TAXA)
+    fatal("Unknown taxon %s", label);
+
+  return seqs[i];
+}
+
+static pll_partition_t * create_partition(unsigned int inner_clvs,
+                                          unsigned int pmatrices,
+                                          unsigned int attributes)
+{
+  double rate_cats[RATE_CATS];
+
+  pll_partition_t * partition = pll_partition_create(N_TAXA,
+                                                     inner_clvs,
+                                                     N_STATES,
+                                                     N_SITES,
+                                                     1,
+                                                     pmatrices,
+                                                     RATE_CATS,
+                                                     inner_clvs,
+                                                     attributes);
+  if (!partition)
+    fatal("Cannot create partition: %s", pll_errmsg);
+
+  pll_compute_gamma_cats(ALPHA, RATE_CATS, rate_cats, PLL_GAMMA_RATES_MEAN);
+  pll_set_category_rates(partition, rate_cats);
+
+  return partition;
+}
+
+/* builds the tree information over a new partition, tips are matched to
+   the alignment rows by label */
+static pllmod_treeinfo_t * create_treeinfo(pll_utree_t * tree,
+                                           unsigned int attributes)
+{
+  unsigned int i;
+  pll_partition_t * partition = create_partition(N_TAXA - 2,
+                                                 2 * N_TAXA - 3,
+                                                 attributes);
+
+  for (i = 0; i < tree->tip_count; ++i)
+    pll_set_tip_states(partition, tree->nodes[i]->clv_index, pll_map_nt,
+                       seq_by_label(tree->nodes[i]->label));
+
+  pllmod_treeinfo_t * treeinfo = pllmod_treeinfo_create(tree->vroot, N_TAXA, 1,
+                                                      PLLMOD_COMMON_BRLEN_LINKED);
+  if (!treeinfo)
+    fatal("Cannot create tree info: %s", pll_errmsg);
+
+  if (!pllmod_treeinfo_init_partition(treeinfo, 0, partition,
+                                      PLLMOD_OPT_PARAM_BRANCHES_ITERATIVE,
+                                      PLL_GAMMA_RATES_MEAN, ALPHA,
+                                      params_indices, NULL))
+    fatal("Cannot initialize partition: %s", pll_errmsg);
+
+  return treeinfo;
+}
+
+static void destroy_treeinfo(pllmod_treeinfo_t * treeinfo)
+{
+  pll_partition_t * partition = treeinfo->partitions[0];
+
+  pllmod_treeinfo_destroy(treeinfo);
+  pll_partition_destroy(partition);
+}
+
+static pll_utree_t * parse_tree(const char * newick)
+{
+  pll_utree_t * tree = pll_utree_parse_newick_string(newick);
+
+  if (!tree)
+    fatal("Cannot parse tree %s", newick);
+
+  return tree;
+}
+
+/* starting point of the rounds: the start tree with optimized branches */
+static double optimize_start(pllmod_treeinfo_t * treeinfo)
+{
+  /* the derivatives need valid CLVs at every branch */
+  if (!pllmod_treeinfo_compute_loglh(treeinfo, 0))
+    fatal("Cannot compute log-likelihood: %s", pll_errmsg);
+
+  double loglh = pllmod_algo_opt_brlen_treeinfo(treeinfo,
+                                                PLLMOD_OPT_MIN_BRANCH_LEN,
+                                                PLLMOD_OPT_MAX_BRANCH_LEN,
+                                                LH_EPSILON,
+                                                SMOOTHINGS,
+                                                PLLMOD_OPT_BLO_NEWTON_FAST,
+                                                PLLMOD_OPT_BRLEN_OPTIMIZE_ALL);
+  if (!loglh)
+    fatal("Cannot optimize branch lengths: %s", pll_errmsg);
+
+  /* the optimization returns the negative log-likelihood */
+  return -loglh;
+}
+
+static const char * yes_no(int value)
+{
+  return value ? "yes" : "no";
+}
+
+static void print_round(const char * name,
+                        pllmod_treeinfo_t * treeinfo,
+                        double start_loglh,
+                        double loglh)
+{
+  if (!loglh)
+    fatal("%s failed: %s", name, pll_errmsg);
+
+  double recomputed = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  printf("%s: not worse: %s, recomputed: %s, integrity: %s\n", name,
+         yes_no(loglh >= start_loglh - LH_TOLERANCE),
+         yes_no(fabs(recomputed - loglh) < LH_TOLERANCE),
+         pll_utree_check_integrity(treeinfo->tree) ? "OK" : "FAILED");
+}
+
+/* the tip indices are renumbered on a copy, the tree information keeps
+   its own */
+static unsigned int rf_to_optimum(const pll_utree_t * tree)
+{
+  pll_utree_t * opt_tree = parse_tree(OPT_TREE);
+  pll_utree_t * copy = pll_utree_clone(tree);
+  unsigned int rf;
+
+  if (!copy)
+    fatal("Cannot clone tree: %s", pll_errmsg);
+
+  pllmod_utree_consistency_set(opt_tree, copy);
+  rf = pllmod_utree_rf_distance(copy->vroot, opt_tree->vroot, N_TAXA);
+  pll_utree_destroy(copy, NULL);
+  pll_utree_destroy(opt_tree, NULL);
+
+  return rf;
+}
+
+/* runs one kind of round on two copies of the start tree, with and without
+   a workspace; both runs must end in the same tree */
+typedef double (*round_cb)(pllmod_treeinfo_t * treeinfo,
+                           pllmod_spr_workspace_t * workspace);
+
+static double spr_round(pllmod_treeinfo_t * treeinfo,
+                        pllmod_spr_workspace_t * workspace)
+{
+  cutoff_info_t cutoff_info;
+  double loglh = pllmod_treeinfo_compute_loglh(treeinfo, 0);
+
+  cutoff_info.lh_dec_count = 0;
+  cutoff_info.lh_dec_sum = 0.;
+  cutoff_info.lh_start = loglh;
+  cutoff_info.lh_cutoff = loglh / -1000.0;
+
+  if (!workspace)
+    return pllmod_algo_spr_round(treeinfo, RADIUS_MIN, RADIUS_MAX, NTOPOL_KEEP,
+                                 PLL_TRUE, PLLMOD_OPT_BLO_NEWTON_FAST,
+                                 PLLMOD_OPT_MIN_BRANCH_LEN,
+                                 PLLMOD_OPT_MAX_BRANCH_LEN, SMOOTHINGS,
+                                 LH_EPSILON, &cutoff_info, SUBTREE_CUTOFF,
+                                 1, LH_EPSILON);
+
+  return pllmod_algo_spr_round_workspace(treeinfo, workspace, RADIUS_MIN,
+                                         RADIUS_MAX, NTOPOL_KEEP, PLL_TRUE,
+                                         PLLMOD_OPT_BLO_NEWTON_FAST,
+                                         PLLMOD_OPT_MIN_BRANCH_LEN,
+                                         PLLMOD_OPT_MAX_BRANCH_LEN, SMOOTHINGS,
+                                         LH_EPSILON, &cutoff_info,
+                                         SUBTREE_CUTOFF, 1, LH_EPSILON);
+}
+
+static double nni_round(pllmod_treeinfo_t * treeinfo,
+                        pllmod_spr_workspace_t * workspace)
+{
+  if (!workspace)
+    return pllmod_algo_nni_round(treeinfo, PLLMOD_OPT_MIN_BRANCH_LEN,
+                                 PLLMOD_OPT_MAX_BRANCH_LEN,
+                                 PLLMOD_OPT_BLO_NEWTON_FAST, SMOOTHINGS,
+                                 LH_EPSILON);
+
+  return pllmod_algo_nni_round_workspace(treeinfo, workspace,
+                                         PLLMOD_OPT_MIN_BRANCH_LEN,
+                                         PLLMOD_OPT_MAX_BRANCH_LEN,
+                                         PLLMOD_OPT_BLO_NEWTON_FAST,
+                                         SMOOTHINGS, LH_EPSILON);
+}
+
+static double tbr_round(pllmod_treeinfo_t * treeinfo,
+                        pllmod_spr_workspace_t * workspace)
+{
+  if (!workspace)
+    return pllmod_algo_tbr_round(treeinfo, RADIUS_MIN, RADIUS_MAX,
+                                 NTOPOL_KEEP, PLL_TRUE,
+                                 PLLMOD_OPT_BLO_NEWTON_FAST,
+                                 PLLMOD_OPT_MIN_BRANCH_LEN,
+                                 PLLMOD_OPT_MAX_BRANCH_LEN, SMOOTHINGS,
+                                 LH_EPSILON, NULL, 0.);
+
+  return pllmod_algo_tbr_round_workspace(treeinfo, workspace, RADIUS_MIN,
+                                         RADIUS_MAX, NTOPOL_KEEP, PLL_TRUE,
+                                         PLLMOD_OPT_BLO_NEWTON_FAST,
+                                         PLLMOD_OPT_MIN_BRANCH_LEN,
+                                         PLLMOD_OPT_MAX_BRANCH_LEN, SMOOTHINGS,
+                                         LH_EPSILON, NULL, 0.);
+}
+
+void test_round(const char * name, round_cb round, unsigned int attributes)
+{
+  pll_utree_t * tree = parse_tree(START_TREE);
+  pll_utree_t * ws_tree = parse_tree(START_TREE);
+  pllmod_treeinfo_t * treeinfo = create_treeinfo(tree, attributes);
+  pllmod_treeinfo_t * ws_treeinfo = create_treeinfo(ws_tree, attributes);
+  char ws_name[64];
+
+  double start_loglh = optimize_start(treeinfo);
+  double loglh = round(treeinfo, NULL);
+  print_round(name, treeinfo, start_loglh, loglh);
+
+  pllmod_spr_workspace_t * workspace =
+      pllmod_algo_spr_workspace_create(ws_treeinfo, NTOPOL_KEEP);
+  if (!workspace)
+    fatal("Cannot create workspace: %s", pll_errmsg);
+
+  optimize_start(ws_treeinfo);
+  double ws_loglh = round(ws_treeinfo, workspace);
+  snprintf(ws_name, sizeof(ws_name), "%s (workspace)", name);
+  print_round(ws_name, ws_treeinfo, start_loglh, ws_loglh);
+
+  /* the workspace only provides the buffers */
+  printf("Same as without workspace: %s\n",
+         yes_no(ws_loglh == loglh &&
+                !pllmod_utree_rf_distance(treeinfo->root, ws_treeinfo->root,
+                                          N_TAXA)));
+
+  /* a second round reuses the buffers of the first one */
+  loglh = round(ws_treeinfo, workspace);
+  print_round("  Second round", ws_treeinfo, ws_loglh, loglh);
+
+  pllmod_algo_spr_workspace_destroy(workspace);
+  destroy_treeinfo(treeinfo);
+  destroy_treeinfo(ws_treeinfo);
+  pll_utree_destroy(tree, NULL);
+  pll_utree_destroy(ws_tree, NULL);
+}
+
+void test_tabu(unsigned int attributes)
+{
+  unsigned int i;
+  pll_utree_t * tree = parse_tree(START_TREE);
+  pllmod_treeinfo_t * treeinfo = create_treeinfo(tree, attributes);
+
+  pllmod_spr_workspace_t * workspace =
+      pllmod_algo_spr_workspace_create(treeinfo, NTOPOL_KEEP);
+  if (!workspace)
+    fatal("Cannot create workspace: %s", pll_errmsg);
+
+  printf("Disabled tabu cache: %s\n",
+         pllmod_algo_spr_workspace_set_tabu(workspace, 0, TABU_MAX_AGE) ?
+         "accepted" : "rejected");
+
+  if (!pllmod_algo_spr_workspace_set_tabu(workspace, TABU_SIZE, TABU_MAX_AGE))
+    fatal("Cannot set tabu cache: %s", pll_errmsg);
+
+  double loglh = optimize_start(treeinfo);
+  for (i = 0; i < 3; ++i)
+  {
+    char name[32];
+    double new_loglh = spr_round(treeinfo, workspace);
+
+    snprintf(name, sizeof(name), "Tabu round %u", i + 1);
+    print_round(name, treeinfo, loglh, new_loglh);
+    loglh = new_loglh;
+  }
+
+  pllmod_algo_spr_workspace_destroy(workspace);
+  destroy_treeinfo(treeinfo);
+  pll_utree_destroy(tree, NULL);
+}
+
+void test_search(unsigned int attributes)
+{
+  pllmod_search_options_t options;
+  pll_utree_t * tree = parse_tree(START_TREE);
+  pllmod_treeinfo_t * treeinfo = create_treeinfo(tree, attributes);
+
+  pllmod_algo_search_options_init(&options);
+  options.radius_max = RADIUS_MAX;
+
+  double start_loglh = optimize_start(treeinfo);
+  double loglh = pllmod_algo_search(treeinfo, &options);
+  print_round("Search", treeinfo, start_loglh, loglh);
+  printf("RF to optimum: %u\n", rf_to_optimum(treeinfo->tree));
+
+  /* the tabu cache does not change the result */
+  options.tabu_size = TABU_SIZE;
+  options.tabu_max_age = TABU_MAX_AGE;
+  loglh = pllmod_algo_search(treeinfo, &options);
+  print_round("Search with tabu cache", treeinfo, start_loglh, loglh);
+  printf("RF to optimum: %u\n", rf_to_optimum(treeinfo->tree));
+
+  options.radius_min = 0;
+  printf("Radius 0: %s\n",
+         pllmod_algo_search(treeinfo, &options) ? "accepted" : "rejected");
+
+  destroy_treeinfo(treeinfo);
+  pll_utree_destroy(tree, NULL);
+}
+
+/* multi-start callbacks: one random tree and partition per start */
+static pllmod_treeinfo_t * multistart_create(unsigned int start,
+                                             unsigned int seed,
+                                             void * data)
+{
+  unsigned int attributes = *((unsigned int *) data);
+  pll_utree_t * tree = pllmod_utree_create_random(N_TAXA, names, seed);
+
+  (void) start;
+
+  if (!tree)
+    return NULL;
+
+  pllmod_treeinfo_t * treeinfo = create_treeinfo(tree, attributes);
+
+  /* the tree information keeps its own wrapper around the nodes */
+  free(tree->nodes);
+  free(tree);
+
+  return treeinfo;
+}
+
+static void multistart_destroy(pllmod_treeinfo_t * treeinfo, void * data)
+{
+  (void) data;
+
+  pll_utree_graph_destroy(treeinfo->root, NULL);
+  destroy_treeinfo(treeinfo);
+}
+
+void test_multistart(unsigned int attributes)
+{
+  unsigned int i;
+  pllmod_search_options_t options;
+
+  pllmod_algo_search_options_init(&options);
+  options.radius_max = RADIUS_MAX;
+
+  pllmod_multistart_t * multistart =
+      pllmod_algo_multistart_create(N_STARTS, RAND_SEED, &options,
+                                    multistart_create, multistart_destroy,
+                                    &attributes);
+  if (!multistart)
+    fatal("Cannot create multi-start search: %s", pll_errmsg);
+
+  /* per-start seeds only depend on the base seed */
+  pllmod_multistart_t * other =
+      pllmod_algo_multistart_create(N_STARTS, RAND_SEED, &options,
+                                    multistart_create, multistart_destroy,
+                                    &attributes);
+  printf("Same seeds: %s\n",
+         yes_no(!memcmp(multistart->seeds, other->seeds,
+                        N_STARTS * sizeof(unsigned int))));
+  pllmod_algo_multistart_destroy(other);
+
+  printf("Best start before run: %d\n",
+         pllmod_algo_multistart_best(multistart));
+
+  if (!pllmod_algo_multistart_run(multistart))
+    fatal("Cannot run multi-start search: %s", pll_errmsg);
+
+  for (i = 0; i < N_STARTS; ++i)
+    printf("Start %u: finished: %s, RF to optimum: %u\n", i,
+           yes_no(multistart->trees[i] && multistart->loglh[i] < 0.),
+           rf_to_optimum(multistart->trees[i]));
+
+  int best = pllmod_algo_multistart_best(multistart);
+  int best_ok = best >= 0;
+  for (i = 0; best_ok && i < N_STARTS; ++i)
+    best_ok = multistart->loglh[i] <= multistart->loglh[best];
+  printf("Best start valid: %s\n", yes_no(best_ok));
+
+  /* every start has been claimed */
+  printf("Second run: %s\n",
+         pllmod_algo_multistart_run(multistart) ? "OK" : "FAILED");
+
+  pllmod_algo_multistart_destroy(multistart);
+
+  printf("No starts: %s\n",
+         pllmod_algo_multistart_create(0, RAND_SEED, &options,
+                                       multistart_create, multistart_destroy,
+                                       &attributes) ? "accepted" : "rejected");
+}
+
+void test_rtree_round(unsigned int attributes)
+{
+  unsigned int i;
+  pll_rtree_t * tree = pll_rtree_parse_newick_string(START_RTREE);
+  if (!tree)
+    fatal("Cannot parse tree %s", START_RTREE);
+
+  pll_partition_t * partition = create_partition(N_TAXA - 1,
+                                                 2 * N_TAXA - 2,
+                                                 attributes);
+  for (i = 0; i < tree->tip_count; ++i)
+    pll_set_tip_states(partition, tree->nodes[i]->clv_index, pll_map_nt,
+                       seq_by_label(tree->nodes[i]->label));
+
+  pllmod_rtreeinfo_t * rtreeinfo = pllmod_rtreeinfo_create(tree->root,
+                                                           N_TAXA, 1);
+  if (!rtreeinfo)
+    fatal("Cannot create tree info: %s", pll_errmsg);
+
+  if (!pllmod_rtreeinfo_init_partition(rtreeinfo, 0, partition,
+                                       params_indices))
+    fatal("Cannot initialize partition: %s", pll_errmsg);
+
+  printf("Radius 0..0: %s\n",
+         pllmod_algo_rtree_spr_round(rtreeinfo, 0, 0,
+                                     PLLMOD_OPT_MIN_BRANCH_LEN,
+                                     LH_EPSILON) ? "accepted" : "rejected");
+
+  double loglh = pllmod_rtreeinfo_compute_loglh(rtreeinfo, 0);
+  for (i = 0; i < 2; ++i)
+  {
+    double new_loglh = pllmod_algo_rtree_spr_round(rtreeinfo, RADIUS_MIN,
+                                                   RADIUS_MAX,
+                                                   PLLMOD_OPT_MIN_BRANCH_LEN,
+                                                   LH_EPSILON);
+    if (!new_loglh)
+      fatal("Rooted SPR round failed: %s", pll_errmsg);
+
+    double recomputed = pllmod_rtreeinfo_compute_loglh(rtreeinfo, 0);
+
+    printf("Rooted SPR round %u: not worse: %s, recomputed: %s, root: %s\n",
+           i + 1, yes_no(new_loglh >= loglh - LH_TOLERANCE),
+           yes_no(fabs(recomputed - new_loglh) < LH_TOLERANCE),
+           rtreeinfo->root->parent ? "FAILED" : "OK");
+    loglh = new_loglh;
+  }
+
+  pllmod_rtreeinfo_destroy(rtreeinfo);
+  pll_partition_destroy(partition);
+  pll_rtree_destroy(tree, NULL);
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  printf("Testing SPR round:\n\n");
+  test_round("SPR round", spr_round, attributes);
+
+  printf("\nTesting NNI round:\n\n");
+  test_round("NNI round", nni_round, attributes);
+
+  printf("\nTesting TBR round:\n\n");
+  test_round("TBR round", tbr_round, attributes);
+
+  printf("\nTesting SPR tabu cache:\n\n");
+  test_tabu(attributes);
+
+  printf("\nTesting search driver:\n\n");
+  test_search(attributes);
+
+  printf("\nTesting multi-start search:\n\n");
+  test_multistart(attributes);
+
+  printf("\nTesting rooted SPR round:\n\n");
+  test_rtree_round(attributes);
+
+  return 0;
+}
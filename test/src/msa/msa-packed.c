@@ -0,0 +1,242 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_msa.h"
+#include "../common.h"
+
+#define N_TAXA 4
+#define N_SITES 70
+#define N_STATES 4
+#define N_PARTS 3
+
+#define OUT_FNAME     "msa-packed.tmp"
+#define OUT_FNAME_REF "msa-packed-ref.tmp"
+
+static const char * labels[N_TAXA] = { "t1", "t2", "t3", "t4" };
+
+/* 70 sites span three 64-bit words with 2 bits per site, and five words
+   with 4 bits per site */
+static const char * seqs_nt[N_TAXA] = {
+  "ACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTAC",
+  "ACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTAC",
+  "TTGCAACCGGTTAACCGGTTTTGCAACCGGTTAACCGGTTTTGCAACCGGTTAACCGGTTTTGCAACCGG",
+  "GATTACAGATTACAGATTACAGATTACAGATTACAGATTACAGATTACAGATTACAGATTACAGATTACA"
+};
+
+/* same alignment with gaps and ambiguities */
+static const char * seqs_amb[N_TAXA] = {
+  "ACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTAC",
+  "ACGTACGTAC-TACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTACGTAC",
+  "TTGCAACCGGTTAACCGGTTTTGCAACCGGTRAACCGGTTTTGCAACCGGTTAACCGGTTTTGCAACCGG",
+  "----------------------------------------------------------------------"
+};
+
+static const unsigned long remove_seqs[1] = { 1 };
+static const unsigned long remove_cols[5] = { 0, 31, 32, 33, 64 };
+
+static pll_msa_t * create_msa(const char * const * seqs)
+{
+  unsigned int i;
+  pll_msa_t * msa = (pll_msa_t *) calloc(1, sizeof(pll_msa_t));
+
+  msa->count = N_TAXA;
+  msa->length = N_SITES;
+  msa->sequence = (char **) calloc(N_TAXA, sizeof(char *));
+  msa->label = (char **) calloc(N_TAXA, sizeof(char *));
+  for (i = 0; i < N_TAXA; ++i)
+  {
+    msa->sequence[i] = strdup(seqs[i]);
+    msa->label[i] = strdup(labels[i]);
+  }
+
+  return msa;
+}
+
+static int same_msa(const pll_msa_t * a, const pll_msa_t * b)
+{
+  int i;
+
+  if (a->count != b->count || a->length != b->length)
+    return 0;
+
+  for (i = 0; i < a->count; ++i)
+    if (memcmp(a->sequence[i], b->sequence[i], (size_t) a->length))
+      return 0;
+
+  return 1;
+}
+
+static int same_file(const char * fname1, const char * fname2)
+{
+  int c1, c2;
+  FILE * f1 = fopen(fname1, "r");
+  FILE * f2 = fopen(fname2, "r");
+
+  if (!f1 || !f2)
+    fatal("Cannot open output files");
+
+  do
+  {
+    c1 = fgetc(f1);
+    c2 = fgetc(f2);
+  }
+  while (c1 == c2 && c1 != EOF);
+
+  fclose(f1);
+  fclose(f2);
+  remove(fname1);
+  remove(fname2);
+
+  return c1 == c2;
+}
+
+static const char * yes_no(int value)
+{
+  return value ? "yes" : "no";
+}
+
+void test_packed(const char * const * seqs, unsigned int bits)
+{
+  int i;
+  unsigned int p;
+  pll_msa_t * msa = create_msa(seqs);
+
+  pllmod_msa_packed_t * packed = pllmod_msa_pack(msa, pll_map_nt, bits);
+  if (!packed)
+    fatal("Cannot pack MSA: %s", pll_errmsg);
+
+  printf("Bits per site: %u, words per sequence: %lu\n",
+         packed->bits, packed->words);
+
+  pll_msa_t * unpacked = pllmod_msa_unpack(packed);
+  if (!unpacked)
+    fatal("Cannot unpack MSA: %s", pll_errmsg);
+  printf("Unpacked MSA equal: %s\n", yes_no(same_msa(msa, unpacked)));
+
+  int labels_ok = 1;
+  for (i = 0; i < N_TAXA; ++i)
+    labels_ok &= !strcmp(unpacked->label[i], labels[i]);
+  printf("Unpacked labels equal: %s\n", yes_no(labels_ok));
+  pll_msa_destroy(unpacked);
+
+  /* filtering across word boundaries */
+  pllmod_msa_packed_t * packed_filtered =
+      pllmod_msa_packed_filter(packed, remove_seqs, 1, remove_cols, 5);
+  if (!packed_filtered)
+    fatal("Cannot filter packed MSA: %s", pll_errmsg);
+
+  pll_msa_t * filtered = pllmod_msa_filter(msa, (unsigned long *) remove_seqs,
+                                           1, (unsigned long *) remove_cols, 5,
+                                           0);
+  unpacked = pllmod_msa_unpack(packed_filtered);
+  printf("Filtered MSA: %d x %d, equal: %s\n", packed_filtered->count,
+         packed_filtered->length, yes_no(same_msa(filtered, unpacked)));
+  pll_msa_destroy(unpacked);
+  pll_msa_destroy(filtered);
+  pllmod_msa_packed_destroy(packed_filtered);
+
+  /* partitions of interleaved columns and of runs of columns */
+  unsigned int site_part[N_SITES];
+  for (i = 0; i < N_SITES; ++i)
+    site_part[i] = (i < 40) ? 1 + i % 2 : ((i < 65) ? 3 : 0);
+
+  pllmod_msa_packed_t ** packed_parts = pllmod_msa_packed_split(packed,
+                                                                site_part,
+                                                                N_PARTS);
+  if (!packed_parts)
+    fatal("Cannot split packed MSA: %s", pll_errmsg);
+
+  pll_msa_t ** parts = pllmod_msa_split(msa, site_part, N_PARTS);
+  for (p = 0; p < N_PARTS; ++p)
+  {
+    unpacked = pllmod_msa_unpack(packed_parts[p]);
+    printf("Partition %u: %d sites, equal: %s\n", p + 1,
+           packed_parts[p]->length, yes_no(same_msa(parts[p], unpacked)));
+    pll_msa_destroy(unpacked);
+    pll_msa_destroy(parts[p]);
+    pllmod_msa_packed_destroy(packed_parts[p]);
+  }
+  free(parts);
+  free(packed_parts);
+
+  /* statistics without unpacking the whole alignment */
+  pllmod_msa_stats_t * stats = pllmod_msa_compute_stats(msa, N_STATES,
+                                                        pll_map_nt, NULL,
+                                                        PLLMOD_MSA_STATS_ALL);
+  pllmod_msa_stats_t * packed_stats =
+      pllmod_msa_packed_compute_stats(packed, N_STATES, pll_map_nt, NULL,
+                                      PLLMOD_MSA_STATS_ALL);
+  if (!stats || !packed_stats)
+    fatal("Cannot compute statistics: %s", pll_errmsg);
+
+  int stats_ok = stats->gap_prop == packed_stats->gap_prop &&
+                 stats->inv_prop == packed_stats->inv_prop &&
+                 stats->gap_seqs_count == packed_stats->gap_seqs_count &&
+                 stats->inv_cols_count == packed_stats->inv_cols_count &&
+                 stats->dup_seqs_pairs_count ==
+                     packed_stats->dup_seqs_pairs_count;
+  for (p = 0; p < N_STATES; ++p)
+    stats_ok &= stats->freqs[p] == packed_stats->freqs[p];
+
+  printf("Statistics: %lu invariant columns, %lu duplicate sequences, "
+         "equal: %s\n", packed_stats->inv_cols_count,
+         packed_stats->dup_seqs_pairs_count, yes_no(stats_ok));
+  pllmod_msa_destroy_stats(stats);
+  pllmod_msa_destroy_stats(packed_stats);
+
+  if (!pllmod_msa_packed_save_phylip(packed, OUT_FNAME) ||
+      !pllmod_msa_save_phylip(msa, OUT_FNAME_REF))
+    fatal("Cannot save MSA: %s", pll_errmsg);
+  printf("PHYLIP output equal: %s\n", yes_no(same_file(OUT_FNAME,
+                                                       OUT_FNAME_REF)));
+
+  pllmod_msa_packed_destroy(packed);
+  pll_msa_destroy(msa);
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  printf("Testing packed MSA (nucleotides, 2 bits):\n\n");
+  test_packed(seqs_nt, 0);
+
+  printf("\nTesting packed MSA (nucleotides, 4 bits):\n\n");
+  test_packed(seqs_nt, 4);
+
+  printf("\nTesting packed MSA (ambiguities):\n\n");
+  test_packed(seqs_amb, 0);
+
+  /* ambiguities do not fit in 2 bits */
+  pll_msa_t * msa = create_msa(seqs_amb);
+  printf("\nAmbiguities in 2 bits: %s\n",
+         pllmod_msa_pack(msa, pll_map_nt, 2) ? "accepted" : "rejected");
+  printf("3 bits per site: %s\n",
+         pllmod_msa_pack(msa, pll_map_nt, 3) ? "accepted" : "rejected");
+  pll_msa_destroy(msa);
+
+  return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_msa.h"
+#include "../common.h"
+
+#define N_TAXA 5
+#define N_SITES 10
+#define N_PARTS 2
+
+#define OUT_FNAME "msa-patterns.tmp"
+
+static const char * labels[N_TAXA] = {
+  "t1", "t2", "t3", "t4", "a_long_label"
+};
+
+/* columns 0 and 4 are identical */
+static const char * seqs[N_TAXA] = {
+  "ACGTACGT-A",
+  "ACGTACGT-A",
+  "ACCTAGGT-C",
+  "----------",
+  "ACGAACGT-G"
+};
+
+static const unsigned int weights[N_SITES] = { 1, 2, 1, 1, 3, 1, 1, 1, 1, 1 };
+
+/* column 7 is not assigned to any partition */
+static const unsigned int site_part[N_SITES] = { 1, 1, 2, 2, 1, 2, 1, 0, 2, 1 };
+
+static pll_msa_t * create_msa()
+{
+  unsigned int i;
+  pll_msa_t * msa = (pll_msa_t *) calloc(1, sizeof(pll_msa_t));
+
+  msa->count = N_TAXA;
+  msa->length = N_SITES;
+  msa->sequence = (char **) calloc(N_TAXA, sizeof(char *));
+  msa->label = (char **) calloc(N_TAXA, sizeof(char *));
+  for (i = 0; i < N_TAXA; ++i)
+  {
+    msa->sequence[i] = strdup(seqs[i]);
+    msa->label[i] = strdup(labels[i]);
+  }
+
+  return msa;
+}
+
+static void print_msa(const pll_msa_t * msa)
+{
+  int i;
+
+  for (i = 0; i < msa->count; ++i)
+    printf("  %.*s\n", msa->length, msa->sequence[i]);
+}
+
+static void print_weights(const char * name,
+                          const unsigned int * w,
+                          unsigned int count)
+{
+  unsigned int i;
+
+  printf("%s:", name);
+  for (i = 0; i < count; ++i)
+    printf(" %u", w[i]);
+  printf("\n");
+}
+
+static void print_file(const char * fname)
+{
+  int c;
+  FILE * f = fopen(fname, "r");
+
+  if (!f)
+    fatal("Cannot open %s", fname);
+
+  while ((c = fgetc(f)) != EOF)
+    putchar(c);
+
+  fclose(f);
+  remove(fname);
+}
+
+static int same_msa(const pll_msa_t * a, const pll_msa_t * b)
+{
+  int i;
+
+  if (a->count != b->count || a->length != b->length)
+    return 0;
+
+  for (i = 0; i < a->count; ++i)
+    if (memcmp(a->sequence[i], b->sequence[i], (size_t) a->length))
+      return 0;
+
+  return 1;
+}
+
+void test_compress(const pll_msa_t * msa)
+{
+  unsigned int * pattern_weights;
+  unsigned int site_pattern[N_SITES];
+
+  pll_msa_t * compressed = pllmod_msa_compress_patterns(msa, NULL,
+                                                        &pattern_weights,
+                                                        site_pattern);
+  if (!compressed)
+    fatal("Cannot compress patterns: %s", pll_errmsg);
+
+  printf("Patterns: %d\n", compressed->length);
+  print_weights("Pattern weights", pattern_weights,
+                (unsigned int) compressed->length);
+  print_weights("Site patterns", site_pattern, N_SITES);
+  print_msa(compressed);
+  printf("Labels copied: %s\n",
+         strcmp(compressed->label[N_TAXA-1], labels[N_TAXA-1]) ? "no" : "yes");
+
+  free(pattern_weights);
+  pll_msa_destroy(compressed);
+
+  /* the column weights add up per pattern */
+  compressed = pllmod_msa_compress_patterns(msa, weights, &pattern_weights,
+                                            NULL);
+  if (!compressed)
+    fatal("Cannot compress patterns: %s", pll_errmsg);
+
+  print_weights("Weighted pattern weights", pattern_weights,
+                (unsigned int) compressed->length);
+
+  free(pattern_weights);
+  pll_msa_destroy(compressed);
+}
+
+void test_split_patterns(const pll_msa_t * msa)
+{
+  unsigned int p;
+  unsigned int ** part_weights;
+
+  pll_msa_t ** parts = pllmod_msa_split_patterns(msa, site_part, N_PARTS,
+                                                 NULL, &part_weights);
+  if (!parts)
+    fatal("Cannot split patterns: %s", pll_errmsg);
+
+  /* same as splitting first and compressing every partition */
+  pll_msa_t ** split = pllmod_msa_split(msa, site_part, N_PARTS);
+  if (!split)
+    fatal("Cannot split MSA: %s", pll_errmsg);
+
+  for (p = 0; p < N_PARTS; ++p)
+  {
+    unsigned int * weights_ref;
+    pll_msa_t * ref = pllmod_msa_compress_patterns(split[p], NULL,
+                                                   &weights_ref, NULL);
+    if (!ref)
+      fatal("Cannot compress patterns: %s", pll_errmsg);
+
+    printf("Partition %u: %d patterns\n", p + 1, parts[p]->length);
+    print_weights("Pattern weights", part_weights[p],
+                  (unsigned int) parts[p]->length);
+    print_msa(parts[p]);
+    printf("Same as split and compress: %s\n",
+           same_msa(parts[p], ref) &&
+           !memcmp(part_weights[p], weights_ref,
+                   (size_t) ref->length * sizeof(unsigned int)) ? "yes" : "no");
+
+    free(weights_ref);
+    pll_msa_destroy(ref);
+    free(part_weights[p]);
+    pll_msa_destroy(parts[p]);
+  }
+
+  free(part_weights);
+  free(parts);
+
+  /* partition indices are checked */
+  unsigned int bad_part[N_SITES] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 3 };
+  printf("Partition index out of bounds: %s\n",
+         pllmod_msa_split_patterns(msa, bad_part, N_PARTS, NULL,
+                                   &part_weights) ? "accepted" : "rejected");
+
+  /* save the partitions with the labels of the original alignment */
+  const char * fnames[N_PARTS] = { OUT_FNAME ".1", OUT_FNAME ".2" };
+  if (!pllmod_msa_save_list((const pll_msa_t * const *) split, N_PARTS,
+                            msa->label, fnames, PLLMOD_MSA_FORMAT_PHYLIP_RELAXED))
+    fatal("Cannot save partitions: %s", pll_errmsg);
+
+  for (p = 0; p < N_PARTS; ++p)
+  {
+    printf("\nPartition %u file:\n", p + 1);
+    print_file(fnames[p]);
+    pll_msa_destroy(split[p]);
+  }
+  free(split);
+}
+
+void test_save(const pll_msa_t * msa)
+{
+  printf("PHYLIP (relaxed):\n");
+  if (!pllmod_msa_save(msa, OUT_FNAME, PLLMOD_MSA_FORMAT_PHYLIP_RELAXED))
+    fatal("Cannot save MSA: %s", pll_errmsg);
+  print_file(OUT_FNAME);
+
+  printf("\nPHYLIP (strict):\n");
+  if (!pllmod_msa_save(msa, OUT_FNAME, PLLMOD_MSA_FORMAT_PHYLIP_STRICT))
+    fatal("Cannot save MSA: %s", pll_errmsg);
+  print_file(OUT_FNAME);
+
+  printf("\nFASTA:\n");
+  if (!pllmod_msa_save(msa, OUT_FNAME, PLLMOD_MSA_FORMAT_FASTA))
+    fatal("Cannot save MSA: %s", pll_errmsg);
+  print_file(OUT_FNAME);
+
+  printf("\nInvalid format: %s\n",
+         pllmod_msa_save(msa, OUT_FNAME, 42) ? "accepted" : "rejected");
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  pll_msa_t * msa = create_msa();
+
+  printf("Testing pattern compression:\n\n");
+  test_compress(msa);
+
+  printf("\nTesting partitioned pattern compression:\n\n");
+  test_split_patterns(msa);
+
+  printf("\nTesting MSA output:\n\n");
+  test_save(msa);
+
+  pll_msa_destroy(msa);
+
+  return 0;
+}
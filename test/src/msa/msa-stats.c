@@ -0,0 +1,320 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_msa.h"
+#include "../common.h"
+
+#include <math.h>
+
+#define N_TAXA 5
+#define N_SITES 10
+#define N_STATES 4
+#define N_BLOCKS 4
+
+/* copies of the alignment in the wide alignment, which spans several tiles
+   of columns */
+#define N_COPIES 500
+
+/* t1/t2 are identical, t4 is gap-only, column 8 is gap-only and
+   columns 0, 1, 4, 6 and 7 are invariant */
+static const char * labels[N_TAXA] = { "t1", "t2", "t3", "t4", "t1" };
+
+static const char * seqs[N_TAXA] = {
+  "ACGTACGT-A",
+  "ACGTACGT-A",
+  "ACCTAGGT-C",
+  "----------",
+  "ACGAACGT-G"
+};
+
+static const unsigned int weights[N_SITES] = { 1, 2, 1, 1, 3, 1, 1, 1, 1, 1 };
+
+/* stream block sizes, adding up to N_SITES */
+static const unsigned long block_len[N_BLOCKS] = { 1, 2, 3, 4 };
+
+static pll_msa_t * create_msa(const char * const * seq_list)
+{
+  unsigned int i;
+  pll_msa_t * msa = (pll_msa_t *) calloc(1, sizeof(pll_msa_t));
+
+  msa->count = N_TAXA;
+  msa->length = N_SITES;
+  msa->sequence = (char **) calloc(N_TAXA, sizeof(char *));
+  msa->label = (char **) calloc(N_TAXA, sizeof(char *));
+  for (i = 0; i < N_TAXA; ++i)
+  {
+    msa->sequence[i] = strdup(seq_list[i]);
+    msa->label[i] = strdup(labels[i]);
+  }
+
+  return msa;
+}
+
+/* N_COPIES copies of the alignment side by side */
+static pll_msa_t * create_wide_msa(void)
+{
+  unsigned int i, k;
+  char * wide_seqs[N_TAXA];
+
+  for (i = 0; i < N_TAXA; ++i)
+  {
+    wide_seqs[i] = (char *) malloc(N_COPIES * N_SITES + 1);
+    for (k = 0; k < N_COPIES; ++k)
+      memcpy(wide_seqs[i] + k * N_SITES, seqs[i], N_SITES);
+    wide_seqs[i][N_COPIES * N_SITES] = '\0';
+  }
+
+  pll_msa_t * msa = create_msa((const char * const *) wide_seqs);
+  msa->length = N_COPIES * N_SITES;
+
+  for (i = 0; i < N_TAXA; ++i)
+    free(wide_seqs[i]);
+
+  return msa;
+}
+
+static void print_list(const char * name,
+                       const unsigned long * list,
+                       unsigned long count)
+{
+  unsigned long i;
+
+  printf("%s: %lu [", name, count);
+  for (i = 0; i < count; ++i)
+    printf(i ? " %lu" : "%lu", list[i]);
+  printf("]\n");
+}
+
+static void print_pairs(const char * name,
+                        const unsigned long * pairs,
+                        unsigned long count)
+{
+  unsigned long i;
+
+  printf("%s: %lu", name, count);
+  for (i = 0; i < count; ++i)
+    printf(" (%lu,%lu)", pairs[2*i], pairs[2*i+1]);
+  printf("\n");
+}
+
+static void print_stats(const pllmod_msa_stats_t * stats)
+{
+  unsigned long i;
+
+  print_pairs("Duplicate taxa", stats->dup_taxa_pairs,
+              stats->dup_taxa_pairs_count);
+  print_pairs("Duplicate sequences", stats->dup_seqs_pairs,
+              stats->dup_seqs_pairs_count);
+  printf("Duplicate sequence groups: %lu\n", stats->dup_seqs_groups_count);
+  for (i = 0; i < stats->dup_seqs_groups_count; ++i)
+  {
+    const unsigned long start = stats->dup_seqs_groups_offset[i];
+    print_list("  Group", stats->dup_seqs_groups + start,
+               stats->dup_seqs_groups_offset[i+1] - start);
+  }
+  printf("Gap proportion: %.6f\n", stats->gap_prop);
+  print_list("Gap sequences", stats->gap_seqs, stats->gap_seqs_count);
+  print_list("Gap columns", stats->gap_cols, stats->gap_cols_count);
+  printf("Invariant proportion: %.6f\n", stats->inv_prop);
+  print_list("Invariant columns", stats->inv_cols, stats->inv_cols_count);
+  printf("Frequencies:");
+  for (i = 0; i < stats->states; ++i)
+    printf(" %.6f", stats->freqs[i]);
+  printf("\n");
+}
+
+static int same_list(const unsigned long * a,
+                     const unsigned long * b,
+                     unsigned long count)
+{
+  return !count || !memcmp(a, b, count * sizeof(unsigned long));
+}
+
+static int same_stats(const pllmod_msa_stats_t * a,
+                      const pllmod_msa_stats_t * b)
+{
+  unsigned int i;
+
+  if (a->dup_taxa_pairs_count != b->dup_taxa_pairs_count ||
+      a->dup_seqs_pairs_count != b->dup_seqs_pairs_count ||
+      a->dup_seqs_groups_count != b->dup_seqs_groups_count ||
+      a->gap_seqs_count != b->gap_seqs_count ||
+      a->gap_cols_count != b->gap_cols_count ||
+      a->inv_cols_count != b->inv_cols_count ||
+      a->gap_prop != b->gap_prop || a->inv_prop != b->inv_prop)
+    return 0;
+
+  if (!same_list(a->dup_taxa_pairs, b->dup_taxa_pairs,
+                 2 * a->dup_taxa_pairs_count) ||
+      !same_list(a->dup_seqs_pairs, b->dup_seqs_pairs,
+                 2 * a->dup_seqs_pairs_count) ||
+      !same_list(a->gap_seqs, b->gap_seqs, a->gap_seqs_count) ||
+      !same_list(a->gap_cols, b->gap_cols, a->gap_cols_count) ||
+      !same_list(a->inv_cols, b->inv_cols, a->inv_cols_count))
+    return 0;
+
+  if (a->dup_seqs_groups_count &&
+      (!same_list(a->dup_seqs_groups_offset, b->dup_seqs_groups_offset,
+                  a->dup_seqs_groups_count + 1) ||
+       !same_list(a->dup_seqs_groups, b->dup_seqs_groups,
+                  a->dup_seqs_groups_offset[a->dup_seqs_groups_count])))
+    return 0;
+
+  for (i = 0; i < a->states; ++i)
+    if (a->freqs[i] != b->freqs[i])
+      return 0;
+
+  for (i = 0; i < 6; ++i)
+    if (a->subst_rates[i] != b->subst_rates[i])
+      return 0;
+
+  return 1;
+}
+
+/* statistics from blocks of columns of increasing size */
+static pllmod_msa_stats_t * stream_stats(const pll_msa_t * msa,
+                                         const unsigned int * site_weights)
+{
+  unsigned int i, b;
+  unsigned long start = 0;
+  const char * block[N_TAXA];
+  pllmod_msa_stats_t * stats;
+
+  pllmod_msa_stats_stream_t * stream =
+      pllmod_msa_stats_stream_create(N_TAXA, msa->label, N_STATES, pll_map_nt,
+                                     PLLMOD_MSA_STATS_ALL);
+  if (!stream)
+    fatal("Cannot create statistics stream: %s", pll_errmsg);
+
+  for (b = 0; b < N_BLOCKS; ++b)
+  {
+    for (i = 0; i < N_TAXA; ++i)
+      block[i] = msa->sequence[i] + start;
+
+    if (!pllmod_msa_stats_stream_update(stream, block, block_len[b],
+                                        site_weights ? site_weights + start :
+                                                       NULL))
+      fatal("Cannot update statistics: %s", pll_errmsg);
+
+    start += block_len[b];
+  }
+
+  stats = pllmod_msa_stats_stream_finalize(stream);
+  if (!stats)
+    fatal("Cannot finalize statistics: %s", pll_errmsg);
+
+  printf("Update after finalize: %s\n",
+         pllmod_msa_stats_stream_update(stream, block, 1, NULL) ?
+         "accepted" : "rejected");
+
+  pllmod_msa_stats_stream_destroy(stream);
+
+  return stats;
+}
+
+void test_stats(const pll_msa_t * msa, const unsigned int * site_weights)
+{
+  pllmod_msa_stats_t * stats = pllmod_msa_compute_stats(msa, N_STATES,
+                                                        pll_map_nt,
+                                                        site_weights,
+                                                        PLLMOD_MSA_STATS_ALL);
+  if (!stats)
+    fatal("Cannot compute statistics: %s", pll_errmsg);
+
+  print_stats(stats);
+
+  pllmod_msa_stats_t * streamed = stream_stats(msa, site_weights);
+  printf("Streamed statistics: %s\n",
+         same_stats(stats, streamed) ? "same" : "different");
+
+  pllmod_msa_destroy_stats(streamed);
+  pllmod_msa_destroy_stats(stats);
+}
+
+void test_wide_stats(const pll_msa_t * msa)
+{
+  unsigned int i;
+  int same_freqs = 1;
+  pll_msa_t * wide_msa = create_wide_msa();
+
+  pllmod_msa_stats_t * stats = pllmod_msa_compute_stats(msa, N_STATES,
+                                                        pll_map_nt, NULL,
+                                                        PLLMOD_MSA_STATS_ALL);
+  pllmod_msa_stats_t * wide_stats =
+      pllmod_msa_compute_stats(wide_msa, N_STATES, pll_map_nt, NULL,
+                               PLLMOD_MSA_STATS_ALL);
+  if (!stats || !wide_stats)
+    fatal("Cannot compute statistics: %s", pll_errmsg);
+
+  for (i = 0; i < N_STATES; ++i)
+    if (fabs(stats->freqs[i] - wide_stats->freqs[i]) > 1e-12)
+      same_freqs = 0;
+
+  printf("Sites: %d\n", wide_msa->length);
+  print_pairs("Duplicate sequences", wide_stats->dup_seqs_pairs,
+              wide_stats->dup_seqs_pairs_count);
+  printf("Gap proportion: %.6f\n", wide_stats->gap_prop);
+  printf("Gap columns: %lu, last: %lu\n", wide_stats->gap_cols_count,
+         wide_stats->gap_cols[wide_stats->gap_cols_count - 1]);
+  printf("Invariant proportion: %.6f\n", wide_stats->inv_prop);
+  printf("Invariant columns: %lu, last: %lu\n", wide_stats->inv_cols_count,
+         wide_stats->inv_cols[wide_stats->inv_cols_count - 1]);
+  printf("Same frequencies as one copy: %s\n", same_freqs ? "yes" : "no");
+
+  pllmod_msa_destroy_stats(wide_stats);
+  pllmod_msa_destroy_stats(stats);
+
+  /* the first invalid character in row-major order is reported, although
+     the one in the third sequence is in an earlier tile */
+  wide_msa->sequence[2][2100] = '!';
+  wide_msa->sequence[0][4500] = '!';
+  printf("Invalid characters: %s (%s)\n",
+         pllmod_msa_compute_stats(wide_msa, N_STATES, pll_map_nt, NULL,
+                                  PLLMOD_MSA_STATS_ALL) ?
+         "accepted" : "rejected", pll_errmsg);
+
+  pll_msa_destroy(wide_msa);
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  pll_msa_t * msa = create_msa(seqs);
+
+  printf("Testing MSA statistics:\n\n");
+  test_stats(msa, NULL);
+
+  printf("\nTesting weighted MSA statistics:\n\n");
+  test_stats(msa, weights);
+
+  printf("\nTesting MSA statistics over several tiles:\n\n");
+  test_wide_stats(msa);
+
+  pll_msa_destroy(msa);
+
+  return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_tree.h"
+#include "../common.h"
+
+#define TREE1 "((A:0.1,B:0.2):0.3,(C:0.4,D:0.5):0.6,((E:0.7,F:0.8):0.9,(G:1.0,H:1.1):1.2):1.3);"
+#define TREE2 "(A,B,(C,D));"
+
+#define RANDOM_TAXA 8
+#define RANDOM_SEED 42
+
+static const char * tip_names[RANDOM_TAXA] = {
+  "A", "B", "C", "D", "E", "F", "G", "H"
+};
+
+static void print_tree_info(const char * name, pll_utree_t * tree)
+{
+  printf("%s: tips %u, inner %u, edges %u, binary %d, integrity %s\n",
+         name, tree->tip_count, tree->inner_count, tree->edge_count,
+         tree->binary, pll_utree_check_integrity(tree) ? "OK" : "FAILED");
+}
+
+void test_clone(pllmod_utree_arena_t * arena, pll_utree_t * tree)
+{
+  unsigned int i;
+  unsigned int node_count = tree->tip_count + tree->inner_count;
+  unsigned int same_order = 1;
+
+  pll_utree_t * clone = pllmod_utree_arena_clone(arena, tree);
+  if (!clone)
+    fatal("Cannot clone tree: %s", pll_errmsg);
+
+  print_tree_info("Clone", clone);
+
+  /* the node array keeps the order of the original tree */
+  for (i = 0; i < node_count; ++i)
+  {
+    if (clone->nodes[i]->node_index != tree->nodes[i]->node_index ||
+        clone->nodes[i]->clv_index != tree->nodes[i]->clv_index ||
+        clone->nodes[i]->length != tree->nodes[i]->length)
+      same_order = 0;
+  }
+  printf("Same node order: %s\n", same_order ? "yes" : "no");
+
+  char * newick = pll_utree_export_newick(tree->vroot, NULL);
+  char * clone_newick = pll_utree_export_newick(clone->vroot, NULL);
+  printf("Same newick: %s\n", strcmp(newick, clone_newick) ? "no" : "yes");
+  printf("RF to original: %u\n",
+         pllmod_utree_rf_distance(tree->vroot, clone->vroot, tree->tip_count));
+  free(newick);
+  free(clone_newick);
+}
+
+void test_build(pllmod_utree_arena_t * arena)
+{
+  unsigned int i;
+  pll_unode_t * tips[4];
+  pll_unode_t * inner[2];
+
+  /* ((A,B),(C,D)) built node by node */
+  for (i = 0; i < 4; ++i)
+  {
+    tips[i] = pllmod_utree_arena_create_tip(arena, i, tip_names[i], NULL);
+    if (!tips[i])
+      fatal("Cannot create tip: %s", pll_errmsg);
+    tips[i]->node_index = i;
+    tips[i]->pmatrix_index = i;
+  }
+
+  for (i = 0; i < 2; ++i)
+  {
+    inner[i] = pllmod_utree_arena_create_node(arena, 4 + i, (int) i,
+                                              NULL, NULL);
+    if (!inner[i])
+      fatal("Cannot create inner node: %s", pll_errmsg);
+    inner[i]->node_index = 4 + 3 * i;
+    inner[i]->next->node_index = 5 + 3 * i;
+    inner[i]->next->next->node_index = 6 + 3 * i;
+  }
+
+  printf("Inner node ring adjacent: %s\n",
+         inner[0]->next == inner[0] + 1 &&
+         inner[0]->next->next == inner[0] + 2 ? "yes" : "no");
+
+  pllmod_utree_connect_nodes(tips[0], inner[0], 0.1);
+  pllmod_utree_connect_nodes(tips[1], inner[0]->next, 0.1);
+  pllmod_utree_connect_nodes(inner[0]->next->next, inner[1], 0.1);
+  pllmod_utree_connect_nodes(tips[2], inner[1]->next, 0.1);
+  pllmod_utree_connect_nodes(tips[3], inner[1]->next->next, 0.1);
+
+  pll_utree_t * tree = pllmod_utree_arena_wraptree(arena, inner[0], 4);
+  if (!tree)
+    fatal("Cannot wrap tree: %s", pll_errmsg);
+
+  print_tree_info("Built tree", tree);
+
+  pll_utree_t * parsed = pll_utree_parse_newick_string(TREE2);
+  pllmod_utree_consistency_set(tree, parsed);
+  printf("RF to %s: %u\n", TREE2,
+         pllmod_utree_rf_distance(tree->vroot, parsed->vroot, 4));
+  pll_utree_destroy(parsed, NULL);
+}
+
+void test_random(pllmod_utree_arena_t * arena)
+{
+  pll_utree_t * tree = pllmod_utree_arena_create_random(arena, RANDOM_TAXA,
+                                                        tip_names, RANDOM_SEED);
+  if (!tree)
+    fatal("Cannot create random tree: %s", pll_errmsg);
+
+  print_tree_info("Random tree", tree);
+
+  /* same seed, same topology as the heap version */
+  pll_utree_t * heap_tree = pllmod_utree_create_random(RANDOM_TAXA, tip_names,
+                                                       RANDOM_SEED);
+  printf("RF to heap tree: %u\n",
+         pllmod_utree_rf_distance(tree->vroot, heap_tree->vroot, RANDOM_TAXA));
+  pll_utree_destroy(heap_tree, NULL);
+}
+
+int main (int argc, char * argv[])
+{
+  size_t total_size;
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  pll_utree_t * tree = pll_utree_parse_newick_string(TREE1);
+  if (!tree)
+    fatal("Cannot parse tree: %s", pll_errmsg);
+
+  pllmod_utree_arena_t * arena = pllmod_utree_arena_create(tree->tip_count);
+  if (!arena)
+    fatal("Cannot create arena: %s", pll_errmsg);
+
+  printf("Testing arena clone:\n\n");
+  test_clone(arena, tree);
+
+  printf("\nTesting arena nodes:\n\n");
+  test_build(arena);
+
+  printf("\nTesting arena random tree:\n\n");
+  test_random(arena);
+
+  /* the merged block holds the same trees again without growing */
+  if (!pllmod_utree_arena_reset(arena))
+    fatal("Cannot reset arena: %s", pll_errmsg);
+  total_size = arena->total_size;
+
+  printf("\nTesting arena reset:\n\n");
+  test_clone(arena, tree);
+  test_build(arena);
+  test_random(arena);
+  printf("Arena grown after reset: %s\n",
+         arena->total_size == total_size ? "no" : "yes");
+
+  pllmod_utree_arena_destroy(arena);
+  pll_utree_destroy(tree, NULL);
+
+  return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_tree.h"
+#include "../common.h"
+
+#include <assert.h>
+
+#define TREE1  "((A,B),(C,D),((E,F),(G,H)));"
+#define TREE1B "((H,G),(F,E),((D,C),(B,A)));"
+#define TREE2  "((A,C),(B,D),((E,F),(G,H)));"
+
+#define FP_SEED 12345
+
+/* collects the edges of the subtree below `node` */
+static void collect_edges(pll_unode_t * node,
+                          pll_unode_t ** edges,
+                          unsigned int * count)
+{
+  edges[(*count)++] = node;
+  if (!pllmod_utree_is_tip(node))
+  {
+    collect_edges(node->next->back, edges, count);
+    collect_edges(node->next->next->back, edges, count);
+  }
+}
+
+static unsigned int check_traversal(pll_utree_t * tree,
+                                    pllmod_utree_traversal_t * traversal)
+{
+  unsigned int i;
+  unsigned int node_count = traversal->node_count;
+  unsigned int errors = 0;
+  char * seen = (char *) calloc(tree->tip_count + 3 * tree->inner_count, 1);
+
+  /* every inner node comes after its two children in post-order... */
+  for (i = 0; i < node_count; ++i)
+  {
+    pll_unode_t * node = traversal->postorder[i];
+    seen[node->node_index] = 1;
+    if (!pllmod_utree_is_tip(node) &&
+        (!seen[node->next->back->node_index] ||
+         !seen[node->next->next->back->node_index]))
+      ++errors;
+  }
+
+  /* ...and before them in pre-order */
+  memset(seen, 0, tree->tip_count + 3 * tree->inner_count);
+  for (i = 0; i < node_count; ++i)
+  {
+    pll_unode_t * node = traversal->preorder[i];
+    seen[node->node_index] = 1;
+    if (!pllmod_utree_is_tip(node) &&
+        (seen[node->next->back->node_index] ||
+         seen[node->next->next->back->node_index]))
+      ++errors;
+  }
+
+  free(seen);
+  return errors;
+}
+
+void test_traversal(pll_utree_t * tree)
+{
+  pllmod_utree_traversal_t * traversal =
+      pllmod_utree_traversal_create(2 * tree->tip_count - 2);
+
+  if (!pllmod_utree_traversal_update(traversal, tree->vroot))
+    fatal("Cannot update traversal: %s", pll_errmsg);
+
+  printf("Traversal nodes: %u, order errors: %u\n",
+         traversal->node_count, check_traversal(tree, traversal));
+
+  pllmod_utree_traversal_invalidate(traversal);
+  if (!pllmod_utree_traversal_update(traversal, tree->vroot->next))
+    fatal("Cannot update traversal: %s", pll_errmsg);
+
+  printf("Traversal nodes: %u, order errors: %u\n",
+         traversal->node_count, check_traversal(tree, traversal));
+
+  pllmod_utree_traversal_destroy(traversal);
+}
+
+void test_fingerprint(pll_utree_t * tree1,
+                      pll_utree_t * tree1b,
+                      pll_utree_t * tree2)
+{
+  unsigned int tip_count = tree1->tip_count;
+  pllmod_utree_fingerprint_t * fp =
+      pllmod_utree_fingerprint_create(tip_count, FP_SEED);
+
+  pllmod_fingerprint_t fp1 = pllmod_utree_fingerprint_compute(fp,
+                                                              tree1->vroot);
+  pllmod_fingerprint_t fp1b = pllmod_utree_fingerprint_compute(fp,
+                                                               tree1b->vroot);
+  pllmod_fingerprint_t fp1r = pllmod_utree_fingerprint_compute(fp,
+                                       tree1->nodes[tree1->tip_count + 1]);
+  pllmod_fingerprint_t fp2 = pllmod_utree_fingerprint_compute(fp,
+                                                              tree2->vroot);
+
+  printf("Same topology, different layout: %s\n",
+         fp1 == fp1b ? "equal" : "different");
+  printf("Same topology, different root: %s\n",
+         fp1 == fp1r ? "equal" : "different");
+  printf("Different topology: %s\n", fp1 == fp2 ? "equal" : "different");
+
+  pllmod_utree_fingerprint_destroy(fp);
+}
+
+void test_spr_neighborhood(pll_utree_t * tree)
+{
+  unsigned int i, j;
+  unsigned int tip_count = tree->tip_count;
+  unsigned int inner_count = tree->inner_count;
+  unsigned int edge_count, move_count = 0, mismatches = 0;
+  unsigned int neighbor_count = 0;
+  pll_unode_t ** edges;
+  pllmod_fingerprint_t * neighbors;
+  pll_tree_rollback_t rollback_info;
+  pllmod_utree_fingerprint_t * fp =
+      pllmod_utree_fingerprint_create(tip_count, FP_SEED);
+
+  edges = (pll_unode_t **) malloc(4 * tip_count * sizeof(pll_unode_t *));
+  neighbors = (pllmod_fingerprint_t *) malloc(
+      3 * inner_count * 4 * tip_count * sizeof(pllmod_fingerprint_t));
+
+  for (i = 0; i < inner_count; ++i)
+  {
+    pll_unode_t * node = tree->nodes[tip_count + i];
+    pll_unode_t * p_edge = node;
+
+    do
+    {
+      pllmod_fingerprint_t tree_fp;
+      pllmod_fingerprint_t spr_fp[4 * tip_count];
+
+      /* the whole tree is the neighborhood */
+      pllmod_utree_fingerprint_compute(fp, node);
+      tree_fp = pllmod_utree_fingerprint_spr(fp, p_edge, tip_count);
+
+      /* all the edges outside the pruned subtree */
+      edge_count = 0;
+      collect_edges(p_edge->next->back, edges, &edge_count);
+      collect_edges(p_edge->next->next->back, edges, &edge_count);
+
+      for (j = 0; j < edge_count; ++j)
+        spr_fp[j] = fp->spr_fp[edges[j]->node_index];
+
+      for (j = 0; j < edge_count; ++j)
+      {
+        pll_unode_t * r_edge = edges[j];
+
+        /* re-inserting into the merged branch gives the same tree */
+        if (r_edge == p_edge->next->back || r_edge == p_edge->next->next->back)
+        {
+          if (spr_fp[j] != tree_fp)
+            ++mismatches;
+          continue;
+        }
+
+        if (!pllmod_utree_spr(p_edge, r_edge, &rollback_info))
+          fatal("Cannot apply SPR: %s", pll_errmsg);
+
+        if (pllmod_utree_fingerprint_compute(fp, node) != spr_fp[j])
+          ++mismatches;
+        neighbors[neighbor_count++] = spr_fp[j];
+        ++move_count;
+
+        if (!pllmod_tree_rollback(&rollback_info))
+          fatal("Cannot undo SPR: %s", pll_errmsg);
+      }
+
+      if (pllmod_utree_fingerprint_compute(fp, node) != tree_fp)
+        fatal("Tree was not restored");
+
+      p_edge = p_edge->next;
+    }
+    while (p_edge != node);
+  }
+
+  /* count distinct neighbors */
+  unsigned int distinct = 0;
+  for (i = 0; i < neighbor_count; ++i)
+  {
+    for (j = 0; j < i && neighbors[j] != neighbors[i]; ++j);
+    if (j == i)
+      ++distinct;
+  }
+
+  printf("SPR moves: %u, fingerprint mismatches: %u\n",
+         move_count, mismatches);
+  printf("Distinct SPR neighbors: %u (expected %u)\n",
+         distinct, 2 * (tip_count - 3) * (2 * tip_count - 7));
+
+  free(edges);
+  free(neighbors);
+  pllmod_utree_fingerprint_destroy(fp);
+}
+
+void test_topology_cache()
+{
+  double loglh = 0;
+  int found;
+
+  /* capacity is rounded up to 4 slots */
+  pllmod_topology_cache_t * cache = pllmod_topology_cache_create(3, 2);
+  if (!cache)
+    fatal("Cannot create topology cache: %s", pll_errmsg);
+
+  printf("Capacity: %u\n", cache->capacity);
+
+  pllmod_topology_cache_insert(cache, 0x10, -100.5);
+  pllmod_topology_cache_insert(cache, 0x11, -200.5);
+
+  found = pllmod_topology_cache_lookup(cache, 0x10, &loglh);
+  printf("Lookup 0x10: %d %.2f\n", found, loglh);
+
+  /* same slot as 0x10 */
+  pllmod_topology_cache_insert(cache, 0x20, -300.5);
+  found = pllmod_topology_cache_lookup(cache, 0x10, NULL);
+  printf("Lookup 0x10 after replacement: %d\n", found);
+
+  pllmod_topology_cache_next_generation(cache);
+  found = pllmod_topology_cache_lookup(cache, 0x11, &loglh);
+  printf("Lookup 0x11 after 1 generation: %d %.2f\n", found, loglh);
+
+  pllmod_topology_cache_next_generation(cache);
+  found = pllmod_topology_cache_lookup(cache, 0x11, NULL);
+  printf("Lookup 0x11 after 2 generations: %d\n", found);
+
+  printf("Lookups: %lu, hits: %lu\n", cache->lookups, cache->hits);
+
+  /* clearing also resets the statistics */
+  pllmod_topology_cache_insert(cache, 0x11, -400.5);
+  pllmod_topology_cache_clear(cache);
+  found = pllmod_topology_cache_lookup(cache, 0x11, NULL);
+  printf("Lookup 0x11 after clear: %d\n", found);
+
+  printf("Lookups: %lu, hits: %lu\n", cache->lookups, cache->hits);
+
+  pllmod_topology_cache_destroy(cache);
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  pll_utree_t * tree1  = pll_utree_parse_newick_string(TREE1);
+  pll_utree_t * tree1b = pll_utree_parse_newick_string(TREE1B);
+  pll_utree_t * tree2  = pll_utree_parse_newick_string(TREE2);
+
+  pllmod_utree_consistency_set(tree1, tree1b);
+  pllmod_utree_consistency_set(tree1, tree2);
+
+  printf("Testing traversal:\n\n");
+  test_traversal(tree1);
+
+  printf("\nTesting fingerprints:\n\n");
+  test_fingerprint(tree1, tree1b, tree2);
+
+  printf("\nTesting SPR fingerprints:\n\n");
+  test_spr_neighborhood(tree1);
+
+  printf("\nTesting topology cache:\n\n");
+  test_topology_cache();
+
+  pll_utree_destroy(tree1, NULL);
+  pll_utree_destroy(tree1b, NULL);
+  pll_utree_destroy(tree2, NULL);
+
+  return 0;
+}
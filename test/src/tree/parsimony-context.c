@@ -0,0 +1,130 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_tree.h"
+#include "../common.h"
+
+#define N_TAXA 6
+#define N_SITES 12
+#define N_STATES 4
+#define N_TREES 3
+
+static char * names[N_TAXA] = { "A", "B", "C", "D", "E", "F" };
+
+static char * seqs[N_TAXA] = {
+  "CTAGATGGCCAG",
+  "CTAGATGTAGAG",
+  "AGCAATGGCGAC",
+  "AGCAATGTCGTC",
+  "AGAGCCATAGAC",
+  "AGAGCCATCGTC"
+};
+
+/* the stepwise addition order depends on the random number generator of
+   libpll, so only properties that do not depend on it are printed */
+
+/* RF distance between two trees built from the same context, which share
+   the tip indices */
+static unsigned int rf_distance(const pll_utree_t * t1, const pll_utree_t * t2)
+{
+  return pllmod_utree_rf_distance(t1->vroot, t2->vroot, N_TAXA);
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int score;
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  pll_partition_t * partition = pll_partition_create(N_TAXA,
+                                                     N_TAXA - 2,
+                                                     N_STATES,
+                                                     N_SITES,
+                                                     1,
+                                                     2 * N_TAXA - 3,
+                                                     1,
+                                                     N_TAXA - 2,
+                                                     attributes);
+  if (!partition)
+    fatal("Cannot create partition: %s", pll_errmsg);
+
+  for (i = 0; i < N_TAXA; ++i)
+    pll_set_tip_states(partition, i, pll_map_nt, seqs[i]);
+
+  pllmod_parsimony_context_t * context =
+      pllmod_utree_parsimony_context_create(N_TAXA, names, 1, &partition);
+  if (!context)
+    fatal("Cannot create parsimony context: %s", pll_errmsg);
+
+  printf("Testing parsimony context:\n\n");
+
+  /* several trees from one context */
+  unsigned int seeds[N_TREES] = { 1, 2, 3 };
+  unsigned int scores[N_TREES];
+  pll_utree_t * trees[N_TREES];
+
+  if (!pllmod_utree_parsimony_context_trees(context, seeds, N_TREES,
+                                            trees, scores))
+    fatal("Cannot build parsimony trees: %s", pll_errmsg);
+
+  for (i = 0; i < N_TREES; ++i)
+  {
+    printf("Tree %u: tips %u, integrity: %s\n", i, trees[i]->tip_count,
+           pll_utree_check_integrity(trees[i]) ? "OK" : "FAILED");
+  }
+
+  /* the context is not modified by building a tree */
+  pll_utree_t * tree = pllmod_utree_parsimony_context_tree(context, seeds[0],
+                                                           &score);
+  if (!tree)
+    fatal("Cannot build parsimony tree: %s", pll_errmsg);
+  printf("Same seed again: same score: %s, RF to tree 0: %u\n",
+         score == scores[0] ? "yes" : "no",
+         rf_distance(tree, trees[0]));
+  pll_utree_destroy(tree, NULL);
+
+  /* same tree as without a context */
+  tree = pllmod_utree_create_parsimony_multipart(N_TAXA, names, 1, &partition,
+                                                 seeds[0], &score);
+  if (!tree)
+    fatal("Cannot build parsimony tree: %s", pll_errmsg);
+  printf("Without context: same score: %s, RF to tree 0: %u\n",
+         score == scores[0] ? "yes" : "no",
+         rf_distance(tree, trees[0]));
+  pll_utree_destroy(tree, NULL);
+
+  printf("No seeds: %s\n",
+         pllmod_utree_parsimony_context_trees(context, NULL, N_TREES, trees,
+                                              scores) ?
+         "accepted" : "rejected");
+
+  for (i = 0; i < N_TREES; ++i)
+    pll_utree_destroy(trees[i], NULL);
+  pllmod_utree_parsimony_context_destroy(context);
+  pll_partition_destroy(partition);
+
+  return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_tree.h"
+#include "../common.h"
+
+#define N_TAXA 6
+#define N_SITES 12
+#define N_STATES 4
+#define N_TREES 3
+
+#define SPR_RADIUS 6
+#define RATCHET_ITERATIONS 5
+#define RAND_SEED 42
+
+/* the only tree without a better SPR neighbor is OPT_TREE (score 15) */
+#define OPT_TREE   "((A,B),(C,D),(E,F));"
+#define START_TREE "((A,C),(B,E),(D,F));"
+
+static char * names[N_TAXA] = { "A", "B", "C", "D", "E", "F" };
+
+static char * seqs[N_TAXA] = {
+  "CTAGATGGCCAG",
+  "CTAGATGTAGAG",
+  "AGCAATGGCGAC",
+  "AGCAATGTCGTC",
+  "AGAGCCATAGAC",
+  "AGAGCCATCGTC"
+};
+
+/* parses a tree and sets the tip CLV indices to the alignment rows */
+static pll_utree_t * parse_tree(const char * newick)
+{
+  unsigned int i, j;
+  pll_utree_t * tree = pll_utree_parse_newick_string(newick);
+
+  if (!tree)
+    fatal("Cannot parse tree %s", newick);
+
+  for (i = 0; i < tree->tip_count; ++i)
+  {
+    for (j = 0; j < N_TAXA && strcmp(tree->nodes[i]->label, names[j]); ++j);
+    if (j == N_TAXA)
+      fatal("Unknown taxon %s", tree->nodes[i]->label);
+    tree->nodes[i]->clv_index = tree->nodes[i]->node_index = j;
+  }
+
+  return tree;
+}
+
+static void print_score(pllmod_parsimony_context_t * context,
+                        const char * name,
+                        pll_utree_t * tree,
+                        unsigned int reported,
+                        pll_utree_t * opt_tree)
+{
+  unsigned int score;
+
+  pllmod_utree_consistency_set(opt_tree, tree);
+
+  if (!pllmod_utree_parsimony_score(context, tree, &score))
+    fatal("Cannot score tree: %s", pll_errmsg);
+
+  printf("%s: score %u, recomputed %u, RF to optimum %u\n", name, reported,
+         score, pllmod_utree_rf_distance(tree->vroot, opt_tree->vroot,
+                                         N_TAXA));
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int i;
+  unsigned int score;
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  pll_partition_t * partition = pll_partition_create(N_TAXA,
+                                                     N_TAXA - 2,
+                                                     N_STATES,
+                                                     N_SITES,
+                                                     1,
+                                                     2 * N_TAXA - 3,
+                                                     1,
+                                                     N_TAXA - 2,
+                                                     attributes);
+  if (!partition)
+    fatal("Cannot create partition: %s", pll_errmsg);
+
+  for (i = 0; i < N_TAXA; ++i)
+    pll_set_tip_states(partition, i, pll_map_nt, seqs[i]);
+
+  pllmod_parsimony_context_t * context =
+      pllmod_utree_parsimony_context_create(N_TAXA, names, 1, &partition);
+  if (!context)
+    fatal("Cannot create parsimony context: %s", pll_errmsg);
+
+  pll_utree_t * opt_tree = parse_tree(OPT_TREE);
+  pll_utree_t * start_tree = parse_tree(START_TREE);
+
+  printf("Testing parsimony score:\n\n");
+
+  if (!pllmod_utree_parsimony_score(context, opt_tree, &score))
+    fatal("Cannot score tree: %s", pll_errmsg);
+  printf("Score of %s: %u\n", OPT_TREE, score);
+
+  if (!pllmod_utree_parsimony_score(context, start_tree, &score))
+    fatal("Cannot score tree: %s", pll_errmsg);
+  printf("Score of %s: %u\n", START_TREE, score);
+
+  printf("\nTesting parsimony SPR:\n\n");
+
+  pll_utree_t * spr_tree = pll_utree_clone(start_tree);
+  printf("SPR radius 0: %s\n",
+         pllmod_utree_parsimony_spr(context, spr_tree, 0, &score) ?
+         "accepted" : "rejected");
+
+  if (!pllmod_utree_parsimony_spr(context, spr_tree, SPR_RADIUS, &score))
+    fatal("Cannot run parsimony SPR: %s", pll_errmsg);
+  print_score(context, "SPR", spr_tree, score, opt_tree);
+  printf("Integrity: %s\n",
+         pll_utree_check_integrity(spr_tree) ? "OK" : "FAILED");
+  pll_utree_destroy(spr_tree, NULL);
+
+  /* stepwise addition trees from one context */
+  unsigned int seeds[N_TREES] = { 1, 2, 3 };
+  unsigned int scores[N_TREES];
+  pll_utree_t * trees[N_TREES];
+
+  if (!pllmod_utree_parsimony_context_trees(context, seeds, N_TREES,
+                                            trees, scores))
+    fatal("Cannot build parsimony trees: %s", pll_errmsg);
+
+  for (i = 0; i < N_TREES; ++i)
+  {
+    if (!pllmod_utree_parsimony_score(context, trees[i], &score))
+      fatal("Cannot score tree: %s", pll_errmsg);
+    printf("Stepwise tree %u: score recomputed: %s\n", i,
+           score == scores[i] ? "same" : "different");
+
+    if (!pllmod_utree_parsimony_spr(context, trees[i], SPR_RADIUS, &score))
+      fatal("Cannot run parsimony SPR: %s", pll_errmsg);
+    print_score(context, "  SPR", trees[i], score, opt_tree);
+    pll_utree_destroy(trees[i], NULL);
+  }
+
+  printf("\nTesting parsimony ratchet:\n\n");
+
+  pll_utree_t * ratchet_tree = pllmod_utree_parsimony_ratchet(context,
+                                                              start_tree,
+                                                              RATCHET_ITERATIONS,
+                                                              SPR_RADIUS,
+                                                              RAND_SEED,
+                                                              &score);
+  if (!ratchet_tree)
+    fatal("Cannot run parsimony ratchet: %s", pll_errmsg);
+  print_score(context, "Ratchet", ratchet_tree, score, opt_tree);
+
+  /* the starting tree is not modified */
+  if (!pllmod_utree_parsimony_score(context, start_tree, &score))
+    fatal("Cannot score tree: %s", pll_errmsg);
+  printf("Starting tree score: %u\n", score);
+
+  pll_utree_destroy(ratchet_tree, NULL);
+  pll_utree_destroy(start_tree, NULL);
+  pll_utree_destroy(opt_tree, NULL);
+  pllmod_utree_parsimony_context_destroy(context);
+  pll_partition_destroy(partition);
+
+  return 0;
+}
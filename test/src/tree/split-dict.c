@@ -0,0 +1,271 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_tree.h"
+#include "../common.h"
+
+#include <assert.h>
+#include <math.h>
+
+#define TREE_COUNT 3
+
+/* trees on taxa A..H, with 5 distinct splits in every pair */
+static char * tree_str[TREE_COUNT] = {
+  "((A:0.1,B:0.1):0.1,(C:0.1,D:0.1):0.1,((E:0.1,F:0.1):0.1,(G:0.1,H:0.1):0.1):0.1);",
+  "((A:0.2,C:0.2):0.2,(B:0.2,D:0.2):0.2,((E:0.2,F:0.2):0.2,(G:0.2,H:0.2):0.2):0.2);",
+  "((A:0.1,B:0.1):0.3,(C:0.1,(D:0.1,E:0.1):0.3):0.3,(F:0.1,(G:0.1,H:0.1):0.3):0.3);"
+};
+
+static const char * distance_name[4] = { "RF", "WRF", "KF", "INFO_RF" };
+
+static int cmp_support_desc(const void * a, const void * b)
+{
+  double x = *((const double *) a);
+  double y = *((const double *) b);
+  return (x < y) - (x > y);
+}
+
+static unsigned int tip_index(pll_utree_t * tree, const char * label)
+{
+  unsigned int i;
+  for (i = 0; i < tree->tip_count; ++i)
+    if (!strcmp(tree->nodes[i]->label, label))
+      return tree->nodes[i]->node_index;
+
+  fatal("Tip %s not found", label);
+}
+
+void test_dictionary(pll_utree_t ** trees)
+{
+  unsigned int i;
+  unsigned int tip_count = trees[0]->tip_count;
+  unsigned int split_count;
+  unsigned int * ids[TREE_COUNT];
+
+  pll_split_dict_t * dict = pllmod_utree_split_dict_create(tip_count, 0);
+  if (!dict)
+    fatal("Cannot create split dictionary: %s", pll_errmsg);
+
+  for (i = 0; i < TREE_COUNT; ++i)
+  {
+    ids[i] = pllmod_utree_split_dict_add_tree(dict, trees[i]->vroot,
+                                              &split_count);
+    if (!ids[i])
+      fatal("Cannot add tree %u: %s", i, pll_errmsg);
+  }
+
+  printf("Distinct splits: %u, trees: %u\n",
+         dict->split_count, dict->tree_count);
+
+  /* majority-rule consensus from the split frequencies */
+  pll_split_system_t * consensus = pllmod_utree_split_dict_consensus(dict, 0.5);
+  if (!consensus)
+    fatal("Cannot build consensus: %s", pll_errmsg);
+
+  qsort(consensus->support, consensus->split_count, sizeof(double),
+        cmp_support_desc);
+  printf("\nConsensus splits: %u\n", consensus->split_count);
+  printf("Support:");
+  for (i = 0; i < consensus->split_count; ++i)
+    printf(" %.6f", consensus->support[i]);
+  printf("\n");
+  pllmod_utree_split_system_destroy(consensus);
+
+  /* single split lookup and insertion */
+  unsigned int ah[2];
+  ah[0] = tip_index(trees[0], "A");
+  ah[1] = tip_index(trees[0], "H");
+  pll_split_t split = pllmod_utree_split_from_tips(ah, 2, tip_count);
+
+  printf("\nSplit AH lookup: %s\n",
+         pllmod_utree_split_dict_lookup(dict, split) == HASH_KEY_UNDEF ?
+         "not found" : "found");
+  unsigned int split_id = pllmod_utree_split_dict_insert(dict, split);
+  printf("Split AH id: %u, lookup: %u, same split: %s\n",
+         split_id,
+         pllmod_utree_split_dict_lookup(dict, split),
+         memcmp(pllmod_utree_split_dict_get(dict, split_id), split,
+                sizeof(pll_split_base_t)) ? "no" : "yes");
+  free(split);
+
+  /* serialization keeps ids and frequencies */
+  size_t size;
+  void * buffer = pllmod_utree_split_dict_serialize(dict, &size);
+  pll_split_dict_t * copy = pllmod_utree_split_dict_deserialize(buffer, size);
+  if (!copy)
+    fatal("Cannot deserialize dictionary: %s", pll_errmsg);
+
+  unsigned int ids_ok = 1;
+  for (i = 0; i < dict->split_count; ++i)
+  {
+    if (pllmod_utree_split_dict_lookup(copy,
+                                       pllmod_utree_split_dict_get(dict, i)) != i ||
+        copy->frequency[i] != dict->frequency[i])
+      ids_ok = 0;
+  }
+  printf("Deserialized splits: %u, trees: %u, ids preserved: %s\n",
+         copy->split_count, copy->tree_count, ids_ok ? "yes" : "no");
+
+  free(buffer);
+  pllmod_utree_split_dict_destroy(copy);
+
+  for (i = 0; i < TREE_COUNT; ++i)
+    free(ids[i]);
+  pllmod_utree_split_dict_destroy(dict);
+}
+
+void test_split_ids(pll_utree_t ** trees)
+{
+  unsigned int i, j;
+  unsigned int tip_count = trees[0]->tip_count;
+  unsigned int split_count;
+  unsigned int * ids[TREE_COUNT];
+
+  pll_split_dict_t * dict = pllmod_utree_split_dict_create(tip_count, 0);
+
+  /* one tree through every entry point */
+  ids[0] = pllmod_utree_split_dict_add_tree(dict, trees[0]->vroot,
+                                            &split_count);
+
+  pll_split_t * splits = pllmod_utree_split_create(trees[1]->vroot, tip_count,
+                                                   NULL);
+  ids[1] = pllmod_utree_split_dict_add_splits(dict, splits, tip_count - 3);
+  pllmod_utree_split_destroy(splits);
+
+  unsigned int * tip_rank = (unsigned int *) malloc(tip_count *
+                                                    sizeof(unsigned int));
+  pllmod_utree_split_tip_ranks(trees[0]->vroot, tip_count, tip_rank);
+  pll_compact_split_set_t * set =
+      pllmod_utree_compact_split_create(trees[2]->vroot, tip_count, tip_rank,
+                                        NULL);
+  ids[2] = pllmod_utree_split_dict_add_compact(dict, set);
+  pllmod_utree_compact_split_destroy(set);
+  free(tip_rank);
+
+  if (!ids[0] || !ids[1] || !ids[2])
+    fatal("Cannot add trees: %s", pll_errmsg);
+
+  printf("Distinct splits: %u, trees: %u\n",
+         dict->split_count, dict->tree_count);
+
+  for (i = 0; i < TREE_COUNT; ++i)
+  {
+    for (j = i + 1; j < TREE_COUNT; ++j)
+    {
+      printf("Trees %u-%u: common splits: %u, RF: %u\n", i, j,
+             pllmod_utree_split_ids_intersect(ids[i], split_count,
+                                              ids[j], split_count, NULL),
+             pllmod_utree_split_ids_rf_distance(ids[i], split_count,
+                                                ids[j], split_count));
+    }
+  }
+
+  for (i = 0; i < TREE_COUNT; ++i)
+    free(ids[i]);
+  pllmod_utree_split_dict_destroy(dict);
+}
+
+void test_distances(pll_utree_t ** trees)
+{
+  unsigned int i, j;
+  unsigned int tip_count = trees[0]->tip_count;
+  pll_split_dict_tree_t * dict_trees[TREE_COUNT];
+  double matrix[TREE_COUNT * TREE_COUNT];
+  int d;
+
+  pll_split_dict_t * dict = pllmod_utree_split_dict_create(tip_count, 0);
+  if (!dict)
+    fatal("Cannot create split dictionary: %s", pll_errmsg);
+
+  for (i = 0; i < TREE_COUNT; ++i)
+  {
+    dict_trees[i] = pllmod_utree_split_dict_tree_create(dict, trees[i]->vroot);
+    if (!dict_trees[i])
+      fatal("Cannot add tree %u: %s", i, pll_errmsg);
+  }
+
+  /* the matrix must match the pairwise distances */
+  for (d = PLLMOD_TREE_DISTANCE_RF; d <= PLLMOD_TREE_DISTANCE_INFO_RF; ++d)
+  {
+    unsigned int mismatches = 0;
+
+    if (!pllmod_utree_split_dict_distance_matrix(dict, dict_trees, TREE_COUNT,
+                                                 d, matrix))
+      fatal("Cannot compute distance matrix: %s", pll_errmsg);
+
+    printf("%s distance matrix:\n", distance_name[d]);
+    for (i = 0; i < TREE_COUNT; ++i)
+    {
+      for (j = 0; j < TREE_COUNT; ++j)
+      {
+        double dist = pllmod_utree_split_dict_distance(dict, dict_trees[i],
+                                                       dict_trees[j], d);
+        if (fabs(dist - matrix[i * TREE_COUNT + j]) > 1e-9)
+          ++mismatches;
+        printf(" %10.6f", matrix[i * TREE_COUNT + j]);
+      }
+      printf("\n");
+    }
+    printf("Pairwise mismatches: %u\n\n", mismatches);
+  }
+
+  for (i = 0; i < TREE_COUNT; ++i)
+    pllmod_utree_split_dict_tree_destroy(dict_trees[i]);
+  pllmod_utree_split_dict_destroy(dict);
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int i;
+  pll_utree_t * trees[TREE_COUNT];
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  for (i = 0; i < TREE_COUNT; ++i)
+  {
+    trees[i] = pll_utree_parse_newick_string(tree_str[i]);
+    if (!trees[i])
+      fatal("Cannot parse tree %u", i);
+    if (i)
+      pllmod_utree_consistency_set(trees[0], trees[i]);
+  }
+
+  printf("Testing split dictionary:\n\n");
+
+  test_dictionary(trees);
+
+  printf("\nTesting split ids:\n\n");
+
+  test_split_ids(trees);
+
+  printf("\nTesting split dictionary distances:\n\n");
+
+  test_distances(trees);
+
+  for (i = 0; i < TREE_COUNT; ++i)
+    pll_utree_destroy(trees[i], NULL);
+
+  return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ Copyright (C) 2026 Alexey Kozlov
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ Contact: Alexey Kozlov <Alexey.Kozlov@h-its.org>,
+ Exelixis Lab, Heidelberg Instutute for Theoretical Studies
+ Schloss-Wolfsbrunnenweg 35, D-69118 Heidelberg, Germany
+ */
+
+#include "pll_tree.h"
+#include "../common.h"
+
+#include <assert.h>
+
+/* trees on taxa A..H */
+#define TREE1  "((A,B),(C,D),((E,F),(G,H)));"
+#define TREE1B "((H,G),(F,E),((D,C),(B,A)));"
+#define TREE2  "((A,C),(B,D),((E,F),(G,H)));"
+#define TREE3  "((A,B),(C,(D,E)),(F,(G,H)));"
+#define TREE4  "(A,B,(C,(D,(E,(F,(G,H))))));"
+
+static unsigned int find_dense_split(pll_split_t * splits,
+                                     unsigned int split_count,
+                                     pll_split_t split,
+                                     unsigned int tip_count)
+{
+  unsigned int split_len = (tip_count + sizeof(pll_split_base_t) * 8 - 1) /
+                           (sizeof(pll_split_base_t) * 8);
+  unsigned int i;
+
+  for (i = 0; i < split_count; ++i)
+    if (!memcmp(splits[i], split, split_len * sizeof(pll_split_base_t)))
+      return i;
+
+  return split_count;
+}
+
+/* expands every compact split and looks it up in the dense split set */
+static unsigned int check_compact_splits(const pll_compact_split_set_t * set,
+                                         pll_split_t * dense,
+                                         pll_split_t * expanded,
+                                         unsigned int * lightside_sum)
+{
+  unsigned int tip_count = set->tip_count;
+  unsigned int found = 0;
+  unsigned int i, j;
+
+  *lightside_sum = 0;
+  for (i = 0; i < set->split_count; ++i)
+  {
+    pllmod_utree_compact_split_get(set, i, expanded[i]);
+
+    j = find_dense_split(dense, tip_count - 3, expanded[i], tip_count);
+    if (j < tip_count - 3 &&
+        pllmod_utree_split_lightside(dense[j], tip_count) ==
+        pllmod_utree_compact_split_lightside(set, i))
+      ++found;
+
+    *lightside_sum += pllmod_utree_compact_split_lightside(set, i);
+  }
+
+  return found;
+}
+
+static pll_split_t * alloc_splits(unsigned int split_count,
+                                  unsigned int tip_count)
+{
+  unsigned int split_len = (tip_count + sizeof(pll_split_base_t) * 8 - 1) /
+                           (sizeof(pll_split_base_t) * 8);
+  pll_split_t * splits = (pll_split_t *) malloc(split_count *
+                                                sizeof(pll_split_t));
+  unsigned int i;
+
+  splits[0] = (pll_split_t) calloc(split_count * split_len,
+                                   sizeof(pll_split_base_t));
+  for (i = 1; i < split_count; ++i)
+    splits[i] = splits[0] + i * split_len;
+
+  return splits;
+}
+
+static void free_splits(pll_split_t * splits)
+{
+  free(splits[0]);
+  free(splits);
+}
+
+void run_rf_test(unsigned int test_num, char * tree1_str, char * tree2_str)
+{
+  pll_utree_t * tree1 = pll_utree_parse_newick_string(tree1_str);
+  pll_utree_t * tree2 = pll_utree_parse_newick_string(tree2_str);
+  unsigned int tip_count = tree1->tip_count;
+  unsigned int split_count = tip_count - 3;
+  unsigned int found1, found2, lsum1, lsum2;
+  unsigned int shared = 0, hamming_errors = 0;
+  unsigned int i, j;
+
+  assert(tree1->tip_count == tree2->tip_count);
+
+  pllmod_utree_consistency_set(tree1, tree2);
+
+  /* dense splits */
+  pll_split_t * splits1 = pllmod_utree_split_create(tree1->vroot, tip_count,
+                                                    NULL);
+  pll_split_t * splits2 = pllmod_utree_split_create(tree2->vroot, tip_count,
+                                                    NULL);
+
+  /* compact splits, with the tip ranks of the first tree */
+  unsigned int * tip_rank = (unsigned int *) malloc(tip_count *
+                                                    sizeof(unsigned int));
+  if (!pllmod_utree_split_tip_ranks(tree1->vroot, tip_count, tip_rank))
+    fatal("Cannot rank tips: %s", pll_errmsg);
+
+  pll_compact_split_set_t * set1 =
+      pllmod_utree_compact_split_create(tree1->vroot, tip_count, tip_rank, NULL);
+  pll_compact_split_set_t * set2 =
+      pllmod_utree_compact_split_create(tree2->vroot, tip_count, tip_rank, NULL);
+  if (!set1 || !set2)
+    fatal("Cannot create compact splits: %s", pll_errmsg);
+
+  pll_split_t * expanded1 = alloc_splits(split_count, tip_count);
+  pll_split_t * expanded2 = alloc_splits(split_count, tip_count);
+
+  found1 = check_compact_splits(set1, splits1, expanded1, &lsum1);
+  found2 = check_compact_splits(set2, splits2, expanded2, &lsum2);
+
+  for (i = 0; i < set1->split_count; ++i)
+  {
+    for (j = 0; j < set2->split_count; ++j)
+    {
+      if (pllmod_utree_compact_split_equal(set1, i, set2, j))
+        ++shared;
+
+      if (pllmod_utree_compact_split_hamming_distance(set1, i, set2, j) !=
+          pllmod_utree_split_hamming_distance(expanded1[i], expanded2[j],
+                                              tip_count))
+        ++hamming_errors;
+    }
+  }
+
+  bitv_hashtable_t * hash =
+      pllmod_utree_split_hashtable_insert_compact(NULL, set1, NULL, 0);
+  hash = pllmod_utree_split_hashtable_insert_compact(hash, set2, NULL, 0);
+  if (!hash)
+    fatal("Cannot insert compact splits: %s", pll_errmsg);
+
+  printf("TEST #%u: SPLITS: %u %u\n", test_num,
+         set1->split_count, set2->split_count);
+  printf("  RF: %u (dense) %u (compact) %u (default) %u (Day)\n",
+         pllmod_utree_split_rf_distance(splits1, splits2, tip_count),
+         pllmod_utree_compact_split_rf_distance(set1, set2),
+         pllmod_utree_rf_distance(tree1->vroot, tree2->vroot, tip_count),
+         pllmod_utree_rf_distance_day(tree1->vroot, tree2->vroot, tip_count));
+  printf("  RF (swapped): %u (compact) %u (Day)\n",
+         pllmod_utree_compact_split_rf_distance(set2, set1),
+         pllmod_utree_rf_distance_day(tree2->vroot, tree1->vroot, tip_count));
+  printf("  Compact splits in dense set: %u %u\n", found1, found2);
+  printf("  Light side sum: %u %u\n", lsum1, lsum2);
+  printf("  Shared splits: %u, Hamming mismatches: %u\n",
+         shared, hamming_errors);
+  printf("  Hashtable entries: %u\n", hash->entry_count);
+
+  pllmod_utree_split_hashtable_destroy(hash);
+  free_splits(expanded1);
+  free_splits(expanded2);
+  pllmod_utree_compact_split_destroy(set1);
+  pllmod_utree_compact_split_destroy(set2);
+  free(tip_rank);
+  pllmod_utree_split_destroy(splits1);
+  pllmod_utree_split_destroy(splits2);
+
+  pll_utree_destroy(tree1, NULL);
+  pll_utree_destroy(tree2, NULL);
+}
+
+int main (int argc, char * argv[])
+{
+  unsigned int attributes = get_attributes(argc, argv);
+
+  if (attributes != PLL_ATTRIB_ARCH_CPU)
+  {
+    skip_test();
+  }
+
+  printf("Testing RF distance and compact splits:\n\n");
+
+  run_rf_test(1, TREE1, TREE1B);
+  run_rf_test(2, TREE1, TREE2);
+  run_rf_test(3, TREE1, TREE3);
+  run_rf_test(4, TREE2, TREE3);
+  run_rf_test(5, TREE1, TREE4);
+
+  return 0;
+}